@@ -0,0 +1,137 @@
+#include "Corruption.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kHeaderSize = 100;
+
+struct PatternName {
+    CorruptionPattern pattern;
+    const char* name;
+};
+
+const PatternName kPatterns[] = {
+    { CorruptionPattern::None, "none" },
+    { CorruptionPattern::ZeroHeader, "zero-header" },
+    { CorruptionPattern::TornPages, "torn-pages" },
+    { CorruptionPattern::DestroyMaster, "destroy-master" },
+    { CorruptionPattern::Truncate, "truncate" },
+    { CorruptionPattern::BitFlips, "bit-flips" },
+};
+
+uint64_t fileSize(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<uint64_t>(in.tellg()) : 0;
+}
+
+bool truncateFile(const std::string& path, uint64_t size)
+{
+#if defined(_WIN32)
+    int fd = -1;
+    if (_sopen_s(&fd, path.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+        return false;
+    const bool ok = _chsize_s(fd, static_cast<__int64>(size)) == 0;
+    _close(fd);
+    return ok;
+#else
+    return truncate(path.c_str(), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool overwrite(std::fstream& file, uint64_t offset, const std::vector<char>& bytes)
+{
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(file);
+}
+
+} // namespace
+
+bool parseCorruptionPattern(const std::string& name, CorruptionPattern& out)
+{
+    for (const PatternName& p : kPatterns) {
+        if (name == p.name) {
+            out = p.pattern;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* corruptionPatternName(CorruptionPattern pattern)
+{
+    for (const PatternName& p : kPatterns) {
+        if (pattern == p.pattern)
+            return p.name;
+    }
+    return "unknown";
+}
+
+bool injectCorruption(const std::string& path, CorruptionPattern pattern, uint32_t pageSize, uint64_t seed)
+{
+    const uint64_t size = fileSize(path);
+    const uint64_t pages = pageSize > 0 ? size / pageSize : 0;
+    if (pages == 0)
+        return false;
+    if (pattern == CorruptionPattern::None)
+        return true;
+    if (pattern == CorruptionPattern::Truncate)
+        return truncateFile(path, std::max<uint64_t>(1, pages * 6 / 10) * pageSize);
+
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file)
+        return false;
+    std::mt19937_64 random(seed);
+    switch (pattern) {
+    case CorruptionPattern::ZeroHeader:
+        return overwrite(file, 0, std::vector<char>(kHeaderSize, 0));
+    case CorruptionPattern::DestroyMaster:
+        return overwrite(file, kHeaderSize, std::vector<char>(pageSize - kHeaderSize, 0));
+    case CorruptionPattern::TornPages: {
+        const uint64_t count = std::max<uint64_t>(2, pages / 100);
+        const std::vector<char> zeros(pageSize / 2, 0);
+        for (uint64_t i = 0; i < count; i++) {
+            const uint64_t pgno = 2 + random() % std::max<uint64_t>(1, pages - 1); // keep page 1
+            if (pgno > pages)
+                continue;
+            if (!overwrite(file, (pgno - 1) * pageSize + pageSize / 2, zeros))
+                return false;
+        }
+        return true;
+    }
+    case CorruptionPattern::BitFlips: {
+        const uint64_t count = std::max<uint64_t>(8, pages / 50);
+        for (uint64_t i = 0; i < count; i++) {
+            const uint64_t bit = random() % (size * 8);
+            char byte = 0;
+            file.seekg(static_cast<std::streamoff>(bit / 8));
+            file.read(&byte, 1);
+            byte = static_cast<char>(byte ^ (1 << (bit % 8)));
+            if (!overwrite(file, bit / 8, std::vector<char>(1, byte)))
+                return false;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+} // namespace WCDBRepair
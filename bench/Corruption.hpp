@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace WCDBRepair {
+
+enum class CorruptionPattern {
+    None,
+    ZeroHeader,    // first 100 bytes zeroed (salt + first ciphertext block when encrypted)
+    TornPages,     // second half of ~1% of the pages zeroed, as after a torn sector write
+    DestroyMaster, // page 1 after the header zeroed: sqlite_master is gone
+    Truncate,      // file cut to 60% of its pages
+    BitFlips,      // ~1 random bit per 50 pages flipped
+};
+
+bool parseCorruptionPattern(const std::string& name, CorruptionPattern& out);
+const char* corruptionPatternName(CorruptionPattern pattern);
+
+// Damages the file in place. The same seed, file size and page size damage the same bytes
+// on every platform (std::mt19937_64 output is specified; no distributions are used).
+bool injectCorruption(const std::string& path, CorruptionPattern pattern, uint32_t pageSize, uint64_t seed);
+
+} // namespace WCDBRepair
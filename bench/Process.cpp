@@ -0,0 +1,197 @@
+#include "Process.hpp"
+
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+#if defined(_WIN32)
+std::wstring wideFromUtf8(const std::string& s)
+{
+    if (s.empty())
+        return std::wstring();
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.data(), static_cast<int>(s.size()), nullptr, 0);
+    std::wstring out(static_cast<size_t>(len), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), static_cast<int>(s.size()), &out[0], len);
+    return out;
+}
+
+// Quoting rules of CommandLineToArgvW / the MSVC runtime.
+void appendQuoted(std::wstring& commandLine, const std::wstring& arg)
+{
+    if (!commandLine.empty())
+        commandLine.push_back(L' ');
+    if (!arg.empty() && arg.find_first_of(L" \t\n\v\"") == std::wstring::npos) {
+        commandLine += arg;
+        return;
+    }
+    commandLine.push_back(L'"');
+    size_t backslashes = 0;
+    for (wchar_t c : arg) {
+        if (c == L'\\') {
+            backslashes++;
+            continue;
+        }
+        if (c == L'"')
+            commandLine.append(backslashes * 2 + 1, L'\\');
+        else
+            commandLine.append(backslashes, L'\\');
+        backslashes = 0;
+        commandLine.push_back(c);
+    }
+    commandLine.append(backslashes * 2, L'\\');
+    commandLine.push_back(L'"');
+}
+
+double fileTimeMs(const FILETIME& t)
+{
+    ULARGE_INTEGER v;
+    v.LowPart = t.dwLowDateTime;
+    v.HighPart = t.dwHighDateTime;
+    return static_cast<double>(v.QuadPart) / 10000.0; // 100ns units
+}
+#endif
+
+} // namespace
+
+#if defined(_WIN32)
+bool runProcess(const std::vector<std::string>& argv, std::string& output, ProcessStats& stats)
+{
+    stats = ProcessStats();
+    output.clear();
+    if (argv.empty())
+        return false;
+    std::wstring commandLine;
+    for (const std::string& arg : argv) {
+        appendQuoted(commandLine, wideFromUtf8(arg));
+    }
+
+    SECURITY_ATTRIBUTES sa = {};
+    sa.nLength = sizeof(sa);
+    sa.bInheritHandle = TRUE;
+    HANDLE readPipe = nullptr;
+    HANDLE writePipe = nullptr;
+    if (!CreatePipe(&readPipe, &writePipe, &sa, 0))
+        return false;
+    SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOW si = {};
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdOutput = writePipe;
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    PROCESS_INFORMATION pi = {};
+
+    const auto start = std::chrono::steady_clock::now();
+    const BOOL created = CreateProcessW(
+    nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+    CloseHandle(writePipe);
+    if (!created) {
+        CloseHandle(readPipe);
+        return false;
+    }
+
+    char buffer[4096];
+    DWORD got = 0;
+    while (ReadFile(readPipe, buffer, sizeof(buffer), &got, nullptr) && got > 0) {
+        output.append(buffer, got);
+    }
+    CloseHandle(readPipe);
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    stats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    DWORD exitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+    stats.exitCode = static_cast<int>(exitCode);
+    FILETIME creation, exit, kernel, user;
+    if (GetProcessTimes(pi.hProcess, &creation, &exit, &kernel, &user)) {
+        stats.userMs = fileTimeMs(user);
+        stats.systemMs = fileTimeMs(kernel);
+    }
+    PROCESS_MEMORY_COUNTERS memory = {};
+    if (GetProcessMemoryInfo(pi.hProcess, &memory, sizeof(memory))) {
+        stats.peakRssKb = static_cast<uint64_t>(memory.PeakWorkingSetSize) / 1024;
+    }
+    IO_COUNTERS io = {};
+    if (GetProcessIoCounters(pi.hProcess, &io)) {
+        stats.readBytes = io.ReadTransferCount;
+        stats.writeBytes = io.WriteTransferCount;
+    }
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return true;
+}
+#else
+bool runProcess(const std::vector<std::string>& argv, std::string& output, ProcessStats& stats)
+{
+    stats = ProcessStats();
+    output.clear();
+    if (argv.empty())
+        return false;
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    std::vector<char*> args;
+    for (const std::string& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(args[0], args.data());
+        _exit(127);
+    }
+    close(fds[1]);
+
+    char buffer[4096];
+    for (;;) {
+        const ssize_t got = ::read(fds[0], buffer, sizeof(buffer));
+        if (got <= 0)
+            break;
+        output.append(buffer, static_cast<size_t>(got));
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage = {};
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return false;
+    stats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    stats.userMs = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0;
+    stats.systemMs = usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+#if defined(__APPLE__)
+    stats.peakRssKb = static_cast<uint64_t>(usage.ru_maxrss) / 1024; // bytes on macOS
+#else
+    stats.peakRssKb = static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+    stats.readBytes = static_cast<uint64_t>(usage.ru_inblock) * 512;
+    stats.writeBytes = static_cast<uint64_t>(usage.ru_oublock) * 512;
+    return true;
+}
+#endif
+
+} // namespace WCDBRepair
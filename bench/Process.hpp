@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+struct ProcessStats {
+    int exitCode = -1;
+    double wallMs = 0;
+    double userMs = 0;
+    double systemMs = 0;
+    uint64_t peakRssKb = 0;
+    // Bytes the OS attributes to the process: transfer counts on Windows, block I/O
+    // (page cache misses / write-back) on POSIX.
+    uint64_t readBytes = 0;
+    uint64_t writeBytes = 0;
+};
+
+// Runs argv[0] with the given arguments, captures its stdout and measures it.
+// stderr is inherited. Returns false if the process could not be started.
+bool runProcess(const std::vector<std::string>& argv, std::string& output, ProcessStats& stats);
+
+} // namespace WCDBRepair
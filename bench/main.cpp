@@ -0,0 +1,554 @@
+#include "WCDBCpp.h"
+
+#include "Corruption.hpp"
+#include "Process.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr int kRowsPerTransaction = 10000;
+constexpr double kNoiseFloorMs = 5.0; // differences below this are never regressions
+
+struct Options {
+    std::string tool; // wcdb-repair executable
+    std::string workdir = "wcdb-repair-bench.work";
+    std::string output; // JSON results, empty means <workdir>/bench-results.json
+    std::string baseline;
+    double threshold = 10.0; // percent slower than baseline that counts as a regression
+
+    int tables = 4;
+    int rows = 100000; // across all tables
+    int indexes = 2;   // per table, at most 4
+    int textBytes = 64;
+    int blobBytes = 0;
+    uint64_t seed = 1;
+    std::string key = "wcdb-repair-bench";
+
+    bool plain = true;
+    bool sqlcipher = true;
+    std::vector<WCDBRepair::CorruptionPattern> patterns;
+    std::vector<std::string> commands = { "backup", "check", "repair", "deposit" };
+};
+
+struct Result {
+    std::string caseName;
+    std::string command;
+    WCDBRepair::ProcessStats stats;
+    uint64_t dbBytes = 0;
+    double score = -1; // repair only
+};
+
+void printUsage()
+{
+    std::fprintf(stderr,
+                 "WCDB Repair benchmark\n"
+                 "\n"
+                 "Usage:\n"
+                 "  wcdb-repair-bench\n"
+                 "      [--tool <path to wcdb-repair>]\n"
+                 "      [--workdir <dir>]\n"
+                 "      [--output <json>]\n"
+                 "      [--baseline <json> [--threshold <percent>]]\n"
+                 "      [--tables <n>] [--rows <n>] [--indexes <0-4>]\n"
+                 "      [--text-bytes <n>] [--blob-bytes <n>]\n"
+                 "      [--cipher <plain|sqlcipher|both>] [--key <ascii>]\n"
+                 "      [--patterns <none,zero-header,torn-pages,destroy-master,truncate,bit-flips>]\n"
+                 "      [--commands <backup,check,repair,deposit>]\n"
+                 "      [--seed <n>]\n"
+                 "\n"
+                 "Notes:\n"
+                 "  - Every case copies a generated DB, runs backup, injects the corruption, then runs\n"
+                 "    check, repair and deposit as child processes. Wall/CPU time, peak RSS and I/O\n"
+                 "    bytes are measured per process; repair also reports its recovery score.\n"
+                 "  - Results go to --output as JSON, one result object per line. With --baseline, each\n"
+                 "    result is compared to the same case/command there; slower than --threshold percent\n"
+                 "    (default 10) or a lower score is a regression and the exit code is 1.\n");
+}
+
+bool parseInt(const std::string& s, int& out)
+{
+    char* end = nullptr;
+    const long v = std::strtol(s.c_str(), &end, 10);
+    if (end == s.c_str() || *end != '\0' || v < 0 || v > 1000000000L)
+        return false;
+    out = static_cast<int>(v);
+    return true;
+}
+
+std::vector<std::string> splitList(const std::string& s)
+{
+    std::vector<std::string> out;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty())
+            out.push_back(item);
+    }
+    return out;
+}
+
+std::string defaultToolPath(const std::string& argv0)
+{
+    const size_t slash = argv0.find_last_of("/\\");
+    const std::string dir = slash == std::string::npos ? std::string(".") : argv0.substr(0, slash);
+#if defined(_WIN32)
+    return dir + "\\wcdb-repair.exe";
+#else
+    return dir + "/wcdb-repair";
+#endif
+}
+
+bool parseArgs(int argc, char** argv, Options& opt)
+{
+    opt.tool = defaultToolPath(argc > 0 ? argv[0] : "");
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        if (a == "--help" || a == "-h")
+            return false;
+        if (i + 1 >= argc)
+            return false;
+        const std::string v = argv[++i];
+        int n = 0;
+        if (a == "--tool") {
+            opt.tool = v;
+        } else if (a == "--workdir") {
+            opt.workdir = v;
+        } else if (a == "--output") {
+            opt.output = v;
+        } else if (a == "--baseline") {
+            opt.baseline = v;
+        } else if (a == "--threshold") {
+            if (!parseInt(v, n))
+                return false;
+            opt.threshold = n;
+        } else if (a == "--tables") {
+            if (!parseInt(v, n) || n < 1)
+                return false;
+            opt.tables = n;
+        } else if (a == "--rows") {
+            if (!parseInt(v, n))
+                return false;
+            opt.rows = n;
+        } else if (a == "--indexes") {
+            if (!parseInt(v, n) || n > 4)
+                return false;
+            opt.indexes = n;
+        } else if (a == "--text-bytes") {
+            if (!parseInt(v, n))
+                return false;
+            opt.textBytes = n;
+        } else if (a == "--blob-bytes") {
+            if (!parseInt(v, n))
+                return false;
+            opt.blobBytes = n;
+        } else if (a == "--seed") {
+            if (!parseInt(v, n))
+                return false;
+            opt.seed = static_cast<uint64_t>(n);
+        } else if (a == "--key") {
+            opt.key = v;
+        } else if (a == "--cipher") {
+            opt.plain = v == "plain" || v == "both";
+            opt.sqlcipher = v == "sqlcipher" || v == "both";
+            if (!opt.plain && !opt.sqlcipher)
+                return false;
+        } else if (a == "--patterns") {
+            opt.patterns.clear();
+            for (const std::string& name : splitList(v)) {
+                WCDBRepair::CorruptionPattern p;
+                if (!WCDBRepair::parseCorruptionPattern(name, p))
+                    return false;
+                opt.patterns.push_back(p);
+            }
+        } else if (a == "--commands") {
+            opt.commands = splitList(v);
+            for (const std::string& c : opt.commands) {
+                if (c != "backup" && c != "check" && c != "repair" && c != "deposit")
+                    return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    if (opt.patterns.empty()) {
+        for (const char* name : { "none", "zero-header", "torn-pages", "destroy-master", "truncate", "bit-flips" }) {
+            WCDBRepair::CorruptionPattern p;
+            WCDBRepair::parseCorruptionPattern(name, p);
+            opt.patterns.push_back(p);
+        }
+    }
+    return true;
+}
+
+bool wants(const Options& opt, const char* command)
+{
+    for (const std::string& c : opt.commands) {
+        if (c == command)
+            return true;
+    }
+    return false;
+}
+
+void makeDirectory(const std::string& path)
+{
+#if defined(_WIN32)
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+uint64_t fileSize(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<uint64_t>(in.tellg()) : 0;
+}
+
+bool copyFile(const std::string& from, const std::string& to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (!in || !out)
+        return false;
+    out << in.rdbuf();
+    return static_cast<bool>(out.flush());
+}
+
+// Files WCDB keeps next to a database; removed so every case starts from scratch.
+void removeDatabaseFiles(const std::string& path)
+{
+    for (const char* suffix : { "", "-wal", "-shm", "-journal", "-first.material", "-last.material" }) {
+        std::remove((path + suffix).c_str());
+    }
+}
+
+void applyKey(WCDB::Database& db, const Options& opt)
+{
+    const WCDB::UnsafeData key = WCDB::UnsafeData::immutable(
+    reinterpret_cast<const unsigned char*>(opt.key.data()), opt.key.size());
+    db.setCipherKey(key, kPageSize, WCDB::Database::CipherVersion::Version4);
+}
+
+std::string randomText(std::mt19937_64& random, int length)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+    std::string s(static_cast<size_t>(length), ' ');
+    for (char& c : s) {
+        c = alphabet[random() % (sizeof(alphabet) - 1)];
+    }
+    return s;
+}
+
+// Message-like tables, filled row by row with the indexes in place, like an app would.
+bool generateDatabase(const std::string& path, bool encrypted, const Options& opt)
+{
+    static const char* const indexColumns[] = { "talker", "createTime", "flag", "talker, createTime" };
+    removeDatabaseFiles(path);
+    WCDB::Database db(path);
+    if (encrypted)
+        applyKey(db, opt);
+    {
+        WCDB::Handle handle = db.getHandle();
+        for (int t = 0; t < opt.tables; t++) {
+            const std::string table = "message" + std::to_string(t);
+            bool ok = handle.execute(WCDB::UnsafeStringView(
+            "CREATE TABLE " + table
+            + "(id INTEGER PRIMARY KEY, talker TEXT, content TEXT, createTime INTEGER, flag INTEGER, payload BLOB)"));
+            for (int i = 0; ok && i < opt.indexes; i++) {
+                ok = handle.execute(WCDB::UnsafeStringView("CREATE INDEX " + table + "_index" + std::to_string(i)
+                                                           + " ON " + table + "(" + indexColumns[i] + ")"));
+            }
+            if (!ok)
+                return false;
+        }
+
+        std::mt19937_64 random(opt.seed);
+        std::vector<unsigned char> blob(static_cast<size_t>(opt.blobBytes));
+        const int rowsPerTable = opt.rows / opt.tables;
+        for (int t = 0; t < opt.tables; t++) {
+            const std::string insert = "INSERT INTO message" + std::to_string(t)
+                                       + "(talker, content, createTime, flag, payload) VALUES(?, ?, ?, ?, ?)";
+            for (int done = 0; done < rowsPerTable;) {
+                if (!handle.beginTransaction() || !handle.prepareSQL(WCDB::UnsafeStringView(insert)))
+                    return false;
+                const int end = std::min(rowsPerTable, done + kRowsPerTransaction);
+                for (; done < end; done++) {
+                    for (unsigned char& b : blob) {
+                        b = static_cast<unsigned char>(random());
+                    }
+                    handle.bindText(WCDB::UnsafeStringView("talker" + std::to_string(random() % 500)), 1);
+                    handle.bindText(WCDB::UnsafeStringView(randomText(random, opt.textBytes)), 2);
+                    handle.bindInteger(static_cast<int64_t>(1600000000 + random() % 100000000), 3);
+                    handle.bindInteger(static_cast<int64_t>(random() % 8), 4);
+                    handle.bindBLOB(WCDB::UnsafeData::immutable(blob.data(), blob.size()), 5);
+                    if (!handle.step())
+                        return false;
+                    handle.reset();
+                }
+                handle.finalize();
+                if (!handle.commitOrRollbackTransaction())
+                    return false;
+            }
+        }
+    }
+    // Everything into the main file, so copying it copies the database.
+    db.truncateCheckpoint();
+    db.close();
+    return true;
+}
+
+std::vector<std::string> toolArgs(const Options& opt, const char* command, const std::string& path, bool encrypted)
+{
+    std::vector<std::string> args = { opt.tool, command, path, "--no-sql-trace", "--no-progress" };
+    if (encrypted) {
+        args.insert(args.end(), { "--key", opt.key, "--cipher-version", "4", "--cipher-page-size", std::to_string(kPageSize) });
+    }
+    return args;
+}
+
+double parseScore(const std::string& output)
+{
+    const size_t result = output.find("RESULT=repair ");
+    if (result == std::string::npos)
+        return -1;
+    const size_t score = output.find("score=", result);
+    return score == std::string::npos ? -1 : std::atof(output.c_str() + score + 6);
+}
+
+void printResult(const Result& r)
+{
+    const double cpuMs = r.stats.userMs + r.stats.systemMs;
+    const double mbps = r.stats.wallMs > 0 ? r.dbBytes / (1024.0 * 1024.0) / (r.stats.wallMs / 1000.0) : 0;
+    std::printf("BENCH case=%s command=%s exit=%d wallMs=%.1f cpuMs=%.1f peakRssKb=%llu readBytes=%llu "
+                "writeBytes=%llu mbps=%.1f",
+                r.caseName.c_str(),
+                r.command.c_str(),
+                r.stats.exitCode,
+                r.stats.wallMs,
+                cpuMs,
+                static_cast<unsigned long long>(r.stats.peakRssKb),
+                static_cast<unsigned long long>(r.stats.readBytes),
+                static_cast<unsigned long long>(r.stats.writeBytes),
+                mbps);
+    if (r.score >= 0)
+        std::printf(" score=%.6f", r.score);
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+std::string resultJson(const Result& r)
+{
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "{\"case\":\"%s\",\"command\":\"%s\",\"exitCode\":%d,\"wallMs\":%.3f,\"userMs\":%.3f,"
+                  "\"systemMs\":%.3f,\"peakRssKb\":%llu,\"readBytes\":%llu,\"writeBytes\":%llu,\"dbBytes\":%llu,"
+                  "\"score\":%.6f}",
+                  r.caseName.c_str(),
+                  r.command.c_str(),
+                  r.stats.exitCode,
+                  r.stats.wallMs,
+                  r.stats.userMs,
+                  r.stats.systemMs,
+                  static_cast<unsigned long long>(r.stats.peakRssKb),
+                  static_cast<unsigned long long>(r.stats.readBytes),
+                  static_cast<unsigned long long>(r.stats.writeBytes),
+                  static_cast<unsigned long long>(r.dbBytes),
+                  r.score);
+    return buf;
+}
+
+bool writeJson(const std::string& path, const Options& opt, const std::vector<Result>& results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+        return false;
+    out << "{\n\"tool\":\"wcdb-repair-bench\",\n\"config\":{\"tables\":" << opt.tables << ",\"rows\":" << opt.rows
+        << ",\"indexes\":" << opt.indexes << ",\"textBytes\":" << opt.textBytes << ",\"blobBytes\":" << opt.blobBytes
+        << ",\"seed\":" << opt.seed << "},\n\"results\":[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        out << resultJson(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]\n}\n";
+    return static_cast<bool>(out.flush());
+}
+
+// Value of "key": in one line of our own JSON output (strings unquoted).
+std::string jsonField(const std::string& line, const char* key)
+{
+    const std::string needle = std::string("\"") + key + "\":";
+    size_t pos = line.find(needle);
+    if (pos == std::string::npos)
+        return std::string();
+    pos += needle.size();
+    if (pos < line.size() && line[pos] == '"') {
+        const size_t end = line.find('"', pos + 1);
+        return end == std::string::npos ? std::string() : line.substr(pos + 1, end - pos - 1);
+    }
+    const size_t end = line.find_first_of(",}", pos);
+    return line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+// Compares against a saved result file; returns the number of regressions or -1.
+int compareBaseline(const std::string& path, double threshold, const std::vector<Result>& results)
+{
+    std::ifstream in(path);
+    if (!in)
+        return -1;
+    int regressions = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string caseName = jsonField(line, "case");
+        const std::string command = jsonField(line, "command");
+        if (caseName.empty() || command.empty())
+            continue;
+        for (const Result& r : results) {
+            if (r.caseName != caseName || r.command != command)
+                continue;
+            const double baseMs = std::atof(jsonField(line, "wallMs").c_str());
+            const double baseScore = std::atof(jsonField(line, "score").c_str());
+            const double ratio = baseMs > 0 ? r.stats.wallMs / baseMs : 1.0;
+            const bool slower = ratio > 1.0 + threshold / 100.0 && r.stats.wallMs - baseMs > kNoiseFloorMs;
+            const bool worseScore = r.score >= 0 && r.score + 1e-6 < baseScore;
+            const char* status = slower || worseScore ? "regression"
+                                 : ratio < 1.0 - threshold / 100.0 ? "improved"
+                                                                    : "ok";
+            std::printf("COMPARE case=%s command=%s baselineMs=%.1f wallMs=%.1f ratio=%.3f baselineScore=%.6f "
+                        "score=%.6f status=%s\n",
+                        caseName.c_str(),
+                        command.c_str(),
+                        baseMs,
+                        r.stats.wallMs,
+                        ratio,
+                        baseScore,
+                        r.score,
+                        status);
+            if (slower || worseScore)
+                regressions++;
+        }
+    }
+    return regressions;
+}
+
+bool runTool(const Options& opt,
+             const char* command,
+             const std::string& caseName,
+             const std::string& path,
+             bool encrypted,
+             std::vector<Result>& results)
+{
+    Result r;
+    r.caseName = caseName;
+    r.command = command;
+    r.dbBytes = fileSize(path);
+    std::string output;
+    if (!WCDBRepair::runProcess(toolArgs(opt, command, path, encrypted), output, r.stats)) {
+        std::printf("STATE=BENCH_TOOL_START_FAILED detail=%s\n", opt.tool.c_str());
+        return false;
+    }
+    if (std::strcmp(command, "repair") == 0)
+        r.score = parseScore(output);
+    if (wants(opt, command)) {
+        printResult(r);
+        results.push_back(r);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        printUsage();
+        return 2;
+    }
+    makeDirectory(opt.workdir);
+    const std::string dir = opt.workdir + "/";
+
+    std::vector<Result> results;
+    for (int variant = 0; variant < 2; variant++) {
+        const bool encrypted = variant == 1;
+        if ((encrypted && !opt.sqlcipher) || (!encrypted && !opt.plain))
+            continue;
+        const std::string cipherName = encrypted ? "sqlcipher" : "plain";
+        const std::string source = dir + cipherName + "-source.db";
+
+        std::printf("STATE=BENCH_GENERATE detail=%s\n", source.c_str());
+        std::fflush(stdout);
+        const auto start = std::chrono::steady_clock::now();
+        if (!generateDatabase(source, encrypted, opt)) {
+            std::printf("STATE=BENCH_GENERATE_FAILED detail=%s\n", source.c_str());
+            return 1;
+        }
+        const double generateMs =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::printf("STATE=BENCH_GENERATED detail=bytes=%llu,ms=%.1f\n",
+                    static_cast<unsigned long long>(fileSize(source)),
+                    generateMs);
+
+        for (WCDBRepair::CorruptionPattern pattern : opt.patterns) {
+            const std::string caseName = cipherName + "/" + WCDBRepair::corruptionPatternName(pattern);
+            const std::string path = dir + cipherName + "-" + WCDBRepair::corruptionPatternName(pattern) + ".db";
+            removeDatabaseFiles(path);
+            if (!copyFile(source, path)) {
+                std::printf("STATE=BENCH_COPY_FAILED detail=%s\n", path.c_str());
+                return 1;
+            }
+            // Backup always runs: repair scores depend on the material.
+            if (!runTool(opt, "backup", caseName, path, encrypted, results))
+                return 1;
+            if (!WCDBRepair::injectCorruption(path, pattern, kPageSize, opt.seed)) {
+                std::printf("STATE=BENCH_CORRUPT_FAILED detail=%s\n", caseName.c_str());
+                return 1;
+            }
+            if (wants(opt, "check") && !runTool(opt, "check", caseName, path, encrypted, results))
+                return 1;
+            if (wants(opt, "repair") && !runTool(opt, "repair", caseName, path, encrypted, results))
+                return 1;
+            if (wants(opt, "deposit")) {
+                if (!runTool(opt, "deposit", caseName, path, encrypted, results))
+                    return 1;
+                std::vector<Result> ignored;
+                Options quiet = opt;
+                quiet.commands.clear();
+                runTool(quiet, "remove-deposited", caseName, path, encrypted, ignored);
+            }
+        }
+    }
+
+    const std::string output = opt.output.empty() ? dir + "bench-results.json" : opt.output;
+    if (!writeJson(output, opt, results)) {
+        std::printf("STATE=BENCH_OUTPUT_FAILED detail=%s\n", output.c_str());
+        return 1;
+    }
+    int regressions = 0;
+    if (!opt.baseline.empty()) {
+        regressions = compareBaseline(opt.baseline, opt.threshold, results);
+        if (regressions < 0) {
+            std::printf("STATE=BENCH_BASELINE_UNREADABLE detail=%s\n", opt.baseline.c_str());
+            return 2;
+        }
+    }
+    std::printf("RESULT=bench results=%zu regressions=%d output=%s\n", results.size(), regressions, output.c_str());
+    return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * wcdbrepair: the commands of wcdb-repair as an in-process C API.
+ *
+ * A run takes the same command names and options as the CLI
+ * ("repair", "check", "backup", "salvage", "estimate", "verify-hmac", "probe", ...)
+ * and reports through callbacks instead of stdout: every output line, structured
+ * progress, and a cancel poll at the points where the CLI checks for SIGINT.
+ * The outcome comes back as a result object holding the fields of the RESULT line.
+ *
+ * All strings are UTF-8. Functions may be called from any thread; runs on different
+ * databases may go on concurrently, also through the same session.
+ */
+#ifndef WCDBREPAIR_H
+#define WCDBREPAIR_H
+
+#include <stddef.h>
+
+#if defined(WCDBREPAIR_SHARED)
+#if defined(_WIN32)
+#if defined(WCDBREPAIR_BUILDING)
+#define WCDBREPAIR_API __declspec(dllexport)
+#else
+#define WCDBREPAIR_API __declspec(dllimport)
+#endif
+#else
+#define WCDBREPAIR_API __attribute__((visibility("default")))
+#endif
+#else
+#define WCDBREPAIR_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped on incompatible changes; compare with wcdbrepair_api_version(). */
+#define WCDBREPAIR_API_VERSION 1
+
+typedef struct wcdbrepair_session wcdbrepair_session;
+typedef struct wcdbrepair_result wcdbrepair_result;
+
+typedef enum wcdbrepair_line_kind {
+    WCDBREPAIR_LINE_STATE = 0,  /* STATE=<name> [detail=...] */
+    WCDBREPAIR_LINE_RESULT = 1, /* RESULT=<kind> key=value ... */
+    WCDBREPAIR_LINE_OTHER = 2   /* BAD_PAGE, HMAC_FAILED, SPAN, ... */
+} wcdbrepair_line_kind;
+
+typedef struct wcdbrepair_callbacks {
+    void* user_data;
+    /* Long commands (repair, salvage): fraction done in [0, 1] and the progress event as a
+       JSON object (phase, table, pages/s, rows/s, bytes, etaSec), at most ~4 per second.
+       Needs no --progress-json; PROGRESS_JSON lines never reach the line callback. */
+    void (*progress)(void* user_data, double fraction, const char* json);
+    /* Every line the CLI would print, without the newline. */
+    void (*line)(void* user_data, wcdbrepair_line_kind kind, const char* line);
+    /* Polled at safe points; non-zero stops the run there, as SIGINT stops the CLI. */
+    int (*cancel)(void* user_data);
+} wcdbrepair_callbacks;
+
+WCDBREPAIR_API int wcdbrepair_api_version(void);
+
+/* Opens a session: services shared by its runs, kept warm between them. Derived keys are
+   cached (--kdf-cache is implied; --kdf-cache-file with --kdf-cache-secret-hex persists
+   them, saved on close) and --sql-trace-file gives the runs one SQL trace writer.
+   `options` are CLI options applied to every run before the run's own; may be NULL.
+   Returns NULL when an option is invalid. */
+WCDBREPAIR_API wcdbrepair_session* wcdbrepair_session_open(const char* const* options, size_t option_count);
+WCDBREPAIR_API void wcdbrepair_session_close(wcdbrepair_session* session);
+
+/* Runs `command` on `db_path` with CLI `options` and blocks until it ends. `session` may be
+   NULL for a one-off run, `callbacks` NULL for none. Callbacks may be invoked from worker
+   threads of the command, but never two at once for the same run. Returns the CLI exit
+   code: 0 success, 1 failure or cancelled, 2 bad command or options. When `result` is not
+   NULL it receives a result to release with wcdbrepair_result_free(). batch and serve are
+   CLI only. */
+WCDBREPAIR_API int wcdbrepair_run(wcdbrepair_session* session,
+                                  const char* command,
+                                  const char* db_path,
+                                  const char* const* options,
+                                  size_t option_count,
+                                  const wcdbrepair_callbacks* callbacks,
+                                  wcdbrepair_result** result);
+
+WCDBREPAIR_API int wcdbrepair_result_exit_code(const wcdbrepair_result* result);
+/* Non-zero when the run stopped early on cancel or --deadline. */
+WCDBREPAIR_API int wcdbrepair_result_cancelled(const wcdbrepair_result* result);
+/* First word of the RESULT line ("repair", "salvage", "check", ...); NULL when there was none. */
+WCDBREPAIR_API const char* wcdbrepair_result_kind(const wcdbrepair_result* result);
+/* Name of the last STATE, which says where a failed run gave up (e.g. "SALVAGE_OUTPUT_EXISTS"). */
+WCDBREPAIR_API const char* wcdbrepair_result_last_state(const wcdbrepair_result* result);
+
+/* The key=value fields of the RESULT line, in order. */
+WCDBREPAIR_API size_t wcdbrepair_result_field_count(const wcdbrepair_result* result);
+WCDBREPAIR_API const char* wcdbrepair_result_field_name(const wcdbrepair_result* result, size_t index);
+WCDBREPAIR_API const char* wcdbrepair_result_field_value(const wcdbrepair_result* result, size_t index);
+/* Value of field `name` (e.g. "score", "ok", "rows"); NULL when absent. */
+WCDBREPAIR_API const char* wcdbrepair_result_get(const wcdbrepair_result* result, const char* name);
+/* Numeric value of field `name`, or `fallback` when absent or not a number. */
+WCDBREPAIR_API double wcdbrepair_result_get_double(const wcdbrepair_result* result, const char* name, double fallback);
+
+WCDBREPAIR_API void wcdbrepair_result_free(wcdbrepair_result* result);
+
+/* The wcdb-repair command line (argv[0] first): prints to stdout, installs SIGINT/SIGTERM
+   handlers and returns the process exit code, exactly like the executable. */
+WCDBREPAIR_API int wcdbrepair_cli_main(const char* const* argv, size_t argc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WCDBREPAIR_H */
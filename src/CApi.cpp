@@ -0,0 +1,291 @@
+#include "wcdbrepair.h"
+
+#include "Commands.hpp"
+#include "KeyCache.hpp"
+#include "ResultLine.hpp"
+#include "TraceSink.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct wcdbrepair_session {
+    WCDBRepair::Options options; // rawOptions go in front of every run's own
+    std::unique_ptr<WCDBRepair::DerivedKeyCache> keyCache;
+    std::unique_ptr<WCDBRepair::TraceSink> traceSink;
+};
+
+// kind and fields come from the RESULT= line.
+struct wcdbrepair_result : WCDBRepair::ResultLine {
+    int exitCode = 0;
+    bool cancelled = false;
+    std::string lastState;
+};
+
+namespace {
+
+std::vector<std::string> commandLine(const char* command,
+                                     const char* dbPath,
+                                     const std::vector<std::string>& front,
+                                     const char* const* options,
+                                     size_t count)
+{
+    std::vector<std::string> argv;
+    argv.reserve(3 + front.size() + count);
+    argv.push_back("wcdbrepair");
+    argv.push_back(command != nullptr ? command : "");
+    argv.push_back(dbPath != nullptr ? dbPath : "");
+    argv.insert(argv.end(), front.begin(), front.end());
+    for (size_t i = 0; i < count; i++) {
+        argv.push_back(options[i] != nullptr ? options[i] : "");
+    }
+    return argv;
+}
+
+bool startsWith(const std::string& s, const char* prefix)
+{
+    return s.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+const char* field(const wcdbrepair_result* result, const char* name)
+{
+    if (result == nullptr || name == nullptr)
+        return nullptr;
+    for (const auto& f : result->fields) {
+        if (f.first == name)
+            return f.second.c_str();
+    }
+    return nullptr;
+}
+
+int runWith(wcdbrepair_session& session,
+            const char* command,
+            const char* dbPath,
+            const char* const* options,
+            size_t optionCount,
+            const wcdbrepair_callbacks* callbacks,
+            wcdbrepair_result& result)
+{
+    const wcdbrepair_callbacks none = {};
+    const wcdbrepair_callbacks& cb = callbacks != nullptr ? *callbacks : none;
+
+    auto deliver = [&cb](wcdbrepair_line_kind kind, const std::string& line) {
+        if (cb.line != nullptr)
+            cb.line(cb.user_data, kind, line.c_str());
+    };
+
+    const std::string name = command != nullptr ? command : "";
+    WCDBRepair::Options opt;
+    if (name == "batch" || name == "serve" || name == "help") {
+        result.lastState = "UNSUPPORTED_COMMAND";
+        deliver(WCDBREPAIR_LINE_STATE, "STATE=UNSUPPORTED_COMMAND detail=" + name);
+        return 2;
+    }
+    if (!WCDBRepair::parseArgs(commandLine(command, dbPath, session.options.rawOptions, options, optionCount), opt)) {
+        result.lastState = "BAD_OPTIONS";
+        deliver(WCDBREPAIR_LINE_STATE, "STATE=BAD_OPTIONS");
+        return 2;
+    }
+    // The progress callback gets the fraction and the structured event; the bare fraction
+    // would repeat them.
+    opt.showProgress = false;
+    opt.kdfCache = true;
+    std::mutex outputMutex; // commands write from worker threads; callbacks are not reentered
+    if (cb.progress != nullptr) {
+        opt.progressListener = [&cb, &outputMutex](double fraction, const std::string& json) {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            cb.progress(cb.user_data, fraction, json.c_str());
+        };
+    }
+    opt.writer = [&cb, &result, &deliver, &outputMutex](const std::string& line) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (startsWith(line, "PROGRESS_JSON="))
+            return; // --progress-json: the same events as the progress callback
+        if (startsWith(line, "STATE=")) {
+            const size_t end = line.find(' ');
+            result.lastState = line.substr(6, end == std::string::npos ? std::string::npos : end - 6);
+            deliver(WCDBREPAIR_LINE_STATE, line);
+        } else if (startsWith(line, "RESULT=")) {
+            WCDBRepair::parseResultLine(line, result);
+            deliver(WCDBREPAIR_LINE_RESULT, line);
+        } else {
+            deliver(WCDBREPAIR_LINE_OTHER, line);
+        }
+    };
+
+    WCDBRepair::Context ctx;
+    ctx.traceSink = session.traceSink.get();
+    ctx.keyCache = session.keyCache.get();
+    if (opt.deadlineSeconds > 0) {
+        ctx.hasDeadline = true;
+        ctx.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(opt.deadlineSeconds);
+    }
+    std::atomic<bool> cancelRequested(false);
+    if (cb.cancel != nullptr) {
+        ctx.cancelled = [&cb, &cancelRequested]() {
+            if (cb.cancel(cb.user_data) == 0)
+                return false;
+            cancelRequested.store(true);
+            return true;
+        };
+    }
+
+    const int rc = WCDBRepair::runCommand(opt, ctx);
+    const char* stopped = field(&result, "cancelled");
+    result.cancelled = rc != 0
+                       && (cancelRequested.load() || (stopped != nullptr && std::strcmp(stopped, "true") == 0));
+    return rc;
+}
+
+} // namespace
+
+extern "C" {
+
+int wcdbrepair_api_version(void)
+{
+    return WCDBREPAIR_API_VERSION;
+}
+
+wcdbrepair_session* wcdbrepair_session_open(const char* const* options, size_t option_count)
+{
+    try {
+        std::unique_ptr<wcdbrepair_session> session(new wcdbrepair_session());
+        if (!WCDBRepair::parseArgs(commandLine("session", "-", std::vector<std::string>(), options, option_count),
+                                   session->options))
+            return nullptr;
+        const WCDBRepair::Options& opt = session->options;
+        session->keyCache.reset(new WCDBRepair::DerivedKeyCache(opt.kdfCacheSecret));
+        if (!opt.kdfCacheFile.empty())
+            session->keyCache->load(opt.kdfCacheFile); // a bad file only costs a derivation
+        // Unlike the CLI, SQL is traced only into a file: stdout belongs to the host.
+        if (opt.sqlTrace && !opt.sqlTraceFile.empty()) {
+            session->traceSink.reset(
+            new WCDBRepair::TraceSink(static_cast<size_t>(opt.sqlTraceQueue), opt.sqlTracePolicy));
+            if (!session->traceSink->start(opt.sqlTraceFile))
+                return nullptr;
+        }
+        return session.release();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void wcdbrepair_session_close(wcdbrepair_session* session)
+{
+    if (session == nullptr)
+        return;
+    const WCDBRepair::Options& opt = session->options;
+    if (!opt.kdfCacheFile.empty() && session->keyCache->misses() > 0)
+        session->keyCache->save(opt.kdfCacheFile);
+    if (session->traceSink)
+        session->traceSink->stop();
+    delete session;
+}
+
+int wcdbrepair_run(wcdbrepair_session* session,
+                   const char* command,
+                   const char* db_path,
+                   const char* const* options,
+                   size_t option_count,
+                   const wcdbrepair_callbacks* callbacks,
+                   wcdbrepair_result** result)
+{
+    if (result != nullptr)
+        *result = nullptr;
+    try {
+        std::unique_ptr<wcdbrepair_session> oneOff;
+        if (session == nullptr) {
+            oneOff.reset(wcdbrepair_session_open(nullptr, 0));
+            session = oneOff.get();
+            if (session == nullptr)
+                return 2;
+        }
+        std::unique_ptr<wcdbrepair_result> out(new wcdbrepair_result());
+        out->exitCode = runWith(*session, command, db_path, options, option_count, callbacks, *out);
+        const int rc = out->exitCode;
+        if (oneOff)
+            wcdbrepair_session_close(oneOff.release());
+        if (result != nullptr)
+            *result = out.release();
+        return rc;
+    } catch (...) {
+        return 2;
+    }
+}
+
+int wcdbrepair_result_exit_code(const wcdbrepair_result* result)
+{
+    return result != nullptr ? result->exitCode : 2;
+}
+
+int wcdbrepair_result_cancelled(const wcdbrepair_result* result)
+{
+    return result != nullptr && result->cancelled ? 1 : 0;
+}
+
+const char* wcdbrepair_result_kind(const wcdbrepair_result* result)
+{
+    return result != nullptr && !result->kind.empty() ? result->kind.c_str() : nullptr;
+}
+
+const char* wcdbrepair_result_last_state(const wcdbrepair_result* result)
+{
+    return result != nullptr && !result->lastState.empty() ? result->lastState.c_str() : nullptr;
+}
+
+size_t wcdbrepair_result_field_count(const wcdbrepair_result* result)
+{
+    return result != nullptr ? result->fields.size() : 0;
+}
+
+const char* wcdbrepair_result_field_name(const wcdbrepair_result* result, size_t index)
+{
+    if (result == nullptr || index >= result->fields.size())
+        return nullptr;
+    return result->fields[index].first.c_str();
+}
+
+const char* wcdbrepair_result_field_value(const wcdbrepair_result* result, size_t index)
+{
+    if (result == nullptr || index >= result->fields.size())
+        return nullptr;
+    return result->fields[index].second.c_str();
+}
+
+const char* wcdbrepair_result_get(const wcdbrepair_result* result, const char* name)
+{
+    return field(result, name);
+}
+
+double wcdbrepair_result_get_double(const wcdbrepair_result* result, const char* name, double fallback)
+{
+    const char* value = field(result, name);
+    if (value == nullptr || *value == '\0')
+        return fallback;
+    char* end = nullptr;
+    const double v = std::strtod(value, &end);
+    return end != nullptr && *end == '\0' ? v : fallback;
+}
+
+void wcdbrepair_result_free(wcdbrepair_result* result)
+{
+    delete result;
+}
+
+int wcdbrepair_cli_main(const char* const* argv, size_t argc)
+{
+    std::vector<std::string> args;
+    args.reserve(argc);
+    for (size_t i = 0; i < argc; i++) {
+        args.emplace_back(argv[i] != nullptr ? argv[i] : "");
+    }
+    return WCDBRepair::runCli(args);
+}
+
+} // extern "C"
@@ -0,0 +1,3581 @@
+#include "Commands.hpp"
+
+#include "WCDBCpp.h"
+#include "Configs.hpp"
+#include "Estimate.hpp"
+#include "FastCheck.hpp"
+#include "HmacVerify.hpp"
+#include "JobProtocol.hpp"
+#include "KeyCache.hpp"
+#include "LocalSocket.hpp"
+#include "Material.hpp"
+#include "PageCache.hpp"
+#include "PageFile.hpp"
+#include "PhaseTimeline.hpp"
+#include "Probe.hpp"
+#include "Progress.hpp"
+#include "RowidSort.hpp"
+#include "Salvage.hpp"
+#include "SalvageCheckpoint.hpp"
+#include "SalvageOutput.hpp"
+#include "TraceSink.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+
+using WCDBRepair::Context;
+using WCDBRepair::Options;
+
+static void printUsage()
+{
+    std::fprintf(stderr,
+                 "WCDB Repair Tool\n"
+                 "\n"
+                 "Usage:\n"
+                 "  wcdb-repair check  <dbPath> [--fast] [--jobs <n>]\n"
+                 "  wcdb-repair backup <dbPath> [--incremental [--material <path>] [--jobs <n>]\n"
+                 "      [--material-dict <path> [--train-material-dict]]]\n"
+                 "  wcdb-repair repair <dbPath>\n"
+                 "      [--material <path>] [--material-dict <path>]\n"
+                 "      [--verify-hmac]\n"
+                 "      [--fast-assemble]\n"
+                 "      [--deadline <seconds>] [--resume [--checkpoint-interval <seconds>]]\n"
+                 "      [--budget <seconds>]\n"
+                 "      [--priority-tables <t1,t2,...> | --tables <t1,t2,...>]\n"
+                 "      [--index-threads <n>]\n"
+                 "      [--export <dir> [--format <ndjson|csv|columnar>]]\n"
+                 "      [--key-hex <hex>]\n"
+                 "      [--cipher-page-size <n>]\n"
+                 "      [--cipher-version <default|1|2|3|4>]\n"
+                  "      [--key <ascii>]\n"
+                 "      [--kdf-iter <n>]\n"
+                 "      [--cipher-hmac-algorithm <name>]\n"
+                  "      [--cipher-default-kdf-algorithm <name>]\n"
+                  "      [--cipher <name>]\n"
+                  "      [--kdf-cache]\n"
+                  "      [--kdf-cache-file <path> [--kdf-cache-secret-hex <hex>]]\n"
+                  "      [--no-sql-trace]\n"
+                  "      [--no-full-sql-trace]\n"
+                  "      [--sql-trace-file <path>]\n"
+                  "      [--sql-trace-queue <records>]\n"
+                  "      [--sql-trace-policy <drop|block>]\n"
+                  "      [--no-error-trace]\n"
+                 "      [--no-progress]\n"
+                 "      [--progress-json]\n"
+                 "      [--timing] [--trace-events <path.json>]\n"
+                 "  wcdb-repair deposit <dbPath>\n"
+                 "  wcdb-repair contains-deposited <dbPath>\n"
+                 "  wcdb-repair remove-deposited <dbPath>\n"
+                 "  wcdb-repair probe <dbPath> (--key <ascii> | --key-hex <hex>)\n"
+                 "      [--kdf-iter <n>]\n"
+                 "      [--jobs <n>]\n"
+                 "  wcdb-repair salvage <dbPath>\n"
+                 "      [--output <path>]\n"
+                 "      [--schema <ddl.sql>]\n"
+                 "      [--schema-from <dbPath>]\n"
+                 "      [--material <path>] [--material-dict <path>]\n"
+                 "      [--index-threads <n>]\n"
+                 "      [--sort-memory-mb <n>]\n"
+                 "      [--priority-tables <t1,t2,...>]\n"
+                 "      [--jobs <n>]\n"
+                 "      [--export <dir> [--format <ndjson|csv|columnar>]]\n"
+                 "      [--deadline <seconds>] [--checkpoint-interval <seconds>] [--resume]\n"
+                 "      [--cipher-page-size <n>] [cipher options as for repair]\n"
+                 "  wcdb-repair estimate <dbPath>\n"
+                 "      [--sample <fraction>] [--seed <n>] [--rows-per-sec <n>]\n"
+                 "      [--jobs <n>] [--cipher-page-size <n>] [cipher options as for repair]\n"
+                 "  wcdb-repair verify-hmac <dbPath> (--key <ascii> | --key-hex <hex>)\n"
+                 "      [--jobs <n>]\n"
+                 "  page I/O of check --fast, verify-hmac (and repair --verify-hmac), backup --incremental:\n"
+                 "      [--io-engine <auto|uring|pread>] [--io-depth <n>] [--io-read-kb <n>]\n"
+                 "      [--io-policy <default|sequential|dontneed|direct>] [--direct-io]\n"
+                 "      [--no-registered-buffers]\n"
+                 "  wcdb-repair batch <manifestPath>\n"
+                 "      [--batch-command <check|backup|repair|verify-hmac|salvage|estimate>]\n"
+                 "      [--jobs <n>]\n"
+                 "      [--io-slots <n>]\n"
+                 "      [any per-DB option above, applied to every entry]\n"
+                 "  wcdb-repair serve <socketPath>\n"
+                 "      [--jobs <n>]\n"
+                 "      [any per-DB option above, applied to every job]\n"
+                 "\n"
+                 "Notes:\n"
+                 "  - repair calls WCDB Database::retrieve(); --budget, --priority-tables, --resume and\n"
+                 "    --material (or a sidecar material newer than WCDB's) salvage instead, into a new\n"
+                 "    file that takes the DB's place once the original is deposited.\n"
+                 "  - For encrypted DB, use --key-hex or --key.\n"
+                 "  - For non-default SQLCipher settings (e.g. kdf_iter=4000, cipher_hmac_algorithm=HMAC_SHA1), set flags accordingly.\n"
+                 "  - --kdf-cache derives the key once and hands WCDB the raw key; it needs --cipher-version\n"
+                 "    1-4, or --kdf-iter and --cipher-default-kdf-algorithm. --kdf-cache-file keeps derived\n"
+                 "    keys across runs, encrypted under --kdf-cache-secret-hex (or env\n"
+                 "    WCDBREPAIR_KDF_CACHE_SECRET).\n"
+                 "  - SQL tracing is enabled by default; disable with --no-sql-trace. When the trace queue\n"
+                 "    is full, --sql-trace-policy block (default) waits and drop discards the line.\n"
+                 "  - check --fast scans the pages itself and lists BAD_PAGE lines; verify-hmac checks every\n"
+                 "    page HMAC and lists HMAC_FAILED lines; repair --verify-hmac runs it first and stops\n"
+                 "    when no page verifies.\n"
+                 "  - --io-* apply to check --fast, verify-hmac and backup --incremental: --io-depth reads\n"
+                 "    of --io-read-kb KiB in flight (default 32 x 256). --io-policy sequential hints\n"
+                 "    readahead, dontneed also drops what the scan cached, direct (= --direct-io) bypasses\n"
+                 "    the page cache.\n"
+                 "  - repair --fast-assemble turns journal and sync off while the DB is rebuilt and syncs\n"
+                 "    once at the end. A crash meanwhile leaves it unusable: run repair again.\n"
+                 "  - SIGINT/SIGTERM or --deadline stop repair, salvage and batch at the next safe point (a\n"
+                 "    second signal kills). salvage checkpoints every --checkpoint-interval seconds\n"
+                 "    (default 30) and when stopped; --resume continues into the same output. repair\n"
+                 "    --resume does the same into <dbPath>-repair.db.\n"
+                 "  - repair --budget <s> runs retrieve() only if it will finish in time, else salvages\n"
+                 "    --priority-tables first, then the smallest tables, until the budget runs out.\n"
+                 "  - repair --priority-tables salvages the named tables into the DB's place, prints\n"
+                 "    STATE=PRIORITY_READY, then fills in the other tables while the app may use the DB\n"
+                 "    in WAL mode (existing rows win; no schema changes). --tables stops at ready.\n"
+                 "  - --progress-json adds PROGRESS_JSON={...} lines (phase, table, rates, etaSec).\n"
+                 "  - --timing prints SPAN lines per state and a TIMING table at exit; --trace-events\n"
+                 "    writes them as Chrome trace-event JSON.\n"
+                 "  - --index-threads: threads for sorting index keys (default: all cores, at most 8).\n"
+                 "  - backup --incremental keeps its own material (<dbPath>-wcdbrepair.material) and\n"
+                 "    rewalks only changed b-trees. --train-material-dict trains a dictionary into\n"
+                 "    --material-dict; pass the same one to backups and salvages of DBs with that schema.\n"
+                 "  - salvage reads rows from the b-tree pages into a new DB (default <dbPath>-salvage.db).\n"
+                 "    Table DDL comes from the file, --schema-from and --schema. --sort-memory-mb bounds\n"
+                 "    the rowid sort (0: insert unsorted). --jobs walks tables on several threads.\n"
+                 "  - repair/salvage --export <dir> write one file per table (--format ndjson, csv or\n"
+                 "    columnar .wcol) plus schema.sql instead of a database.\n"
+                 "  - estimate predicts score, rows and runtime from a --sample of the pages (default 0.01).\n"
+                 "  - probe finds the SQLCipher page size, kdf_iter and algorithms; --kdf-iter adds a\n"
+                 "    candidate.\n"
+                 "  - batch manifest: one \"<dbPath> [per-DB options]\" per line, '#' comments. --io-slots\n"
+                 "    limits how many DBs are in their I/O heavy phase at once.\n"
+                 "  - serve takes jobs on a Unix domain socket as 4-byte big-endian length + JSON frames\n"
+                 "    ({\"id\",\"command\",\"path\",\"priority\",\"args\",\"progress\"}, or command cancel with\n"
+                 "    \"target\") and streams events back; see README.md.\n");
+}
+
+static bool isHexChar(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int hexVal(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return 10 + (c - 'a');
+    if (c >= 'A' && c <= 'F')
+        return 10 + (c - 'A');
+    return -1;
+}
+
+static bool parseHex(const std::string& hex, std::vector<unsigned char>& out)
+{
+    std::string s;
+    s.reserve(hex.size());
+    for (char c : hex) {
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            continue;
+        if (!isHexChar(c))
+            return false;
+        s.push_back(c);
+    }
+    if ((s.size() % 2) != 0)
+        return false;
+
+    out.clear();
+    out.reserve(s.size() / 2);
+    for (size_t i = 0; i < s.size(); i += 2) {
+        int hi = hexVal(s[i]);
+        int lo = hexVal(s[i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out.push_back(static_cast<unsigned char>((hi << 4) | lo));
+    }
+    return true;
+}
+
+static std::string toVisibleKeyPreview(const std::vector<unsigned char>& bytes)
+{
+    // Convert bytes into "visible" ASCII; non-printable -> '?'
+    std::string s;
+    s.reserve(bytes.size());
+    for (unsigned char c : bytes) {
+        if (c >= 0x20 && c <= 0x7E) {
+            s.push_back(static_cast<char>(c));
+        } else {
+            s.push_back('?');
+        }
+    }
+    // Mask long previews to reduce accidental leakage.
+    if (s.size() > 16) {
+        s.replace(16, std::string::npos, "***");
+    }
+    return s;
+}
+
+static bool parseInt(const std::string& s, int& out)
+{
+    if (s.empty())
+        return false;
+    char* end = nullptr;
+    long v = std::strtol(s.c_str(), &end, 10);
+    if (end == nullptr || *end != '\0')
+        return false;
+    if (v < 0 || v > 1'000'000'000L)
+        return false;
+    out = static_cast<int>(v);
+    return true;
+}
+
+static bool parseDouble(const std::string& s, double& out)
+{
+    if (s.empty())
+        return false;
+    char* end = nullptr;
+    const double v = std::strtod(s.c_str(), &end);
+    if (end == nullptr || *end != '\0' || !(v == v))
+        return false;
+    out = v;
+    return true;
+}
+
+static bool parseCipherVersion(const std::string& s, WCDB::Database::CipherVersion& out)
+{
+    if (s == "default") {
+        out = WCDB::Database::CipherVersion::DefaultVersion;
+        return true;
+    }
+    if (s == "1") {
+        out = WCDB::Database::CipherVersion::Version1;
+        return true;
+    }
+    if (s == "2") {
+        out = WCDB::Database::CipherVersion::Version2;
+        return true;
+    }
+    if (s == "3") {
+        out = WCDB::Database::CipherVersion::Version3;
+        return true;
+    }
+    if (s == "4") {
+        out = WCDB::Database::CipherVersion::Version4;
+        return true;
+    }
+    return false;
+}
+
+} // namespace
+
+namespace WCDBRepair {
+
+bool parseArgs(const std::vector<std::string>& argv, Options& opt)
+{
+    if (argv.size() < 2)
+        return false;
+
+    const std::string& cmd = argv[1];
+    if (cmd == "-h" || cmd == "--help" || cmd == "help") {
+        opt.command = "help";
+        return true;
+    }
+
+    if (argv.size() < 3)
+        return false;
+
+    opt.command = cmd;
+    opt.dbPath = argv[2];
+    opt.rawOptions.assign(argv.begin() + 3, argv.end());
+
+    for (size_t i = 3; i < argv.size(); i++) {
+        const std::string& a = argv[i];
+        if (a == "--fast") {
+            opt.fastCheck = true;
+            continue;
+        }
+        if (a == "--incremental") {
+            opt.incrementalBackup = true;
+            continue;
+        }
+        if (a == "--material") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.materialPath = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--material-dict") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.materialDict = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--train-material-dict") {
+            opt.trainMaterialDict = true;
+            continue;
+        }
+        if (a == "--output") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.salvageOutput = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--sample") {
+            if (i + 1 >= argv.size())
+                return false;
+            double v = 0;
+            if (!parseDouble(argv[i + 1], v) || v <= 0 || v > 1)
+                return false;
+            opt.sampleFraction = v;
+            i++;
+            continue;
+        }
+        if (a == "--seed") {
+            if (i + 1 >= argv.size())
+                return false;
+            if (!parseInt(argv[i + 1], opt.sampleSeed))
+                return false;
+            i++;
+            continue;
+        }
+        if (a == "--rows-per-sec") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.rowsPerSecond = v;
+            i++;
+            continue;
+        }
+        if (a == "--export") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.exportDir = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--format") {
+            if (i + 1 >= argv.size())
+                return false;
+            if (!WCDBRepair::parseExportFormat(argv[i + 1], opt.exportFormat))
+                return false;
+            i++;
+            continue;
+        }
+        if (a == "--schema") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.schemaFile = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--schema-from") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.schemaFromDb = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--verify-hmac") {
+            opt.verifyHmacFirst = true;
+            continue;
+        }
+        if (a == "--io-engine") {
+            if (i + 1 >= argv.size())
+                return false;
+            if (!WCDBRepair::parseIoEngine(argv[i + 1], opt.pageRead.engine))
+                return false;
+            i++;
+            continue;
+        }
+        if (a == "--io-depth") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1 || v > 256)
+                return false;
+            opt.pageRead.queueDepth = v;
+            i++;
+            continue;
+        }
+        if (a == "--io-read-kb") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 4 || v > 65536)
+                return false;
+            opt.pageRead.readBytes = static_cast<uint32_t>(v) * 1024;
+            i++;
+            continue;
+        }
+        if (a == "--io-policy") {
+            if (i + 1 >= argv.size())
+                return false;
+            if (!WCDBRepair::parseIoPolicy(argv[i + 1], opt.pageRead.policy))
+                return false;
+            i++;
+            continue;
+        }
+        if (a == "--direct-io") {
+            opt.pageRead.policy = WCDBRepair::IoPolicy::Direct;
+            continue;
+        }
+        if (a == "--no-registered-buffers") {
+            opt.pageRead.registeredBuffers = false;
+            continue;
+        }
+        if (a == "--fast-assemble") {
+            opt.fastAssemble = true;
+            continue;
+        }
+        if (a == "--sort-memory-mb") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 0)
+                return false;
+            opt.sortMemoryMb = v;
+            i++;
+            continue;
+        }
+        if (a == "--index-threads") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.indexThreads = v;
+            i++;
+            continue;
+        }
+        if (a == "--deadline") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.deadlineSeconds = v;
+            i++;
+            continue;
+        }
+        if (a == "--budget") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.budgetSeconds = v;
+            i++;
+            continue;
+        }
+        if (a == "--priority-tables" || a == "--tables") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.tablesOnly = a == "--tables";
+            opt.priorityTables.clear();
+            const std::string& list = argv[i + 1];
+            for (size_t start = 0; start <= list.size();) {
+                size_t comma = list.find(',', start);
+                if (comma == std::string::npos)
+                    comma = list.size();
+                if (comma > start)
+                    opt.priorityTables.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+            if (opt.priorityTables.empty())
+                return false;
+            i++;
+            continue;
+        }
+        if (a == "--resume") {
+            opt.resume = true;
+            continue;
+        }
+        if (a == "--checkpoint-interval") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 0)
+                return false;
+            opt.checkpointIntervalSeconds = v;
+            i++;
+            continue;
+        }
+        if (a == "--timing") {
+            opt.timing = true;
+            continue;
+        }
+        if (a == "--trace-events") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.traceEventsPath = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--progress-json") {
+            opt.progressJson = true;
+            continue;
+        }
+        if (a == "--no-progress") {
+            opt.showProgress = false;
+            continue;
+        }
+        if (a == "--no-sql-trace") {
+            opt.sqlTrace = false;
+            continue;
+        }
+        if (a == "--no-full-sql-trace") {
+            opt.fullSqlTrace = false;
+            continue;
+        }
+        if (a == "--sql-trace-file") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.sqlTraceFile = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--sql-trace-queue") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.sqlTraceQueue = v;
+            i++;
+            continue;
+        }
+        if (a == "--sql-trace-policy") {
+            if (i + 1 >= argv.size())
+                return false;
+            const std::string& p = argv[i + 1];
+            if (p == "drop") {
+                opt.sqlTracePolicy = WCDBRepair::TraceSink::Policy::Drop;
+            } else if (p == "block") {
+                opt.sqlTracePolicy = WCDBRepair::TraceSink::Policy::Block;
+            } else {
+                return false;
+            }
+            i++;
+            continue;
+        }
+        if (a == "--no-error-trace") {
+            opt.errorTrace = false;
+            continue;
+        }
+        if (a == "--key") {
+            if (i + 1 >= argv.size())
+                return false;
+            const std::string& k = argv[i + 1];
+            opt.hasKey = true;
+            opt.keyBytes.assign(reinterpret_cast<const unsigned char*>(k.data()),
+                                reinterpret_cast<const unsigned char*>(k.data()) + k.size());
+            // For --key (ASCII/UTF-8), keep a masked preview for logs.
+            opt.keyPreview = toVisibleKeyPreview(opt.keyBytes);
+            i++;
+            continue;
+        }
+        if (a == "--key-hex") {
+            if (i + 1 >= argv.size())
+                return false;
+            std::vector<unsigned char> bytes;
+            if (!parseHex(argv[i + 1], bytes))
+                return false;
+            opt.hasKey = true;
+            opt.keyBytes = std::move(bytes);
+            opt.keyPreview = toVisibleKeyPreview(opt.keyBytes);
+            i++;
+            continue;
+        }
+        if (a == "--cipher-page-size") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v))
+                return false;
+            opt.cipherPageSize = v;
+            i++;
+            continue;
+        }
+        if (a == "--cipher-version") {
+            if (i + 1 >= argv.size())
+                return false;
+            WCDB::Database::CipherVersion v;
+            if (!parseCipherVersion(argv[i + 1], v))
+                return false;
+            opt.cipherVersion = v;
+            i++;
+            continue;
+        }
+        if (a == "--kdf-iter") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v))
+                return false;
+            opt.hasKdfIter = true;
+            opt.kdfIter = v;
+            i++;
+            continue;
+        }
+        if (a == "--cipher-hmac-algorithm") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.cipherHmacAlgorithm = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--cipher-default-kdf-algorithm") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.cipherDefaultKdfAlgorithm = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--cipher") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.cipher = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--kdf-cache") {
+            opt.kdfCache = true;
+            continue;
+        }
+        if (a == "--kdf-cache-file") {
+            if (i + 1 >= argv.size())
+                return false;
+            opt.kdfCache = true;
+            opt.kdfCacheFile = argv[i + 1];
+            i++;
+            continue;
+        }
+        if (a == "--kdf-cache-secret-hex") {
+            if (i + 1 >= argv.size())
+                return false;
+            std::vector<unsigned char> bytes;
+            if (!parseHex(argv[i + 1], bytes) || bytes.empty())
+                return false;
+            opt.kdfCacheSecret = std::move(bytes);
+            i++;
+            continue;
+        }
+        if (a == "--batch-command") {
+            if (i + 1 >= argv.size())
+                return false;
+            const std::string& c = argv[i + 1];
+            if (c != "check" && c != "backup" && c != "repair" && c != "verify-hmac" && c != "salvage"
+                && c != "estimate")
+                return false;
+            opt.batchCommand = c;
+            i++;
+            continue;
+        }
+        if (a == "--jobs") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.jobs = v;
+            i++;
+            continue;
+        }
+        if (a == "--io-slots") {
+            if (i + 1 >= argv.size())
+                return false;
+            int v = 0;
+            if (!parseInt(argv[i + 1], v) || v < 1)
+                return false;
+            opt.ioSlots = v;
+            i++;
+            continue;
+        }
+        return false;
+    }
+
+    if (!opt.kdfCacheFile.empty() && opt.kdfCacheSecret.empty()) {
+        const char* env = std::getenv("WCDBREPAIR_KDF_CACHE_SECRET");
+        if (env == nullptr || !parseHex(env, opt.kdfCacheSecret) || opt.kdfCacheSecret.empty())
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace WCDBRepair
+
+namespace {
+
+static void logState(const char* state, const std::string& detail = std::string())
+{
+    if (detail.empty()) {
+        std::printf("STATE=%s\n", state);
+    } else {
+        std::printf("STATE=%s detail=%s\n", state, detail.c_str());
+    }
+    std::fflush(stdout);
+}
+
+// Writes one output line of a database's run; serve jobs hand it to their client.
+static void writeLine(const Options& opt, const std::string& line)
+{
+    if (opt.writer) {
+        opt.writer(line);
+        return;
+    }
+    std::printf("%s\n", line.c_str());
+    std::fflush(stdout);
+}
+
+// Per-database variants: in batch mode several databases run concurrently, so every
+// line is tagged with the database path. Each line is written with a single printf.
+static void logState(const Options& opt, const char* state, const std::string& detail = std::string())
+{
+    WCDBRepair::PhaseSpan span;
+    if (opt.timeline != nullptr && opt.timeline->mark(opt.timelineTrack, state, span) && opt.timing) {
+        char buf[256];
+        std::snprintf(buf,
+                      sizeof(buf),
+                      " startMs=%.3f durMs=%.3f cpuMs=%.3f peakRssDeltaKb=%lld",
+                      span.startMs,
+                      span.durationMs,
+                      span.cpuMs,
+                      static_cast<long long>(span.peakRssDeltaKb));
+        if (opt.batchItem) {
+            writeLine(opt, "SPAN name=" + span.name + " path=" + opt.dbPath + buf);
+        } else {
+            writeLine(opt, "SPAN name=" + span.name + buf);
+        }
+    }
+    if (!opt.batchItem && !opt.writer) {
+        logState(state, detail);
+        return;
+    }
+    std::string line = std::string("STATE=") + state;
+    if (opt.batchItem)
+        line += " path=" + opt.dbPath;
+    if (!detail.empty())
+        line += " detail=" + detail;
+    writeLine(opt, line);
+}
+
+static void printResult(const Options& opt, const std::string& result)
+{
+    if (opt.batchItem) {
+        writeLine(opt, "RESULT=" + result + " path=" + opt.dbPath);
+    } else {
+        writeLine(opt, "RESULT=" + result);
+    }
+}
+
+// <PREFIX>_IO with how a whole-file pass read the file, and what it could not use.
+static void logPageRead(const Options& opt, const std::string& prefix, const WCDBRepair::PageReadStats& stats)
+{
+    logState(opt, (prefix + "_IO").c_str(), WCDBRepair::describePageRead(stats));
+    if (!stats.fallback.empty())
+        logState(opt, (prefix + "_IO_FALLBACK").c_str(), stats.fallback);
+}
+
+// WCDB's check, backup and retrieve read through their own handles, where no readahead hint
+// reaches; what --io-policy dontneed or direct can still do is drop what they brought into
+// the cache of the DB, its WAL and the factory (deposited originals), until `guard` goes.
+static void guardPageCache(const Options& opt, const std::string& prefix, std::unique_ptr<WCDBRepair::CacheGuard>& guard)
+{
+    const WCDBRepair::IoPolicy policy = opt.pageRead.policy;
+    if (policy == WCDBRepair::IoPolicy::Default)
+        return;
+    if (!WCDBRepair::pageCacheAdviceAvailable()) {
+        logState(opt, (prefix + "_IO_FALLBACK").c_str(), "policy: posix_fadvise is not available on this platform");
+        return;
+    }
+    if (policy == WCDBRepair::IoPolicy::Sequential) {
+        logState(opt, (prefix + "_IO_FALLBACK").c_str(), "sequential: WCDB reads through its own handles");
+        return;
+    }
+    logState(opt, (prefix + "_CACHE_GUARD").c_str(), std::string("policy=") + WCDBRepair::ioPolicyName(policy));
+    guard.reset(new WCDBRepair::CacheGuard({opt.dbPath, opt.dbPath + "-wal"}, {opt.dbPath + ".factory"}));
+}
+
+static void enableGlobalErrorTraceIfNeeded(const Options& opt)
+{
+    if (!opt.errorTrace)
+        return;
+    WCDB::Database::globalTraceError([](const WCDB::Error& error) {
+        // Keep it one-line, English, parse-friendly.
+        const auto level = WCDB::Error::levelName(error.level);
+        const auto code = WCDB::Error::codeName(error.code());
+        std::printf("ERROR level=%s code=%s path=%s sql=%s message=%s\n",
+                    level ? level : "UNKNOWN",
+                    code ? code : "UNKNOWN",
+                    error.getPath().data(),
+                    error.getSQL().data(),
+                    error.getMessage().data());
+    });
+}
+
+// Sends a command's progress where its other output goes, and to the C API's listener.
+static void routeProgress(WCDBRepair::ProgressReporter& progress, const Options& opt)
+{
+    if (opt.writer)
+        progress.setWriter(opt.writer);
+    if (opt.progressListener)
+        progress.setListener(opt.progressListener);
+}
+
+// Rows of every table of the rebuilt DB, for the last PROGRESS_JSON event of repair:
+// retrieve() reports pages, not rows, and tracing its inserts would cost a callback each.
+static void countTableRows(WCDB::Database& db, WCDBRepair::ProgressReporter& progress)
+{
+    WCDB::Handle handle = db.getHandle();
+    std::vector<std::string> tables;
+    if (!handle.prepareSQL(WCDB::UnsafeStringView(
+        "SELECT name FROM sqlite_master WHERE type = 'table' AND name NOT LIKE 'sqlite\\_%' ESCAPE '\\'")))
+        return;
+    while (handle.step() && !handle.isDone()) {
+        const WCDB::StringView name = handle.getText(0);
+        tables.emplace_back(name.data(), name.length());
+    }
+    handle.finalize();
+    for (const std::string& table : tables) {
+        std::string quoted = "\"";
+        for (char c : table) {
+            if (c == '"')
+                quoted.push_back('"');
+            quoted.push_back(c);
+        }
+        quoted.push_back('"');
+        if (!handle.prepareSQL(WCDB::UnsafeStringView("SELECT count(*) FROM " + quoted)))
+            continue;
+        if (handle.step() && !handle.isDone()) {
+            progress.setTable(table);
+            progress.addRows(static_cast<uint64_t>(handle.getInteger(0)));
+        }
+        handle.finalize();
+    }
+}
+
+// Page size of the input: from the header of a plaintext DB, else the SQLCipher setting.
+static uint32_t inputPageSize(const Options& opt)
+{
+    WCDBRepair::PageFile file;
+    unsigned char header[100];
+    if (file.open(opt.dbPath) && file.readFully(0, header, sizeof(header))) {
+        WCDBRepair::DatabaseHeader parsed;
+        if (parsed.parse(header, sizeof(header)))
+            return parsed.pageSize;
+    }
+    return static_cast<uint32_t>(opt.cipherPageSize);
+}
+
+static void enableSqlTraceIfNeeded(WCDB::Database& db, const Options& opt, WCDBRepair::TraceSink* sink)
+{
+    if (!opt.sqlTrace || sink == nullptr)
+        return;
+    db.setFullSQLTraceEnable(opt.fullSqlTrace);
+    db.traceSQL([sink](long tag,
+                       const WCDB::UnsafeStringView& path,
+                       const void* handleIdentifier,
+                       const WCDB::UnsafeStringView& sql,
+                       const WCDB::UnsafeStringView& info) {
+        // English, single-line logs for easy grepping/parsing.
+        // Formatted into the sink's ring buffer; no stdio on the calling thread.
+        if (info.length() > 0) {
+            sink->printf("SQL tag=%ld handle=%p path=%s sql=%s info=%s\n",
+                         tag,
+                         handleIdentifier,
+                         path.data(),
+                         sql.data(),
+                         info.data());
+        } else {
+            sink->printf("SQL tag=%ld handle=%p path=%s sql=%s\n",
+                         tag,
+                         handleIdentifier,
+                         path.data(),
+                         sql.data());
+        }
+    });
+}
+
+static void applySqlcipherPragmasIfNeeded(WCDB::Database& db, const Options& opt)
+{
+    const bool needKdfIter = opt.hasKdfIter;
+    const bool needHmacAlg = !opt.cipherHmacAlgorithm.empty();
+    const bool needDefaultKdfAlg = !opt.cipherDefaultKdfAlgorithm.empty();
+    const bool needCipher = !opt.cipher.empty();
+    if (!needKdfIter && !needHmacAlg && !needDefaultKdfAlg && !needCipher)
+        return;
+
+    // Note: priority is controlled by WCDB::Configs::Priority (not Database::Priority).
+    db.setConfig("wcdbrepair.sqlcipher",
+                 [=](WCDB::Handle& handle) -> bool {
+                     bool ok = true;
+                     if (needDefaultKdfAlg) {
+                         ok = ok && handle.execute(WCDB::StatementPragma()
+                                                       .pragma(WCDB::Pragma("cipher_default_kdf_algorithm"))
+                                                       .to(opt.cipherDefaultKdfAlgorithm.c_str()));
+                     }
+                     if (needCipher) {
+                         ok = ok && handle.execute(WCDB::StatementPragma()
+                                                       .pragma(WCDB::Pragma::cipher())
+                                                       .to(opt.cipher.c_str()));
+                     }
+                     if (needKdfIter) {
+                         ok = ok && handle.execute(
+                                       WCDB::StatementPragma().pragma(WCDB::Pragma("kdf_iter")).to(opt.kdfIter));
+                     }
+                     if (needHmacAlg) {
+                         ok = ok && handle.execute(WCDB::StatementPragma()
+                                                       .pragma(WCDB::Pragma::cipherHmacAlgorithm())
+                                                       .to(opt.cipherHmacAlgorithm.c_str()));
+                     }
+                     return ok;
+                 },
+                 nullptr,
+                 static_cast<WCDB::Database::Priority>(WCDB::Configs::Priority::Higher));
+}
+
+static const char* const kFastAssembleConfigName = "wcdbrepair.fast-assemble";
+static constexpr int64_t kFastAssembleCacheKb = 256 * 1024;
+
+// Bulk-load settings for the handles retrieve() assembles the new DB with. Priority Low runs
+// after BasicConfig, which would otherwise put journal_mode back to WAL.
+static void applyFastAssembleConfig(WCDB::Database& db)
+{
+    db.setConfig(kFastAssembleConfigName,
+                 [](WCDB::Handle& handle) -> bool {
+                     return handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::journalMode()).to("OFF"))
+                            && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::synchronous()).to("OFF"))
+                            && handle.execute(
+                            WCDB::StatementPragma().pragma(WCDB::Pragma::cacheSize()).to(-kFastAssembleCacheKb))
+                            && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::tempStore()).to("MEMORY"));
+                 },
+                 [](WCDB::Handle& handle) -> bool {
+                     return handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::journalMode()).to("WAL"))
+                            && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::synchronous()).to("FULL"))
+                            && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::cacheSize()).to(-2000))
+                            && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::tempStore()).to("DEFAULT"));
+                 },
+                 static_cast<WCDB::Database::Priority>(WCDB::Configs::Priority::Low));
+}
+
+// Pages written with synchronous=OFF may still sit in the OS cache. Back on WAL with
+// synchronous=FULL, one real commit plus a checkpoint fsyncs the whole file.
+static bool finishFastAssemble(WCDB::Database& db)
+{
+    db.removeConfig(kFastAssembleConfigName);
+    bool ok = false;
+    {
+        WCDB::Handle handle = db.getHandle();
+        ok = handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::journalMode()).to("WAL"))
+             && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::synchronous()).to("FULL"));
+        int64_t userVersion = 0;
+        if (ok && handle.prepareSQL(WCDB::UnsafeStringView("PRAGMA user_version"))) {
+            ok = handle.step();
+            if (ok && !handle.isDone())
+                userVersion = handle.getInteger(0);
+            handle.finalize();
+        }
+        // Rewriting the same value dirties page 1, so the commit is not skipped.
+        ok = ok && handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::userVersion()).to(userVersion));
+    }
+    return ok && db.truncateCheckpoint();
+}
+
+static const char* const kIndexBuildConfigName = "wcdbrepair.index-build";
+static constexpr int kMaxSorterThreads = 8; // SQLITE_MAX_WORKER_THREADS default
+
+// CREATE INDEX feeds every key through SQLite's external sorter and builds the b-tree from
+// the sorted run; PRAGMA threads lets that sort use auxiliary worker threads.
+static void applyIndexBuildConfig(WCDB::Database& db, const Options& opt)
+{
+    int threads = opt.indexThreads;
+    if (threads <= 0)
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (threads > kMaxSorterThreads)
+        threads = kMaxSorterThreads;
+    if (threads <= 1)
+        return;
+    const int helpers = threads - 1; // the connection's own thread sorts too
+    db.setConfig(kIndexBuildConfigName,
+                 [helpers](WCDB::Handle& handle) -> bool {
+                     return handle.execute(WCDB::StatementPragma().pragma(WCDB::Pragma::threads()).to(helpers));
+                 },
+                 nullptr,
+                 static_cast<WCDB::Database::Priority>(WCDB::Configs::Priority::Low));
+}
+
+static int cipherVersionNumber(WCDB::Database::CipherVersion version)
+{
+    switch (version) {
+    case WCDB::Database::CipherVersion::Version1:
+        return 1;
+    case WCDB::Database::CipherVersion::Version2:
+        return 2;
+    case WCDB::Database::CipherVersion::Version3:
+        return 3;
+    case WCDB::Database::CipherVersion::Version4:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Effective SQLCipher parameters from --cipher-version and the override flags.
+// False when the KDF parameters cannot be known (default version without overrides).
+static bool resolveCipherParams(const Options& opt, WCDBRepair::CipherParams& params, std::string& why)
+{
+    bool known = WCDBRepair::CipherParams::forCompatibility(cipherVersionNumber(opt.cipherVersion), params);
+    bool kdfAlgorithmSet = false;
+    if (!opt.cipherDefaultKdfAlgorithm.empty()) {
+        if (!WCDBRepair::parseKdfAlgorithm(opt.cipherDefaultKdfAlgorithm, params.kdfAlgorithm)) {
+            why = "unknown-kdf-algorithm";
+            return false;
+        }
+        kdfAlgorithmSet = true;
+    }
+    if (!opt.cipherHmacAlgorithm.empty()) {
+        if (!WCDBRepair::parseHmacAlgorithm(opt.cipherHmacAlgorithm, params.hmacAlgorithm)) {
+            why = "unknown-hmac-algorithm";
+            return false;
+        }
+        params.useHmac = true;
+    }
+    if (opt.hasKdfIter) {
+        params.kdfIter = opt.kdfIter;
+    }
+    params.pageSize = opt.cipherPageSize;
+    if (!known && !(kdfAlgorithmSet && opt.hasKdfIter)) {
+        why = "unknown-kdf-params";
+        return false;
+    }
+    return true;
+}
+
+// Derives the key through the cache and builds SQLCipher's raw key form
+// x'<key hex><salt hex>', which makes every handle skip PBKDF2.
+static bool makeRawCipherKey(const Options& opt, WCDBRepair::DerivedKeyCache& cache, std::string& rawKey)
+{
+    WCDBRepair::CipherParams params;
+    std::string why;
+    if (!resolveCipherParams(opt, params, why)) {
+        logState(opt, "KDF_CACHE_SKIPPED", why);
+        return false;
+    }
+
+    // The salt lives in the first 16 bytes of an existing encrypted file.
+    WCDBRepair::PageFile file;
+    unsigned char salt[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, salt, sizeof(salt))) {
+        logState(opt, "KDF_CACHE_SKIPPED", "no-salt");
+        return false;
+    }
+    if (std::memcmp(salt, "SQLite format 3", sizeof(salt)) == 0) {
+        logState(opt, "KDF_CACHE_SKIPPED", "plaintext-header");
+        return false;
+    }
+
+    unsigned char key[WCDBRepair::KeySize];
+    bool hit = false;
+    const auto start = std::chrono::steady_clock::now();
+    if (!cache.derive(opt.keyBytes, salt, params.kdfAlgorithm, params.kdfIter, key, &hit)) {
+        logState(opt, "KDF_CACHE_SKIPPED", "derive-failed");
+        return false;
+    }
+    const long long elapsedMs = static_cast<long long>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+    static const char digits[] = "0123456789abcdef";
+    rawKey = "x'";
+    for (unsigned char c : key) {
+        rawKey.push_back(digits[c >> 4]);
+        rawKey.push_back(digits[c & 0x0F]);
+    }
+    for (unsigned char c : salt) {
+        rawKey.push_back(digits[c >> 4]);
+        rawKey.push_back(digits[c & 0x0F]);
+    }
+    rawKey.push_back('\'');
+    logState(opt, "KDF_CACHE", std::string(hit ? "hit" : "miss") + ",elapsedMs=" + std::to_string(elapsedMs));
+    return true;
+}
+
+// `rawKey` receives the raw key when the cache is used; it must outlive `db`'s use of it.
+static void applyCipherIfNeeded(WCDB::Database& db,
+                                const Options& opt,
+                                WCDBRepair::DerivedKeyCache* keyCache,
+                                std::string& rawKey)
+{
+    if (!opt.hasKey)
+        return;
+    if (keyCache != nullptr && opt.kdfCache && makeRawCipherKey(opt, *keyCache, rawKey)) {
+        const WCDB::UnsafeData key = WCDB::UnsafeData::immutable(
+        reinterpret_cast<const unsigned char*>(rawKey.data()), rawKey.size());
+        db.setCipherKey(key, opt.cipherPageSize, opt.cipherVersion);
+        return;
+    }
+    const WCDB::UnsafeData key = WCDB::UnsafeData::immutable(opt.keyBytes.data(), opt.keyBytes.size());
+    db.setCipherKey(key, opt.cipherPageSize, opt.cipherVersion);
+}
+
+// Last SIGINT/SIGTERM received; long-running commands poll it and stop at a safe point.
+static std::atomic<int> stopSignal(0);
+
+static void onStopSignal(int sig)
+{
+    stopSignal.store(sig);
+    // A second signal terminates right away.
+    std::signal(sig, SIG_DFL);
+}
+
+static void installStopHandlers()
+{
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+}
+
+// Why the running command should stop now, or nullptr to go on.
+static const char* stopReason(const Context& ctx)
+{
+    if (stopSignal.load() != 0)
+        return "signal";
+    if (ctx.hasDeadline && std::chrono::steady_clock::now() >= ctx.deadline)
+        return "deadline";
+    if (ctx.cancelled && ctx.cancelled())
+        return "cancelled";
+    return nullptr;
+}
+
+// One of batch's --io-slots, held from construction until release() or the end of the scope.
+class IoSlot {
+public:
+    explicit IoSlot(const Context& ctx) : m_ctx(ctx), m_held(static_cast<bool>(ctx.acquireIo))
+    {
+        if (m_held)
+            m_ctx.acquireIo();
+    }
+    ~IoSlot() { release(); }
+
+    IoSlot(const IoSlot&) = delete;
+    IoSlot& operator=(const IoSlot&) = delete;
+
+    void release()
+    {
+        if (!m_held)
+            return;
+        m_held = false;
+        m_ctx.releaseIo();
+    }
+
+private:
+    const Context& m_ctx;
+    bool m_held;
+};
+
+static int runProbe(const Options& opt)
+{
+    if (!opt.hasKey) {
+        logState(opt, "PROBE_NEED_KEY");
+        return 2;
+    }
+    WCDBRepair::PageFile file;
+    if (!file.open(opt.dbPath)) {
+        logState(opt, "PROBE_OPEN_FAILED", opt.dbPath);
+        printResult(opt, "probe found=false");
+        return 1;
+    }
+
+    WCDBRepair::ProbeOptions probeOptions;
+    if (opt.hasKdfIter) {
+        probeOptions.extraKdfIters.push_back(opt.kdfIter);
+    }
+    probeOptions.threads = opt.jobs;
+
+    logState(opt, "PROBE_START");
+    const auto start = std::chrono::steady_clock::now();
+    WCDBRepair::ProbeResult result;
+    const bool ok = WCDBRepair::probeCipher(file, opt.keyBytes, probeOptions, result);
+    const long long elapsedMs = static_cast<long long>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    logState(opt, "PROBE_DONE");
+
+    if (!ok) {
+        printResult(opt, "probe found=false");
+        return 1;
+    }
+    if (!result.encrypted) {
+        printResult(opt, "probe found=false encrypted=false");
+        return 1;
+    }
+    char buf[512];
+    if (!result.found) {
+        std::snprintf(buf,
+                      sizeof(buf),
+                      "probe found=false candidates=%d derivations=%d elapsedMs=%lld",
+                      result.candidates,
+                      result.derivations,
+                      elapsedMs);
+        printResult(opt, buf);
+        return 1;
+    }
+    const WCDBRepair::CipherParams& p = result.params;
+    const int version = p.matchingCompatibility();
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "probe found=true cipher-version=%s cipher-page-size=%d kdf-iter=%d "
+                  "cipher-default-kdf-algorithm=%s cipher-hmac-algorithm=%s sampledPages=%d "
+                  "candidates=%d derivations=%d elapsedMs=%lld",
+                  version > 0 ? std::to_string(version).c_str() : "custom",
+                  p.pageSize,
+                  p.kdfIter,
+                  WCDBRepair::kdfAlgorithmName(p.kdfAlgorithm),
+                  p.useHmac ? WCDBRepair::hmacAlgorithmName(p.hmacAlgorithm) : "none",
+                  result.sampledPages,
+                  result.candidates,
+                  result.derivations,
+                  elapsedMs);
+    printResult(opt, buf);
+    return 0;
+}
+
+// Resolves the cipher parameters and derives the page keys for a file whose first
+// bytes (the salt) are given. On failure `why` is a STATE suffix, `detail` may explain it.
+static bool deriveCipherKeys(const Options& opt,
+                             Context& ctx,
+                             const unsigned char* head,
+                             uint64_t headSize,
+                             WCDBRepair::CipherKeys& keys,
+                             std::string& why,
+                             std::string& detail)
+{
+    WCDBRepair::CipherParams params;
+    if (!resolveCipherParams(opt, params, detail)) {
+        why = "CIPHER_PARAMS_UNKNOWN";
+        return false;
+    }
+    unsigned char key[WCDBRepair::KeySize];
+    if (headSize < WCDBRepair::SaltSize
+        || !ctx.keyCache->derive(opt.keyBytes, head, params.kdfAlgorithm, params.kdfIter, key)
+        || !keys.init(params, head, key)) {
+        why = "KEY_DERIVE_FAILED";
+        return false;
+    }
+    return true;
+}
+
+// Runs the HMAC verification pass; `why` is set the same way as deriveCipherKeys().
+static bool verifyHmacPass(const Options& opt,
+                           Context& ctx,
+                           WCDBRepair::HmacVerifyResult& result,
+                           std::string& why,
+                           std::string& detail)
+{
+    WCDBRepair::PageFile file;
+    if (!file.open(opt.dbPath)) {
+        why = "OPEN_FAILED";
+        return false;
+    }
+    unsigned char salt[WCDBRepair::SaltSize];
+    const uint64_t saltSize = file.size() < sizeof(salt) ? 0 : sizeof(salt);
+    if (saltSize > 0 && !file.readFully(0, salt, sizeof(salt))) {
+        why = "OPEN_FAILED";
+        return false;
+    }
+    WCDBRepair::CipherKeys keys;
+    if (!deriveCipherKeys(opt, ctx, salt, saltSize, keys, why, detail))
+        return false;
+    if (!keys.params.useHmac) {
+        why = "NO_HMAC";
+        return false;
+    }
+
+    WCDBRepair::HmacVerifyOptions options;
+    options.threads = opt.jobs;
+    options.io = opt.pageRead;
+    IoSlot io(ctx);
+    if (!WCDBRepair::verifyPageHmacs(file, keys, options, result)) {
+        why = "READ_FAILED";
+        detail = result.error;
+        return false;
+    }
+    return true;
+}
+
+static int runVerifyHmac(const Options& opt, Context& ctx)
+{
+    if (!opt.hasKey) {
+        logState(opt, "VERIFY_HMAC_KEY_REQUIRED");
+        return 2;
+    }
+    logState(opt, "VERIFY_HMAC_START");
+    WCDBRepair::HmacVerifyResult result;
+    std::string why;
+    std::string detail;
+    if (!verifyHmacPass(opt, ctx, result, why, detail)) {
+        logState(opt, ("VERIFY_HMAC_" + why).c_str(), detail);
+        printResult(opt, "verify-hmac ok=false");
+        return 1;
+    }
+    logPageRead(opt, "VERIFY_HMAC", result.io);
+    // Wrong key/params fail every page; keep the listing readable.
+    const size_t maxListed = 1000;
+    for (size_t i = 0; i < result.failedPages.size() && i < maxListed; i++) {
+        writeLine(opt, "HMAC_FAILED pgno=" + std::to_string(result.failedPages[i]));
+    }
+    char buf[256];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "verify-hmac ok=%s pages=%llu failedPages=%zu zeroPages=%llu seconds=%.3f mbps=%.1f",
+                  result.failedPages.empty() ? "true" : "false",
+                  static_cast<unsigned long long>(result.pages),
+                  result.failedPages.size(),
+                  static_cast<unsigned long long>(result.zeroPages),
+                  result.seconds,
+                  result.seconds > 0 ? static_cast<double>(result.bytes) / (1024.0 * 1024.0) / result.seconds : 0.0);
+    printResult(opt, buf);
+    return result.failedPages.empty() ? 0 : 1;
+}
+
+static std::string materialPathOf(const Options& opt)
+{
+    return opt.materialPath.empty() ? opt.dbPath + "-wcdbrepair.material" : opt.materialPath;
+}
+
+static int runIncrementalBackup(const Options& opt, Context& ctx)
+{
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, head, sizeof(head))) {
+        logState(opt, "BACKUP_OPEN_FAILED", opt.dbPath);
+        printResult(opt, "backup ok=false mode=incremental");
+        return 1;
+    }
+    WCDBRepair::SalvageOptions options;
+    options.pageSize = static_cast<uint32_t>(opt.cipherPageSize);
+    WCDBRepair::CipherKeys keys;
+    if (opt.hasKey) {
+        logState(opt, "SQLCIPHER_KEY_SETUP");
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail)) {
+            logState(opt, ("BACKUP_" + why).c_str(), detail);
+            return 2;
+        }
+        options.keys = &keys;
+    }
+    WCDBRepair::Salvager salvager(file, options);
+    std::string error;
+    if (!salvager.open(error)) {
+        logState(opt, "BACKUP_OPEN_FAILED", error);
+        printResult(opt, "backup ok=false mode=incremental");
+        return 1;
+    }
+
+    if (opt.trainMaterialDict && opt.materialDict.empty()) {
+        logState(opt, "BACKUP_MATERIAL_DICT_MISSING", "--train-material-dict writes to --material-dict <path>");
+        return 2;
+    }
+    std::vector<unsigned char> dictionary;
+    std::string dictError;
+    if (!opt.materialDict.empty() && !WCDBRepair::loadMaterialDictionary(opt.materialDict, dictionary, dictError)
+        && !opt.trainMaterialDict) {
+        logState(opt, "BACKUP_MATERIAL_DICT_UNREADABLE", opt.materialDict + ": " + dictError);
+        return 2;
+    }
+    const std::string path = materialPathOf(opt);
+    WCDBRepair::Material previous;
+    const bool hasPrevious = previous.load(path, options.keys, error, dictionary);
+    if (!hasPrevious && error == "wrong-key") {
+        // Do not replace material of the right key with garbage.
+        logState(opt, "BACKUP_MATERIAL_KEY_MISMATCH", path);
+        printResult(opt, "backup ok=false mode=incremental");
+        return 1;
+    }
+    if (!hasPrevious && error != "missing") {
+        logState(opt, "BACKUP_MATERIAL_IGNORED", error);
+    }
+
+    logState(opt, "BACKUP_START", "mode=incremental");
+    const auto start = std::chrono::steady_clock::now();
+    WCDBRepair::Material material;
+    WCDBRepair::IncrementalStats stats;
+    IoSlot io(ctx);
+    bool ok = WCDBRepair::updateMaterial(
+    file, salvager, hasPrevious ? &previous : nullptr, opt.jobs, opt.pageRead, material, stats);
+    io.release();
+    if (ok)
+        logPageRead(opt, "BACKUP", stats.io);
+    if (ok && opt.trainMaterialDict) {
+        // Material already written with the old dictionary stays readable only with that one.
+        std::vector<unsigned char> trained;
+        if (WCDBRepair::trainMaterialDictionary(material, trained, error)
+            && WCDBRepair::saveMaterialDictionary(opt.materialDict, trained)) {
+            dictionary.swap(trained);
+            logState(opt, "BACKUP_MATERIAL_DICT_TRAINED", "bytes=" + std::to_string(dictionary.size()));
+        } else {
+            logState(opt, "BACKUP_MATERIAL_DICT_TRAIN_FAILED", error);
+        }
+    }
+    uint64_t storedBytes = 0;
+    uint64_t rawBytes = 0;
+    ok = ok && material.save(path, options.keys, dictionary, &storedBytes, &rawBytes);
+    const long long elapsedMs = static_cast<long long>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "backup ok=%s mode=incremental pages=%u changedPages=%llu walkedTrees=%llu reusedTrees=%llu "
+                  "damagedTrees=%llu materialBytes=%llu rawBytes=%llu compressed=%s elapsedMs=%lld",
+                  ok ? "true" : "false",
+                  stats.pageCount,
+                  static_cast<unsigned long long>(stats.changedPages),
+                  static_cast<unsigned long long>(stats.walkedTrees),
+                  static_cast<unsigned long long>(stats.reusedTrees),
+                  static_cast<unsigned long long>(stats.damagedTrees),
+                  static_cast<unsigned long long>(storedBytes),
+                  static_cast<unsigned long long>(rawBytes),
+                  WCDBRepair::materialCompressionAvailable() ? "true" : "false",
+                  elapsedMs);
+    printResult(opt, buf);
+    return ok ? 0 : 1;
+}
+
+// Adds entries whose name is not known yet; an existing entry only gains missing SQL.
+// Root pages are kept only when they refer to this same file.
+static void mergeSchema(std::vector<WCDBRepair::SchemaEntry>& into,
+                        const std::vector<WCDBRepair::SchemaEntry>& from,
+                        bool keepRoots = false)
+{
+    for (const WCDBRepair::SchemaEntry& entry : from) {
+        bool found = false;
+        for (WCDBRepair::SchemaEntry& known : into) {
+            if (known.type == entry.type && known.name == entry.name) {
+                if (known.sql.empty())
+                    known.sql = entry.sql;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            into.push_back(entry);
+            if (!keepRoots)
+                into.back().rootPage = 0;
+        }
+    }
+}
+
+// Reads sqlite_master of `path` page by page, with the same key options as the input.
+static bool readSchemaOf(const Options& opt,
+                         Context& ctx,
+                         const std::string& path,
+                         std::vector<WCDBRepair::SchemaEntry>& entries)
+{
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(path) || !file.readFully(0, head, sizeof(head)))
+        return false;
+    WCDBRepair::CipherKeys keys;
+    WCDBRepair::SalvageOptions options;
+    options.pageSize = static_cast<uint32_t>(opt.cipherPageSize);
+    if (opt.hasKey && std::memcmp(head, "SQLite format 3", sizeof(head)) != 0) {
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail))
+            return false;
+        options.keys = &keys;
+    }
+    WCDBRepair::Salvager salvager(file, options);
+    std::string error;
+    if (!salvager.open(error))
+        return false;
+    salvager.readSchema(entries);
+    return !entries.empty();
+}
+
+static bool fileExists(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return static_cast<bool>(in);
+}
+
+// Seconds since the epoch of the last write; -1 when the file is missing.
+static int64_t modifiedTimeOf(const std::string& path)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    return _stat64(path.c_str(), &st) == 0 ? static_cast<int64_t>(st.st_mtime) : -1;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<int64_t>(st.st_mtime) : -1;
+#endif
+}
+
+// Renames a database and its WAL; the shared-memory index is rebuilt on open.
+static bool moveDatabaseFiles(const std::string& from, const std::string& to)
+{
+    if (fileExists(to) || std::rename(from.c_str(), to.c_str()) != 0)
+        return false;
+    if (fileExists(from + "-wal")) {
+        std::remove((to + "-wal").c_str());
+        if (std::rename((from + "-wal").c_str(), (to + "-wal").c_str()) != 0)
+            return false;
+    }
+    std::remove((from + "-shm").c_str());
+    std::remove((to + "-shm").c_str());
+    return true;
+}
+
+static void removeDatabaseFiles(const std::string& path)
+{
+    for (const char* suffix : { "", "-wal", "-shm", "-journal" }) {
+        std::remove((path + suffix).c_str());
+    }
+}
+
+// Counts rows on their way into the output for PROGRESS_JSON events; also keeps events
+// coming while a sort merge feeds rows after the page scan has finished.
+class ProgressSink final : public WCDBRepair::SalvageSink {
+public:
+    ProgressSink(const std::vector<WCDBRepair::SalvageTable>& tables,
+                 WCDBRepair::SalvageSink& next,
+                 WCDBRepair::ProgressReporter& progress,
+                 const double& fraction)
+    : m_tables(tables), m_next(next), m_progress(progress), m_fraction(fraction), m_lastTable(SIZE_MAX)
+    {
+    }
+
+    bool row(size_t table, int64_t rowid, const std::vector<WCDBRepair::RecordValue>& values) override
+    {
+        if (table != m_lastTable) {
+            m_lastTable = table;
+            m_progress.setTable(m_tables[table].name);
+        }
+        m_progress.addRows(1);
+        if ((m_progress.rows() & 4095) == 0)
+            m_progress.update(m_fraction);
+        return m_next.row(table, rowid, values);
+    }
+
+private:
+    const std::vector<WCDBRepair::SalvageTable>& m_tables;
+    WCDBRepair::SalvageSink& m_next;
+    WCDBRepair::ProgressReporter& m_progress;
+    const double& m_fraction;
+    size_t m_lastTable;
+};
+
+// SQLite compares identifiers case-insensitively (ASCII only).
+static bool sameSqlName(const std::string& a, const std::string& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+// Pass 1 order for --priority-tables and --budget: the named tables in the given order,
+// then the others smallest first, so a run cut short has finished as many as it could.
+static std::vector<size_t> priorityWalkOrder(const Options& opt,
+                                             const std::vector<WCDBRepair::SalvageTable>& tables,
+                                             WCDBRepair::Salvager& salvager,
+                                             size_t* named = nullptr)
+{
+    std::vector<size_t> order;
+    std::vector<bool> taken(tables.size(), false);
+    for (const std::string& name : opt.priorityTables) {
+        size_t found = tables.size();
+        for (size_t t = 0; t < tables.size(); t++) {
+            if (!taken[t] && sameSqlName(tables[t].name, name))
+                found = t;
+        }
+        if (found == tables.size()) {
+            logState(opt, "PRIORITY_TABLE_UNKNOWN", name);
+            continue;
+        }
+        taken[found] = true;
+        order.push_back(found);
+    }
+    if (named != nullptr)
+        *named = order.size();
+    std::vector<std::pair<uint64_t, size_t>> rest;
+    for (size_t t = 0; t < tables.size(); t++) {
+        if (taken[t])
+            continue;
+        uint64_t pages = UINT64_MAX; // no root: only the page scan can find its rows
+        if (!tables[t].knownPages.empty())
+            pages = tables[t].knownPages.size();
+        else if (tables[t].rootPage != 0)
+            pages = salvager.estimateTreePages(tables[t].rootPage, tables[t].withoutRowid);
+        rest.emplace_back(pages, t);
+    }
+    std::stable_sort(rest.begin(), rest.end(), [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+        return a.first < b.first;
+    });
+    for (const auto& entry : rest) {
+        order.push_back(entry.second);
+    }
+    return order;
+}
+
+// salvage --jobs: pass 1 on worker threads. Each worker takes the next table of `order`,
+// walks it with its own Salvager and writes the rows into its own shard database next
+// to the output (scratch: no journal, no fsync); the shards are then merged into
+// `writer`, also after a stop (rows of a table cut short come again, and are ignored,
+// when it is walked again). The tables walked to the end go to `completed`, in the order
+// they finished. Row counts and decode failures are added to `total`.
+static bool salvageInShards(const Options& opt,
+                            Context& ctx,
+                            const WCDBRepair::PageFile& file,
+                            const WCDBRepair::SalvageOptions& options,
+                            const std::vector<WCDBRepair::SchemaEntry>& schema,
+                            const std::vector<WCDBRepair::SalvageTable>& tables,
+                            const std::vector<size_t>& order,
+                            const std::string& outputPath,
+                            WCDBRepair::SalvageOutput& writer,
+                            std::vector<size_t>& completed,
+                            WCDBRepair::SalvageStats& total,
+                            uint64_t& failedRows)
+{
+    const size_t workers = std::min(static_cast<size_t>(opt.jobs), order.size());
+    WCDBRepair::Salvager probe(file, options);
+    std::string error;
+    if (!probe.open(error))
+        return false;
+    const uint64_t pageCount = std::max<uint64_t>(1, file.size() / probe.pageSize());
+    std::vector<std::string> shards;
+    for (size_t w = 0; w < workers; w++) {
+        shards.push_back(outputPath + "-shard" + std::to_string(w));
+        removeDatabaseFiles(shards.back());
+    }
+    logState(opt, "SALVAGE_SHARDS", "workers=" + std::to_string(workers) + ",tables=" + std::to_string(order.size()));
+
+    std::atomic<size_t> next(0);
+    std::mutex mutex; // guards total, completed, failedRows, ok and the progress callback
+    bool ok = true;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&, w]() {
+            std::string rawCipherKey; // must outlive shard
+            WCDB::Database shard(shards[w]);
+            applySqlcipherPragmasIfNeeded(shard, opt);
+            applyCipherIfNeeded(shard, opt, ctx.keyCache, rawCipherKey);
+            applyFastAssembleConfig(shard);
+            bool workerOk = true;
+            uint64_t workerFailedRows = 0;
+            {
+                WCDBRepair::SalvageOutput out(shard);
+                std::vector<WCDBRepair::SalvageTable> shardTables;
+                std::vector<std::string> failed;
+                out.createTables(schema, shardTables, failed);
+                // Rows are addressed by table index, so the shard must describe the same list.
+                workerOk = shardTables.size() == tables.size();
+                for (size_t t = 0; workerOk && t < tables.size(); t++) {
+                    workerOk = shardTables[t].name == tables[t].name && shardTables[t].columns == tables[t].columns;
+                }
+                WCDBRepair::SalvageOptions workerOptions = options;
+                workerOptions.progress = nullptr;
+                workerOptions.checkpoint = nullptr;
+                workerOptions.resumeFrom = WCDBRepair::SalvagePosition();
+                WCDBRepair::Salvager salvager(file, workerOptions);
+                std::string openError;
+                workerOk = workerOk && salvager.open(openError);
+                for (size_t i = next++; workerOk && i < order.size(); i = next++) {
+                    WCDBRepair::SalvageStats one;
+                    salvager.run(tables, out, one, std::vector<size_t>(1, order[i]));
+                    std::lock_guard<std::mutex> lock(mutex);
+                    total.walkedPages += one.walkedPages;
+                    total.rows += one.rows;
+                    total.brokenPayloads += one.brokenPayloads;
+                    total.badRecords += one.badRecords;
+                    total.unreadablePages += one.unreadablePages;
+                    if (one.cancelled) {
+                        total.cancelled = true;
+                        break;
+                    }
+                    completed.push_back(order[i]);
+                    if (options.progress)
+                        options.progress(0.5 * static_cast<double>(total.walkedPages) / pageCount);
+                }
+                workerOk = out.commit() && workerOk;
+                workerFailedRows = out.failedRows();
+            }
+            shard.close();
+            std::lock_guard<std::mutex> lock(mutex);
+            ok = ok && workerOk;
+            failedRows += workerFailedRows;
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    if (ok) {
+        logState(opt, "SALVAGE_MERGE", "shards=" + std::to_string(workers));
+        for (const std::string& path : shards) {
+            ok = writer.mergeShard(path) && ok;
+        }
+    }
+    for (const std::string& path : shards) {
+        removeDatabaseFiles(path);
+    }
+    return ok;
+}
+
+// Schema for a salvage: the file's own sqlite_master first (it knows the root pages),
+// then the other sources for tables it lost. False when --schema cannot be read.
+static bool gatherSalvageSchema(const Options& opt,
+                                Context& ctx,
+                                WCDBRepair::Salvager& salvager,
+                                std::vector<WCDBRepair::SchemaEntry>& schema,
+                                WCDBRepair::Material& material)
+{
+    logState(opt, "SALVAGE_SCHEMA");
+    salvager.readSchema(schema);
+    const size_t ownEntries = schema.size();
+    {
+        std::string why;
+        std::vector<unsigned char> dictionary;
+        std::string dictError;
+        if (!opt.materialDict.empty() && !WCDBRepair::loadMaterialDictionary(opt.materialDict, dictionary, dictError))
+            logState(opt, "SALVAGE_MATERIAL_DICT_UNREADABLE", opt.materialDict + ": " + dictError);
+        if (material.load(materialPathOf(opt), salvager.keys(), why, dictionary)) {
+            std::vector<WCDBRepair::SchemaEntry> other;
+            for (const WCDBRepair::MaterialTree& tree : material.trees) {
+                other.push_back(tree.entry);
+            }
+            mergeSchema(schema, other, true);
+            logState(opt, "SALVAGE_MATERIAL", materialPathOf(opt));
+        } else if (why != "missing" || !opt.materialPath.empty()) {
+            logState(opt, "SALVAGE_MATERIAL_UNUSABLE", why);
+        }
+    }
+    if (!opt.schemaFromDb.empty()) {
+        std::vector<WCDBRepair::SchemaEntry> other;
+        if (!readSchemaOf(opt, ctx, opt.schemaFromDb, other)) {
+            logState(opt, "SALVAGE_SCHEMA_FROM_UNREADABLE", opt.schemaFromDb);
+        }
+        mergeSchema(schema, other);
+    }
+    if (!opt.schemaFile.empty()) {
+        std::ifstream in(opt.schemaFile, std::ios::binary);
+        if (!in) {
+            logState(opt, "SALVAGE_SCHEMA_FILE_OPEN_FAILED", opt.schemaFile);
+            return false;
+        }
+        std::string script((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<WCDBRepair::SchemaEntry> other;
+        WCDBRepair::parseSchemaScript(script, other);
+        mergeSchema(schema, other);
+    }
+    logState(opt,
+             "SALVAGE_SCHEMA_DONE",
+             "entries=" + std::to_string(schema.size()) + ",fromFile=" + std::to_string(ownEntries));
+    return true;
+}
+
+// Set when repair drives runSalvage (--budget, --priority-tables, --tables); the RESULT
+// line is then left to the caller.
+struct SalvageScope {
+    // --budget: stop at `end` and still finish the output, instead of checkpointing it.
+    bool hasEnd = false;
+    std::chrono::steady_clock::time_point end;
+    // Walk only the --priority-tables, then finish the output without triggers and leave
+    // a checkpoint from which a --resume run salvages the rest.
+    bool priorityOnly = false;
+    // Another connection may write to the output: wait this long for its write lock.
+    std::chrono::milliseconds busyTimeout{ 0 };
+    // Called with the progress fraction; the caller reports it.
+    std::function<void(double)> progress;
+
+    const char* stopped = nullptr; // out: signal/deadline, output checkpointed
+    bool reached = false;          // out: stopped by `end` before the end of the file
+    double coverage = 0;           // out: share of the file read
+    uint64_t rows = 0;             // out
+};
+
+static int runSalvage(const Options& opt, Context& ctx, SalvageScope* scope = nullptr)
+{
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, head, sizeof(head))) {
+        logState(opt, "SALVAGE_OPEN_FAILED", opt.dbPath);
+        if (scope == nullptr)
+            printResult(opt, "salvage ok=false");
+        return 1;
+    }
+    WCDBRepair::SalvageOptions options;
+    options.pageSize = static_cast<uint32_t>(opt.cipherPageSize);
+    WCDBRepair::CipherKeys keys;
+    if (opt.hasKey) {
+        logState(opt, "SQLCIPHER_KEY_SETUP");
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail)) {
+            logState(opt, ("SALVAGE_" + why).c_str(), detail);
+            return 2;
+        }
+        options.keys = &keys;
+    }
+    WCDBRepair::ProgressReporter progress("salvage", opt.dbPath, opt.showProgress, opt.progressJson);
+    routeProgress(progress, opt);
+    double scanned = 0;
+    options.progress = [&](double fraction) {
+        scanned = fraction;
+        progress.update(fraction);
+        if (scope != nullptr && scope->progress)
+            scope->progress(fraction);
+    };
+    const bool finishOnStop = scope != nullptr && scope->hasEnd;
+    options.cancelled = [&ctx, scope, finishOnStop]() {
+        return stopReason(ctx) != nullptr || (finishOnStop && std::chrono::steady_clock::now() >= scope->end);
+    };
+    std::function<void(const WCDBRepair::SalvagePosition&)> onCheckpoint; // set once the output is open
+    options.checkpoint = [&onCheckpoint](const WCDBRepair::SalvagePosition& position) {
+        if (onCheckpoint)
+            onCheckpoint(position);
+    };
+
+    const std::string outputPath = opt.salvageOutput.empty() ? opt.dbPath + "-salvage.db" : opt.salvageOutput;
+    const std::string checkpointPath = outputPath + "-checkpoint";
+    WCDBRepair::SalvageCheckpoint resumed;
+    if (opt.resume) {
+        if (!WCDBRepair::loadSalvageCheckpoint(checkpointPath, resumed)) {
+            logState(opt, "SALVAGE_RESUME_NO_CHECKPOINT", checkpointPath);
+            return 2;
+        }
+        if (resumed.sourceSize != file.size()) {
+            logState(opt, "SALVAGE_RESUME_SOURCE_CHANGED", opt.dbPath);
+            return 2;
+        }
+        options.resumeFrom = resumed.position;
+        logState(opt,
+                 "SALVAGE_RESUME",
+                 "walkedTables=" + std::to_string(resumed.position.walkedTables)
+                 + ",scanPage=" + std::to_string(resumed.position.scanPage));
+    }
+
+    WCDBRepair::Salvager salvager(file, options);
+    std::string error;
+    if (!salvager.open(error)) {
+        logState(opt, "SALVAGE_OPEN_FAILED", error);
+        if (scope == nullptr)
+            printResult(opt, "salvage ok=false");
+        return 1;
+    }
+
+    std::vector<WCDBRepair::SchemaEntry> schema;
+    WCDBRepair::Material material;
+    if (!gatherSalvageSchema(opt, ctx, salvager, schema, material))
+        return 2;
+
+    {
+        WCDBRepair::PageFile existing;
+        const bool exists = existing.open(outputPath);
+        if (exists && !opt.resume) {
+            WCDBRepair::SalvageCheckpoint unused;
+            const bool resumable = WCDBRepair::loadSalvageCheckpoint(checkpointPath, unused);
+            logState(opt, "SALVAGE_OUTPUT_EXISTS", resumable ? outputPath + " (interrupted; use --resume)" : outputPath);
+            return 2;
+        }
+        if (!exists && opt.resume) {
+            logState(opt, "SALVAGE_RESUME_NO_OUTPUT", outputPath);
+            return 2;
+        }
+    }
+    std::string rawCipherKey; // declared before output: must outlive it
+    WCDB::Database output(outputPath);
+    enableSqlTraceIfNeeded(output, opt, ctx.traceSink);
+    applySqlcipherPragmasIfNeeded(output, opt);
+    applyCipherIfNeeded(output, opt, ctx.keyCache, rawCipherKey);
+    applyIndexBuildConfig(output, opt);
+
+    WCDBRepair::SalvageStats stats;
+    std::vector<std::string> failedSchema;
+    uint64_t failedRows = 0;
+    uint64_t shardFailedRows = 0;
+    size_t tableCount = 0;
+    bool ok = false;
+    const char* stopped = nullptr;
+    {
+        WCDBRepair::SalvageOutput writer(output);
+        if (scope != nullptr)
+            writer.setBusyTimeout(scope->busyTimeout);
+        std::vector<WCDBRepair::SalvageTable> tables;
+        writer.createTables(schema, tables, failedSchema, opt.resume);
+        tableCount = tables.size();
+        std::vector<std::string> tableNames;
+        for (const WCDBRepair::SalvageTable& table : tables) {
+            tableNames.push_back(table.name);
+        }
+        if (opt.resume && tableNames != resumed.tables) {
+            // Positions count tables; they only mean the same thing for the same table list.
+            logState(opt, "SALVAGE_RESUME_SCHEMA_CHANGED", "resume with the same schema sources");
+            return 2;
+        }
+        for (WCDBRepair::SalvageTable& table : tables) {
+            for (const WCDBRepair::MaterialTree& tree : material.trees) {
+                if (tree.entry.type == "table" && tree.entry.name == table.name)
+                    table.knownPages = tree.pages;
+            }
+        }
+        if (tables.empty()) {
+            logState(opt, "SALVAGE_NO_SCHEMA", "use --schema or --schema-from");
+        }
+        std::vector<size_t> walkOrder;
+        std::vector<size_t> walkNow; // what this run walks: the priority tables or all
+        if (opt.resume) {
+            walkOrder = resumed.walkOrder;
+        } else if (scope != nullptr || !opt.priorityTables.empty()) {
+            size_t named = 0;
+            walkOrder = priorityWalkOrder(opt, tables, salvager, &named);
+            if (scope != nullptr && scope->priorityOnly) {
+                walkNow.assign(walkOrder.begin(), walkOrder.begin() + named);
+                if (walkNow.empty()) {
+                    logState(opt, "SALVAGE_NO_PRIORITY_TABLES");
+                    return 2;
+                }
+            }
+        }
+        if (walkNow.empty())
+            walkNow = walkOrder;
+        for (size_t t = walkNow.size(); walkOrder.empty() && t < tables.size(); t++) {
+            walkNow.push_back(t); // list order
+        }
+
+        logState(opt, "SALVAGE_START", "output=" + outputPath);
+        progress.setTotals(file.size() / salvager.pageSize(), salvager.pageSize());
+        progress.setOutputPath(outputPath);
+        progress.setPhase("scan");
+        ProgressSink counted(tables, writer, progress, scanned);
+        WCDBRepair::SalvageSink& sink = progress.json() ? static_cast<WCDBRepair::SalvageSink&>(counted) : writer;
+        std::unique_ptr<WCDBRepair::RowidSorter> sorter;
+        if (opt.sortMemoryMb > 0) {
+            sorter.reset(new WCDBRepair::RowidSorter(
+            tables, sink, static_cast<size_t>(opt.sortMemoryMb) << 20, outputPath + "-sort"));
+        }
+
+        // A checkpoint flushes the sorter (the sort order restarts there) and commits, so
+        // every row before the recorded position is in the output.
+        WCDBRepair::SalvagePosition safe = options.resumeFrom;
+        auto lastCheckpoint = std::chrono::steady_clock::now();
+        auto saveCheckpoint = [&]() {
+            WCDBRepair::SalvageCheckpoint checkpoint;
+            checkpoint.sourceSize = file.size();
+            checkpoint.tables = tableNames;
+            checkpoint.walkOrder = walkOrder;
+            checkpoint.position = safe;
+            const bool saved = (!sorter || sorter->finish()) && writer.commit()
+                               && WCDBRepair::saveSalvageCheckpoint(checkpointPath, checkpoint);
+            logState(opt,
+                     saved ? "SALVAGE_CHECKPOINT" : "SALVAGE_CHECKPOINT_FAILED",
+                     "walkedTables=" + std::to_string(safe.walkedTables) + ",scanPage=" + std::to_string(safe.scanPage));
+        };
+        if (!finishOnStop)
+            onCheckpoint = [&](const WCDBRepair::SalvagePosition& position) {
+                safe = position;
+                const auto now = std::chrono::steady_clock::now();
+                if (now - lastCheckpoint >= std::chrono::seconds(opt.checkpointIntervalSeconds)) {
+                    lastCheckpoint = now;
+                    saveCheckpoint();
+                }
+            };
+
+        WCDBRepair::SalvageSink& target = sorter ? static_cast<WCDBRepair::SalvageSink&>(*sorter) : sink;
+        const size_t walkFrom = options.resumeFrom.scanPage == 0 ? options.resumeFrom.walkedTables : walkNow.size();
+        // The walk and the orphan scan read the file; sorting and indexing below do not.
+        IoSlot io(ctx);
+        if (opt.jobs > 1 && walkNow.size() - std::min(walkFrom, walkNow.size()) > 1) {
+            // Pass 1 in shards; the orphan scan then replays the walks (to know their pages)
+            // without emitting their rows again.
+            const std::vector<size_t> shardOrder(walkNow.begin() + walkFrom, walkNow.end());
+            WCDBRepair::SalvageStats walked;
+            std::vector<size_t> completed;
+            ok = salvageInShards(
+            opt, ctx, file, options, schema, tables, shardOrder, outputPath, writer, completed, walked, shardFailedRows);
+            if (ok && walked.cancelled) {
+                // Positions count a prefix of the walk order: move the tables that were
+                // walked to the end up front, so a resume does not walk them again.
+                std::vector<size_t> reordered(walkNow.begin(), walkNow.begin() + walkFrom);
+                reordered.insert(reordered.end(), completed.begin(), completed.end());
+                for (size_t t : shardOrder) {
+                    if (std::find(completed.begin(), completed.end(), t) == completed.end())
+                        reordered.push_back(t);
+                }
+                if (walkOrder.size() > walkNow.size())
+                    reordered.insert(reordered.end(), walkOrder.begin() + walkNow.size(), walkOrder.end());
+                walkOrder = reordered;
+                walkNow.assign(reordered.begin(), reordered.begin() + walkNow.size());
+                safe.walkedTables = walkFrom + completed.size();
+                safe.scanPage = 0;
+            }
+            if (walked.cancelled || !ok || walkNow.size() < tables.size()) {
+                stats = walked;
+                stats.pageCount = static_cast<uint32_t>(file.size() / salvager.pageSize());
+            } else {
+                safe.walkedTables = walkNow.size();
+                safe.scanPage = 0;
+                WCDBRepair::SalvageOptions scanOptions = options;
+                scanOptions.resumeFrom = safe;
+                WCDBRepair::Salvager scanner(file, scanOptions);
+                std::string error;
+                ok = scanner.open(error) && scanner.run(tables, target, stats, walkNow);
+                stats.rows += walked.rows;
+                stats.brokenPayloads += walked.brokenPayloads;
+                stats.badRecords += walked.badRecords;
+            }
+        } else {
+            ok = salvager.run(tables, target, stats, walkNow);
+        }
+        io.release();
+        onCheckpoint = nullptr;
+        if (stats.cancelled && !finishOnStop) {
+            stopped = stopReason(ctx);
+            if (stopped == nullptr)
+                stopped = "signal";
+            saveCheckpoint();
+        } else {
+            if (stats.cancelled) {
+                // Out of budget: what was read so far still makes a complete database.
+                scope->reached = true;
+                logState(opt, "SALVAGE_BUDGET_REACHED", "rows=" + std::to_string(stats.rows));
+                ok = true;
+            }
+            if (sorter) {
+                logState(opt,
+                         "SALVAGE_SORT",
+                         "runs=" + std::to_string(sorter->runs())
+                         + ",spilledBytes=" + std::to_string(sorter->spilledBytes()));
+                progress.setPhase("assemble");
+                ok = sorter->finish() && ok;
+            }
+            progress.setPhase("index");
+            const bool priorityOnly = scope != nullptr && scope->priorityOnly;
+            if (priorityOnly) {
+                // Triggers would fire on the rows the resumed run adds, and indexes on the tables
+                // it fills would be kept up row by row: both come with the rest.
+                std::vector<std::string> filled;
+                for (size_t t : walkNow)
+                    filled.push_back(tables[t].name);
+                ok = writer.finish(schema, failedSchema, false, &filled) && ok;
+            } else {
+                ok = writer.finish(schema, failedSchema) && ok;
+            }
+            if (priorityOnly) {
+                saveCheckpoint();
+            } else {
+                WCDBRepair::removeSalvageCheckpoint(checkpointPath);
+            }
+        }
+        const bool complete = !stats.cancelled;
+        progress.finish(complete ? 1.0 : scanned, stopped != nullptr ? "cancelled" : "done");
+        failedRows = writer.failedRows() + shardFailedRows;
+        if (scope != nullptr) {
+            // Progress is the tree walks up to 0.5, then the page scan in file order.
+            const double walked = stats.pageCount > 0 ? static_cast<double>(stats.walkedPages) / stats.pageCount : 0;
+            if (scope->priorityOnly)
+                scope->coverage = walked;
+            else
+                scope->coverage = complete ? 1.0 : scanned < 0.5 ? walked : std::max(walked, 2 * (scanned - 0.5));
+            scope->rows = stats.rows;
+            scope->stopped = stopped;
+        }
+    }
+    output.close();
+    if (stopped != nullptr) {
+        logState(opt, "SALVAGE_CANCELLED", stopped);
+        if (scope != nullptr)
+            return 1;
+        printResult(opt,
+                    std::string("salvage ok=false cancelled=true reason=") + stopped
+                    + " rows=" + std::to_string(stats.rows) + " checkpoint=" + checkpointPath);
+        return 1;
+    }
+    logState(opt, "SALVAGE_DONE");
+    for (const std::string& name : failedSchema) {
+        logState(opt, "SALVAGE_DDL_FAILED", name);
+    }
+    if (scope != nullptr)
+        return ok ? 0 : 1;
+
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "salvage ok=%s rows=%llu tables=%zu pages=%u walkedPages=%llu knownLeafPages=%llu orphanLeafPages=%llu "
+                  "ambiguousPages=%llu unmatchedPages=%llu unreadablePages=%llu brokenPayloads=%llu "
+                  "badRecords=%llu failedRows=%llu",
+                  ok ? "true" : "false",
+                  static_cast<unsigned long long>(stats.rows),
+                  tableCount,
+                  stats.pageCount,
+                  static_cast<unsigned long long>(stats.walkedPages),
+                  static_cast<unsigned long long>(stats.knownLeafPages),
+                  static_cast<unsigned long long>(stats.orphanLeafPages),
+                  static_cast<unsigned long long>(stats.ambiguousPages),
+                  static_cast<unsigned long long>(stats.unmatchedPages),
+                  static_cast<unsigned long long>(stats.unreadablePages),
+                  static_cast<unsigned long long>(stats.brokenPayloads),
+                  static_cast<unsigned long long>(stats.badRecords),
+                  static_cast<unsigned long long>(failedRows));
+    printResult(opt, buf);
+    return ok && stats.rows > 0 ? 0 : 1;
+}
+
+// repair/salvage --export: the salvage reader streams rows straight into per-table files,
+// with no database to assemble. retrieve() can only write into a database, so repair
+// exports through the same reader. The DDL goes to <dir>/schema.sql.
+static int runExport(const Options& opt, Context& ctx)
+{
+    const std::string kind = opt.command; // repair or salvage
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, head, sizeof(head))) {
+        logState(opt, "EXPORT_OPEN_FAILED", opt.dbPath);
+        printResult(opt, kind + " ok=false mode=export");
+        return 1;
+    }
+    if (!WCDBRepair::makeDirectory(opt.exportDir)) {
+        logState(opt, "EXPORT_DIR_FAILED", opt.exportDir);
+        return 2;
+    }
+    WCDBRepair::SalvageOptions options;
+    options.pageSize = static_cast<uint32_t>(opt.cipherPageSize);
+    WCDBRepair::CipherKeys keys;
+    if (opt.hasKey) {
+        logState(opt, "SQLCIPHER_KEY_SETUP");
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail)) {
+            logState(opt, ("EXPORT_" + why).c_str(), detail);
+            return 2;
+        }
+        options.keys = &keys;
+    }
+    WCDBRepair::ProgressReporter progress(kind, opt.dbPath, opt.showProgress, opt.progressJson);
+    routeProgress(progress, opt);
+    double scanned = 0;
+    options.progress = [&](double fraction) {
+        scanned = fraction;
+        progress.update(fraction);
+    };
+    options.cancelled = [&ctx]() { return stopReason(ctx) != nullptr; };
+
+    WCDBRepair::Salvager salvager(file, options);
+    std::string error;
+    if (!salvager.open(error)) {
+        logState(opt, "EXPORT_OPEN_FAILED", error);
+        printResult(opt, kind + " ok=false mode=export");
+        return 1;
+    }
+    std::vector<WCDBRepair::SchemaEntry> schema;
+    WCDBRepair::Material material;
+    if (!gatherSalvageSchema(opt, ctx, salvager, schema, material))
+        return 2;
+
+    // Record layouts come from SQLite itself (PRAGMA table_info), in a scratch database.
+    std::vector<WCDBRepair::SalvageTable> tables;
+    std::vector<std::string> failedSchema;
+    {
+        const std::string scratchPath = opt.exportDir + "/.schema.db";
+        removeDatabaseFiles(scratchPath);
+        {
+            WCDB::Database scratch(scratchPath);
+            WCDBRepair::SalvageOutput describer(scratch);
+            describer.createTables(schema, tables, failedSchema);
+            scratch.close();
+        }
+        removeDatabaseFiles(scratchPath);
+    }
+    for (WCDBRepair::SalvageTable& table : tables) {
+        for (const WCDBRepair::MaterialTree& tree : material.trees) {
+            if (tree.entry.type == "table" && tree.entry.name == table.name)
+                table.knownPages = tree.pages;
+        }
+    }
+    for (const std::string& name : failedSchema) {
+        logState(opt, "EXPORT_DDL_FAILED", name);
+    }
+    if (tables.empty()) {
+        logState(opt, "EXPORT_NO_SCHEMA", "use --schema or --schema-from");
+    }
+    {
+        std::ofstream ddl(opt.exportDir + "/schema.sql", std::ios::binary);
+        for (const WCDBRepair::SchemaEntry& entry : schema) {
+            if (!entry.sql.empty())
+                ddl << entry.sql << ";\n";
+        }
+    }
+
+    std::vector<size_t> walkOrder;
+    if (!opt.priorityTables.empty())
+        walkOrder = priorityWalkOrder(opt, tables, salvager);
+
+    logState(opt, "EXPORT_START", std::string("dir=") + opt.exportDir + ",format=" + WCDBRepair::exportFormatName(opt.exportFormat));
+    progress.setTotals(file.size() / salvager.pageSize(), salvager.pageSize());
+    progress.setOutputPath(opt.exportDir);
+    progress.setPhase("scan");
+    WCDBRepair::ExportSink exporter(tables, opt.exportDir, opt.exportFormat);
+    ProgressSink counted(tables, exporter, progress, scanned);
+    WCDBRepair::SalvageSink& sink = progress.json() ? static_cast<WCDBRepair::SalvageSink&>(counted) : exporter;
+    // Always sorted: rows then leave each table file in rowid order, and the sort puts
+    // the copies of a rowid next to each other so that only the first is kept.
+    const size_t sortMemory = static_cast<size_t>(opt.sortMemoryMb > 0 ? opt.sortMemoryMb : 256) << 20;
+    WCDBRepair::RowidSorter sorter(tables, sink, sortMemory, opt.exportDir + "/.sort");
+
+    WCDBRepair::SalvageStats stats;
+    IoSlot io(ctx);
+    bool ok = salvager.run(tables, sorter, stats, walkOrder);
+    io.release();
+    const char* stopped = nullptr;
+    if (stats.cancelled) {
+        stopped = stopReason(ctx);
+        if (stopped == nullptr)
+            stopped = "signal";
+    }
+    // A stopped export still writes out what it has: every file is complete up to there.
+    logState(opt,
+             "EXPORT_SORT",
+             "runs=" + std::to_string(sorter.runs()) + ",spilledBytes=" + std::to_string(sorter.spilledBytes()));
+    progress.setPhase("write");
+    ok = sorter.finish() && ok;
+    ok = exporter.finish() && ok;
+    if (!exporter.error().empty())
+        logState(opt, "EXPORT_WRITE_FAILED", exporter.error());
+    progress.finish(stopped == nullptr ? 1.0 : scanned, stopped != nullptr ? "cancelled" : "done");
+    if (stopped != nullptr)
+        logState(opt, "EXPORT_CANCELLED", stopped);
+    else
+        logState(opt, "EXPORT_DONE");
+
+    // score=: share of the pages that could be read.
+    const double score = stats.pageCount > 0 ? 1.0 - static_cast<double>(stats.unreadablePages) / stats.pageCount : 0;
+    ok = ok && stopped == nullptr && exporter.rows() > 0;
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  " score=%.6f ok=%s mode=export format=%s rows=%llu tables=%zu files=%zu bytes=%llu duplicates=%llu "
+                  "pages=%u unreadablePages=%llu badRecords=%llu",
+                  score,
+                  ok ? "true" : "false",
+                  WCDBRepair::exportFormatName(opt.exportFormat),
+                  static_cast<unsigned long long>(exporter.rows()),
+                  tables.size(),
+                  exporter.files(),
+                  static_cast<unsigned long long>(exporter.bytesWritten()),
+                  static_cast<unsigned long long>(exporter.duplicateRows()),
+                  stats.pageCount,
+                  static_cast<unsigned long long>(stats.unreadablePages),
+                  static_cast<unsigned long long>(stats.badRecords));
+    std::string result = kind + buf;
+    if (stopped != nullptr)
+        result += std::string(" cancelled=true reason=") + stopped;
+    result += " dir=" + opt.exportDir;
+    printResult(opt, result);
+    return ok ? 0 : 1;
+}
+
+// retrieve() reads only the material of Database::backup(). The material of backup
+// --incremental is used when it is named with --material, or when it is newer than all
+// of WCDB's own.
+static bool repairUsesSidecarMaterial(const Options& opt)
+{
+    if (!opt.materialPath.empty())
+        return true;
+    const int64_t sidecar = modifiedTimeOf(materialPathOf(opt));
+    if (sidecar < 0)
+        return false;
+    for (const char* suffix : { "-first.material", "-last.material", "-incremental.material" }) {
+        if (modifiedTimeOf(opt.dbPath + suffix) >= sidecar)
+            return false;
+    }
+    return true;
+}
+
+// repair with backup --incremental material, or repair --resume: salvage into
+// <dbPath>-repair.db (with the material, the b-trees whose interior pages are lost are
+// found through its page lists), deposit the original and put the new file in its place.
+// A stopped run leaves the checkpoint of that salvage, which repair --resume continues.
+static int repairBySalvage(const Options& opt, Context& ctx, WCDB::Database& db, const char* mode)
+{
+    Options salvageOpt = opt;
+    salvageOpt.salvageOutput = opt.dbPath + "-repair.db";
+    const std::string checkpointPath = salvageOpt.salvageOutput + "-checkpoint";
+    WCDBRepair::SalvageCheckpoint checkpoint;
+    salvageOpt.resume = opt.resume && fileExists(salvageOpt.salvageOutput)
+                        && WCDBRepair::loadSalvageCheckpoint(checkpointPath, checkpoint);
+    if (!salvageOpt.resume) {
+        removeDatabaseFiles(salvageOpt.salvageOutput); // left by an earlier run that failed to swap
+        WCDBRepair::removeSalvageCheckpoint(checkpointPath);
+    }
+    if (fileExists(materialPathOf(opt)))
+        salvageOpt.materialPath = materialPathOf(opt);
+
+    logState(opt,
+             salvageOpt.resume ? "REPAIR_RESUME" : "REPAIR_SALVAGE",
+             "output=" + salvageOpt.salvageOutput + ",material="
+             + (salvageOpt.materialPath.empty() ? std::string("none") : salvageOpt.materialPath));
+    SalvageScope scope;
+    if (runSalvage(salvageOpt, ctx, &scope) != 0) {
+        char buf[512];
+        if (scope.stopped != nullptr) {
+            std::snprintf(buf,
+                          sizeof(buf),
+                          "repair score=0.000000 ok=false cancelled=true reason=%s mode=%s checkpoint=%s",
+                          scope.stopped,
+                          mode,
+                          checkpointPath.c_str());
+        } else {
+            logState(opt, "REPAIR_SALVAGE_FAILED", salvageOpt.salvageOutput);
+            std::snprintf(buf, sizeof(buf), "repair score=0.000000 ok=false mode=%s", mode);
+        }
+        printResult(opt, buf);
+        return 1;
+    }
+
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "repair score=0.000000 ok=false mode=%s", mode);
+    logState(opt, "REPAIR_SALVAGE_DEPOSIT");
+    db.close();
+    if (!db.deposit()) {
+        logState(opt, "REPAIR_SALVAGE_DEPOSIT_FAILED", "salvaged copy left at " + salvageOpt.salvageOutput);
+        printResult(opt, buf);
+        return 1;
+    }
+    if (!moveDatabaseFiles(salvageOpt.salvageOutput, opt.dbPath)) {
+        logState(opt, "REPAIR_SALVAGE_SWAP_FAILED", "salvaged copy left at " + salvageOpt.salvageOutput);
+        printResult(opt, buf);
+        return 1;
+    }
+    logState(opt, "REPAIR_DONE");
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "repair score=%.6f ok=true mode=%s rows=%llu",
+                  scope.coverage,
+                  mode,
+                  static_cast<unsigned long long>(scope.rows));
+    printResult(opt, buf);
+    return 0;
+}
+
+// retrieve() keeps the run under --budget while its progress, once there is some, says it
+// will finish in time; without a usable projection it gets half of the budget.
+static constexpr double kRetrieveBudgetShare = 0.5;
+static constexpr double kBudgetProjectionSlack = 0.9; // projected finish must leave this much
+static constexpr double kBudgetIndexShare = 0.1;      // of the budget, kept for indexes and the swap
+
+static bool retrieveFitsBudget(std::chrono::steady_clock::time_point start, int budgetSeconds, double fraction)
+{
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double budget = budgetSeconds;
+    if (elapsed >= kBudgetProjectionSlack * budget)
+        return false;
+    if (fraction < 0.01 || elapsed < 0.05 * budget)
+        return elapsed < kRetrieveBudgetShare * budget;
+    return elapsed / fraction <= kBudgetProjectionSlack * budget;
+}
+
+// repair --budget after retrieve() was abandoned: salvage into a new file with what is
+// left of the budget, deposit the original and put the new file in its place.
+static int repairWithinBudget(const Options& opt,
+                              Context& ctx,
+                              WCDB::Database& db,
+                              std::chrono::steady_clock::time_point budgetEnd)
+{
+    Options salvageOpt = opt;
+    salvageOpt.salvageOutput = opt.dbPath + "-budget.db";
+    salvageOpt.resume = false;
+    salvageOpt.sortMemoryMb = 0; // sorted rows are inserted at the end, where the budget cannot stop them
+    removeDatabaseFiles(salvageOpt.salvageOutput); // left by an earlier run that failed to swap
+    WCDBRepair::removeSalvageCheckpoint(salvageOpt.salvageOutput + "-checkpoint");
+
+    SalvageScope budget;
+    budget.hasEnd = true;
+    const auto reserve = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(std::max(1.0, kBudgetIndexShare * opt.budgetSeconds)));
+    budget.end = budgetEnd - reserve;
+    if (runSalvage(salvageOpt, ctx, &budget) != 0) {
+        logState(opt, "REPAIR_BUDGET_SALVAGE_FAILED", salvageOpt.salvageOutput);
+        printResult(opt, "repair score=0.000000 ok=false budget=true mode=salvage");
+        return 1;
+    }
+
+    // Deposited, the original stays in WCDB's factory: a later full repair merges back
+    // whatever the budget did not cover.
+    logState(opt, "REPAIR_BUDGET_DEPOSIT");
+    db.close();
+    if (!db.deposit()) {
+        logState(opt, "REPAIR_BUDGET_DEPOSIT_FAILED", "salvaged copy left at " + salvageOpt.salvageOutput);
+        printResult(opt, "repair score=0.000000 ok=false budget=true mode=salvage");
+        return 1;
+    }
+    if (!moveDatabaseFiles(salvageOpt.salvageOutput, opt.dbPath)) {
+        logState(opt, "REPAIR_BUDGET_SWAP_FAILED", "salvaged copy left at " + salvageOpt.salvageOutput);
+        printResult(opt, "repair score=0.000000 ok=false budget=true mode=salvage");
+        return 1;
+    }
+    logState(opt, "REPAIR_BUDGET_DONE");
+    char buf[256];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "repair score=%.6f ok=true budget=true mode=salvage rows=%llu complete=%s",
+                  budget.coverage,
+                  static_cast<unsigned long long>(budget.rows),
+                  budget.reached ? "false" : "true");
+    printResult(opt, buf);
+    return 0;
+}
+
+// The background stage of repair --priority-tables waits this long for a write lock the
+// app holds before it gives up; the last checkpoint stays for salvage --resume.
+static constexpr std::chrono::milliseconds kLiveBusyTimeout(30000);
+
+// repair --priority-tables / --tables: salvage the named tables into a new file and put it in
+// place of the DB, then salvage the rest into that same file while the app is using it.
+static int repairPriorityFirst(const Options& opt, Context& ctx, WCDB::Database& db)
+{
+    const std::string original = opt.dbPath + "-original";
+    const std::string staging = opt.dbPath + "-priority.db";
+    if (fileExists(original)) {
+        // The source of an earlier run that did not get through the rest; see the notes.
+        logState(opt, "PRIORITY_ORIGINAL_EXISTS", original);
+        return 2;
+    }
+    removeDatabaseFiles(staging);
+    WCDBRepair::removeSalvageCheckpoint(staging + "-checkpoint");
+
+    Options hotOpt = opt;
+    hotOpt.salvageOutput = staging;
+    SalvageScope hot;
+    hot.priorityOnly = true;
+    if (runSalvage(hotOpt, ctx, &hot) != 0) {
+        logState(opt, hot.stopped != nullptr ? "PRIORITY_CANCELLED" : "PRIORITY_SALVAGE_FAILED", staging);
+        printResult(opt, "repair score=0.000000 ok=false mode=priority ready=false");
+        return 1;
+    }
+
+    db.close();
+    if (!moveDatabaseFiles(opt.dbPath, original)) {
+        logState(opt, "PRIORITY_SWAP_FAILED", original);
+        printResult(opt, "repair score=0.000000 ok=false mode=priority ready=false");
+        return 1;
+    }
+    if (!moveDatabaseFiles(staging, opt.dbPath)) {
+        logState(opt, "PRIORITY_SWAP_FAILED", opt.dbPath);
+        moveDatabaseFiles(original, opt.dbPath);
+        printResult(opt, "repair score=0.000000 ok=false mode=priority ready=false");
+        return 1;
+    }
+    const std::string checkpointPath = opt.dbPath + "-checkpoint";
+    WCDBRepair::removeSalvageCheckpoint(checkpointPath);
+    std::rename((staging + "-checkpoint").c_str(), checkpointPath.c_str());
+    logState(opt, "PRIORITY_READY", opt.dbPath);
+
+    char buf[512];
+    if (opt.tablesOnly) {
+        std::snprintf(buf,
+                      sizeof(buf),
+                      "repair score=%.6f ok=true mode=tables ready=true rows=%llu original=%s",
+                      hot.coverage,
+                      static_cast<unsigned long long>(hot.rows),
+                      original.c_str());
+        printResult(opt, buf);
+        return 0;
+    }
+
+    // The rest, from the original into the file the app now has open, on a worker; this
+    // thread reports its progress as phase "background", also while the worker waits for
+    // the app's write lock. The walk of the priority tables is replayed from the
+    // checkpoint, not emitted again. Contract with the app: see the usage notes.
+    logState(opt, "PRIORITY_BACKGROUND");
+    std::mutex outputMutex; // the worker's lines and this thread's progress, one at a time
+    auto writeSerialized = [&outputMutex, &opt](const std::string& line) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (opt.writer) {
+            opt.writer(line);
+        } else {
+            std::printf("%s\n", line.c_str());
+            std::fflush(stdout);
+        }
+    };
+    Options restOpt = opt;
+    restOpt.dbPath = original;
+    restOpt.salvageOutput = opt.dbPath;
+    restOpt.resume = true;
+    restOpt.showProgress = false;
+    restOpt.progressJson = false;
+    restOpt.progressListener = nullptr;
+    restOpt.writer = writeSerialized;
+    if (fileExists(materialPathOf(opt)))
+        restOpt.materialPath = materialPathOf(opt); // named after the DB, not the original
+    SalvageScope rest;
+    rest.busyTimeout = kLiveBusyTimeout;
+    std::atomic<double> fraction(0);
+    rest.progress = [&fraction](double f) { fraction = f; };
+
+    WCDBRepair::ProgressReporter progress("repair", opt.dbPath, opt.showProgress, opt.progressJson);
+    routeProgress(progress, opt);
+    progress.setWriter(writeSerialized);
+    {
+        WCDBRepair::PageFile file;
+        const uint32_t pageSize = inputPageSize(opt);
+        if (file.open(original) && pageSize > 0)
+            progress.setTotals(file.size() / pageSize, pageSize);
+    }
+    progress.setOutputPath(opt.dbPath);
+    progress.setPhase("background");
+    std::mutex doneMutex;
+    std::condition_variable doneChanged;
+    bool done = false;
+    bool ok = false;
+    std::thread worker([&]() {
+        const bool salvaged = runSalvage(restOpt, ctx, &rest) == 0;
+        std::lock_guard<std::mutex> lock(doneMutex);
+        ok = salvaged;
+        done = true;
+        doneChanged.notify_all();
+    });
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        while (!doneChanged.wait_for(lock, std::chrono::milliseconds(250), [&done] { return done; })) {
+            lock.unlock();
+            progress.update(fraction);
+            lock.lock();
+        }
+    }
+    worker.join();
+    progress.finish(ok ? 1.0 : fraction.load(), rest.stopped != nullptr ? "cancelled" : "done");
+
+    if (rest.stopped != nullptr) {
+        logState(opt, "PRIORITY_BACKGROUND_CANCELLED", rest.stopped);
+    } else if (ok) {
+        logState(opt, "PRIORITY_DONE");
+    } else {
+        logState(opt, "PRIORITY_BACKGROUND_FAILED", opt.dbPath);
+    }
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "repair score=%.6f ok=%s mode=priority ready=true rows=%llu complete=%s original=%s",
+                  rest.coverage,
+                  ok ? "true" : "false",
+                  static_cast<unsigned long long>(hot.rows + rest.rows),
+                  ok ? "true" : "false",
+                  original.c_str());
+    printResult(opt, buf);
+    return ok ? 0 : 1;
+}
+
+static int runEstimate(const Options& opt, Context& ctx)
+{
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, head, sizeof(head))) {
+        logState(opt, "ESTIMATE_OPEN_FAILED", opt.dbPath);
+        printResult(opt, "estimate ok=false");
+        return 1;
+    }
+
+    WCDBRepair::EstimateOptions estimateOptions;
+    estimateOptions.sampleFraction = opt.sampleFraction;
+    estimateOptions.seed = static_cast<uint64_t>(opt.sampleSeed);
+    estimateOptions.threads = opt.jobs;
+    estimateOptions.rowsPerSecond = opt.rowsPerSecond;
+    estimateOptions.pageSize = static_cast<uint32_t>(opt.cipherPageSize);
+    WCDBRepair::CipherKeys keys;
+    if (opt.hasKey) {
+        logState(opt, "SQLCIPHER_KEY_SETUP");
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail)) {
+            logState(opt, ("ESTIMATE_" + why).c_str(), detail);
+            return 2;
+        }
+        estimateOptions.keys = &keys;
+        estimateOptions.pageSize = static_cast<uint32_t>(keys.params.pageSize);
+    }
+
+    logState(opt, "ESTIMATE_START");
+    const auto start = std::chrono::steady_clock::now();
+    WCDBRepair::EstimateResult result;
+    std::string error;
+    IoSlot io(ctx);
+    if (!WCDBRepair::estimateRepair(file, estimateOptions, result, error)) {
+        logState(opt, "ESTIMATE_FAILED", error);
+        printResult(opt, "estimate ok=false");
+        return 1;
+    }
+    const long long elapsedMs = static_cast<long long>(
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    logState(opt, "ESTIMATE_DONE");
+
+    char buf[640];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "estimate ok=true score=%.6f scoreStdErr=%.6f rows=%.0f seconds=%.1f pages=%u pageSize=%u "
+                  "sampledPages=%llu leafPages=%llu interiorPages=%llu overflowPages=%llu freePages=%llu "
+                  "garbagePages=%llu unreadablePages=%llu sampledRows=%llu readUsPerPage=%.2f headerReadable=%s "
+                  "elapsedMs=%lld",
+                  result.score,
+                  result.scoreStdErr,
+                  result.rows,
+                  result.seconds,
+                  result.pageCount,
+                  result.pageSize,
+                  static_cast<unsigned long long>(result.sampledPages),
+                  static_cast<unsigned long long>(result.leafPages),
+                  static_cast<unsigned long long>(result.interiorPages),
+                  static_cast<unsigned long long>(result.overflowPages),
+                  static_cast<unsigned long long>(result.freePages),
+                  static_cast<unsigned long long>(result.garbagePages),
+                  static_cast<unsigned long long>(result.unreadablePages),
+                  static_cast<unsigned long long>(result.sampledRows),
+                  result.readSecondsPerPage * 1e6,
+                  result.headerReadable ? "true" : "false",
+                  elapsedMs);
+    printResult(opt, buf);
+    return 0;
+}
+
+static int runFastCheck(const Options& opt, Context& ctx)
+{
+    WCDBRepair::PageFile file;
+    unsigned char head[WCDBRepair::SaltSize];
+    if (!file.open(opt.dbPath) || !file.readFully(0, head, sizeof(head))) {
+        logState(opt, "CHECK_OPEN_FAILED", opt.dbPath);
+        printResult(opt, "check corrupted=true mode=fast");
+        return 1;
+    }
+
+    WCDBRepair::FastCheckOptions checkOptions;
+    checkOptions.threads = opt.jobs;
+    checkOptions.io = opt.pageRead;
+    WCDBRepair::CipherKeys keys;
+    if (opt.hasKey) {
+        logState(opt, "SQLCIPHER_KEY_SETUP");
+        std::string why;
+        std::string detail;
+        if (!deriveCipherKeys(opt, ctx, head, sizeof(head), keys, why, detail)) {
+            logState(opt, ("CHECK_" + why).c_str(), detail);
+            return 2;
+        }
+        checkOptions.keys = &keys;
+        checkOptions.pageSize = static_cast<uint32_t>(keys.params.pageSize);
+    }
+
+    logState(opt, "CHECK_START", "mode=fast");
+    WCDBRepair::FastCheckResult result;
+    std::string error;
+    IoSlot io(ctx);
+    const bool checked = WCDBRepair::fastCheck(file, checkOptions, result, error);
+    io.release();
+    if (!checked) {
+        logState(opt, "CHECK_FAILED", error);
+        printResult(opt, "check corrupted=true mode=fast");
+        return 1;
+    }
+    logPageRead(opt, "CHECK", result.io);
+
+    // Wrong key/params make every page bad; keep the listing readable.
+    const size_t maxListed = 1000;
+    for (size_t i = 0; i < result.badPages.size() && i < maxListed; i++) {
+        writeLine(opt,
+                  "BAD_PAGE pgno=" + std::to_string(result.badPages[i].pgno) + " reason=" + result.badPages[i].reason);
+    }
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "check corrupted=%s mode=fast pages=%u btreePages=%llu overflowPages=%llu freelistPages=%llu "
+                  "badPages=%zu orphanPages=%llu hmacFailures=%llu schemaReadable=%s",
+                  result.corrupted() ? "true" : "false",
+                  result.pageCount,
+                  static_cast<unsigned long long>(result.btreePages),
+                  static_cast<unsigned long long>(result.overflowPages),
+                  static_cast<unsigned long long>(result.freelistPages),
+                  result.badPages.size(),
+                  static_cast<unsigned long long>(result.orphanPages),
+                  static_cast<unsigned long long>(result.hmacFailures),
+                  result.schemaReadable ? "true" : "false");
+    printResult(opt, buf);
+    return result.corrupted() ? 1 : 0;
+}
+
+} // namespace
+
+namespace WCDBRepair {
+
+int runCommand(const Options& opt, Context& ctx)
+{
+    if (opt.command == "check" && opt.fastCheck) {
+        return runFastCheck(opt, ctx);
+    }
+    if (opt.command == "probe") {
+        return runProbe(opt);
+    }
+    if (opt.command == "verify-hmac") {
+        return runVerifyHmac(opt, ctx);
+    }
+    if (opt.command == "estimate") {
+        return runEstimate(opt, ctx);
+    }
+    if ((opt.command == "repair" || opt.command == "salvage") && !opt.exportDir.empty()) {
+        return runExport(opt, ctx);
+    }
+    if (opt.command == "salvage") {
+        return runSalvage(opt, ctx);
+    }
+    if (opt.command == "backup" && opt.incrementalBackup) {
+        return runIncrementalBackup(opt, ctx);
+    }
+
+    // Declared before db: the trace callback and the cipher key must outlive it.
+    WCDBRepair::ProgressReporter progress("repair", opt.dbPath, opt.showProgress, opt.progressJson);
+    routeProgress(progress, opt);
+    std::string rawCipherKey;
+    WCDB::Database db(opt.dbPath);
+    logState(opt, "DATABASE_CREATED", opt.dbPath);
+
+    // Enable SQL trace early. (Full SQL trace is enabled by default.)
+    logState(opt, "SQL_TRACE_SETUP");
+    enableSqlTraceIfNeeded(db, opt, ctx.traceSink);
+
+    // Apply SQLCipher pragmas first, so they take effect before the key is used.
+    logState(opt, "SQLCIPHER_PRAGMA_SETUP");
+    applySqlcipherPragmasIfNeeded(db, opt);
+    logState(opt, "SQLCIPHER_KEY_SETUP");
+    if (opt.hasKey && !opt.keyPreview.empty()) {
+        logState(opt, "KEY_PREVIEW", opt.keyPreview);
+    }
+    applyCipherIfNeeded(db, opt, ctx.keyCache, rawCipherKey);
+
+    char buf[128];
+
+    if (opt.command == "check") {
+        logState(opt, "CHECK_START");
+        std::unique_ptr<WCDBRepair::CacheGuard> cacheGuard;
+        guardPageCache(opt, "CHECK", cacheGuard);
+        IoSlot io(ctx);
+        bool corrupted = db.checkIfCorrupted();
+        io.release();
+        printResult(opt, std::string("check corrupted=") + (corrupted ? "true" : "false"));
+        return corrupted ? 1 : 0;
+    }
+
+    if (opt.command == "backup") {
+        logState(opt, "BACKUP_START");
+        std::unique_ptr<WCDBRepair::CacheGuard> cacheGuard;
+        guardPageCache(opt, "BACKUP", cacheGuard);
+        IoSlot io(ctx);
+        bool ok = db.backup();
+        io.release();
+        printResult(opt, std::string("backup ok=") + (ok ? "true" : "false"));
+        return ok ? 0 : 1;
+    }
+
+    if (opt.command == "deposit") {
+        logState(opt, "DEPOSIT_START");
+        bool ok = db.deposit();
+        printResult(opt, std::string("deposit ok=") + (ok ? "true" : "false"));
+        return ok ? 0 : 1;
+    }
+
+    if (opt.command == "contains-deposited") {
+        logState(opt, "CONTAINS_DEPOSITED_START");
+        bool yes = db.containsDeposited();
+        printResult(opt, std::string("containsDeposited value=") + (yes ? "true" : "false"));
+        return yes ? 0 : 1;
+    }
+
+    if (opt.command == "remove-deposited") {
+        logState(opt, "REMOVE_DEPOSITED_START");
+        bool ok = db.removeDeposited();
+        printResult(opt, std::string("removeDeposited ok=") + (ok ? "true" : "false"));
+        return ok ? 0 : 1;
+    }
+
+    if (opt.command == "repair") {
+        if (opt.verifyHmacFirst && opt.hasKey) {
+            // Cheap triage: a DB where no page verifies would only yield an empty retrieve.
+            WCDBRepair::HmacVerifyResult verify;
+            std::string why;
+            std::string detail;
+            if (!verifyHmacPass(opt, ctx, verify, why, detail)) {
+                logState(opt, "HMAC_PRECHECK_SKIPPED", detail.empty() ? why : why + ": " + detail);
+            } else {
+                logState(opt,
+                         "HMAC_PRECHECK",
+                         "pages=" + std::to_string(verify.pages) + ",failedPages="
+                         + std::to_string(verify.failedPages.size()));
+                if (verify.pages > 0 && verify.failedPages.size() == verify.pages) {
+                    logState(opt, "HMAC_PRECHECK_KEY_MISMATCH");
+                    printResult(opt, "repair score=0.000000 ok=false");
+                    return 1;
+                }
+            }
+        }
+        std::unique_ptr<WCDBRepair::CacheGuard> cacheGuard;
+        guardPageCache(opt, "REPAIR", cacheGuard);
+        if (opt.resume) {
+            return repairBySalvage(opt, ctx, db, "resume");
+        }
+        if (!opt.priorityTables.empty() && opt.budgetSeconds == 0) {
+            return repairPriorityFirst(opt, ctx, db);
+        }
+        if (opt.budgetSeconds == 0 && repairUsesSidecarMaterial(opt)) {
+            return repairBySalvage(opt, ctx, db, "material");
+        }
+        if (opt.fastAssemble) {
+            logState(opt, "FAST_ASSEMBLE_ENABLED");
+            applyFastAssembleConfig(db);
+        }
+        applyIndexBuildConfig(db, opt);
+        {
+            WCDBRepair::PageFile file;
+            const uint32_t pageSize = inputPageSize(opt);
+            if (file.open(opt.dbPath) && pageSize > 0)
+                progress.setTotals(file.size() / pageSize, pageSize);
+        }
+        // retrieve() writes the rebuilt DB at the original path.
+        progress.setOutputPath(opt.dbPath);
+        progress.setPhase("backup-load");
+        logState(opt, "REPAIR_START");
+        bool retrieving = false;
+        const char* stopped = nullptr;
+        const auto repairStart = std::chrono::steady_clock::now();
+        bool overBudget = false;
+        IoSlot io(ctx);
+        double score = db.retrieve([&](double fraction, double /*increment*/) -> bool {
+            stopped = stopReason(ctx);
+            if (stopped != nullptr)
+                return false; // retrieve() gives up at its next progress report
+            if (opt.budgetSeconds > 0 && !retrieveFitsBudget(repairStart, opt.budgetSeconds, fraction)) {
+                overBudget = true;
+                return false;
+            }
+            if (fraction > 0 && !retrieving) {
+                // retrieve() reports nothing while it loads the backup material.
+                retrieving = true;
+                progress.setPhase("retrieve");
+                logState(opt, "REPAIR_RETRIEVE");
+            }
+            progress.update(fraction);
+            return true;
+        });
+        io.release();
+        if (stopped != nullptr) {
+            progress.finish(0.0, "cancelled");
+            logState(opt, "REPAIR_CANCELLED", stopped);
+            std::snprintf(buf, sizeof(buf), "repair score=%.6f ok=false cancelled=true reason=%s", score, stopped);
+            printResult(opt, buf);
+            return 1;
+        }
+        if (overBudget) {
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - repairStart).count();
+            progress.finish(0.0, "salvage");
+            std::snprintf(buf, sizeof(buf), "elapsedSec=%.1f,budgetSec=%d", elapsed, opt.budgetSeconds);
+            logState(opt, "REPAIR_BUDGET_FALLBACK", buf);
+            return repairWithinBudget(opt, ctx, db, repairStart + std::chrono::seconds(opt.budgetSeconds));
+        }
+        if (score > 0 && progress.json()) {
+            progress.setPhase("count");
+            countTableRows(db, progress);
+        }
+        progress.finish(score > 0 ? 1.0 : 0.0, "done");
+        logState(opt, "REPAIR_DONE");
+        if (opt.fastAssemble && score > 0) {
+            logState(opt, "FAST_ASSEMBLE_SYNC");
+            logState(opt, finishFastAssemble(db) ? "FAST_ASSEMBLE_SYNCED" : "FAST_ASSEMBLE_SYNC_FAILED");
+        }
+        std::snprintf(buf,
+                      sizeof(buf),
+                      "repair score=%.6f ok=%s%s",
+                      score,
+                      score > 0 ? "true" : "false",
+                      opt.budgetSeconds > 0 ? " budget=true mode=retrieve" : "");
+        printResult(opt, buf);
+        return score > 0 ? 0 : 1;
+    }
+
+    return 2;
+}
+
+} // namespace WCDBRepair
+
+namespace {
+
+// Counting semaphore (C++14 has none); bounds how many batch items are in their I/O heavy phase.
+class Semaphore {
+public:
+    explicit Semaphore(int count) : m_count(count) {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return m_count > 0; });
+        m_count--;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_count++;
+        }
+        m_cond.notify_one();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    int m_count;
+};
+
+// Splits a manifest line into whitespace separated tokens; double quotes group a token.
+static bool tokenizeManifestLine(const std::string& line, std::vector<std::string>& out)
+{
+    out.clear();
+    std::string cur;
+    bool inToken = false;
+    bool inQuote = false;
+    for (char c : line) {
+        if (inQuote) {
+            if (c == '"') {
+                inQuote = false;
+            } else {
+                cur.push_back(c);
+            }
+            continue;
+        }
+        if (c == '#')
+            break;
+        if (c == '"') {
+            inQuote = true;
+            inToken = true;
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            if (inToken) {
+                out.push_back(cur);
+                cur.clear();
+                inToken = false;
+            }
+            continue;
+        }
+        cur.push_back(c);
+        inToken = true;
+    }
+    if (inQuote)
+        return false;
+    if (inToken)
+        out.push_back(cur);
+    return true;
+}
+
+struct BatchItem {
+    int line = 0;
+    Options opt;
+};
+
+static bool loadManifest(const Options& opt, std::vector<BatchItem>& items)
+{
+    std::ifstream in(opt.dbPath);
+    if (!in) {
+        logState("BATCH_MANIFEST_OPEN_FAILED", opt.dbPath);
+        return false;
+    }
+    std::string line;
+    std::vector<std::string> tokens;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (!tokenizeManifestLine(line, tokens)) {
+            logState("BATCH_MANIFEST_BAD_LINE", std::to_string(lineNo));
+            return false;
+        }
+        if (tokens.empty())
+            continue;
+
+        // Re-use the regular parser: global options first, per-line options override them.
+        std::vector<std::string> args;
+        args.reserve(3 + opt.rawOptions.size() + tokens.size());
+        args.push_back("wcdb-repair");
+        args.push_back(opt.batchCommand);
+        args.push_back(tokens[0]);
+        args.insert(args.end(), opt.rawOptions.begin(), opt.rawOptions.end());
+        args.insert(args.end(), tokens.begin() + 1, tokens.end());
+
+        BatchItem item;
+        item.line = lineNo;
+        if (!parseArgs(args, item.opt)) {
+            logState("BATCH_MANIFEST_BAD_LINE", std::to_string(lineNo));
+            return false;
+        }
+        item.opt.batchItem = true;
+        item.opt.timing = opt.timing;
+        item.opt.timeline = opt.timeline;
+        item.opt.timelineTrack = lineNo;
+        // Interleaved PROGRESS= lines from many DBs are meaningless; results are per DB.
+        item.opt.showProgress = false;
+        items.push_back(std::move(item));
+    }
+    return true;
+}
+
+static int runBatch(const Options& opt, Context& ctx)
+{
+    std::vector<BatchItem> items;
+    if (!loadManifest(opt, items)) {
+        return 2;
+    }
+
+    int jobs = opt.jobs;
+    if (jobs <= 0) {
+        jobs = static_cast<int>(std::thread::hardware_concurrency());
+        if (jobs <= 0)
+            jobs = 1;
+    }
+    if (static_cast<size_t>(jobs) > items.size())
+        jobs = static_cast<int>(items.size());
+    const int ioSlots = opt.ioSlots > 0 ? opt.ioSlots : jobs;
+
+    logState(opt,
+             "BATCH_START",
+             "items=" + std::to_string(items.size()) + ",jobs=" + std::to_string(jobs)
+             + ",ioSlots=" + std::to_string(ioSlots));
+
+    // Items hold a slot only for their I/O heavy phase; key derivation, sorting,
+    // indexing and the like run on all --jobs workers.
+    Semaphore ioSemaphore(ioSlots);
+    Context itemCtx = ctx;
+    itemCtx.acquireIo = [&]() { ioSemaphore.acquire(); };
+    itemCtx.releaseIo = [&]() { ioSemaphore.release(); };
+    std::atomic<size_t> next(0);
+    std::atomic<int> succeeded(0);
+    std::atomic<int> failed(0);
+    std::atomic<int> skipped(0);
+    std::vector<std::thread> workers;
+    workers.reserve(static_cast<size_t>(jobs));
+    for (int w = 0; w < jobs; w++) {
+        workers.emplace_back([&]() {
+            for (;;) {
+                const size_t idx = next.fetch_add(1);
+                if (idx >= items.size())
+                    return;
+                if (stopReason(ctx) != nullptr) {
+                    skipped++;
+                    continue;
+                }
+                const int rc = runCommand(items[idx].opt, itemCtx);
+                (rc == 0 ? succeeded : failed)++;
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    logState(opt, "BATCH_DONE");
+    char buf[256];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "batch command=%s total=%zu succeeded=%d failed=%d skipped=%d",
+                  opt.batchCommand.c_str(),
+                  items.size(),
+                  succeeded.load(),
+                  failed.load(),
+                  skipped.load());
+    printResult(opt, buf);
+    return failed.load() == 0 && skipped.load() == 0 ? 0 : 1;
+}
+
+// ---- serve: local-socket job daemon ----
+
+static constexpr int kServePollMs = 200; // how often idle threads look at stopReason()
+
+struct ServeClient;
+
+struct ServeJob {
+    std::string id;
+    int priority = 0;
+    uint64_t seq = 0;
+    Options opt;
+    std::shared_ptr<ServeClient> client;
+    std::atomic<bool> cancelled{ false };
+    bool holdsPath = false; // guarded by the queue
+};
+
+// One connection. Its reader thread handles the requests; workers running its jobs
+// write events, one whole frame at a time under the lock.
+struct ServeClient {
+    WCDBRepair::LocalSocket socket;
+    std::mutex mutex; // socket writes, `connected` and `jobs`
+    bool connected = true;
+    std::map<std::string, std::shared_ptr<ServeJob>> jobs; // queued or running, by request id
+
+    void send(const std::string& event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // A client that went away does not stop its jobs; their events are dropped.
+        if (connected && !WCDBRepair::writeFrame(socket, event))
+            connected = false;
+    }
+};
+
+static std::string serveEvent(const std::string& id, const char* event, const std::string& fields = std::string())
+{
+    return "{\"id\":" + WCDBRepair::jsonQuote(id) + ",\"event\":\"" + event + "\"" + fields + "}";
+}
+
+// Jobs waiting for a worker: highest priority first, then in arrival order. Jobs on the
+// same database never run at the same time; a later one waits until the path is free.
+class ServeQueue {
+public:
+    bool push(const std::shared_ptr<ServeJob>& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closed)
+                return false;
+            m_waiting.push_back(job);
+        }
+        m_cond.notify_one();
+        return true;
+    }
+
+    // Blocks for the next runnable job; nullptr once closed and drained. After close()
+    // the rest come out regardless of their path, to be answered as cancelled.
+    std::shared_ptr<ServeJob> pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            size_t best = m_waiting.size();
+            for (size_t i = 0; i < m_waiting.size(); i++) {
+                const ServeJob& job = *m_waiting[i];
+                if (!m_closed && m_busyPaths.count(job.opt.dbPath) > 0)
+                    continue;
+                if (best == m_waiting.size() || job.priority > m_waiting[best]->priority
+                    || (job.priority == m_waiting[best]->priority && job.seq < m_waiting[best]->seq))
+                    best = i;
+            }
+            if (best < m_waiting.size()) {
+                std::shared_ptr<ServeJob> job = m_waiting[best];
+                m_waiting.erase(m_waiting.begin() + static_cast<std::ptrdiff_t>(best));
+                if (!m_closed) {
+                    m_busyPaths.insert(job->opt.dbPath);
+                    job->holdsPath = true;
+                }
+                return job;
+            }
+            if (m_closed)
+                return nullptr;
+            m_cond.wait(lock);
+        }
+    }
+
+    void done(ServeJob& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!job.holdsPath)
+                return;
+            m_busyPaths.erase(job.opt.dbPath);
+            job.holdsPath = false;
+        }
+        m_cond.notify_all();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_cond.notify_all();
+    }
+
+    size_t waiting() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_waiting.size();
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<std::shared_ptr<ServeJob>> m_waiting;
+    std::set<std::string> m_busyPaths;
+    bool m_closed = false;
+};
+
+struct ServeStats {
+    std::atomic<uint64_t> connections{ 0 };
+    std::atomic<uint64_t> jobs{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+    std::atomic<uint64_t> cancelled{ 0 };
+};
+
+// Output lines of a job become events: PROGRESS_JSON= objects are passed through as
+// "data", every other line is sent as is.
+static void routeJobOutput(ServeJob& job)
+{
+    std::shared_ptr<ServeClient> client = job.client;
+    const std::string id = job.id;
+    job.opt.writer = [client, id](const std::string& line) {
+        static const char kProgressJson[] = "PROGRESS_JSON=";
+        const size_t prefix = sizeof(kProgressJson) - 1;
+        if (line.compare(0, prefix, kProgressJson) == 0) {
+            client->send(serveEvent(id, "progress", ",\"data\":" + line.substr(prefix)));
+            return;
+        }
+        const char* event = line.compare(0, 6, "STATE=") == 0    ? "state"
+                            : line.compare(0, 7, "RESULT=") == 0 ? "result"
+                                                                 : "output";
+        client->send(serveEvent(id, event, ",\"line\":" + WCDBRepair::jsonQuote(line)));
+    };
+}
+
+static void runServeJob(ServeJob& job, const Context& ctx, ServeStats& stats)
+{
+    int rc = 1;
+    bool cancelled = job.cancelled.load() || stopReason(ctx) != nullptr;
+    if (!cancelled) {
+        job.client->send(serveEvent(job.id, "started"));
+        Context jobCtx = ctx;
+        jobCtx.cancelled = [&job]() { return job.cancelled.load(); };
+        if (job.opt.deadlineSeconds > 0) {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(job.opt.deadlineSeconds);
+            if (!jobCtx.hasDeadline || deadline < jobCtx.deadline)
+                jobCtx.deadline = deadline;
+            jobCtx.hasDeadline = true;
+        }
+        rc = runCommand(job.opt, jobCtx);
+        // A job that finished before it saw the stop still counts as done.
+        cancelled = rc != 0 && stopReason(jobCtx) != nullptr;
+    }
+    stats.jobs++;
+    if (cancelled) {
+        stats.cancelled++;
+    } else if (rc != 0) {
+        stats.failed++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(job.client->mutex);
+        job.client->jobs.erase(job.id);
+    }
+    job.client->send(serveEvent(job.id,
+                                "done",
+                                ",\"exitCode\":" + std::to_string(rc) + ",\"cancelled\":" + (cancelled ? "true" : "false")));
+}
+
+// Turns a request into a job: the serve command line's options first, then the request's
+// own args, through the regular parser.
+static bool makeServeJob(const Options& opt,
+                         const WCDBRepair::JobRequest& request,
+                         uint64_t seq,
+                         ServeJob& job,
+                         std::string& why)
+{
+    if (request.command == "batch" || request.command == "serve" || request.command == "help") {
+        why = "unsupported-command";
+        return false;
+    }
+    if (request.path.empty()) {
+        why = "missing-path";
+        return false;
+    }
+    std::vector<std::string> args;
+    args.reserve(3 + opt.rawOptions.size() + request.args.size());
+    args.push_back("wcdb-repair");
+    args.push_back(request.command);
+    args.push_back(request.path);
+    args.insert(args.end(), opt.rawOptions.begin(), opt.rawOptions.end());
+    args.insert(args.end(), request.args.begin(), request.args.end());
+    if (!parseArgs(args, job.opt)) {
+        why = "bad-args";
+        return false;
+    }
+    job.id = request.id;
+    job.priority = request.priority;
+    job.seq = seq;
+    job.opt.timing = opt.timing;
+    job.opt.timeline = opt.timeline;
+    job.opt.timelineTrack = static_cast<int>(seq);
+    // Progress events only for jobs that ask (it costs a sink per row in salvage); the
+    // plain fraction would only repeat them.
+    job.opt.showProgress = false;
+    job.opt.progressJson = job.opt.progressJson || request.progress;
+    // Warm state: the daemon's key cache derives each key once for all later jobs.
+    job.opt.kdfCache = true;
+    return true;
+}
+
+static void serveClient(const std::shared_ptr<ServeClient>& client,
+                        const Options& opt,
+                        const Context& ctx,
+                        ServeQueue& queue,
+                        std::atomic<uint64_t>& seq)
+{
+    std::string payload;
+    while (stopReason(ctx) == nullptr) {
+        if (!client->socket.waitReadable(kServePollMs))
+            continue;
+        if (!WCDBRepair::readFrame(client->socket, payload))
+            break; // disconnected, or a frame over the limit
+        WCDBRepair::JobRequest request;
+        std::string why;
+        if (!WCDBRepair::parseJobRequest(payload, request, why)) {
+            client->send(serveEvent(request.id, "error", ",\"message\":" + WCDBRepair::jsonQuote(why)));
+            continue;
+        }
+
+        if (request.command == "cancel") {
+            std::shared_ptr<ServeJob> target;
+            {
+                std::lock_guard<std::mutex> lock(client->mutex);
+                auto it = client->jobs.find(request.target);
+                if (it != client->jobs.end())
+                    target = it->second;
+            }
+            if (!target) {
+                client->send(serveEvent(request.id, "error", ",\"message\":\"unknown-job\""));
+                continue;
+            }
+            // Queued: answered when a worker takes it. Running: stops at its next safe point.
+            target->cancelled.store(true);
+            client->send(serveEvent(request.id, "cancelling", ",\"target\":" + WCDBRepair::jsonQuote(request.target)));
+            continue;
+        }
+
+        std::shared_ptr<ServeJob> job = std::make_shared<ServeJob>();
+        if (!makeServeJob(opt, request, seq.fetch_add(1) + 1, *job, why)) {
+            client->send(serveEvent(request.id, "error", ",\"message\":" + WCDBRepair::jsonQuote(why)));
+            continue;
+        }
+        job->client = client;
+        routeJobOutput(*job);
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            if (!client->jobs.emplace(job->id, job).second)
+                why = "duplicate-id";
+        }
+        if (!why.empty()) {
+            client->send(serveEvent(request.id, "error", ",\"message\":" + WCDBRepair::jsonQuote(why)));
+            continue;
+        }
+        // Sent before the push so that "started" cannot overtake it.
+        client->send(serveEvent(job->id,
+                                "queued",
+                                ",\"priority\":" + std::to_string(job->priority)
+                                + ",\"waiting\":" + std::to_string(queue.waiting())));
+        if (!queue.push(job)) {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            client->jobs.erase(job->id);
+        }
+    }
+}
+
+static int runServe(const Options& opt, Context& ctx)
+{
+    WCDBRepair::LocalSocket listener;
+    std::string why;
+    if (!listener.listen(opt.dbPath, why)) {
+        logState(opt, "SERVE_LISTEN_FAILED", why);
+        return 1;
+    }
+
+    int workers = opt.jobs;
+    if (workers <= 0) {
+        workers = static_cast<int>(std::thread::hardware_concurrency());
+        if (workers <= 0)
+            workers = 1;
+    }
+    logState(opt, "SERVE_LISTENING", "socket=" + opt.dbPath + ",workers=" + std::to_string(workers));
+
+    ServeQueue queue;
+    ServeStats stats;
+    std::atomic<uint64_t> seq(0);
+    std::vector<std::thread> pool;
+    pool.reserve(static_cast<size_t>(workers));
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            while (std::shared_ptr<ServeJob> job = queue.pop()) {
+                runServeJob(*job, ctx, stats);
+                queue.done(*job);
+            }
+        });
+    }
+
+    struct Reader {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+    std::vector<Reader> readers;
+    const char* stopped = nullptr;
+    while ((stopped = stopReason(ctx)) == nullptr) {
+        std::shared_ptr<ServeClient> client = std::make_shared<ServeClient>();
+        if (listener.accept(kServePollMs, client->socket)) {
+            stats.connections++;
+            Reader reader;
+            reader.finished = std::make_shared<std::atomic<bool>>(false);
+            std::shared_ptr<std::atomic<bool>> finished = reader.finished;
+            reader.thread = std::thread([client, finished, &opt, &ctx, &queue, &seq]() {
+                serveClient(client, opt, ctx, queue, seq);
+                finished->store(true);
+            });
+            readers.push_back(std::move(reader));
+        }
+        // Join the readers of clients that left.
+        for (size_t i = 0; i < readers.size();) {
+            if (readers[i].finished->load()) {
+                readers[i].thread.join();
+                readers.erase(readers.begin() + static_cast<std::ptrdiff_t>(i));
+            } else {
+                i++;
+            }
+        }
+    }
+
+    // Stop taking work, let running jobs reach their stop point and answer the rest.
+    logState(opt, "SERVE_STOPPING", stopped);
+    listener.close();
+    queue.close();
+    for (auto& t : pool) {
+        t.join();
+    }
+    for (auto& reader : readers) {
+        reader.thread.join();
+    }
+
+    char buf[256];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  "serve connections=%llu jobs=%llu failed=%llu cancelled=%llu reason=%s",
+                  static_cast<unsigned long long>(stats.connections.load()),
+                  static_cast<unsigned long long>(stats.jobs.load()),
+                  static_cast<unsigned long long>(stats.failed.load()),
+                  static_cast<unsigned long long>(stats.cancelled.load()),
+                  stopped);
+    logState(opt, "SERVE_STOPPED");
+    printResult(opt, buf);
+    return 0;
+}
+
+static int run(const std::vector<std::string>& argv)
+{
+    Options opt;
+    if (!parseArgs(argv, opt) || opt.command.empty()) {
+        printUsage();
+        return 2;
+    }
+
+    if (opt.command == "help") {
+        printUsage();
+        return 0;
+    }
+
+    std::unique_ptr<WCDBRepair::PhaseTimeline> timeline;
+    if (opt.timing || !opt.traceEventsPath.empty()) {
+        timeline.reset(new WCDBRepair::PhaseTimeline());
+        opt.timeline = timeline.get();
+    }
+
+    logState(opt, "INIT");
+    logState(opt, "GLOBAL_ERROR_TRACE_SETUP");
+    enableGlobalErrorTraceIfNeeded(opt);
+
+    // One sink per process; batch items share it (per-line trace file options are ignored).
+    std::unique_ptr<WCDBRepair::TraceSink> traceSink;
+    if (opt.sqlTrace) {
+        traceSink.reset(new WCDBRepair::TraceSink(static_cast<size_t>(opt.sqlTraceQueue), opt.sqlTracePolicy));
+        if (!traceSink->start(opt.sqlTraceFile)) {
+            logState("SQL_TRACE_FILE_OPEN_FAILED", opt.sqlTraceFile);
+            return 2;
+        }
+    }
+
+    // Also shared by batch items, which may carry their own --kdf-cache flag.
+    WCDBRepair::DerivedKeyCache keyCache(opt.kdfCacheSecret);
+    if (!opt.kdfCacheFile.empty() && !keyCache.load(opt.kdfCacheFile)) {
+        logState("KDF_CACHE_FILE_INVALID", opt.kdfCacheFile);
+    }
+
+    Context ctx;
+    ctx.traceSink = traceSink.get();
+    ctx.keyCache = &keyCache;
+    if (opt.deadlineSeconds > 0) {
+        ctx.hasDeadline = true;
+        ctx.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(opt.deadlineSeconds);
+    }
+    installStopHandlers();
+
+    int rc = 0;
+    if (opt.command == "batch") {
+        rc = runBatch(opt, ctx);
+    } else if (opt.command == "serve") {
+        rc = runServe(opt, ctx);
+    } else {
+        rc = runCommand(opt, ctx);
+        if (rc == 2) {
+            printUsage();
+        }
+    }
+
+    if (!opt.kdfCacheFile.empty() && keyCache.misses() > 0 && !keyCache.save(opt.kdfCacheFile)) {
+        logState("KDF_CACHE_FILE_SAVE_FAILED", opt.kdfCacheFile);
+    }
+
+    if (traceSink) {
+        traceSink->stop();
+        logState(opt,
+                 "SQL_TRACE_STATS",
+                 "written=" + std::to_string(traceSink->written()) + ",dropped="
+                 + std::to_string(traceSink->dropped()) + ",truncated=" + std::to_string(traceSink->truncated()));
+    }
+    if (timeline) {
+        logState(opt, "EXIT");
+        timeline->closeAll();
+        if (opt.timing)
+            timeline->printSummary(stdout);
+        if (!opt.traceEventsPath.empty() && !timeline->writeTraceEvents(opt.traceEventsPath))
+            logState("TRACE_EVENTS_WRITE_FAILED", opt.traceEventsPath);
+    }
+    return rc;
+}
+
+} // namespace
+
+namespace WCDBRepair {
+
+int runCli(const std::vector<std::string>& argv)
+{
+    return ::run(argv);
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Export.hpp"
+#include "PageReader.hpp"
+#include "TraceSink.hpp"
+
+#include "WCDBCpp.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+class DerivedKeyCache;
+class PhaseTimeline;
+
+// The commands of wcdb-repair, shared by the CLI (main.cpp) and the C API (CApi.cpp).
+
+struct Options {
+    std::string command;
+    std::string dbPath;
+    bool showProgress = true;
+    bool progressJson = false; // PROGRESS_JSON= events with throughput/ETA (repair, salvage)
+    bool timing = false;        // SPAN= lines per state and a TIMING summary at exit
+    std::string traceEventsPath; // Chrome trace-event JSON of the same spans
+    PhaseTimeline* timeline = nullptr; // set by run() when timing is wanted
+    int deadlineSeconds = 0;        // repair/salvage/batch: stop cleanly after this long, 0 means none
+    bool resume = false;            // salvage: continue from <output>-checkpoint
+    int checkpointIntervalSeconds = 30;
+    int timelineTrack = 0;                         // batch manifest line, 0 for a single run
+    bool englishOutput = true;
+
+    bool hasKey = false;
+    std::vector<unsigned char> keyBytes;
+    std::string keyPreview; // printable preview for logs (may be masked)
+    int cipherPageSize = 4096;
+    WCDB::Database::CipherVersion cipherVersion = WCDB::Database::CipherVersion::DefaultVersion;
+
+    bool hasKdfIter = false;
+    int kdfIter = 0;
+    std::string cipherHmacAlgorithm; // empty means not set
+    std::string cipherDefaultKdfAlgorithm; // e.g. PBKDF2_HMAC_SHA512
+    std::string cipher; // e.g. aes-256-cbc
+
+    bool kdfCache = false;
+    std::string kdfCacheFile; // empty means in-process only
+    std::vector<unsigned char> kdfCacheSecret;
+
+    bool fastCheck = false;
+    bool verifyHmacFirst = false; // repair: HMAC pre-check pass before retrieve
+    bool fastAssemble = false;    // repair: non-durable bulk-load pragmas while retrieve assembles
+    int indexThreads = 0;         // repair/salvage: SQLite sorter threads for CREATE INDEX, 0 means all cores
+    int sortMemoryMb = 256;       // salvage: rowid sort memory before spilling runs, 0 disables sorting
+    int budgetSeconds = 0;        // repair: best effort within this long, 0 means no budget
+    std::vector<std::string> priorityTables; // repair/salvage: tables recovered first
+    bool tablesOnly = false;                 // repair --tables: recover just those
+
+    // incremental backup material (backup --incremental, salvage)
+    bool incrementalBackup = false;
+    std::string materialPath; // empty means <dbPath>-wcdbrepair.material
+    std::string materialDict; // zstd dictionary the material is compressed with
+    bool trainMaterialDict = false; // backup --incremental: (re)train materialDict first
+
+    // salvage
+    std::string salvageOutput; // empty means <dbPath>-salvage.db
+    std::string schemaFile;    // DDL script
+    std::string schemaFromDb;  // database whose sqlite_master supplies DDL
+
+    // estimate
+    double sampleFraction = 0.01;
+    int sampleSeed = 0;
+    int rowsPerSecond = 100000; // retrieve() assembly rate assumed for the runtime
+
+    // repair/salvage --export: rows go to files in this directory instead of a database
+    std::string exportDir;
+    ExportFormat exportFormat = ExportFormat::Ndjson;
+
+    bool sqlTrace = true;
+    bool fullSqlTrace = true;
+    std::string sqlTraceFile; // empty means stdout
+    int sqlTraceQueue = 8192; // ring buffer records
+    TraceSink::Policy sqlTracePolicy = TraceSink::Policy::Block;
+
+    bool errorTrace = true; // global error tracing
+
+    // whole-file page passes (check --fast, verify-hmac, backup --incremental)
+    WCDBRepair::PageReadOptions pageRead;
+
+    // batch mode
+    std::string batchCommand = "repair";
+    int jobs = 0;    // 0 means hardware concurrency
+    int ioSlots = 0; // 0 means same as jobs
+    std::vector<std::string> rawOptions; // option args after <dbPath>, forwarded to batch items
+    bool batchItem = false; // results/states are tagged with path= when set
+
+    // serve jobs: output lines (without the newline) go to the client instead of stdout
+    std::function<void(const std::string&)> writer;
+    // C API: every progress event as the fraction and the JSON object, with or without
+    // --progress-json
+    std::function<void(double, const std::string&)> progressListener;
+};
+
+// Process-wide services shared by every database handled in this run.
+struct Context {
+    TraceSink* traceSink = nullptr;
+    DerivedKeyCache* keyCache = nullptr;
+    bool hasDeadline = false; // --deadline of the command line; batch items share it
+    std::chrono::steady_clock::time_point deadline;
+    std::function<bool()> cancelled; // serve/library: the client wants this run stopped
+    // batch --io-slots: taken around the I/O heavy phase of a command (the page reads,
+    // WCDB's check/backup/retrieve) and given back after it; unset means no limit.
+    std::function<void()> acquireIo;
+    std::function<void()> releaseIo;
+};
+
+// Parses `wcdb-repair <command> <dbPath> [options...]` (argv[0] is ignored).
+bool parseArgs(const std::vector<std::string>& argv, Options& opt);
+
+// Runs one per-database command (not batch or serve). Output goes through opt.writer.
+int runCommand(const Options& opt, Context& ctx);
+
+// The whole CLI: parses argv, sets up the process-wide services and runs the command.
+int runCli(const std::vector<std::string>& argv);
+
+} // namespace WCDBRepair
@@ -0,0 +1,255 @@
+#include "Estimate.hpp"
+
+#include "PageSource.hpp"
+#include "SqliteFormat.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr uint32_t kStrataPerTask = 64;      // strata a worker takes at a time
+constexpr uint32_t kCalibrationPages = 256;  // sequential run timed for the read rate
+
+enum SampleKind : uint8_t {
+    SampleLeaf,
+    SampleInterior,
+    SampleOverflow,
+    SampleFree,
+    SampleGarbage,
+};
+
+struct Tally {
+    uint64_t pages[SampleGarbage + 1] = {};
+    double weight[SampleGarbage + 1] = {}; // pages of each kind in the strata
+    uint64_t unreadable = 0;
+    uint64_t rows = 0;
+    double weightedRows = 0;
+
+    void add(const Tally& other)
+    {
+        for (int k = 0; k <= SampleGarbage; k++) {
+            pages[k] += other.pages[k];
+            weight[k] += other.weight[k];
+        }
+        unreadable += other.unreadable;
+        rows += other.rows;
+        weightedRows += other.weightedRows;
+    }
+};
+
+uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Freelist trunk and leaf pages; a broken chain just ends the walk.
+void walkFreelist(PageSource& source, const DatabaseHeader& header, uint32_t pageCount, std::vector<bool>& free)
+{
+    const uint32_t maxLeaves = header.usableSize() / 4 - 2;
+    uint32_t trunk = header.firstFreelistTrunk;
+    while (trunk != 0 && trunk <= pageCount && !free[trunk]) {
+        free[trunk] = true;
+        const unsigned char* data = source.page(trunk);
+        if (data == nullptr)
+            return;
+        const uint32_t leaves = std::min(readBE32(data + 4), maxLeaves);
+        for (uint32_t i = 0; i < leaves; i++) {
+            const uint32_t leaf = readBE32(data + 8 + 4 * i);
+            if (leaf != 0 && leaf <= pageCount)
+                free[leaf] = true;
+        }
+        trunk = readBE32(data);
+    }
+}
+
+// Rows on a table leaf: cells whose record header agrees with their payload size.
+uint64_t countRows(const unsigned char* data, const BTreePage& btree)
+{
+    uint64_t rows = 0;
+    for (const CellInfo& cell : btree.cells) {
+        if (recordHeaderConsistent(data + cell.payloadOffset, cell.localSize, cell.payloadSize))
+            rows++;
+    }
+    return rows;
+}
+
+SampleKind classify(PageSource& source,
+                    BTreePage& btree,
+                    uint32_t pgno,
+                    uint32_t pageCount,
+                    uint32_t usableSize,
+                    const std::vector<bool>& free,
+                    bool pointerMaps,
+                    Tally& tally,
+                    uint64_t& rows)
+{
+    rows = 0;
+    if (free[pgno] || pgno == lockBytePage(source.pageSize())
+        || (pointerMaps && isPointerMapPage(pgno, usableSize, source.pageSize())))
+        return SampleFree;
+    const unsigned char* data = source.page(pgno);
+    if (data == nullptr) {
+        tally.unreadable++;
+        return SampleGarbage;
+    }
+    const uint8_t type = data[pgno == 1 ? DatabaseHeaderSize : 0];
+    if (isBTreePageType(type)) {
+        if (!btree.parse(data, pgno, usableSize))
+            return SampleGarbage;
+        if (!isLeafPageType(type))
+            return SampleInterior;
+        if (type == PageTypeTableLeaf)
+            rows = countRows(data, btree);
+        return SampleLeaf;
+    }
+    // Overflow pages have no header; a next pointer inside the file is the only sign.
+    const uint32_t next = readBE32(data);
+    if (next <= pageCount && !isAllZero(data, usableSize))
+        return SampleOverflow;
+    return SampleGarbage;
+}
+
+// Seconds per page of a sequential read (plus decryption) from `first`.
+double timeSequentialRead(const PageFile& file, uint32_t pageSize, const CipherKeys* keys, uint32_t first, uint32_t count)
+{
+    PageSource source(file, pageSize, keys);
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t pgno = first; pgno < first + count; pgno++) {
+        source.page(pgno);
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return count > 0 ? elapsed / count : 0;
+}
+
+} // namespace
+
+bool estimateRepair(const PageFile& file, const EstimateOptions& options, EstimateResult& result, std::string& error)
+{
+    result = EstimateResult();
+
+    uint32_t pageSize = options.pageSize;
+    if (options.keys == nullptr) {
+        unsigned char head[DatabaseHeaderSize];
+        DatabaseHeader probe;
+        if (file.readFully(0, head, sizeof(head)) && probe.parse(head, sizeof(head))) {
+            pageSize = probe.pageSize;
+        } else if (pageSize == 0) {
+            error = "not a SQLite database (bad header); pass the cipher options for encrypted files";
+            return false;
+        }
+    }
+    if (pageSize == 0 || file.size() < pageSize) {
+        error = "file smaller than one page";
+        return false;
+    }
+    // retrieve() crawls the whole file, so the file size, not the header, gives the pages.
+    PageSource first(file, pageSize, options.keys);
+    const uint32_t pageCount = first.pageCount();
+    result.pageSize = pageSize;
+    result.pageCount = pageCount;
+
+    DatabaseHeader header;
+    const unsigned char* page1 = first.page(1);
+    result.headerReadable = page1 != nullptr && header.parse(page1, pageSize) && header.pageSize == pageSize;
+    uint32_t usableSize = pageSize;
+    if (result.headerReadable)
+        usableSize = header.usableSize();
+    else if (options.keys != nullptr)
+        usableSize = pageSize - static_cast<uint32_t>(options.keys->params.reserveSize());
+    std::vector<bool> free(pageCount + 1, false);
+    if (result.headerReadable)
+        walkFreelist(first, header, pageCount, free);
+    const bool pointerMaps = result.headerReadable && header.largestRootPage != 0;
+
+    const double fraction = std::min(1.0, std::max(0.0, options.sampleFraction));
+    const uint64_t wanted = static_cast<uint64_t>(std::ceil(fraction * pageCount));
+    const uint32_t strata = static_cast<uint32_t>(
+    std::min<uint64_t>(pageCount, std::max<uint64_t>(wanted, kMinEstimateSamples)));
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0)
+            threads = 1;
+    }
+    const uint32_t tasks = (strata + kStrataPerTask - 1) / kStrataPerTask;
+    threads = std::max(1, std::min<int>(threads, static_cast<int>(tasks)));
+
+    // Stratum s covers pages [1 + s*N/S, 1 + (s+1)*N/S); its page depends only on the
+    // seed and s, so the sample does not change with the thread count.
+    std::atomic<uint32_t> nextTask(0);
+    std::vector<Tally> tallies(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            PageSource source(file, pageSize, options.keys);
+            BTreePage btree;
+            Tally& tally = tallies[t];
+            for (;;) {
+                const uint32_t task = nextTask.fetch_add(1);
+                if (task >= tasks)
+                    return;
+                const uint32_t end = std::min(strata, (task + 1) * kStrataPerTask);
+                for (uint32_t s = task * kStrataPerTask; s < end; s++) {
+                    const uint64_t begin = 1 + static_cast<uint64_t>(s) * pageCount / strata;
+                    const uint64_t size = 1 + static_cast<uint64_t>(s + 1) * pageCount / strata - begin;
+                    const uint32_t pgno = static_cast<uint32_t>(begin + splitmix64(options.seed * 0x100000001B3ull + s) % size);
+                    uint64_t rows = 0;
+                    const SampleKind kind =
+                    classify(source, btree, pgno, pageCount, usableSize, free, pointerMaps, tally, rows);
+                    tally.pages[kind]++;
+                    tally.weight[kind] += static_cast<double>(size);
+                    tally.rows += rows;
+                    tally.weightedRows += static_cast<double>(rows) * size;
+                }
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    Tally total;
+    for (const Tally& tally : tallies) {
+        total.add(tally);
+    }
+
+    result.sampledPages = strata;
+    result.leafPages = total.pages[SampleLeaf];
+    result.interiorPages = total.pages[SampleInterior];
+    result.overflowPages = total.pages[SampleOverflow];
+    result.freePages = total.pages[SampleFree];
+    result.garbagePages = total.pages[SampleGarbage];
+    result.unreadablePages = total.unreadable;
+    result.sampledRows = total.rows;
+    result.rows = total.weightedRows;
+
+    const double usable = total.weight[SampleLeaf] + total.weight[SampleInterior] + total.weight[SampleOverflow];
+    const double content = usable + total.weight[SampleGarbage];
+    result.score = content > 0 ? usable / content : 0;
+    // Binomial error of the share over the sampled content pages, with the finite
+    // population correction; stratification only makes the real error smaller.
+    const double n = static_cast<double>(strata - result.freePages);
+    if (n > 0) {
+        const double correction = std::max(0.0, 1.0 - static_cast<double>(strata) / pageCount);
+        result.scoreStdErr = std::sqrt(result.score * (1 - result.score) / n * correction);
+    }
+
+    const uint32_t run = std::min(pageCount, kCalibrationPages);
+    const uint32_t runStart = 1 + static_cast<uint32_t>(splitmix64(options.seed + 1) % (pageCount - run + 1));
+    result.readSecondsPerPage = timeSequentialRead(file, pageSize, options.keys, runStart, run);
+    result.seconds = result.readSecondsPerPage * pageCount
+                     + (options.rowsPerSecond > 0 ? result.rows / options.rowsPerSecond : 0);
+    return true;
+}
+
+} // namespace WCDBRepair
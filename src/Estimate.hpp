@@ -0,0 +1,57 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "Sqlcipher.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace WCDBRepair {
+
+struct EstimateOptions {
+    double sampleFraction = 0.01;     // of the pages; at least kMinEstimateSamples are read
+    uint64_t seed = 0;                // same seed, same sample
+    int threads = 0;                  // 0 means hardware concurrency
+    const CipherKeys* keys = nullptr; // SQLCipher keys, nullptr for plaintext files
+    uint32_t pageSize = 0;            // required for encrypted files (the header is encrypted)
+    double rowsPerSecond = 100000;    // rows retrieve() assembles per second, for the runtime
+};
+
+constexpr uint32_t kMinEstimateSamples = 256;
+
+struct EstimateResult {
+    uint32_t pageSize = 0;
+    uint32_t pageCount = 0;
+    bool headerReadable = false; // page 1 parsed, so free pages are known
+
+    // Sampled pages by kind.
+    uint64_t sampledPages = 0;
+    uint64_t leafPages = 0;     // b-tree leaves that pass the per-page checks
+    uint64_t interiorPages = 0; // same for interior pages
+    uint64_t overflowPages = 0; // not a b-tree page, but a plausible overflow page
+    uint64_t freePages = 0;     // on the freelist (also pointer-map and lock-byte pages)
+    uint64_t garbagePages = 0;  // unreadable, zeroed, or a b-tree page that fails its checks
+    uint64_t unreadablePages = 0; // of garbagePages: read, HMAC or decrypt failures
+    uint64_t sampledRows = 0;   // cells with a sane record header on sampled table leaves
+
+    // Extrapolated to the whole file.
+    double rows = 0;
+    double score = 0;       // share of the pages with content that are usable
+    double scoreStdErr = 0; // sampling error of `score`
+    double readSecondsPerPage = 0; // sequential read + decrypt, measured on a run of pages
+    double seconds = 0;     // expected retrieve() runtime: one pass over the file plus assembly
+};
+
+// Predicts what `repair` will get out of a file, and how long it will take, by reading
+// only a sample of its pages.
+//
+// The file is cut into as many equal strata as there are samples and one page is picked
+// at random in each, so every region of the file is represented. Each sampled page is
+// classified on its own, with the per-page checks of `check --fast`; pages on the
+// freelist (walked from page 1) count as free. Page kinds and rows are weighted by the
+// size of their stratum. The score is the share of usable pages among those that are
+// not free, which is how retrieve() scores a file it can crawl page by page; it does
+// not see damage that only shows across pages (wrong children, lost roots).
+bool estimateRepair(const PageFile& file, const EstimateOptions& options, EstimateResult& result, std::string& error);
+
+} // namespace WCDBRepair
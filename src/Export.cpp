@@ -0,0 +1,718 @@
+#include "Export.hpp"
+
+#include "JobProtocol.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kWriteBuffer = 4 << 20;    // bytes collected before one fwrite
+constexpr size_t kGroupRows = 65536;        // columnar row group limits
+constexpr size_t kGroupBytes = 16 << 20;
+
+// One output file behind a large buffer; writes are counted.
+class BufferedFile {
+public:
+    BufferedFile() : m_file(nullptr), m_written(0) {}
+    ~BufferedFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        m_file = std::fopen(path.c_str(), "wb");
+        if (m_file == nullptr)
+            return false;
+        std::setvbuf(m_file, nullptr, _IONBF, 0); // m_buffer is the buffer
+        m_buffer.reserve(kWriteBuffer);
+        return true;
+    }
+
+    void append(const void* data, size_t size)
+    {
+        m_buffer.append(static_cast<const char*>(data), size);
+        if (m_buffer.size() >= kWriteBuffer)
+            flush();
+    }
+    void append(const std::string& s) { append(s.data(), s.size()); }
+    void append(char c)
+    {
+        m_buffer.push_back(c);
+        if (m_buffer.size() >= kWriteBuffer)
+            flush();
+    }
+
+    bool flush()
+    {
+        if (m_file == nullptr)
+            return false;
+        if (!m_buffer.empty()) {
+            if (std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size())
+                m_failed = true;
+            m_written += m_buffer.size();
+            m_buffer.clear();
+        }
+        return !m_failed;
+    }
+
+    bool close()
+    {
+        if (m_file == nullptr)
+            return !m_failed;
+        flush();
+        if (std::fclose(m_file) != 0)
+            m_failed = true;
+        m_file = nullptr;
+        return !m_failed;
+    }
+
+    uint64_t written() const { return m_written + m_buffer.size(); }
+
+private:
+    std::FILE* m_file;
+    std::string m_buffer;
+    uint64_t m_written;
+    bool m_failed = false;
+};
+
+void appendBase64(std::string& out, const unsigned char* data, size_t size)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 2 < size; i += 3) {
+        const uint32_t v = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8) | data[i + 2];
+        out.push_back(digits[v >> 18]);
+        out.push_back(digits[(v >> 12) & 63]);
+        out.push_back(digits[(v >> 6) & 63]);
+        out.push_back(digits[v & 63]);
+    }
+    if (i + 1 == size) {
+        const uint32_t v = uint32_t(data[i]) << 16;
+        out.push_back(digits[v >> 18]);
+        out.push_back(digits[(v >> 12) & 63]);
+        out += "==";
+    } else if (i + 2 == size) {
+        const uint32_t v = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8);
+        out.push_back(digits[v >> 18]);
+        out.push_back(digits[(v >> 12) & 63]);
+        out.push_back(digits[(v >> 6) & 63]);
+        out.push_back('=');
+    }
+}
+
+void appendReal(std::string& out, double v)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.17g", v);
+    out += buf;
+}
+
+void appendVarint(std::string& out, uint64_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+uint64_t zigzag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+size_t varintSize(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+std::string fileNameOf(const std::string& table)
+{
+    std::string out;
+    for (unsigned char c : table) {
+        const bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'
+                           || c == '-' || c == '.' || c >= 0x80;
+        out.push_back(plain ? static_cast<char>(c) : '_');
+    }
+    if (out.empty() || out[0] == '.')
+        out.insert(out.begin(), '_');
+    return out;
+}
+
+} // namespace
+
+bool parseExportFormat(const std::string& name, ExportFormat& format)
+{
+    if (name == "ndjson") {
+        format = ExportFormat::Ndjson;
+    } else if (name == "csv") {
+        format = ExportFormat::Csv;
+    } else if (name == "columnar") {
+        format = ExportFormat::Columnar;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* exportFormatName(ExportFormat format)
+{
+    switch (format) {
+    case ExportFormat::Ndjson:
+        return "ndjson";
+    case ExportFormat::Csv:
+        return "csv";
+    case ExportFormat::Columnar:
+        return "columnar";
+    }
+    return "";
+}
+
+bool makeDirectory(const std::string& path)
+{
+#if defined(_WIN32)
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+// One table's file. Rows arrive as export columns: the rowid column first when the
+// table has one, an INTEGER PRIMARY KEY filled from the rowid, missing values NULL.
+class ExportTableFile {
+public:
+    explicit ExportTableFile(std::vector<std::string> columns) : m_columns(std::move(columns)) {}
+    virtual ~ExportTableFile() {}
+
+    bool open(const std::string& path) { return m_out.open(path) && begin(); }
+    virtual bool row(const std::vector<RecordValue>& values) = 0;
+    virtual bool finish() { return m_out.close(); }
+
+    uint64_t written() const { return m_out.written(); }
+
+protected:
+    virtual bool begin() { return true; }
+
+    std::vector<std::string> m_columns;
+    BufferedFile m_out;
+    std::string m_line;
+};
+
+namespace {
+
+class NdjsonFile final : public ExportTableFile {
+public:
+    using ExportTableFile::ExportTableFile;
+
+    bool row(const std::vector<RecordValue>& values) override
+    {
+        m_line.clear();
+        m_line.push_back('{');
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                m_line.push_back(',');
+            appendJsonString(m_line, m_columns[i].data(), m_columns[i].size());
+            m_line.push_back(':');
+            const RecordValue& v = values[i];
+            switch (v.type) {
+            case RecordValue::Null:
+                m_line += "null";
+                break;
+            case RecordValue::Integer:
+                m_line += std::to_string(v.integer);
+                break;
+            case RecordValue::Real:
+                if (std::isfinite(v.real)) {
+                    appendReal(m_line, v.real);
+                } else {
+                    m_line += "null"; // JSON has no NaN/Infinity
+                }
+                break;
+            case RecordValue::Text:
+                appendJsonString(m_line, reinterpret_cast<const char*>(v.data), v.size);
+                break;
+            case RecordValue::Blob:
+                m_line += "{\"base64\":\"";
+                appendBase64(m_line, v.data, v.size);
+                m_line += "\"}";
+                break;
+            }
+        }
+        m_line += "}\n";
+        m_out.append(m_line);
+        return true;
+    }
+};
+
+class CsvFile final : public ExportTableFile {
+public:
+    using ExportTableFile::ExportTableFile;
+
+    bool row(const std::vector<RecordValue>& values) override
+    {
+        m_line.clear();
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                m_line.push_back(',');
+            const RecordValue& v = values[i];
+            switch (v.type) {
+            case RecordValue::Null:
+                break;
+            case RecordValue::Integer:
+                m_line += std::to_string(v.integer);
+                break;
+            case RecordValue::Real:
+                appendReal(m_line, v.real);
+                break;
+            case RecordValue::Text:
+                appendField(reinterpret_cast<const char*>(v.data), v.size);
+                break;
+            case RecordValue::Blob:
+                appendBase64(m_line, v.data, v.size);
+                break;
+            }
+        }
+        m_line += "\r\n";
+        m_out.append(m_line);
+        return true;
+    }
+
+private:
+    bool begin() override
+    {
+        m_line.clear();
+        for (size_t i = 0; i < m_columns.size(); i++) {
+            if (i > 0)
+                m_line.push_back(',');
+            appendField(m_columns[i].data(), m_columns[i].size());
+        }
+        m_line += "\r\n";
+        m_out.append(m_line);
+        return true;
+    }
+
+    // Quoted when needed; an empty string is quoted so that it differs from NULL.
+    void appendField(const char* data, size_t size)
+    {
+        bool quote = size == 0;
+        for (size_t i = 0; i < size && !quote; i++) {
+            quote = data[i] == ',' || data[i] == '"' || data[i] == '\n' || data[i] == '\r';
+        }
+        if (!quote) {
+            m_line.append(data, size);
+            return;
+        }
+        m_line.push_back('"');
+        for (size_t i = 0; i < size; i++) {
+            if (data[i] == '"')
+                m_line.push_back('"');
+            m_line.push_back(data[i]);
+        }
+        m_line.push_back('"');
+    }
+};
+
+enum ColumnEncoding : uint8_t {
+    AllNull = 0,
+    IntegerDelta = 1,
+    IntegerPlain = 2,
+    RealPlain = 3,
+    TextPlain = 4,
+    BlobPlain = 5,
+    Dictionary = 6,
+    Mixed = 7,
+};
+
+class ColumnarFile final : public ExportTableFile {
+public:
+    using ExportTableFile::ExportTableFile;
+
+    bool row(const std::vector<RecordValue>& values) override
+    {
+        if (m_chunks.empty())
+            m_chunks.resize(m_columns.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            Chunk& c = m_chunks[i];
+            const RecordValue& v = values[i];
+            c.types.push_back(static_cast<uint8_t>(v.type));
+            switch (v.type) {
+            case RecordValue::Null:
+                break;
+            case RecordValue::Integer:
+                c.integers.push_back(v.integer);
+                m_groupBytes += 8;
+                break;
+            case RecordValue::Real:
+                c.reals.push_back(v.real);
+                m_groupBytes += 8;
+                break;
+            case RecordValue::Text:
+            case RecordValue::Blob:
+                c.bytes.append(reinterpret_cast<const char*>(v.data), v.size);
+                c.sizes.push_back(v.size);
+                m_groupBytes += v.size + 8;
+                break;
+            }
+        }
+        m_groupRows++;
+        m_totalRows++;
+        if (m_groupRows >= kGroupRows || m_groupBytes >= kGroupBytes)
+            writeGroup();
+        return true;
+    }
+
+    bool finish() override
+    {
+        writeGroup();
+        m_out.append('E');
+        m_scratch.clear();
+        appendVarint(m_scratch, m_totalRows);
+        m_out.append(m_scratch);
+        return ExportTableFile::finish();
+    }
+
+private:
+    struct Chunk {
+        std::vector<uint8_t> types; // per row, RecordValue::Type
+        std::vector<int64_t> integers;
+        std::vector<double> reals;
+        std::string bytes;          // text and blob values back to back
+        std::vector<size_t> sizes;
+
+        void clear()
+        {
+            types.clear();
+            integers.clear();
+            reals.clear();
+            bytes.clear();
+            sizes.clear();
+        }
+    };
+
+    bool begin() override
+    {
+        m_scratch.assign("WCOL\x01", 5);
+        appendVarint(m_scratch, m_columns.size());
+        for (const std::string& name : m_columns) {
+            appendVarint(m_scratch, name.size());
+            m_scratch += name;
+        }
+        m_out.append(m_scratch);
+        return true;
+    }
+
+    void writeGroup()
+    {
+        if (m_groupRows == 0)
+            return;
+        m_scratch.assign(1, 'G');
+        appendVarint(m_scratch, m_groupRows);
+        m_out.append(m_scratch);
+        for (Chunk& c : m_chunks) {
+            writeChunk(c);
+            c.clear();
+        }
+        m_groupRows = 0;
+        m_groupBytes = 0;
+    }
+
+    void writeChunk(const Chunk& c)
+    {
+        size_t present = 0;
+        bool single = true;
+        uint8_t type = RecordValue::Null;
+        for (uint8_t t : c.types) {
+            if (t == RecordValue::Null)
+                continue;
+            if (present++ == 0) {
+                type = t;
+            } else if (t != type) {
+                single = false;
+            }
+        }
+
+        m_data.clear();
+        uint8_t encoding = AllNull;
+        if (present == 0) {
+            encoding = AllNull;
+        } else if (!single) {
+            encoding = Mixed;
+            encodeMixed(c);
+        } else if (type == RecordValue::Integer) {
+            encoding = encodeIntegers(c);
+        } else if (type == RecordValue::Real) {
+            encoding = RealPlain;
+            for (double v : c.reals) {
+                appendDouble(m_data, v);
+            }
+        } else {
+            encoding = encodeBytes(c, type);
+        }
+
+        m_scratch.clear();
+        m_scratch.push_back(static_cast<char>(encoding));
+        const bool hasNulls = present < c.types.size();
+        m_scratch.push_back(hasNulls ? 1 : 0);
+        if (hasNulls) {
+            std::string bitmap((c.types.size() + 7) / 8, '\0');
+            for (size_t r = 0; r < c.types.size(); r++) {
+                if (c.types[r] != RecordValue::Null)
+                    bitmap[r / 8] = static_cast<char>(bitmap[r / 8] | (1 << (r % 8)));
+            }
+            m_scratch += bitmap;
+        }
+        appendVarint(m_scratch, m_data.size());
+        m_out.append(m_scratch);
+        m_out.append(m_data);
+    }
+
+    // Delta coding wins on keys and timestamps, plain coding on unordered values.
+    uint8_t encodeIntegers(const Chunk& c)
+    {
+        size_t deltaSize = 0;
+        size_t plainSize = 0;
+        int64_t previous = 0;
+        for (int64_t v : c.integers) {
+            deltaSize += varintSize(zigzag(static_cast<int64_t>(static_cast<uint64_t>(v) - static_cast<uint64_t>(previous))));
+            plainSize += varintSize(zigzag(v));
+            previous = v;
+        }
+        const bool delta = deltaSize < plainSize;
+        previous = 0;
+        for (int64_t v : c.integers) {
+            if (delta) {
+                appendVarint(m_data, zigzag(static_cast<int64_t>(static_cast<uint64_t>(v) - static_cast<uint64_t>(previous))));
+            } else {
+                appendVarint(m_data, zigzag(v));
+            }
+            previous = v;
+        }
+        return delta ? IntegerDelta : IntegerPlain;
+    }
+
+    uint8_t encodeBytes(const Chunk& c, uint8_t type)
+    {
+        // A dictionary only pays off for repeated values; give up once half are distinct.
+        std::unordered_map<std::string, uint32_t> index;
+        std::vector<uint32_t> codes;
+        codes.reserve(c.sizes.size());
+        size_t plainSize = 0;
+        size_t dictionarySize = 0;
+        bool useDictionary = c.sizes.size() >= 16;
+        size_t offset = 0;
+        for (size_t i = 0; i < c.sizes.size() && useDictionary; i++) {
+            std::string value(c.bytes, offset, c.sizes[i]);
+            offset += c.sizes[i];
+            plainSize += varintSize(value.size()) + value.size();
+            auto it = index.find(value);
+            if (it == index.end()) {
+                const uint32_t code = static_cast<uint32_t>(index.size());
+                dictionarySize += 1 + varintSize(value.size()) + value.size();
+                it = index.emplace(std::move(value), code).first;
+                useDictionary = index.size() * 2 <= c.sizes.size();
+            }
+            codes.push_back(it->second);
+            dictionarySize += varintSize(it->second);
+        }
+        if (useDictionary && dictionarySize + varintSize(index.size()) < plainSize) {
+            std::vector<const std::string*> entries(index.size());
+            for (const auto& entry : index) {
+                entries[entry.second] = &entry.first;
+            }
+            appendVarint(m_data, entries.size());
+            for (const std::string* entry : entries) {
+                m_data.push_back(static_cast<char>(type == RecordValue::Text ? TextPlain : BlobPlain));
+                appendVarint(m_data, entry->size());
+                m_data += *entry;
+            }
+            for (uint32_t code : codes) {
+                appendVarint(m_data, code);
+            }
+            return Dictionary;
+        }
+        offset = 0;
+        for (size_t size : c.sizes) {
+            appendVarint(m_data, size);
+            m_data.append(c.bytes, offset, size);
+            offset += size;
+        }
+        return type == RecordValue::Text ? TextPlain : BlobPlain;
+    }
+
+    void encodeMixed(const Chunk& c)
+    {
+        size_t nextInteger = 0;
+        size_t nextReal = 0;
+        size_t nextBytes = 0;
+        size_t offset = 0;
+        for (uint8_t t : c.types) {
+            switch (t) {
+            case RecordValue::Null:
+                break;
+            case RecordValue::Integer:
+                m_data.push_back(static_cast<char>(IntegerPlain));
+                appendVarint(m_data, zigzag(c.integers[nextInteger++]));
+                break;
+            case RecordValue::Real:
+                m_data.push_back(static_cast<char>(RealPlain));
+                appendDouble(m_data, c.reals[nextReal++]);
+                break;
+            default: {
+                const size_t size = c.sizes[nextBytes++];
+                m_data.push_back(static_cast<char>(t == RecordValue::Text ? TextPlain : BlobPlain));
+                appendVarint(m_data, size);
+                m_data.append(c.bytes, offset, size);
+                offset += size;
+                break;
+            }
+            }
+        }
+    }
+
+    static void appendDouble(std::string& out, double v)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        for (int i = 0; i < 8; i++) {
+            out.push_back(static_cast<char>(bits >> (8 * i)));
+        }
+    }
+
+    std::vector<Chunk> m_chunks;
+    size_t m_groupRows = 0;
+    size_t m_groupBytes = 0;
+    uint64_t m_totalRows = 0;
+    std::string m_scratch;
+    std::string m_data;
+};
+
+} // namespace
+
+ExportSink::ExportSink(const std::vector<SalvageTable>& tables, const std::string& directory, ExportFormat format)
+: m_tables(tables)
+, m_directory(directory)
+, m_format(format)
+, m_files(tables.size())
+, m_filesOpened(0)
+, m_rows(0)
+, m_duplicateRows(0)
+, m_bytesWritten(0)
+{
+}
+
+ExportSink::~ExportSink()
+{
+    finish();
+}
+
+ExportTableFile* ExportSink::open(size_t table)
+{
+    const SalvageTable& t = m_tables[table];
+    std::vector<std::string> columns;
+    if (!t.withoutRowid && t.rowidColumn < 0)
+        columns.push_back("rowid");
+    columns.insert(columns.end(), t.columns.begin(), t.columns.end());
+
+    std::string name = fileNameOf(t.name);
+    for (const std::string& used : m_usedNames) {
+        if (used == name) {
+            name += "-" + std::to_string(table); // two names that map to the same file name
+            break;
+        }
+    }
+    m_usedNames.push_back(name);
+
+    std::unique_ptr<ExportTableFile> file;
+    switch (m_format) {
+    case ExportFormat::Ndjson:
+        file.reset(new NdjsonFile(std::move(columns)));
+        name += ".ndjson";
+        break;
+    case ExportFormat::Csv:
+        file.reset(new CsvFile(std::move(columns)));
+        name += ".csv";
+        break;
+    case ExportFormat::Columnar:
+        file.reset(new ColumnarFile(std::move(columns)));
+        name += ".wcol";
+        break;
+    }
+    if (!file->open(m_directory + "/" + name)) {
+        m_error = "open " + name;
+        return nullptr;
+    }
+    m_filesOpened++;
+    m_files[table] = std::move(file);
+    return m_files[table].get();
+}
+
+bool ExportSink::row(size_t table, int64_t rowid, const std::vector<RecordValue>& values)
+{
+    if (!m_error.empty())
+        return false;
+    const SalvageTable& t = m_tables[table];
+    if (!t.withoutRowid) {
+        if (m_lastRowids.size() < m_tables.size())
+            m_lastRowids.assign(m_tables.size(), std::make_pair(false, int64_t(0)));
+        std::pair<bool, int64_t>& last = m_lastRowids[table];
+        if (last.first && last.second == rowid) {
+            m_duplicateRows++;
+            return true;
+        }
+        last = std::make_pair(true, rowid);
+    }
+    ExportTableFile* file = m_files[table] ? m_files[table].get() : open(table);
+    if (file == nullptr)
+        return false;
+
+    m_values.clear();
+    if (!t.withoutRowid && t.rowidColumn < 0) {
+        RecordValue v;
+        v.type = RecordValue::Integer;
+        v.integer = rowid;
+        m_values.push_back(v);
+    }
+    for (size_t i = 0; i < t.columns.size(); i++) {
+        RecordValue v = i < values.size() ? values[i] : RecordValue(); // added columns: NULL
+        if (static_cast<int>(i) == t.rowidColumn && !t.withoutRowid) {
+            v.type = RecordValue::Integer;
+            v.integer = rowid;
+        }
+        m_values.push_back(v);
+    }
+    m_rows++;
+    return file->row(m_values);
+}
+
+bool ExportSink::finish()
+{
+    bool ok = m_error.empty();
+    m_bytesWritten = 0;
+    for (std::unique_ptr<ExportTableFile>& file : m_files) {
+        if (!file)
+            continue;
+        ok = file->finish() && ok;
+        m_bytesWritten += file->written();
+    }
+    if (!ok && m_error.empty())
+        m_error = "write";
+    return ok;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Salvage.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace WCDBRepair {
+
+enum class ExportFormat {
+    Ndjson,   // <table>.ndjson: one JSON object per row
+    Csv,      // <table>.csv: RFC 4180, header line with the column names
+    Columnar, // <table>.wcol: row groups of per-column chunks, see below
+};
+
+bool parseExportFormat(const std::string& name, ExportFormat& format);
+const char* exportFormatName(ExportFormat format);
+
+// Creates `path` if it does not exist yet (one level).
+bool makeDirectory(const std::string& path);
+
+class ExportTableFile;
+
+// Writes salvaged rows to one file per table in a directory instead of a database.
+// Rowid tables get a leading "rowid" column unless they have an INTEGER PRIMARY KEY,
+// which receives the rowid. NULL is null / an empty field; blobs are base64 (NDJSON:
+// {"base64":"..."}). Rows of a rowid table are expected in rowid order (RowidSorter);
+// a repeated rowid is an older copy and is dropped. Files are written through large
+// buffers and only opened once a table has rows.
+//
+// Columnar files (all integers little endian, varints unsigned LEB128, zigzag for signed):
+//   "WCOL" u8 version=1, varint columnCount, per column: varint nameLength, name
+//   row groups: 'G', varint rowCount, per column: u8 encoding, u8 hasNulls,
+//               [presence bitmap, 1 bit per row, LSB first], varint dataLength, data
+//   end: 'E', varint totalRows
+// Encodings of the non-NULL values of a chunk, picked per chunk by size:
+//   0 all NULL (no data)   1 integers, zigzag delta from the previous value
+//   2 integers, zigzag     3 reals, 8 bytes each
+//   4 text, varint length + bytes each        5 blob, same
+//   6 dictionary: varint entries, per entry u8 type (4 text, 5 blob), varint length,
+//     bytes; then a varint entry index per value
+//   7 mixed: per value u8 type (2 integer, 3 real, 4 text, 5 blob) + its plain encoding
+class ExportSink final : public SalvageSink {
+public:
+    ExportSink(const std::vector<SalvageTable>& tables, const std::string& directory, ExportFormat format);
+    ~ExportSink() override;
+
+    bool row(size_t table, int64_t rowid, const std::vector<RecordValue>& values) override;
+
+    // Writes what is buffered and closes the files.
+    bool finish();
+
+    size_t files() const { return m_filesOpened; }
+    uint64_t rows() const { return m_rows; }
+    uint64_t duplicateRows() const { return m_duplicateRows; }
+    uint64_t bytesWritten() const { return m_bytesWritten; }
+    const std::string& error() const { return m_error; }
+
+private:
+    ExportTableFile* open(size_t table);
+
+    const std::vector<SalvageTable>& m_tables;
+    const std::string m_directory;
+    const ExportFormat m_format;
+    std::vector<std::unique_ptr<ExportTableFile>> m_files;
+    std::vector<std::string> m_usedNames;
+    std::vector<std::pair<bool, int64_t>> m_lastRowids; // per table: seen, last rowid
+    std::vector<RecordValue> m_values;
+    size_t m_filesOpened;
+    uint64_t m_rows;
+    uint64_t m_duplicateRows;
+    uint64_t m_bytesWritten;
+    std::string m_error;
+};
+
+} // namespace WCDBRepair
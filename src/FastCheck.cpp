@@ -0,0 +1,445 @@
+#include "FastCheck.hpp"
+
+#include "PageSource.hpp"
+#include "SqliteFormat.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+
+namespace WCDBRepair {
+
+namespace {
+
+enum PageKind : uint8_t {
+    KindUnknown = 0,
+    KindBTree,
+    KindOther, // not a b-tree page: overflow, or garbage
+    KindFreelistTrunk,
+    KindFreelistLeaf,
+    KindPointerMap,
+    KindLockByte,
+    KindOverflow,
+};
+
+enum RefFlag : uint8_t {
+    RefTableChild = 1,
+    RefIndexChild = 2,
+    RefOverflow = 4,
+    RefTableRoot = 8,
+    RefIndexRoot = 16,
+};
+
+struct ScanState {
+    uint32_t pageCount = 0;
+    uint32_t usableSize = 0;
+    // Indexed by pgno; entry 0 unused. Non-atomic arrays are only written by the
+    // thread that owns the page (or by the sequential passes).
+    std::vector<uint8_t> kind;
+    std::vector<uint8_t> btreeType;
+    std::vector<uint32_t> next; // first 4 bytes of non-b-tree pages (overflow "next")
+    std::vector<const char*> reason;
+    std::unique_ptr<std::atomic<uint8_t>[]> refs; // saturating reference count
+    std::unique_ptr<std::atomic<uint8_t>[]> refFlags;
+    std::atomic<uint64_t> hmacFailures;
+
+    explicit ScanState(uint32_t pages, uint32_t usable)
+    : pageCount(pages)
+    , usableSize(usable)
+    , kind(pages + 1, KindUnknown)
+    , btreeType(pages + 1, 0)
+    , next(pages + 1, 0)
+    , reason(pages + 1, nullptr)
+    , refs(new std::atomic<uint8_t>[pages + 1])
+    , refFlags(new std::atomic<uint8_t>[pages + 1])
+    , hmacFailures(0)
+    {
+        for (uint32_t i = 0; i <= pages; i++) {
+            refs[i].store(0, std::memory_order_relaxed);
+            refFlags[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the reference count after adding this one (saturates at 255).
+    uint8_t addRef(uint32_t pgno, uint8_t flag)
+    {
+        if (flag != 0)
+            refFlags[pgno].fetch_or(flag, std::memory_order_relaxed);
+        uint8_t cur = refs[pgno].load(std::memory_order_relaxed);
+        while (cur < 255 && !refs[pgno].compare_exchange_weak(cur, static_cast<uint8_t>(cur + 1))) {
+        }
+        return cur == 255 ? cur : static_cast<uint8_t>(cur + 1);
+    }
+
+    void markBad(uint32_t pgno, const char* why)
+    {
+        if (reason[pgno] == nullptr)
+            reason[pgno] = why;
+    }
+};
+
+const char* reasonForStatus(PageSource::Status status)
+{
+    switch (status) {
+    case PageSource::Status::HmacFailed:
+        return "hmac";
+    case PageSource::Status::DecryptFailed:
+        return "decrypt";
+    default:
+        return "unreadable";
+    }
+}
+
+// `raw` is the page as read from disk.
+void scanPage(ScanState& state, PageSource& source, BTreePage& btree, const unsigned char* raw, uint32_t pgno)
+{
+    PageSource::Status status = PageSource::Status::OK;
+    const unsigned char* data = source.decode(raw, pgno, &status);
+    if (data == nullptr) {
+        state.kind[pgno] = KindOther;
+        state.markBad(pgno, reasonForStatus(status));
+        if (status == PageSource::Status::HmacFailed)
+            state.hmacFailures++;
+        return;
+    }
+    const uint8_t type = data[pgno == 1 ? DatabaseHeaderSize : 0];
+    if (!isBTreePageType(type)) {
+        state.kind[pgno] = KindOther;
+        state.next[pgno] = readBE32(data);
+        if (pgno == 1)
+            state.markBad(pgno, "page-type");
+        return;
+    }
+
+    state.kind[pgno] = KindBTree;
+    state.btreeType[pgno] = type;
+    if (!btree.parse(data, pgno, state.usableSize)) {
+        state.markBad(pgno, btree.error);
+        return;
+    }
+    const uint8_t childFlag = isTablePageType(type) ? RefTableChild : RefIndexChild;
+    const bool interior = !isLeafPageType(type);
+    for (const CellInfo& cell : btree.cells) {
+        if (type != PageTypeTableInterior
+            && !recordHeaderConsistent(data + cell.payloadOffset, cell.localSize, cell.payloadSize)) {
+            state.markBad(pgno, "record-format");
+        }
+        if (interior) {
+            if (cell.leftChild == 0 || cell.leftChild > state.pageCount) {
+                state.markBad(pgno, "child-pointer");
+            } else {
+                state.addRef(cell.leftChild, childFlag);
+            }
+        }
+        if (cell.overflowPage != 0) {
+            if (cell.overflowPage > state.pageCount) {
+                state.markBad(pgno, "overflow-pointer");
+            } else {
+                state.addRef(cell.overflowPage, RefOverflow);
+            }
+        }
+    }
+    if (interior) {
+        if (btree.rightChild == 0 || btree.rightChild > state.pageCount) {
+            state.markBad(pgno, "child-pointer");
+        } else {
+            state.addRef(btree.rightChild, childFlag);
+        }
+    }
+}
+
+void walkFreelist(ScanState& state, PageSource& source, const DatabaseHeader& header)
+{
+    uint32_t trunk = header.firstFreelistTrunk;
+    uint32_t previous = 1;
+    uint64_t count = 0;
+    const uint32_t maxLeaves = state.usableSize / 4 - 2;
+    while (trunk != 0) {
+        if (trunk > state.pageCount) {
+            state.markBad(previous, "freelist-pointer");
+            return;
+        }
+        if (state.kind[trunk] != KindUnknown) {
+            state.markBad(trunk, "freelist-loop");
+            return;
+        }
+        state.kind[trunk] = KindFreelistTrunk;
+        count++;
+        PageSource::Status status = PageSource::Status::OK;
+        const unsigned char* data = source.page(trunk, &status);
+        if (data == nullptr) {
+            state.markBad(trunk, reasonForStatus(status));
+            return;
+        }
+        const uint32_t leaves = readBE32(data + 4);
+        if (leaves > maxLeaves) {
+            state.markBad(trunk, "freelist-leaf-count");
+            return;
+        }
+        for (uint32_t i = 0; i < leaves; i++) {
+            const uint32_t leaf = readBE32(data + 8 + 4 * i);
+            if (leaf == 0 || leaf > state.pageCount) {
+                state.markBad(trunk, "freelist-pointer");
+                continue;
+            }
+            if (state.kind[leaf] != KindUnknown) {
+                state.markBad(leaf, "freelist-duplicate");
+                continue;
+            }
+            state.kind[leaf] = KindFreelistLeaf;
+            count++;
+        }
+        previous = trunk;
+        trunk = readBE32(data);
+    }
+    if (count != header.freelistCount) {
+        state.markBad(1, "freelist-count");
+    }
+}
+
+bool containsWithoutRowid(const unsigned char* sql, size_t size)
+{
+    std::string compact;
+    compact.reserve(size);
+    for (size_t i = 0; i < size; i++) {
+        if (!std::isspace(sql[i]))
+            compact.push_back(static_cast<char>(std::toupper(sql[i])));
+    }
+    return compact.find("WITHOUTROWID") != std::string::npos;
+}
+
+// Walks the sqlite_master b-tree from page 1 and flags every root page.
+bool walkSchema(ScanState& state, PageSource& source)
+{
+    std::vector<uint32_t> stack = { 1 };
+    std::unordered_set<uint32_t> visited;
+    std::vector<std::vector<unsigned char>> payloads;
+    BTreePage btree;
+    while (!stack.empty()) {
+        const uint32_t pgno = stack.back();
+        stack.pop_back();
+        if (pgno == 0 || pgno > state.pageCount || !visited.insert(pgno).second)
+            return false;
+        const unsigned char* data = source.page(pgno);
+        if (data == nullptr || !btree.parse(data, pgno, state.usableSize) || !isTablePageType(btree.type))
+            return false;
+        if (btree.type == PageTypeTableInterior) {
+            for (const CellInfo& cell : btree.cells) {
+                stack.push_back(cell.leftChild);
+            }
+            stack.push_back(btree.rightChild);
+            continue;
+        }
+        // readPayload may reuse the page buffer, so copy all payloads first.
+        payloads.clear();
+        std::vector<CellInfo> cells = btree.cells;
+        std::vector<unsigned char> pageCopy(data, data + source.pageSize());
+        for (const CellInfo& cell : cells) {
+            payloads.emplace_back();
+            if (!source.readPayload(pageCopy.data(), cell, state.usableSize, payloads.back()))
+                return false;
+        }
+        std::vector<RecordValue> values;
+        for (const auto& payload : payloads) {
+            if (!decodeRecord(payload.data(), payload.size(), values) || values.size() < 5)
+                return false;
+            if (values[3].type != RecordValue::Integer || values[3].integer == 0)
+                continue; // views, triggers
+            const int64_t root = values[3].integer;
+            if (root < 1 || root > static_cast<int64_t>(state.pageCount))
+                return false;
+            bool indexTree = values[0].type == RecordValue::Text && values[0].size == 5
+                             && std::equal(values[0].data, values[0].data + 5, "index");
+            if (!indexTree && values[4].type == RecordValue::Text)
+                indexTree = containsWithoutRowid(values[4].data, values[4].size);
+            state.refFlags[static_cast<uint32_t>(root)].fetch_or(indexTree ? RefIndexRoot : RefTableRoot);
+        }
+    }
+    state.refFlags[1].fetch_or(RefTableRoot);
+    return true;
+}
+
+void walkOverflowChains(ScanState& state, PageSource& source)
+{
+    for (uint32_t head = 1; head <= state.pageCount; head++) {
+        if ((state.refFlags[head].load() & RefOverflow) == 0 || state.kind[head] == KindOverflow)
+            continue;
+        uint32_t cur = head;
+        while (cur != 0) {
+            if (state.kind[cur] == KindFreelistTrunk || state.kind[cur] == KindFreelistLeaf) {
+                state.markBad(cur, "freelist-in-use");
+                break;
+            }
+            uint32_t next = state.next[cur];
+            if (state.kind[cur] == KindBTree) {
+                // Only the first byte made it look like a b-tree page; if nothing else
+                // points at it, it is an overflow page whose next pointer is >= 2^25.
+                const uint8_t flags = state.refFlags[cur].load();
+                if (state.refs[cur].load() != 1 || (flags & (RefTableChild | RefIndexChild | RefTableRoot | RefIndexRoot))) {
+                    state.markBad(cur, "overflow-on-btree");
+                    break;
+                }
+                state.reason[cur] = nullptr;
+                const unsigned char* data = source.page(cur);
+                next = data != nullptr ? readBE32(data) : 0;
+            }
+            state.kind[cur] = KindOverflow;
+            if (next == 0)
+                break;
+            if (next > state.pageCount) {
+                state.markBad(cur, "overflow-pointer");
+                break;
+            }
+            if (state.addRef(next, 0) > 1) {
+                state.markBad(next, "multiple-refs");
+                break;
+            }
+            cur = next;
+        }
+    }
+}
+
+} // namespace
+
+bool fastCheck(const PageFile& file, const FastCheckOptions& options, FastCheckResult& result, std::string& error)
+{
+    result = FastCheckResult();
+
+    // Page 1 first: it tells the page size and usable size of a plaintext file.
+    uint32_t pageSize = options.pageSize;
+    if (options.keys == nullptr) {
+        unsigned char head[DatabaseHeaderSize];
+        DatabaseHeader probe;
+        if (!file.readFully(0, head, sizeof(head)) || !probe.parse(head, sizeof(head))) {
+            error = "not a SQLite database (bad header); pass the cipher options for encrypted files";
+            return false;
+        }
+        pageSize = probe.pageSize;
+    }
+    if (pageSize == 0 || file.size() < pageSize) {
+        error = "file smaller than one page";
+        return false;
+    }
+    PageSource first(file, pageSize, options.keys);
+    PageSource::Status status = PageSource::Status::OK;
+    const unsigned char* page1 = first.page(1, &status);
+    DatabaseHeader header;
+    if (page1 == nullptr || !header.parse(page1, pageSize) || header.pageSize != pageSize) {
+        error = page1 == nullptr ? std::string("page 1 unreadable: ") + reasonForStatus(status)
+                                 : "page 1 header invalid (wrong key or cipher parameters?)";
+        return false;
+    }
+
+    const uint32_t filePages = first.pageCount();
+    uint32_t pageCount = header.pageCount != 0 ? std::min(header.pageCount, filePages) : filePages;
+    ScanState state(pageCount, header.usableSize());
+    if (header.pageCount > filePages)
+        state.markBad(1, "page-count");
+    result.pageSize = pageSize;
+    result.pageCount = pageCount;
+
+    const uint32_t lockByte = lockBytePage(pageSize);
+    if (lockByte <= pageCount)
+        state.kind[lockByte] = KindLockByte;
+    if (header.largestRootPage != 0) {
+        for (uint32_t pgno = 2; pgno <= pageCount; pgno++) {
+            if (isPointerMapPage(pgno, header.usableSize(), pageSize))
+                state.kind[pgno] = KindPointerMap;
+        }
+    }
+    walkFreelist(state, first, header);
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0)
+            threads = 1;
+    }
+    std::vector<std::unique_ptr<PageSource>> sources;
+    std::vector<BTreePage> btrees(static_cast<size_t>(threads));
+    for (int t = 0; t < threads; t++) {
+        sources.emplace_back(new PageSource(file, pageSize, options.keys));
+    }
+    const bool read = readPages(
+    file,
+    pageSize,
+    pageCount,
+    threads,
+    options.io,
+    [&](int worker, uint64_t first, const unsigned char* data, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t pgno = static_cast<uint32_t>(first + i + 1);
+            if (state.kind[pgno] == KindUnknown)
+                scanPage(state, *sources[worker], btrees[worker], data + static_cast<size_t>(i) * pageSize, pgno);
+        }
+        return true;
+    },
+    &result.io,
+    error);
+    if (!read)
+        return false;
+
+    result.schemaReadable = walkSchema(state, first);
+    if (!result.schemaReadable)
+        state.markBad(1, "schema-unreadable");
+    walkOverflowChains(state, first);
+
+    for (uint32_t pgno = 1; pgno <= pageCount; pgno++) {
+        const uint8_t kind = state.kind[pgno];
+        const uint8_t refs = state.refs[pgno].load();
+        const uint8_t flags = state.refFlags[pgno].load();
+        const bool root = (flags & (RefTableRoot | RefIndexRoot)) != 0;
+        const char* why = state.reason[pgno];
+        switch (kind) {
+        case KindFreelistTrunk:
+        case KindFreelistLeaf:
+            result.freelistPages++;
+            if (why == nullptr && (refs > 0 || root))
+                why = "freelist-in-use";
+            break;
+        case KindOverflow:
+            result.overflowPages++;
+            if (why == nullptr && root)
+                why = "root-not-btree";
+            break;
+        case KindBTree: {
+            result.btreePages++;
+            const bool table = isTablePageType(state.btreeType[pgno]);
+            if (why != nullptr)
+                break;
+            if (((flags & RefTableChild) && !table) || ((flags & RefIndexChild) && table)) {
+                why = "child-type";
+            } else if (((flags & RefTableRoot) && !table) || ((flags & RefIndexRoot) && table)) {
+                why = "root-type";
+            } else if (refs > 1 || (refs > 0 && root)) {
+                why = "multiple-refs";
+            } else if (refs == 0 && !root && result.schemaReadable) {
+                why = "never-used";
+                result.orphanPages++;
+            }
+            break;
+        }
+        case KindOther:
+            if (why != nullptr)
+                break;
+            if (root || (flags & (RefTableChild | RefIndexChild))) {
+                why = "page-type";
+            } else if (result.schemaReadable) {
+                why = "never-used";
+                result.orphanPages++;
+            }
+            break;
+        default:
+            break;
+        }
+        if (why != nullptr)
+            result.badPages.push_back({ pgno, why });
+    }
+    result.hmacFailures = state.hmacFailures.load();
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,83 @@
+#include "HmacVerify.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace WCDBRepair {
+
+bool verifyPageHmacs(const PageFile& file,
+                     const CipherKeys& keys,
+                     const HmacVerifyOptions& options,
+                     HmacVerifyResult& result)
+{
+    result = HmacVerifyResult();
+    if (!keys.params.useHmac || keys.params.pageSize <= 0)
+        return false;
+
+    const uint32_t pageSize = static_cast<uint32_t>(keys.params.pageSize);
+    const uint64_t pageCount = file.size() / pageSize;
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0)
+            threads = 1;
+    }
+
+    struct Worker {
+        std::unique_ptr<PageCodec> codec;
+        std::vector<uint32_t> failed;
+        uint64_t zeroPages = 0;
+    };
+    std::vector<Worker> workers(static_cast<size_t>(threads));
+    for (Worker& w : workers) {
+        w.codec.reset(new PageCodec(keys));
+        if (!w.codec->isValid()) {
+            result.error = "cipher setup failed";
+            return false;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool read = readPages(
+    file,
+    pageSize,
+    pageCount,
+    threads,
+    options.io,
+    [&](int worker, uint64_t first, const unsigned char* data, uint32_t count) {
+        Worker& w = workers[static_cast<size_t>(worker)];
+        for (uint32_t i = 0; i < count; i++) {
+            const unsigned char* page = data + static_cast<size_t>(i) * pageSize;
+            const uint32_t pgno = static_cast<uint32_t>(first + i + 1);
+            if (!w.codec->verifyHmac(page, pgno)) {
+                w.failed.push_back(pgno);
+            } else if (page[0] == 0 && isAllZero(page, pageSize)) {
+                w.zeroPages++;
+            }
+        }
+        return true;
+    },
+    &result.io,
+    result.error);
+    if (!read)
+        return false;
+
+    std::vector<uint32_t> failed;
+    uint64_t zeroPages = 0;
+    for (Worker& w : workers) {
+        failed.insert(failed.end(), w.failed.begin(), w.failed.end());
+        zeroPages += w.zeroPages;
+    }
+    std::sort(failed.begin(), failed.end());
+    result.pages = pageCount;
+    result.zeroPages = zeroPages;
+    result.bytes = pageCount * pageSize;
+    result.failedPages = std::move(failed);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "PageReader.hpp"
+#include "Sqlcipher.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+struct HmacVerifyOptions {
+    int threads = 0;    // 0 means hardware concurrency
+    PageReadOptions io; // how the file is read
+};
+
+struct HmacVerifyResult {
+    uint64_t pages = 0;
+    uint64_t zeroPages = 0; // never written, accepted like SQLCipher does
+    uint64_t bytes = 0;
+    double seconds = 0; // wall time of the pass, key derivation excluded
+    std::vector<uint32_t> failedPages; // ascending
+    PageReadStats io;
+    std::string error; // why the pass failed
+};
+
+// Verifies the SQLCipher HMAC of every page without decrypting anything.
+//
+// The file is read in large batches by readPages() (io_uring or a pread pool, kept
+// `io.queueDepth` deep), which worker threads hash with a per-thread keyed HMAC state
+// (the ipad/opad blocks are hashed once per thread, not per page).
+// The hashing itself is OpenSSL's, which dispatches to SHA-NI/AVX2 code where the
+// CPU has it; there is no portable multi-buffer HMAC API to batch lanes further.
+bool verifyPageHmacs(const PageFile& file,
+                     const CipherKeys& keys,
+                     const HmacVerifyOptions& options,
+                     HmacVerifyResult& result);
+
+} // namespace WCDBRepair
@@ -0,0 +1,348 @@
+#include "JobProtocol.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace WCDBRepair {
+
+namespace {
+
+// Just enough JSON for requests: objects, arrays, strings, numbers and literals.
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : m_text(text), m_pos(0) {}
+
+    void skipSpace()
+    {
+        while (m_pos < m_text.size()
+               && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+            m_pos++;
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == c) {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    char peek()
+    {
+        skipSpace();
+        return m_pos < m_text.size() ? m_text[m_pos] : '\0';
+    }
+
+    bool atEnd()
+    {
+        skipSpace();
+        return m_pos == m_text.size();
+    }
+
+    bool readString(std::string& out)
+    {
+        out.clear();
+        if (!consume('"'))
+            return false;
+        while (m_pos < m_text.size()) {
+            const char c = m_text[m_pos++];
+            if (c == '"')
+                return true;
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (m_pos >= m_text.size())
+                return false;
+            const char e = m_text[m_pos++];
+            switch (e) {
+            case '"':
+            case '\\':
+            case '/':
+                out.push_back(e);
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                uint32_t cp = 0;
+                if (!readHex4(cp))
+                    return false;
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    uint32_t low = 0;
+                    if (m_pos + 1 >= m_text.size() || m_text[m_pos] != '\\' || m_text[m_pos + 1] != 'u')
+                        return false;
+                    m_pos += 2;
+                    if (!readHex4(low) || low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // A number literal as written; `integer` is set when it has no fraction or exponent.
+    bool readNumber(std::string& out, bool& integer)
+    {
+        skipSpace();
+        const size_t start = m_pos;
+        integer = true;
+        if (m_pos < m_text.size() && m_text[m_pos] == '-')
+            m_pos++;
+        while (m_pos < m_text.size()) {
+            const char c = m_text[m_pos];
+            if (c >= '0' && c <= '9') {
+                m_pos++;
+            } else if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                integer = false;
+                m_pos++;
+            } else {
+                break;
+            }
+        }
+        out = m_text.substr(start, m_pos - start);
+        return !out.empty() && out != "-";
+    }
+
+    bool readBool(bool& out)
+    {
+        skipSpace();
+        for (const bool value : { true, false }) {
+            const std::string word(value ? "true" : "false");
+            if (m_text.compare(m_pos, word.size(), word) == 0) {
+                m_pos += word.size();
+                out = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool skipValue(int depth = 0)
+    {
+        if (depth > 32)
+            return false;
+        const char c = peek();
+        std::string scratch;
+        if (c == '"')
+            return readString(scratch);
+        if (c == '{' || c == '[') {
+            const char close = c == '{' ? '}' : ']';
+            m_pos++;
+            if (consume(close))
+                return true;
+            do {
+                if (c == '{' && (!readString(scratch) || !consume(':')))
+                    return false;
+                if (!skipValue(depth + 1))
+                    return false;
+            } while (consume(','));
+            return consume(close);
+        }
+        for (const char* literal : { "true", "false", "null" }) {
+            const std::string word(literal);
+            if (m_text.compare(m_pos, word.size(), word) == 0) {
+                m_pos += word.size();
+                return true;
+            }
+        }
+        bool integer = false;
+        return readNumber(scratch, integer);
+    }
+
+private:
+    bool readHex4(uint32_t& out)
+    {
+        if (m_pos + 4 > m_text.size())
+            return false;
+        out = 0;
+        for (int i = 0; i < 4; i++) {
+            const char c = m_text[m_pos++];
+            out <<= 4;
+            if (c >= '0' && c <= '9') {
+                out |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                out |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                out |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    const std::string& m_text;
+    size_t m_pos;
+};
+
+} // namespace
+
+bool readFrame(LocalSocket& socket, std::string& payload, size_t maxLength)
+{
+    unsigned char header[4];
+    if (!socket.readFully(header, sizeof(header)))
+        return false;
+    const size_t length = (static_cast<size_t>(header[0]) << 24) | (static_cast<size_t>(header[1]) << 16)
+                          | (static_cast<size_t>(header[2]) << 8) | static_cast<size_t>(header[3]);
+    if (length > maxLength)
+        return false;
+    payload.resize(length);
+    return length == 0 || socket.readFully(&payload[0], length);
+}
+
+bool writeFrame(LocalSocket& socket, const std::string& payload)
+{
+    // Header and payload in one write: fewer syscalls and no half frame between them.
+    std::string frame;
+    frame.reserve(4 + payload.size());
+    const uint32_t length = static_cast<uint32_t>(payload.size());
+    frame.push_back(static_cast<char>(length >> 24));
+    frame.push_back(static_cast<char>(length >> 16));
+    frame.push_back(static_cast<char>(length >> 8));
+    frame.push_back(static_cast<char>(length));
+    frame += payload;
+    return socket.writeFully(frame.data(), frame.size());
+}
+
+bool parseJobRequest(const std::string& json, JobRequest& request, std::string& why)
+{
+    request = JobRequest();
+    JsonReader in(json);
+    if (!in.consume('{')) {
+        why = "not-an-object";
+        return false;
+    }
+    if (!in.consume('}')) {
+        std::string key;
+        do {
+            if (!in.readString(key) || !in.consume(':')) {
+                why = "bad-json";
+                return false;
+            }
+            bool ok = true;
+            if (key == "id") {
+                bool integer = false;
+                ok = in.peek() == '"' ? in.readString(request.id) : in.readNumber(request.id, integer);
+            } else if (key == "command") {
+                ok = in.readString(request.command);
+            } else if (key == "path") {
+                ok = in.readString(request.path);
+            } else if (key == "target") {
+                bool integer = false;
+                ok = in.peek() == '"' ? in.readString(request.target) : in.readNumber(request.target, integer);
+            } else if (key == "priority") {
+                std::string number;
+                bool integer = false;
+                ok = in.readNumber(number, integer) && integer && number.size() < 10;
+                if (ok)
+                    request.priority = std::atoi(number.c_str());
+            } else if (key == "progress") {
+                ok = in.readBool(request.progress);
+            } else if (key == "args") {
+                ok = in.consume('[');
+                if (ok && !in.consume(']')) {
+                    std::string arg;
+                    do {
+                        ok = in.readString(arg);
+                        if (ok)
+                            request.args.push_back(arg);
+                    } while (ok && in.consume(','));
+                    ok = ok && in.consume(']');
+                }
+            } else {
+                ok = in.skipValue();
+            }
+            if (!ok) {
+                why = "bad-field:" + key;
+                return false;
+            }
+        } while (in.consume(','));
+        if (!in.consume('}')) {
+            why = "bad-json";
+            return false;
+        }
+    }
+    if (!in.atEnd()) {
+        why = "trailing-data";
+        return false;
+    }
+    if (request.id.empty()) {
+        why = "missing-id";
+        return false;
+    }
+    if (request.command.empty()) {
+        why = "missing-command";
+        return false;
+    }
+    return true;
+}
+
+std::string jsonQuote(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size() + 2);
+    appendJsonString(out, s);
+    return out;
+}
+
+void appendJsonString(std::string& out, const char* data, size_t size)
+{
+    out.push_back('"');
+    for (size_t i = 0; i < size; i++) {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(static_cast<char>(c));
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out.push_back(static_cast<char>(c));
+        }
+    }
+    out.push_back('"');
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "LocalSocket.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Wire format of `serve`: every message is a frame of a 4-byte big-endian length
+// followed by that many bytes of UTF-8 JSON, one object per frame, in both directions.
+//
+// Requests:
+//   {"id":"7","command":"repair","path":"C:\\db\\msg.db","priority":10,"progress":true,"args":["--key","..."]}
+//   {"id":"8","command":"cancel","target":"7"}
+// Events (all carry the request id):
+//   queued, started, state/result/output (one "line" of the usual CLI output each),
+//   progress ("data" is the PROGRESS_JSON object; only for jobs that asked for it with
+//   "progress":true or --progress-json), done ("exitCode", "cancelled"), error.
+
+const size_t kMaxJobFrame = 1 << 20;
+
+// False on end of stream, a read error or a frame over `maxLength`.
+bool readFrame(LocalSocket& socket, std::string& payload, size_t maxLength = kMaxJobFrame);
+bool writeFrame(LocalSocket& socket, const std::string& payload);
+
+struct JobRequest {
+    std::string id; // a number is kept as its text
+    std::string command;
+    std::string path;
+    int priority = 0; // higher runs first
+    bool progress = false; // send progress events, as --progress-json does
+    std::vector<std::string> args;
+    std::string target; // cancel: id of the job to stop
+};
+
+// Parses one request object; unknown keys are ignored. `why` names the problem.
+bool parseJobRequest(const std::string& json, JobRequest& request, std::string& why);
+
+// `s` as a JSON string literal, quotes included: `"` and `\` escaped, control characters
+// as \u00XX, everything else (UTF-8 included) as is. Shared by every JSON writer here
+// (serve events, PROGRESS_JSON, trace events, NDJSON export).
+std::string jsonQuote(const std::string& s);
+void appendJsonString(std::string& out, const char* data, size_t size);
+inline void appendJsonString(std::string& out, const std::string& s)
+{
+    appendJsonString(out, s.data(), s.size());
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,233 @@
+// HMAC() is deprecated in OpenSSL 3 but is the API that exists in both 1.1 and 3.x.
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "KeyCache.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr const char* kFileMagic = "WCDBREPAIR-KDF-CACHE 1";
+
+std::string toHex(const unsigned char* data, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(length * 2);
+    for (size_t i = 0; i < length; i++) {
+        out.push_back(digits[data[i] >> 4]);
+        out.push_back(digits[data[i] & 0x0F]);
+    }
+    return out;
+}
+
+bool fromHex(const std::string& hex, unsigned char* out, size_t length)
+{
+    if (hex.size() != length * 2)
+        return false;
+    for (size_t i = 0; i < length; i++) {
+        int v = 0;
+        for (size_t j = 0; j < 2; j++) {
+            const char c = hex[i * 2 + j];
+            int d = -1;
+            if (c >= '0' && c <= '9')
+                d = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                d = 10 + (c - 'a');
+            else if (c >= 'A' && c <= 'F')
+                d = 10 + (c - 'A');
+            if (d < 0)
+                return false;
+            v = (v << 4) | d;
+        }
+        out[i] = static_cast<unsigned char>(v);
+    }
+    return true;
+}
+
+// Creates `path` readable by the owner only (0600 on POSIX; created with O_EXCL, so it is
+// never a file someone else placed there) and writes `content`. On Windows the file
+// inherits the ACL of its directory.
+bool writeOwnerOnly(const std::string& path, const std::string& content)
+{
+#if defined(_WIN32)
+    std::ofstream out(path, std::ios::trunc);
+    return out && out.write(content.data(), static_cast<std::streamsize>(content.size())) && out.flush();
+#else
+    ::unlink(path.c_str()); // left by a save that failed
+    int flags = O_WRONLY | O_CREAT | O_EXCL;
+#if defined(O_CLOEXEC)
+    flags |= O_CLOEXEC;
+#endif
+    const int fd = ::open(path.c_str(), flags, 0600);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < content.size()) {
+        const ssize_t n = ::write(fd, content.data() + done, content.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += static_cast<size_t>(n);
+    }
+    const bool ok = ::close(fd) == 0 && done == content.size();
+    if (!ok)
+        ::unlink(path.c_str());
+    return ok;
+#endif
+}
+
+} // namespace
+
+DerivedKeyCache::DerivedKeyCache(const std::vector<unsigned char>& secret)
+: m_secret(secret), m_hits(0), m_misses(0)
+{
+    static const char label[] = "wcdb-repair kdf cache wrap key";
+    unsigned int len = 0;
+    HMAC(EVP_sha256(),
+         m_secret.data(),
+         static_cast<int>(m_secret.size()),
+         reinterpret_cast<const unsigned char*>(label),
+         sizeof(label) - 1,
+         m_wrapKey,
+         &len);
+}
+
+std::string DerivedKeyCache::entryId(const std::vector<unsigned char>& passphrase,
+                                     const unsigned char* salt,
+                                     HashAlgorithm kdfAlgorithm,
+                                     int kdfIter) const
+{
+    std::vector<unsigned char> material;
+    material.reserve(passphrase.size() + SaltSize + 16);
+    const uint32_t passLen = static_cast<uint32_t>(passphrase.size());
+    for (int i = 0; i < 4; i++) {
+        material.push_back(static_cast<unsigned char>((passLen >> (8 * i)) & 0xFF));
+    }
+    material.insert(material.end(), passphrase.begin(), passphrase.end());
+    material.insert(material.end(), salt, salt + SaltSize);
+    material.push_back(static_cast<unsigned char>(kdfAlgorithm));
+    const uint32_t iter = static_cast<uint32_t>(kdfIter);
+    for (int i = 0; i < 4; i++) {
+        material.push_back(static_cast<unsigned char>((iter >> (8 * i)) & 0xFF));
+    }
+
+    unsigned char mac[32];
+    unsigned int len = 0;
+    HMAC(EVP_sha256(),
+         m_secret.data(),
+         static_cast<int>(m_secret.size()),
+         material.data(),
+         material.size(),
+         mac,
+         &len);
+    return toHex(mac, sizeof(mac));
+}
+
+bool DerivedKeyCache::derive(const std::vector<unsigned char>& passphrase,
+                             const unsigned char* salt,
+                             HashAlgorithm kdfAlgorithm,
+                             int kdfIter,
+                             unsigned char* key,
+                             bool* hit)
+{
+    const std::string id = entryId(passphrase, salt, kdfAlgorithm, kdfIter);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(id);
+        if (it != m_entries.end()) {
+            std::memcpy(key, it->second.data(), KeySize);
+            m_hits++;
+            if (hit != nullptr)
+                *hit = true;
+            return true;
+        }
+    }
+
+    // Derive outside the lock; concurrent misses on the same entry just derive twice.
+    if (!deriveKey(passphrase, salt, kdfAlgorithm, kdfIter, key))
+        return false;
+    m_misses++;
+    if (hit != nullptr)
+        *hit = false;
+    Key value;
+    std::memcpy(value.data(), key, KeySize);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[id] = value;
+    return true;
+}
+
+bool DerivedKeyCache::load(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in)
+        return true;
+    std::string line;
+    if (!std::getline(in, line) || line != kFileMagic)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string id, nonceHex, dataHex, tagHex;
+        if (!(fields >> id >> nonceHex >> dataHex >> tagHex))
+            continue;
+        unsigned char nonce[GcmNonceSize];
+        unsigned char data[KeySize];
+        unsigned char tag[GcmTagSize];
+        Key value;
+        if (!fromHex(nonceHex, nonce, GcmNonceSize) || !fromHex(dataHex, data, KeySize)
+            || !fromHex(tagHex, tag, GcmTagSize)) {
+            continue;
+        }
+        // A wrong secret fails authentication; such entries are ignored.
+        if (!aesGcm(false, m_wrapKey, nonce, id, data, KeySize, value.data(), tag))
+            continue;
+        m_entries[id] = value;
+    }
+    return true;
+}
+
+bool DerivedKeyCache::save(const std::string& path)
+{
+    const std::string tmpPath = path + ".tmp";
+    std::ostringstream out;
+    out << kFileMagic << "\n";
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& entry : m_entries) {
+            unsigned char nonce[GcmNonceSize];
+            unsigned char data[KeySize];
+            unsigned char tag[GcmTagSize];
+            if (RAND_bytes(nonce, static_cast<int>(GcmNonceSize)) != 1
+                || !aesGcm(true, m_wrapKey, nonce, entry.first, entry.second.data(), KeySize, data, tag)) {
+                return false;
+            }
+            out << entry.first << " " << toHex(nonce, GcmNonceSize) << " " << toHex(data, KeySize) << " "
+                << toHex(tag, GcmTagSize) << "\n";
+        }
+    }
+    if (!writeOwnerOnly(tmpPath, out.str()))
+        return false;
+    // std::rename does not replace an existing file on Windows.
+    std::remove(path.c_str());
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+} // namespace WCDBRepair
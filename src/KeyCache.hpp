@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Sqlcipher.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Cache of PBKDF2 results keyed by (passphrase, salt, kdf algorithm, kdf_iter).
+//
+// Entries are indexed by HMAC-SHA256(secret, passphrase | salt | algorithm | iter),
+// so neither the passphrase nor the salt is kept in the index. The optional
+// on-disk file stores each derived key AES-256-GCM encrypted under the secret;
+// without the secret the file is useless, with it an attacker skips PBKDF2, so the
+// secret must be protected like the database key itself.
+class DerivedKeyCache {
+public:
+    explicit DerivedKeyCache(const std::vector<unsigned char>& secret = std::vector<unsigned char>());
+
+    // Returns the derived key, running PBKDF2 only on a cache miss.
+    bool derive(const std::vector<unsigned char>& passphrase,
+                const unsigned char* salt,
+                HashAlgorithm kdfAlgorithm,
+                int kdfIter,
+                unsigned char* key /* KeySize */,
+                bool* hit = nullptr);
+
+    // Merges entries from an encrypted cache file. A missing file is not an error.
+    bool load(const std::string& path);
+    // Writes all entries (to an owner-only temp file, then replace).
+    bool save(const std::string& path);
+
+    uint64_t hits() const { return m_hits.load(); }
+    uint64_t misses() const { return m_misses.load(); }
+
+private:
+    typedef std::array<unsigned char, KeySize> Key;
+
+    std::string entryId(const std::vector<unsigned char>& passphrase,
+                        const unsigned char* salt,
+                        HashAlgorithm kdfAlgorithm,
+                        int kdfIter) const;
+
+    std::vector<unsigned char> m_secret;
+    unsigned char m_wrapKey[KeySize];
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Key> m_entries;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+} // namespace WCDBRepair
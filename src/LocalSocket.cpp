@@ -0,0 +1,266 @@
+#include "LocalSocket.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <afunix.h>
+#include <mutex>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+#if defined(_WIN32)
+typedef SOCKET Native;
+const uintptr_t kInvalid = static_cast<uintptr_t>(INVALID_SOCKET);
+
+Native native(uintptr_t s)
+{
+    return static_cast<Native>(s);
+}
+
+bool startup()
+{
+    static std::once_flag once;
+    static bool ok = false;
+    std::call_once(once, [] {
+        WSADATA data;
+        ok = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    });
+    return ok;
+}
+
+void closeNative(Native s)
+{
+    closesocket(s);
+}
+
+int pollOne(Native s, int timeoutMs)
+{
+    WSAPOLLFD fd = {};
+    fd.fd = s;
+    fd.events = POLLRDNORM;
+    return WSAPoll(&fd, 1, timeoutMs);
+}
+#else
+typedef int Native;
+const int kInvalid = -1;
+
+Native native(int s)
+{
+    return s;
+}
+
+bool startup()
+{
+    return true;
+}
+
+void closeNative(Native s)
+{
+    ::close(s);
+}
+
+int pollOne(Native s, int timeoutMs)
+{
+    struct pollfd fd;
+    fd.fd = s;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    int rc;
+    do {
+        rc = ::poll(&fd, 1, timeoutMs);
+    } while (rc < 0 && errno == EINTR);
+    return rc;
+}
+#endif
+
+bool makeAddress(const std::string& path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        return false;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// A socket file that still accepts connections belongs to a running daemon.
+bool isServing(const sockaddr_un& address)
+{
+    Native s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == native(kInvalid))
+        return false;
+    const bool serving = connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    closeNative(s);
+    return serving;
+}
+
+} // namespace
+
+LocalSocket::LocalSocket()
+: m_socket(kInvalid)
+{
+}
+
+LocalSocket::~LocalSocket()
+{
+    close();
+}
+
+bool LocalSocket::listen(const std::string& path, std::string& why)
+{
+    close();
+    sockaddr_un address;
+    if (!makeAddress(path, address)) {
+        why = "path-too-long";
+        return false;
+    }
+    if (!startup()) {
+        why = "winsock";
+        return false;
+    }
+    if (isServing(address)) {
+        why = "in-use";
+        return false;
+    }
+    std::remove(path.c_str());
+
+    Native s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == native(kInvalid)) {
+        why = "socket";
+        return false;
+    }
+#if !defined(_WIN32)
+    // Jobs carry database keys: no other user may connect.
+    const mode_t mask = umask(0077);
+#endif
+    const bool bound = bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+#if !defined(_WIN32)
+    umask(mask);
+#endif
+    if (!bound || ::listen(s, 16) != 0) {
+        why = bound ? "listen" : "bind";
+        closeNative(s);
+        return false;
+    }
+    m_socket = s;
+    m_listenPath = path;
+    return true;
+}
+
+bool LocalSocket::accept(int timeoutMs, LocalSocket& client)
+{
+    client.close();
+    if (!isOpen() || pollOne(native(m_socket), timeoutMs) <= 0)
+        return false;
+    Native s = ::accept(native(m_socket), nullptr, nullptr);
+    if (s == native(kInvalid))
+        return false;
+#if defined(SO_NOSIGPIPE)
+    const int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    client.m_socket = s;
+    return true;
+}
+
+bool LocalSocket::connect(const std::string& path)
+{
+    close();
+    sockaddr_un address;
+    if (!makeAddress(path, address) || !startup())
+        return false;
+    Native s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == native(kInvalid))
+        return false;
+    if (::connect(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        closeNative(s);
+        return false;
+    }
+#if defined(SO_NOSIGPIPE)
+    const int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    m_socket = s;
+    return true;
+}
+
+bool LocalSocket::waitReadable(int timeoutMs) const
+{
+    return isOpen() && pollOne(native(m_socket), timeoutMs) > 0;
+}
+
+bool LocalSocket::readFully(void* buffer, size_t length)
+{
+    char* at = static_cast<char*>(buffer);
+    while (length > 0) {
+        const int chunk = static_cast<int>(length < (1u << 30) ? length : (1u << 30));
+        const auto n = recv(native(m_socket), at, chunk, 0);
+        if (n == 0)
+            return false; // peer closed
+        if (n < 0) {
+#if !defined(_WIN32)
+            if (errno == EINTR)
+                continue;
+#endif
+            return false;
+        }
+        at += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool LocalSocket::writeFully(const void* buffer, size_t length)
+{
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL; // a client that went away must not kill the daemon
+#else
+    const int flags = 0;
+#endif
+    const char* at = static_cast<const char*>(buffer);
+    while (length > 0) {
+        const int chunk = static_cast<int>(length < (1u << 30) ? length : (1u << 30));
+        const auto n = send(native(m_socket), at, chunk, flags);
+        if (n <= 0) {
+#if !defined(_WIN32)
+            if (n < 0 && errno == EINTR)
+                continue;
+#endif
+            return false;
+        }
+        at += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void LocalSocket::close()
+{
+    if (m_socket != kInvalid) {
+        closeNative(native(m_socket));
+        m_socket = kInvalid;
+    }
+    if (!m_listenPath.empty()) {
+        std::remove(m_listenPath.c_str());
+        m_listenPath.clear();
+    }
+}
+
+bool LocalSocket::isOpen() const
+{
+    return m_socket != kInvalid;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace WCDBRepair {
+
+// Stream socket bound to a filesystem path (AF_UNIX; on Windows 10 1803+ through
+// afunix.h). Just what the serve daemon needs: one listener and blocking client sockets
+// that a single reader and a single (locked) writer use at the same time.
+class LocalSocket {
+public:
+    LocalSocket();
+    ~LocalSocket();
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    // Listens on `path`. A socket file left by a daemon that died is replaced; one that
+    // still accepts connections is not ("in-use"). The file is owner-only on POSIX and
+    // removed by close().
+    bool listen(const std::string& path, std::string& why);
+
+    // Waits up to `timeoutMs` for a client; false on timeout or error.
+    bool accept(int timeoutMs, LocalSocket& client);
+
+    // Client side: connects to the daemon listening on `path`.
+    bool connect(const std::string& path);
+
+    // True when data or end of stream arrived within `timeoutMs`.
+    bool waitReadable(int timeoutMs) const;
+
+    // Read/write exactly `length` bytes or fail (end of stream, error, peer gone).
+    bool readFully(void* buffer, size_t length);
+    bool writeFully(const void* buffer, size_t length);
+
+    void close();
+    bool isOpen() const;
+
+private:
+#if defined(_WIN32)
+    uintptr_t m_socket; // SOCKET
+#else
+    int m_socket;
+#endif
+    std::string m_listenPath;
+};
+
+} // namespace WCDBRepair
@@ -0,0 +1,591 @@
+// HMAC() is deprecated in OpenSSL 3 but is the API that exists in both 1.1 and 3.x.
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "Material.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#if defined(WCDBREPAIR_ZSTD)
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr char kMagic[8] = { 'W', 'C', 'D', 'B', 'R', 'M', 'A', 'T' };
+constexpr uint32_t kVersion = 2; // 1: page lists as plain u32
+constexpr uint32_t kFlagEncrypted = 1;
+constexpr uint32_t kFlagCompressed = 2;
+constexpr int kCompressionLevel = 6;
+constexpr size_t kDictionaryCapacity = 16 << 10;
+constexpr uint64_t kMaxBodySize = 1ull << 34; // sanity bound before allocating
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+class Writer {
+public:
+    void u32(uint32_t v)
+    {
+        for (int i = 0; i < 4; i++) {
+            m_data.push_back(static_cast<unsigned char>(v >> (8 * i)));
+        }
+    }
+    void u64(uint64_t v)
+    {
+        for (int i = 0; i < 8; i++) {
+            m_data.push_back(static_cast<unsigned char>(v >> (8 * i)));
+        }
+    }
+    void varint(uint64_t v)
+    {
+        while (v >= 0x80) {
+            m_data.push_back(static_cast<unsigned char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        m_data.push_back(static_cast<unsigned char>(v));
+    }
+    void str(const std::string& s)
+    {
+        u32(static_cast<uint32_t>(s.size()));
+        m_data.insert(m_data.end(), s.begin(), s.end());
+    }
+    std::vector<unsigned char>& data() { return m_data; }
+
+private:
+    std::vector<unsigned char> m_data;
+};
+
+class Reader {
+public:
+    Reader(const unsigned char* p, size_t n) : m_p(p), m_end(p + n) {}
+    bool u32(uint32_t& v)
+    {
+        if (m_end - m_p < 4)
+            return false;
+        v = 0;
+        for (int i = 0; i < 4; i++) {
+            v |= static_cast<uint32_t>(m_p[i]) << (8 * i);
+        }
+        m_p += 4;
+        return true;
+    }
+    bool u64(uint64_t& v)
+    {
+        if (m_end - m_p < 8)
+            return false;
+        v = 0;
+        for (int i = 0; i < 8; i++) {
+            v |= static_cast<uint64_t>(m_p[i]) << (8 * i);
+        }
+        m_p += 8;
+        return true;
+    }
+    bool varint(uint64_t& v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64 && m_p < m_end; shift += 7) {
+            const unsigned char c = *m_p++;
+            v |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (c < 0x80)
+                return true;
+        }
+        return false;
+    }
+    bool str(std::string& s)
+    {
+        uint32_t n = 0;
+        if (!u32(n) || static_cast<size_t>(m_end - m_p) < n)
+            return false;
+        s.assign(reinterpret_cast<const char*>(m_p), n);
+        m_p += n;
+        return true;
+    }
+    size_t remaining() const { return static_cast<size_t>(m_end - m_p); }
+
+private:
+    const unsigned char* m_p;
+    const unsigned char* m_end;
+};
+
+void materialKey(const CipherKeys& keys, unsigned char* out /* KeySize */)
+{
+    static const char label[] = "wcdb-repair material key";
+    unsigned int len = 0;
+    HMAC(EVP_sha256(),
+         keys.key,
+         static_cast<int>(KeySize),
+         reinterpret_cast<const unsigned char*>(label),
+         sizeof(label) - 1,
+         out,
+         &len);
+}
+
+// One tree as the body stores it; also a sample for dictionary training.
+void writeTree(Writer& out, const MaterialTree& tree)
+{
+    out.str(tree.entry.type);
+    out.str(tree.entry.name);
+    out.str(tree.entry.tableName);
+    out.str(tree.entry.sql);
+    out.u32(tree.entry.rootPage);
+    out.u32(static_cast<uint32_t>(tree.pages.size()));
+    // Key order follows allocation order closely, so most deltas fit in a byte.
+    int64_t previous = 0;
+    for (uint32_t pgno : tree.pages) {
+        const int64_t delta = static_cast<int64_t>(pgno) - previous;
+        out.varint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        previous = pgno;
+    }
+}
+
+bool readTree(Reader& in, uint32_t version, MaterialTree& tree)
+{
+    uint32_t count = 0;
+    if (!in.str(tree.entry.type) || !in.str(tree.entry.name) || !in.str(tree.entry.tableName)
+        || !in.str(tree.entry.sql) || !in.u32(tree.entry.rootPage) || !in.u32(count))
+        return false;
+    if (in.remaining() / (version == 1 ? 4 : 1) < count)
+        return false;
+    tree.pages.resize(count);
+    int64_t previous = 0;
+    for (uint32_t& pgno : tree.pages) {
+        if (version == 1) {
+            in.u32(pgno);
+            continue;
+        }
+        uint64_t zigzag = 0;
+        if (!in.varint(zigzag))
+            return false;
+        previous += static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        pgno = static_cast<uint32_t>(previous);
+    }
+    return true;
+}
+
+#if defined(WCDBREPAIR_ZSTD)
+uint32_t dictionaryId(const std::vector<unsigned char>& dictionary)
+{
+    return dictionary.empty() ? 0 : ZDICT_getDictID(dictionary.data(), dictionary.size());
+}
+#endif
+
+
+} // namespace
+
+uint64_t hashPage(const unsigned char* data, size_t length)
+{
+    // MurmurHash3-style mixing over 64-bit words; pages are always a multiple of 8 bytes.
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    uint64_t h = length;
+    for (size_t i = 0; i + 8 <= length; i += 8) {
+        uint64_t k = 0;
+        std::memcpy(&k, data + i, 8);
+        k *= c1;
+        k = rotl(k, 31);
+        k *= c2;
+        h ^= k;
+        h = rotl(h, 27) * 5 + 0x52dce729;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+bool hashPages(const PageFile& file,
+               uint32_t pageSize,
+               int threads,
+               const PageReadOptions& io,
+               std::vector<uint64_t>& hashes,
+               PageReadStats* ioStats)
+{
+    if (pageSize == 0)
+        return false;
+    const uint64_t pageCount = file.size() / pageSize;
+    hashes.assign(static_cast<size_t>(pageCount), 0);
+    std::string error;
+    return readPages(
+    file,
+    pageSize,
+    pageCount,
+    threads,
+    io,
+    [&](int, uint64_t first, const unsigned char* data, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            hashes[static_cast<size_t>(first + i)] = hashPage(data + static_cast<size_t>(i) * pageSize, pageSize);
+        }
+        return true;
+    },
+    ioStats,
+    error);
+}
+
+bool updateMaterial(const PageFile& file,
+                    Salvager& salvager,
+                    const Material* previous,
+                    int threads,
+                    const PageReadOptions& io,
+                    Material& out,
+                    IncrementalStats& stats)
+{
+    stats = IncrementalStats();
+    out = Material();
+    out.pageSize = salvager.pageSize();
+    if (!hashPages(file, out.pageSize, threads, io, out.pageHashes, &stats.io))
+        return false;
+    stats.pageCount = static_cast<uint32_t>(out.pageHashes.size());
+    if (previous != nullptr && previous->pageSize != out.pageSize)
+        previous = nullptr;
+
+    std::vector<bool> changed(out.pageHashes.size() + 1, true);
+    for (size_t i = 0; i < out.pageHashes.size(); i++) {
+        changed[i + 1] = previous == nullptr || i >= previous->pageHashes.size()
+                         || previous->pageHashes[i] != out.pageHashes[i];
+        if (changed[i + 1])
+            stats.changedPages++;
+    }
+
+    std::vector<SchemaEntry> schema;
+    salvager.readSchema(schema);
+    if (schema.empty() && previous != nullptr && !previous->trees.empty())
+        return false; // sqlite_master unreadable now; keep the old material
+    for (const SchemaEntry& entry : schema) {
+        if (entry.rootPage == 0 || (entry.type != "table" && entry.type != "index"))
+            continue;
+        MaterialTree tree;
+        tree.entry = entry;
+
+        // A tree whose pages are all unchanged still has exactly those pages: adding or
+        // removing a page always rewrites its parent.
+        const MaterialTree* old = nullptr;
+        if (previous != nullptr) {
+            for (const MaterialTree& candidate : previous->trees) {
+                if (candidate.entry.type == entry.type && candidate.entry.name == entry.name
+                    && candidate.entry.rootPage == entry.rootPage && candidate.entry.sql == entry.sql) {
+                    old = &candidate;
+                    break;
+                }
+            }
+        }
+        bool reuse = old != nullptr && !old->pages.empty();
+        for (size_t i = 0; reuse && i < old->pages.size(); i++) {
+            const uint32_t pgno = old->pages[i];
+            reuse = pgno < changed.size() && !changed[pgno];
+        }
+        if (reuse) {
+            tree.pages = old->pages;
+            stats.reusedTrees++;
+        } else {
+            // WITHOUT ROWID tables are index b-trees.
+            const bool indexTree = entry.type == "index" || isWithoutRowidTable(entry.sql);
+            if (!salvager.collectTreePages(entry.rootPage, indexTree, tree.pages))
+                stats.damagedTrees++;
+            stats.walkedTrees++;
+        }
+        out.trees.push_back(std::move(tree));
+    }
+    return true;
+}
+
+bool Material::save(const std::string& path,
+                    const CipherKeys* keys,
+                    const std::vector<unsigned char>& dictionary,
+                    uint64_t* storedBytes,
+                    uint64_t* rawBytes) const
+{
+    Writer body;
+    body.u32(pageSize);
+    body.u32(static_cast<uint32_t>(pageHashes.size()));
+    for (uint64_t h : pageHashes) {
+        body.u64(h);
+    }
+    body.u32(static_cast<uint32_t>(trees.size()));
+    for (const MaterialTree& tree : trees) {
+        writeTree(body, tree);
+    }
+    std::vector<unsigned char>& data = body.data();
+    if (rawBytes != nullptr)
+        *rawBytes = data.size();
+
+    uint32_t flags = keys != nullptr ? kFlagEncrypted : 0;
+    Writer header;
+    header.data().assign(kMagic, kMagic + sizeof(kMagic));
+    header.u32(kVersion);
+#if defined(WCDBREPAIR_ZSTD)
+    {
+        // Compressed before sealing: ciphertext does not compress.
+        std::vector<unsigned char> packed(ZSTD_compressBound(data.size()));
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        if (cctx == nullptr)
+            return false;
+        const size_t size = dictionary.empty()
+                            ? ZSTD_compressCCtx(cctx, packed.data(), packed.size(), data.data(), data.size(), kCompressionLevel)
+                            : ZSTD_compress_usingDict(cctx,
+                                                      packed.data(),
+                                                      packed.size(),
+                                                      data.data(),
+                                                      data.size(),
+                                                      dictionary.data(),
+                                                      dictionary.size(),
+                                                      kCompressionLevel);
+        ZSTD_freeCCtx(cctx);
+        if (ZSTD_isError(size))
+            return false;
+        packed.resize(size);
+        flags |= kFlagCompressed;
+        header.u32(flags);
+        header.u32(dictionaryId(dictionary));
+        header.u64(data.size());
+        data.swap(packed);
+    }
+#else
+    (void) dictionary;
+    header.u32(flags);
+#endif
+    if (keys != nullptr) {
+        unsigned char key[KeySize];
+        unsigned char nonce[GcmNonceSize];
+        unsigned char tag[GcmTagSize];
+        std::vector<unsigned char> sealed(data.size());
+        materialKey(*keys, key);
+        if (RAND_bytes(nonce, static_cast<int>(GcmNonceSize)) != 1
+            || !aesGcm(true, key, nonce, std::string(), data.data(), data.size(), sealed.data(), tag))
+            return false;
+        header.data().insert(header.data().end(), nonce, nonce + GcmNonceSize);
+        header.data().insert(header.data().end(), tag, tag + GcmTagSize);
+        data.swap(sealed);
+    }
+
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(header.data().data()), static_cast<std::streamsize>(header.data().size()));
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!out.flush())
+            return false;
+    }
+    if (storedBytes != nullptr)
+        *storedBytes = header.data().size() + data.size();
+    // std::rename does not replace an existing file on Windows.
+    std::remove(path.c_str());
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+bool Material::load(const std::string& path,
+                    const CipherKeys* keys,
+                    std::string& error,
+                    const std::vector<unsigned char>& dictionary)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "missing";
+        return false;
+    }
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (file.size() < sizeof(kMagic) || std::memcmp(file.data(), kMagic, sizeof(kMagic)) != 0) {
+        error = "not-a-material";
+        return false;
+    }
+    Reader header(file.data() + sizeof(kMagic), file.size() - sizeof(kMagic));
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    if (!header.u32(version) || !header.u32(flags) || version < 1 || version > kVersion) {
+        error = "unsupported-version";
+        return false;
+    }
+    size_t offset = sizeof(kMagic) + 8;
+    uint32_t dictId = 0;
+    uint64_t bodySize = 0;
+    if ((flags & kFlagCompressed) != 0) {
+        if (!header.u32(dictId) || !header.u64(bodySize) || bodySize > kMaxBodySize) {
+            error = "truncated";
+            return false;
+        }
+        offset += 12;
+    }
+    std::vector<unsigned char> plain;
+    if ((flags & kFlagEncrypted) != 0) {
+        if (keys == nullptr) {
+            error = "needs-key";
+            return false;
+        }
+        if (file.size() < offset + GcmNonceSize + GcmTagSize) {
+            error = "truncated";
+            return false;
+        }
+        unsigned char key[KeySize];
+        materialKey(*keys, key);
+        const unsigned char* nonce = file.data() + offset;
+        unsigned char tag[GcmTagSize];
+        std::memcpy(tag, file.data() + offset + GcmNonceSize, GcmTagSize);
+        offset += GcmNonceSize + GcmTagSize;
+        plain.resize(file.size() - offset);
+        if (!aesGcm(false, key, nonce, std::string(), file.data() + offset, plain.size(), plain.data(), tag)) {
+            error = "wrong-key";
+            return false;
+        }
+    } else {
+        plain.assign(file.begin() + static_cast<std::ptrdiff_t>(offset), file.end());
+    }
+    if ((flags & kFlagCompressed) != 0) {
+#if defined(WCDBREPAIR_ZSTD)
+        if (dictId != 0 && dictionary.empty()) {
+            error = "needs-dictionary";
+            return false;
+        }
+        if (dictId != 0 && dictionaryId(dictionary) != dictId) {
+            error = "wrong-dictionary";
+            return false;
+        }
+        std::vector<unsigned char> unpacked(static_cast<size_t>(bodySize));
+        ZSTD_DCtx* dctx = ZSTD_createDCtx();
+        if (dctx == nullptr) {
+            error = "out-of-memory";
+            return false;
+        }
+        const size_t size = dictId != 0 ? ZSTD_decompress_usingDict(dctx,
+                                                                    unpacked.data(),
+                                                                    unpacked.size(),
+                                                                    plain.data(),
+                                                                    plain.size(),
+                                                                    dictionary.data(),
+                                                                    dictionary.size())
+                                        : ZSTD_decompressDCtx(dctx, unpacked.data(), unpacked.size(), plain.data(), plain.size());
+        ZSTD_freeDCtx(dctx);
+        if (ZSTD_isError(size) || size != bodySize) {
+            error = "corrupt";
+            return false;
+        }
+        plain.swap(unpacked);
+#else
+        (void) dictionary;
+        error = "needs-zstd";
+        return false;
+#endif
+    }
+
+    Reader body(plain.data(), plain.size());
+    uint32_t pages = 0;
+    uint32_t treeCount = 0;
+    Material parsed;
+    if (!body.u32(parsed.pageSize) || !body.u32(pages) || body.remaining() / 8 < pages) {
+        error = "truncated";
+        return false;
+    }
+    parsed.pageHashes.resize(pages);
+    for (uint64_t& h : parsed.pageHashes) {
+        body.u64(h);
+    }
+    if (!body.u32(treeCount)) {
+        error = "truncated";
+        return false;
+    }
+    for (uint32_t t = 0; t < treeCount; t++) {
+        MaterialTree tree;
+        if (!readTree(body, version, tree)) {
+            error = "truncated";
+            return false;
+        }
+        parsed.trees.push_back(std::move(tree));
+    }
+    *this = std::move(parsed);
+    return true;
+}
+
+bool materialCompressionAvailable()
+{
+#if defined(WCDBREPAIR_ZSTD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool trainMaterialDictionary(const Material& material, std::vector<unsigned char>& dictionary, std::string& error)
+{
+#if defined(WCDBREPAIR_ZSTD)
+    // The page hashes are random and would only dilute it.
+    Writer samples;
+    std::vector<size_t> sizes;
+    for (const MaterialTree& tree : material.trees) {
+        const size_t before = samples.data().size();
+        writeTree(samples, tree);
+        sizes.push_back(samples.data().size() - before);
+    }
+    dictionary.resize(kDictionaryCapacity);
+    const size_t size = ZDICT_trainFromBuffer(
+    dictionary.data(), dictionary.size(), samples.data().data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        dictionary.clear();
+        error = ZDICT_getErrorName(size);
+        return false;
+    }
+    dictionary.resize(size);
+    return true;
+#else
+    (void) material;
+    dictionary.clear();
+    error = "built without zstd";
+    return false;
+#endif
+}
+
+bool loadMaterialDictionary(const std::string& path, std::vector<unsigned char>& dictionary, std::string& error)
+{
+    dictionary.clear();
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "cannot open";
+        return false;
+    }
+    dictionary.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (dictionary.empty()) {
+        error = "empty";
+        return false;
+    }
+#if defined(WCDBREPAIR_ZSTD)
+    // zstd would take any other file as raw content, but the header records the dictionary
+    // by its ID, and with ID 0 the material would be read back without it.
+    if (dictionaryId(dictionary) == 0) {
+        dictionary.clear();
+        error = "not a trained zstd dictionary";
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool saveMaterialDictionary(const std::string& path, const std::vector<unsigned char>& dictionary)
+{
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(dictionary.data()), static_cast<std::streamsize>(dictionary.size()));
+        if (!out.flush())
+            return false;
+    }
+    std::remove(path.c_str());
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+} // namespace WCDBRepair
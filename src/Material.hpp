@@ -0,0 +1,98 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "PageReader.hpp"
+#include "Salvage.hpp"
+#include "Sqlcipher.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// One b-tree of sqlite_master with the pages it had when the material was taken.
+struct MaterialTree {
+    SchemaEntry entry;
+    std::vector<uint32_t> pages; // key order
+};
+
+// Incremental backup material kept next to the database: a hash of every page plus
+// the schema and page list of every b-tree. `salvage --material` uses it to recover
+// schema and page ownership when sqlite_master or interior pages are lost.
+//
+// File format (little-endian): "WCDBRMAT", u32 version, u32 flags, [u32 dictId,
+// u64 bodySize when compressed], body. When the database is encrypted (flag 1) the
+// body is AES-256-GCM sealed (nonce, tag, data) under a key derived from the database
+// key, like WCDB encrypts its own material. With flag 2 the body is one zstd frame,
+// compressed before sealing, with the dictionary of `dictId` unless that is 0.
+// Body: u32 pageSize, u32 pageCount, u64 hash[pageCount], u32 treeCount, trees; a tree
+// is its entry (type, name, tableName, sql as u32 length + bytes, u32 rootPage) and
+// u32 pageCount + pages, which version 2 stores as zigzag varint deltas.
+struct Material {
+    uint32_t pageSize = 0;
+    std::vector<uint64_t> pageHashes; // [pgno - 1], hash of the on-disk bytes
+    std::vector<MaterialTree> trees;
+
+    // A missing file is an error; `error` tells which. `dictionary` is needed for
+    // material compressed with one ("needs-dictionary" otherwise).
+    bool load(const std::string& path,
+              const CipherKeys* keys,
+              std::string& error,
+              const std::vector<unsigned char>& dictionary = std::vector<unsigned char>());
+    // Writes to a temporary file, then replaces `path`. Compressed when built with zstd,
+    // with `dictionary` if it is not empty. `storedBytes` / `rawBytes` receive the file
+    // size and the size of the uncompressed body.
+    bool save(const std::string& path,
+              const CipherKeys* keys,
+              const std::vector<unsigned char>& dictionary = std::vector<unsigned char>(),
+              uint64_t* storedBytes = nullptr,
+              uint64_t* rawBytes = nullptr) const;
+};
+
+// Whether material is written compressed (the build has zstd).
+bool materialCompressionAvailable();
+
+// Trains a zstd dictionary on the b-tree entries of `material`: databases with the same
+// schema share most of those bytes, so their material compresses better with it.
+bool trainMaterialDictionary(const Material& material, std::vector<unsigned char>& dictionary, std::string& error);
+
+// Fails, with `error` telling why, unless `path` holds a dictionary trained by zstd
+// (one with a dictionary ID; material records which one it was written with).
+bool loadMaterialDictionary(const std::string& path, std::vector<unsigned char>& dictionary, std::string& error);
+bool saveMaterialDictionary(const std::string& path, const std::vector<unsigned char>& dictionary);
+
+struct IncrementalStats {
+    uint32_t pageCount = 0;
+    uint64_t changedPages = 0;
+    uint64_t walkedTrees = 0;  // re-walked because one of their pages changed
+    uint64_t reusedTrees = 0;  // copied from the previous material
+    uint64_t damagedTrees = 0; // walk hit an unusable page
+    PageReadStats io;          // how the pages were read for hashing
+};
+
+// 64-bit non-cryptographic hash of a page (change detection only).
+uint64_t hashPage(const unsigned char* data, size_t length);
+
+// Hashes every page of the file on `threads` threads (0 = hardware concurrency), with
+// the pages read through readPages().
+bool hashPages(const PageFile& file,
+               uint32_t pageSize,
+               int threads,
+               const PageReadOptions& io,
+               std::vector<uint64_t>& hashes,
+               PageReadStats* ioStats = nullptr);
+
+// Builds `out` for the current file. Pages are rehashed in parallel; b-trees none of
+// whose pages changed are taken over from `previous` (may be nullptr), all others
+// (and sqlite_master itself) are walked again. Fails rather than dropping every tree
+// of `previous` when sqlite_master cannot be read.
+bool updateMaterial(const PageFile& file,
+                    Salvager& salvager,
+                    const Material* previous,
+                    int threads,
+                    const PageReadOptions& io,
+                    Material& out,
+                    IncrementalStats& stats);
+
+} // namespace WCDBRepair
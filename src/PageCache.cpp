@@ -0,0 +1,250 @@
+#include "PageCache.hpp"
+
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+#define WCDBREPAIR_FADVISE 1
+#endif
+
+namespace WCDBRepair {
+
+bool parseIoPolicy(const std::string& name, IoPolicy& policy)
+{
+    if (name == "default") {
+        policy = IoPolicy::Default;
+    } else if (name == "sequential") {
+        policy = IoPolicy::Sequential;
+    } else if (name == "dontneed") {
+        policy = IoPolicy::DontNeed;
+    } else if (name == "direct") {
+        policy = IoPolicy::Direct;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ioPolicyName(IoPolicy policy)
+{
+    switch (policy) {
+    case IoPolicy::Default:
+        return "default";
+    case IoPolicy::Sequential:
+        return "sequential";
+    case IoPolicy::DontNeed:
+        return "dontneed";
+    case IoPolicy::Direct:
+        return "direct";
+    }
+    return "";
+}
+
+bool pageCacheAdviceAvailable()
+{
+#if defined(WCDBREPAIR_FADVISE)
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if defined(WCDBREPAIR_FADVISE)
+
+void adviseSequential(int fd, bool sequential)
+{
+    posix_fadvise(fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+}
+
+void adviseWillNeed(int fd, uint64_t offset, uint64_t length)
+{
+    if (length > 0)
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+}
+
+bool CacheResidency::take(int fd, uint64_t size)
+{
+    m_kept.clear();
+    if (size == 0)
+        return true;
+#if defined(__linux__)
+    // Mapping the file faults nothing in; mincore() only reports what is cached.
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0)
+        return false;
+    void* map = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    const uint64_t pages = (size + pageSize - 1) / pageSize;
+    std::vector<unsigned char> resident(static_cast<size_t>(pages));
+    const bool ok = mincore(map, static_cast<size_t>(size), resident.data()) == 0;
+    munmap(map, static_cast<size_t>(size));
+    if (!ok)
+        return false;
+    m_kept.assign(static_cast<size_t>((size + kChunkBytes - 1) / kChunkBytes), false);
+    for (uint64_t page = 0; page < pages; page++) {
+        if ((resident[static_cast<size_t>(page)] & 1) != 0)
+            m_kept[static_cast<size_t>(page * pageSize / kChunkBytes)] = true;
+    }
+    return true;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+void CacheResidency::drop(int fd, uint64_t offset, uint64_t length) const
+{
+    if (length == 0)
+        return;
+    // Runs of chunks that are not kept; chunks past the snapshot (the file grew) are new.
+    const uint64_t end = offset + length;
+    const uint64_t lastChunk = (end + kChunkBytes - 1) / kChunkBytes;
+    uint64_t chunk = offset / kChunkBytes;
+    while (chunk < lastChunk) {
+        while (chunk < lastChunk && chunk < m_kept.size() && m_kept[static_cast<size_t>(chunk)]) {
+            chunk++;
+        }
+        const uint64_t runStart = chunk;
+        while (chunk < lastChunk && (chunk >= m_kept.size() || !m_kept[static_cast<size_t>(chunk)])) {
+            chunk++;
+        }
+        if (chunk > runStart) {
+            const uint64_t from = std::max(offset, runStart * kChunkBytes);
+            const uint64_t to = std::min(end, chunk * kChunkBytes);
+            posix_fadvise(fd, static_cast<off_t>(from), static_cast<off_t>(to - from), POSIX_FADV_DONTNEED);
+        }
+    }
+}
+
+#else
+
+void adviseSequential(int, bool)
+{
+}
+
+void adviseWillNeed(int, uint64_t, uint64_t)
+{
+}
+
+bool CacheResidency::take(int, uint64_t)
+{
+    return false;
+}
+
+void CacheResidency::drop(int, uint64_t, uint64_t) const
+{
+}
+
+#endif
+
+CacheGuard::CacheGuard(const std::vector<std::string>& files,
+                       const std::vector<std::string>& directories,
+                       std::chrono::milliseconds interval)
+: m_files(files), m_directories(directories), m_interval(interval)
+{
+    if (!pageCacheAdviceAvailable())
+        return;
+    sweep(true);
+    m_thread = std::thread([this]() { run(); });
+}
+
+CacheGuard::~CacheGuard()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    sweep(false);
+}
+
+void CacheGuard::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, m_interval, [this]() { return m_stop; })) {
+        lock.unlock();
+        sweep(false);
+        lock.lock();
+    }
+}
+
+#if defined(WCDBREPAIR_FADVISE)
+
+// Regular files under `directory`, recursively.
+static void listFiles(const std::string& directory, std::vector<std::string>& out, int depth = 0)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return;
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        const std::string path = directory + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISREG(st.st_mode))
+            out.push_back(path);
+        else if (S_ISDIR(st.st_mode) && depth < 4)
+            listFiles(path, out, depth + 1);
+    }
+    closedir(dir);
+}
+
+void CacheGuard::sweep(bool snapshot)
+{
+    std::vector<std::string> files = m_files;
+    for (const std::string& directory : m_directories) {
+        listFiles(directory, files);
+    }
+    for (const std::string& path : files) {
+        sweepFile(path, snapshot);
+    }
+}
+
+void CacheGuard::sweepFile(const std::string& path, bool snapshot)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        const auto id = std::make_pair(static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino));
+        auto it = m_residency.find(id);
+        if (it == m_residency.end()) {
+            it = m_residency.emplace(id, CacheResidency()).first;
+            // Files that show up later are the guarded call's own: none of their pages are kept.
+            if (snapshot)
+                it->second.take(fd, static_cast<uint64_t>(st.st_size));
+        }
+        if (!snapshot)
+            it->second.drop(fd, 0, static_cast<uint64_t>(st.st_size));
+    }
+    ::close(fd);
+}
+
+#else
+
+void CacheGuard::sweep(bool)
+{
+}
+
+void CacheGuard::sweepFile(const std::string&, bool)
+{
+}
+
+#endif
+
+} // namespace WCDBRepair
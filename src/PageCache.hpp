@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace WCDBRepair {
+
+// How a scan treats the page cache of the host.
+enum class IoPolicy {
+    Default,    // plain reads
+    Sequential, // readahead hints: SEQUENTIAL for the file, WILLNEED ahead of the reads
+    DontNeed,   // as Sequential, plus DONTNEED behind the reads for the pages they brought in
+    Direct,     // unbuffered reads that do not go through the cache at all
+};
+
+bool parseIoPolicy(const std::string& name, IoPolicy& policy);
+const char* ioPolicyName(IoPolicy policy);
+
+// Whether posix_fadvise() hints exist on this platform (not on Windows or macOS).
+bool pageCacheAdviceAvailable();
+
+// posix_fadvise() hints for one handle; they do nothing where it does not exist.
+void adviseSequential(int fd, bool sequential); // SEQUENTIAL, or NORMAL again
+void adviseWillNeed(int fd, uint64_t offset, uint64_t length);
+
+// Which chunks of a file held cached pages at one moment (mmap + mincore), so that a scan
+// can drop what it brought in and keep what the host was already using. Chunks, because
+// the cache holds large folios and DONTNEED leaves any folio that sticks out of its range:
+// drops are only effective over whole, aligned chunks. Without a snapshot nothing is kept.
+class CacheResidency {
+public:
+    static constexpr uint64_t kChunkBytes = 2 << 20;
+
+    bool take(int fd, uint64_t size);
+
+    // posix_fadvise(DONTNEED) over [offset, offset + length), skipping the kept chunks.
+    void drop(int fd, uint64_t offset, uint64_t length) const;
+
+private:
+    std::vector<bool> m_kept; // per chunk
+};
+
+// For WCDB calls that read files through their own handles (checkIfCorrupted, backup,
+// retrieve), where no hint can reach the reads: page-cache state is shared per file, so
+// a thread drops, every `interval`, the pages of `files` and of the files under
+// `directories` that were not cached when the guard started. Files are told apart by
+// inode, so one that replaces another at the same path (retrieve moves the original into
+// its factory and writes a new one) starts with no resident pages.
+// Does nothing where pageCacheAdviceAvailable() is false.
+class CacheGuard {
+public:
+    CacheGuard(const std::vector<std::string>& files,
+               const std::vector<std::string>& directories,
+               std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    // Stops the thread and sweeps once more.
+    ~CacheGuard();
+
+    CacheGuard(const CacheGuard&) = delete;
+    CacheGuard& operator=(const CacheGuard&) = delete;
+
+private:
+    void run();
+    void sweep(bool snapshot);
+    void sweepFile(const std::string& path, bool snapshot);
+
+    std::vector<std::string> m_files;
+    std::vector<std::string> m_directories;
+    std::chrono::milliseconds m_interval;
+    std::map<std::pair<uint64_t, uint64_t>, CacheResidency> m_residency; // (device, inode)
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+} // namespace WCDBRepair
@@ -0,0 +1,195 @@
+#include "PageFile.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace WCDBRepair {
+
+#if defined(_WIN32)
+
+static std::wstring wideFromUtf8(const std::string& s)
+{
+    if (s.empty())
+        return {};
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+    if (len <= 0)
+        return {};
+    std::wstring out;
+    out.resize(static_cast<size_t>(len), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &out[0], len);
+    out.pop_back(); // remove trailing '\0'
+    return out;
+}
+
+PageFile::PageFile()
+: m_handle(INVALID_HANDLE_VALUE), m_size(0), m_direct(false)
+{
+}
+
+bool PageFile::open(const std::string& path, bool direct)
+{
+    close();
+    // Share everything: the production process may have the database open.
+    HANDLE h = CreateFileW(wideFromUtf8(path).c_str(),
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr,
+                           OPEN_EXISTING,
+                           direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size)) {
+        CloseHandle(h);
+        return false;
+    }
+    m_handle = h;
+    m_size = static_cast<uint64_t>(size.QuadPart);
+    m_path = path;
+    m_direct = direct;
+    return true;
+}
+
+void PageFile::close()
+{
+    if (m_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_handle);
+        m_handle = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+    m_path.clear();
+    m_direct = false;
+}
+
+bool PageFile::isOpen() const
+{
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+int64_t PageFile::read(uint64_t offset, void* buffer, size_t length) const
+{
+    size_t total = 0;
+    while (total < length) {
+        OVERLAPPED ov = {};
+        const uint64_t at = offset + total;
+        ov.Offset = static_cast<DWORD>(at & 0xFFFFFFFFull);
+        ov.OffsetHigh = static_cast<DWORD>(at >> 32);
+        const size_t remaining = length - total;
+        const DWORD chunk = remaining > 0x40000000u ? 0x40000000u : static_cast<DWORD>(remaining);
+        DWORD got = 0;
+        if (!ReadFile(m_handle, static_cast<char*>(buffer) + total, chunk, &got, &ov)) {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+            return -1;
+        }
+        if (got == 0)
+            break;
+        total += got;
+        // Unbuffered reads only come back short at the end of file; the offset is no longer aligned.
+        if (m_direct && got < chunk)
+            break;
+    }
+    return static_cast<int64_t>(total);
+}
+
+#else
+
+PageFile::PageFile()
+: m_fd(-1), m_size(0), m_direct(false)
+{
+}
+
+bool PageFile::open(const std::string& path, bool direct)
+{
+    close();
+    int flags = O_RDONLY | O_CLOEXEC;
+#if defined(O_DIRECT)
+    if (direct)
+        flags |= O_DIRECT;
+#endif
+    int fd = ::open(path.c_str(), flags);
+    if (fd < 0)
+        return false;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct && fcntl(fd, F_NOCACHE, 1) != 0) {
+        ::close(fd);
+        return false;
+    }
+#elif !defined(O_DIRECT)
+    if (direct) {
+        ::close(fd);
+        return false;
+    }
+#endif
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    m_fd = fd;
+    m_size = static_cast<uint64_t>(st.st_size);
+    m_path = path;
+    m_direct = direct;
+    return true;
+}
+
+void PageFile::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_size = 0;
+    m_path.clear();
+    m_direct = false;
+}
+
+bool PageFile::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+int64_t PageFile::read(uint64_t offset, void* buffer, size_t length) const
+{
+    size_t total = 0;
+    while (total < length) {
+        const size_t remaining = length - total;
+        ssize_t got = ::pread(m_fd,
+                              static_cast<char*>(buffer) + total,
+                              remaining,
+                              static_cast<off_t>(offset + total));
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (got == 0)
+            break;
+        total += static_cast<size_t>(got);
+        // Unbuffered reads only come back short at the end of file; the offset is no longer aligned.
+        if (m_direct && static_cast<size_t>(got) < remaining)
+            break;
+    }
+    return static_cast<int64_t>(total);
+}
+
+#endif
+
+PageFile::~PageFile()
+{
+    close();
+}
+
+bool PageFile::readFully(uint64_t offset, void* buffer, size_t length) const
+{
+    return read(offset, buffer, length) == static_cast<int64_t>(length);
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace WCDBRepair {
+
+// Read-only database file with positional reads (pread / ReadFile+OVERLAPPED),
+// so any number of threads can read different pages through one handle.
+class PageFile {
+public:
+    PageFile();
+    ~PageFile();
+
+    PageFile(const PageFile&) = delete;
+    PageFile& operator=(const PageFile&) = delete;
+
+    // `direct` bypasses the page cache (O_DIRECT, F_NOCACHE or FILE_FLAG_NO_BUFFERING);
+    // reads must then use 4 KiB aligned offsets, lengths and buffers. Fails where the
+    // file system does not support it.
+    bool open(const std::string& path, bool direct = false);
+    void close();
+    bool isOpen() const;
+
+    uint64_t size() const { return m_size; }
+    const std::string& path() const { return m_path; }
+    bool direct() const { return m_direct; }
+#if !defined(_WIN32)
+    int descriptor() const { return m_fd; }
+#endif
+
+    // Reads up to `length` bytes at `offset`; returns the number of bytes read
+    // (short only at end of file), or -1 on error.
+    int64_t read(uint64_t offset, void* buffer, size_t length) const;
+
+    // Reads exactly `length` bytes or fails.
+    bool readFully(uint64_t offset, void* buffer, size_t length) const;
+
+private:
+#if defined(_WIN32)
+    void* m_handle;
+#else
+    int m_fd;
+#endif
+    uint64_t m_size;
+    std::string m_path;
+    bool m_direct;
+};
+
+} // namespace WCDBRepair
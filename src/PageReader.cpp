@@ -0,0 +1,772 @@
+#include "PageReader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define WCDBREPAIR_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr uint32_t kDirectAlignment = 4096; // offsets, lengths and buffers of unbuffered reads
+constexpr int kMaxQueueDepth = 256;
+// Pread reader threads per core. Past a few per core more threads only contend; the rest
+// of the depth is kernel readahead.
+constexpr int kReadersPerCore = 4;
+
+class AlignedBuffer {
+public:
+    AlignedBuffer() : m_data(nullptr) {}
+    ~AlignedBuffer()
+    {
+#if defined(_WIN32)
+        _aligned_free(m_data);
+#else
+        std::free(m_data);
+#endif
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    bool allocate(size_t size)
+    {
+#if defined(_WIN32)
+        m_data = static_cast<unsigned char*>(_aligned_malloc(size, kDirectAlignment));
+#else
+        void* p = nullptr;
+        m_data = posix_memalign(&p, kDirectAlignment, size) == 0 ? static_cast<unsigned char*>(p) : nullptr;
+#endif
+        return m_data != nullptr;
+    }
+
+    unsigned char* data() const { return m_data; }
+
+private:
+    unsigned char* m_data;
+};
+
+// Reads are numbered from 0; read r covers pages [r * pagesPerRead, ...) of one buffer.
+struct ReadPlan {
+    uint32_t pageSize = 0;
+    uint64_t pageCount = 0;
+    uint32_t pagesPerRead = 0;
+    size_t bufferBytes = 0;
+    uint64_t reads = 0;
+
+    uint64_t firstPage(uint64_t read) const { return read * pagesPerRead; }
+    uint64_t offset(uint64_t read) const { return firstPage(read) * pageSize; }
+    uint32_t pages(uint64_t read) const
+    {
+        return static_cast<uint32_t>(std::min<uint64_t>(pagesPerRead, pageCount - firstPage(read)));
+    }
+    // Bytes the consumers need.
+    size_t wanted(uint64_t read) const { return static_cast<size_t>(pages(read)) * pageSize; }
+    // Bytes asked for: unbuffered reads are rounded up and come back short at the end of file.
+    size_t length(uint64_t read, bool direct) const
+    {
+        const size_t n = wanted(read);
+        return direct ? (n + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment : n;
+    }
+};
+
+struct Batch {
+    size_t buffer = 0;
+    uint64_t firstPage = 0;
+    uint32_t pages = 0;
+};
+
+// Buffers go free -> being read -> ready -> with a consumer -> free.
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t buffers)
+    {
+        for (size_t i = 0; i < buffers; i++) {
+            m_free.push_back(i);
+        }
+    }
+
+    // With `wait`, blocks until a buffer is free. False once the scan failed.
+    bool takeFree(size_t& buffer, bool wait)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (wait)
+            m_changed.wait(lock, [&]() { return m_failed || !m_free.empty(); });
+        if (m_failed || m_free.empty())
+            return false;
+        buffer = m_free.back();
+        m_free.pop_back();
+        return true;
+    }
+
+    void release(size_t buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(buffer);
+        m_changed.notify_all();
+    }
+
+    void pushReady(const Batch& batch)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.push_back(batch);
+        m_batches++;
+        m_changed.notify_all();
+    }
+
+    // Blocks until a batch is ready; false when the reads are over or the scan failed.
+    bool popReady(Batch& batch)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [&]() { return m_failed || m_finished || !m_ready.empty(); });
+        if (m_failed || m_ready.empty())
+            return false;
+        batch = m_ready.front();
+        m_ready.pop_front();
+        return true;
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+        m_changed.notify_all();
+    }
+
+    void fail(const std::string& why)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_failed) {
+            m_failed = true;
+            m_error = why;
+        }
+        m_changed.notify_all();
+    }
+
+    bool failed()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed;
+    }
+
+    std::string error()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_error;
+    }
+
+    uint64_t batches()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_batches;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<size_t> m_free;
+    std::deque<Batch> m_ready;
+    uint64_t m_batches = 0;
+    bool m_finished = false;
+    bool m_failed = false;
+    std::string m_error;
+};
+
+std::string readFailure(const ReadPlan& plan, uint64_t read, const char* what)
+{
+    return std::string(what) + " at page " + std::to_string(plan.firstPage(read) + 1);
+}
+
+void appendFallback(std::string& fallback, const std::string& why)
+{
+    if (!fallback.empty())
+        fallback += "; ";
+    fallback += why;
+}
+
+// The page-cache hints of IoPolicy::Sequential and DontNeed on the scanned handle.
+class CacheAdvice {
+public:
+    CacheAdvice(const PageFile& file, const ReadPlan& plan, IoPolicy policy, int lookahead)
+    : m_file(file), m_plan(plan), m_lookahead(static_cast<uint64_t>(lookahead))
+    {
+#if !defined(_WIN32)
+        if (policy != IoPolicy::Sequential && policy != IoPolicy::DontNeed)
+            return;
+        m_fd = file.descriptor();
+        adviseSequential(m_fd, true);
+        if (policy == IoPolicy::DontNeed) {
+            m_drop = true;
+            m_done.assign(static_cast<size_t>(plan.reads), false);
+            // What the host had cached stays; without a snapshot every scanned chunk goes.
+            m_residency.take(m_fd, file.size());
+        }
+#else
+        (void) file;
+        (void) policy;
+#endif
+    }
+
+    ~CacheAdvice()
+    {
+        if (m_fd < 0)
+            return;
+        if (m_drop)
+            m_residency.drop(m_fd, m_dropped, m_plan.pageCount * m_plan.pageSize - m_dropped);
+        adviseSequential(m_fd, false);
+    }
+
+    CacheAdvice(const CacheAdvice&) = delete;
+    CacheAdvice& operator=(const CacheAdvice&) = delete;
+
+    // The pread engine runs fewer threads than reads in flight: WILLNEED keeps the reads
+    // from `from` up to the lookahead in flight as kernel readahead, also under
+    // IoPolicy::Default. Nothing to do for an unbuffered handle or without posix_fadvise.
+    void readAhead(uint64_t from)
+    {
+#if !defined(_WIN32)
+        if (m_fd >= 0 || m_file.direct() || !pageCacheAdviceAvailable())
+            return; // already hinting
+        m_fd = m_file.descriptor();
+        const uint64_t end = std::min(m_lookahead, m_plan.reads);
+        if (from < end)
+            adviseWillNeed(m_fd, m_plan.offset(from), m_plan.offset(end - 1) + m_plan.wanted(end - 1) - m_plan.offset(from));
+#else
+        (void) from;
+#endif
+    }
+
+    // Read `read` is being submitted: start the one `lookahead` further on.
+    void submitting(uint64_t read) const
+    {
+        if (m_fd < 0 || read + m_lookahead >= m_plan.reads)
+            return;
+        adviseWillNeed(m_fd, m_plan.offset(read + m_lookahead), m_plan.wanted(read + m_lookahead));
+    }
+
+    // Read `read` is in its buffer, so the cache has no use for it any more. Drops go
+    // behind the longest run of finished reads from the start, in whole chunks.
+    void completed(uint64_t read)
+    {
+        if (m_fd < 0 || !m_drop)
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done[static_cast<size_t>(read)] = true;
+        while (m_finished < m_plan.reads && m_done[static_cast<size_t>(m_finished)]) {
+            m_finished++;
+        }
+        const uint64_t behind = m_plan.offset(m_finished) / CacheResidency::kChunkBytes * CacheResidency::kChunkBytes;
+        if (behind > m_dropped) {
+            m_residency.drop(m_fd, m_dropped, behind - m_dropped);
+            m_dropped = behind;
+        }
+    }
+
+private:
+    const PageFile& m_file;
+    const ReadPlan& m_plan;
+    uint64_t m_lookahead;
+    int m_fd = -1;
+    bool m_drop = false;
+    CacheResidency m_residency;
+    std::mutex m_mutex;
+    std::vector<bool> m_done; // per read
+    uint64_t m_finished = 0;  // reads [0, m_finished) are all done
+    uint64_t m_dropped = 0;   // bytes dropped from the start
+};
+
+// `readers` threads, each with one positional read outstanding.
+void readWithThreads(const PageFile& file,
+                     const ReadPlan& plan,
+                     unsigned char* buffers,
+                     int readers,
+                     CacheAdvice& advice,
+                     BatchQueue& queue,
+                     std::atomic<uint64_t>& bytes)
+{
+    std::atomic<uint64_t> next(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++) {
+        threads.emplace_back([&]() {
+            for (;;) {
+                size_t buffer = 0;
+                if (!queue.takeFree(buffer, true))
+                    return;
+                const uint64_t read = next.fetch_add(1);
+                if (read >= plan.reads) {
+                    queue.release(buffer);
+                    return;
+                }
+                advice.submitting(read);
+                unsigned char* data = buffers + buffer * plan.bufferBytes;
+                const int64_t got = file.read(plan.offset(read), data, plan.length(read, file.direct()));
+                if (got < static_cast<int64_t>(plan.wanted(read))) {
+                    queue.release(buffer);
+                    queue.fail(readFailure(plan, read, got < 0 ? "read failed" : "short read"));
+                    return;
+                }
+                bytes += static_cast<uint64_t>(got);
+                advice.completed(read);
+                Batch batch;
+                batch.buffer = buffer;
+                batch.firstPage = plan.firstPage(read);
+                batch.pages = plan.pages(read);
+                queue.pushReady(batch);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+#if defined(WCDBREPAIR_IO_URING)
+
+// A minimal io_uring over the raw system calls (no liburing): one submitter thread,
+// no SQPOLL, so the submission queue is empty again after every io_uring_enter.
+class Uring {
+public:
+    Uring() = default;
+    ~Uring()
+    {
+        if (m_sqes != nullptr)
+            munmap(m_sqes, m_sqesSize);
+        if (m_cq != nullptr && m_cq != m_sq)
+            munmap(m_cq, m_cqSize);
+        if (m_sq != nullptr)
+            munmap(m_sq, m_sqSize);
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    bool setup(unsigned entries, std::string& error)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            error = std::string("io_uring_setup: ") + std::strerror(errno);
+            return false;
+        }
+        m_fd = fd;
+        m_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+        single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+#endif
+        m_sq = mapRing(m_sqSize, IORING_OFF_SQ_RING);
+        m_cq = single ? m_sq : mapRing(m_cqSize, IORING_OFF_CQ_RING);
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(
+        static_cast<void*>(mapRing(m_sqesSize, IORING_OFF_SQES)));
+        if (m_sq == nullptr || m_cq == nullptr || m_sqes == nullptr) {
+            error = std::string("io_uring mmap: ") + std::strerror(errno);
+            return false;
+        }
+        m_sqHead = reinterpret_cast<unsigned*>(m_sq + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(m_sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(m_sq + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(m_sq + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned*>(m_cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(m_cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(m_cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(m_cq + params.cq_off.cqes);
+        m_tail = *m_sqTail;
+        return true;
+    }
+
+    bool registerBuffers(const std::vector<iovec>& buffers, std::string& error)
+    {
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) != 0) {
+            error = std::string("registered buffers: ") + std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    void prepare(uint8_t opcode, int fd, const void* addr, uint32_t length, uint64_t offset, uint16_t bufferIndex, uint64_t userData)
+    {
+        const unsigned index = m_tail & m_sqMask;
+        io_uring_sqe* sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr));
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->buf_index = bufferIndex;
+        sqe->user_data = userData;
+        m_sqArray[index] = index;
+        m_tail++;
+        m_pending++;
+    }
+
+    // Submits everything prepared and waits for at least `waitFor` completions.
+    bool enter(unsigned waitFor, std::string& error)
+    {
+        __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+        for (;;) {
+            const long submitted = syscall(__NR_io_uring_enter,
+                                           m_fd,
+                                           m_pending,
+                                           waitFor,
+                                           waitFor > 0 ? IORING_ENTER_GETEVENTS : 0,
+                                           nullptr,
+                                           0);
+            if (submitted < 0) {
+                // Nothing was submitted when a signal cut the wait short.
+                if (errno == EINTR)
+                    continue;
+                error = std::string("io_uring_enter: ") + std::strerror(errno);
+                return false;
+            }
+            if (submitted == 0 && m_pending > 0) {
+                error = "io_uring_enter: nothing submitted";
+                return false;
+            }
+            m_pending -= static_cast<unsigned>(std::min<long>(submitted, m_pending));
+            if (m_pending == 0)
+                return true;
+        }
+    }
+
+    bool pop(uint64_t& userData, int32_t& result)
+    {
+        const unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+            return false;
+        const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    unsigned char* mapRing(size_t size, off_t offset)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return p == MAP_FAILED ? nullptr : static_cast<unsigned char*>(p);
+    }
+
+    int m_fd = -1;
+    unsigned char* m_sq = nullptr;
+    unsigned char* m_cq = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqSize = 0;
+    size_t m_cqSize = 0;
+    size_t m_sqesSize = 0;
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+    unsigned m_tail = 0;    // local submission tail, published by enter()
+    unsigned m_pending = 0; // prepared, not yet taken by the kernel
+};
+
+// Keeps up to `depth` reads in flight from the calling thread. Returns false only when
+// the ring cannot be set up (nothing was read; `why` tells why); read errors fail `queue`.
+bool readWithUring(const PageFile& file,
+                   const ReadPlan& plan,
+                   unsigned char* buffers,
+                   size_t bufferCount,
+                   int depth,
+                   bool& registered,
+                   std::string& fallback,
+                   CacheAdvice& advice,
+                   BatchQueue& queue,
+                   std::atomic<uint64_t>& bytes,
+                   std::string& why)
+{
+    Uring ring;
+    if (!ring.setup(static_cast<unsigned>(depth), why))
+        return false;
+    std::vector<iovec> iovecs(bufferCount);
+    for (size_t i = 0; i < bufferCount; i++) {
+        iovecs[i].iov_base = buffers + i * plan.bufferBytes;
+        iovecs[i].iov_len = plan.bufferBytes;
+    }
+    if (registered) {
+        std::string note;
+        registered = ring.registerBuffers(iovecs, note);
+        if (!registered)
+            appendFallback(fallback, note);
+    }
+
+    const bool direct = file.direct();
+    struct InFlight {
+        uint64_t read = 0;
+        size_t done = 0; // bytes read so far (a read may complete short and be resubmitted)
+    };
+    std::vector<InFlight> state(bufferCount);
+    auto submit = [&](size_t buffer) {
+        const InFlight& f = state[buffer];
+        unsigned char* data = buffers + buffer * plan.bufferBytes + f.done;
+        const uint32_t length = static_cast<uint32_t>(plan.length(f.read, direct) - f.done);
+        const uint64_t offset = plan.offset(f.read) + f.done;
+        if (registered) {
+            ring.prepare(IORING_OP_READ_FIXED, file.descriptor(), data, length, offset, static_cast<uint16_t>(buffer), buffer);
+        } else {
+            iovecs[buffer].iov_base = data;
+            iovecs[buffer].iov_len = length;
+            ring.prepare(IORING_OP_READV, file.descriptor(), &iovecs[buffer], 1, offset, 0, buffer);
+        }
+    };
+
+    uint64_t next = 0;
+    int inflight = 0;
+    for (;;) {
+        while (inflight < depth && next < plan.reads && !queue.failed()) {
+            size_t buffer = 0;
+            // Only block for a buffer when no completion could come first.
+            if (!queue.takeFree(buffer, inflight == 0))
+                break;
+            state[buffer].read = next++;
+            state[buffer].done = 0;
+            advice.submitting(state[buffer].read);
+            submit(buffer);
+            inflight++;
+        }
+        if (inflight == 0)
+            break;
+        std::string error;
+        if (!ring.enter(1, error)) {
+            queue.fail(error);
+            break;
+        }
+        uint64_t userData = 0;
+        int32_t result = 0;
+        while (ring.pop(userData, result)) {
+            const size_t buffer = static_cast<size_t>(userData);
+            InFlight& f = state[buffer];
+            if (result == -EINTR || result == -EAGAIN) {
+                submit(buffer);
+                continue;
+            }
+            if (result < 0) {
+                inflight--;
+                queue.release(buffer);
+                queue.fail(readFailure(plan, f.read, "read failed") + ": " + std::strerror(-result));
+                continue;
+            }
+            f.done += static_cast<size_t>(result);
+            bytes += static_cast<uint64_t>(result);
+            if (f.done < plan.wanted(f.read)) {
+                // The rest of a short read; unbuffered reads can only continue aligned.
+                if (result == 0 || (direct && f.done % kDirectAlignment != 0)) {
+                    inflight--;
+                    queue.release(buffer);
+                    queue.fail(readFailure(plan, f.read, "short read"));
+                } else {
+                    submit(buffer);
+                }
+                continue;
+            }
+            inflight--;
+            advice.completed(f.read);
+            Batch batch;
+            batch.buffer = buffer;
+            batch.firstPage = plan.firstPage(f.read);
+            batch.pages = plan.pages(f.read);
+            queue.pushReady(batch);
+        }
+    }
+    return true;
+}
+
+#endif // WCDBREPAIR_IO_URING
+
+} // namespace
+
+bool parseIoEngine(const std::string& name, IoEngine& engine)
+{
+    if (name == "auto") {
+        engine = IoEngine::Auto;
+    } else if (name == "uring" || name == "io_uring") {
+        engine = IoEngine::Uring;
+    } else if (name == "pread") {
+        engine = IoEngine::Pread;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ioEngineName(IoEngine engine)
+{
+    switch (engine) {
+    case IoEngine::Auto:
+        return "auto";
+    case IoEngine::Uring:
+        return "uring";
+    case IoEngine::Pread:
+        return "pread";
+    }
+    return "";
+}
+
+bool readPages(const PageFile& file,
+               uint32_t pageSize,
+               uint64_t pageCount,
+               int threads,
+               const PageReadOptions& options,
+               const PageBatchHandler& handler,
+               PageReadStats* stats,
+               std::string& error)
+{
+    error.clear();
+    if (pageSize == 0) {
+        error = "page size unknown";
+        return false;
+    }
+    PageReadStats local;
+    if (pageCount == 0) {
+        if (stats != nullptr)
+            *stats = local;
+        return true;
+    }
+
+    // Reads cover whole pages and stay 4 KiB multiples, so unbuffered reads are aligned.
+    ReadPlan plan;
+    plan.pageSize = pageSize;
+    plan.pageCount = pageCount;
+    const uint64_t unit = std::max<uint64_t>(pageSize, kDirectAlignment);
+    const uint64_t readBytes = std::max<uint64_t>(unit, options.readBytes / unit * unit);
+    plan.pagesPerRead = static_cast<uint32_t>(readBytes / pageSize);
+    plan.bufferBytes = static_cast<size_t>(readBytes);
+    plan.reads = (pageCount + plan.pagesPerRead - 1) / plan.pagesPerRead;
+
+    const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    if (threads <= 0)
+        threads = cores;
+    threads = static_cast<int>(std::max<uint64_t>(1, std::min<uint64_t>(static_cast<uint64_t>(threads), plan.reads)));
+    const int depth = static_cast<int>(std::min<uint64_t>(
+    static_cast<uint64_t>(std::max(1, std::min(options.queueDepth, kMaxQueueDepth))), plan.reads));
+
+    PageFile unbuffered;
+    const PageFile* source = &file;
+    local.policy = options.policy;
+    if (options.policy == IoPolicy::Direct && !file.direct()) {
+        if (unbuffered.open(file.path(), true)) {
+            source = &unbuffered;
+        } else {
+            appendFallback(local.fallback, "direct: the file system refused an unbuffered handle");
+            local.policy = IoPolicy::Default;
+        }
+    }
+    if ((local.policy == IoPolicy::Sequential || local.policy == IoPolicy::DontNeed) && !pageCacheAdviceAvailable()) {
+        appendFallback(local.fallback, std::string(ioPolicyName(local.policy)) + ": posix_fadvise is not available on this platform");
+        local.policy = IoPolicy::Default;
+    }
+    CacheAdvice advice(*source, plan, local.policy, depth);
+
+    // Consumers hold a buffer each while the reads keep `depth` more in flight.
+    const size_t bufferCount = static_cast<size_t>(depth + threads);
+    AlignedBuffer buffers;
+    if (!buffers.allocate(bufferCount * plan.bufferBytes)) {
+        error = "out of memory for read buffers";
+        return false;
+    }
+    BatchQueue queue(bufferCount);
+    std::atomic<uint64_t> bytes(0);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            Batch batch;
+            while (queue.popReady(batch)) {
+                const bool ok = handler(t, batch.firstPage, buffers.data() + batch.buffer * plan.bufferBytes, batch.pages);
+                queue.release(batch.buffer);
+                if (!ok) {
+                    queue.fail("stopped");
+                    return;
+                }
+            }
+        });
+    }
+
+    bool ran = false;
+#if defined(WCDBREPAIR_IO_URING)
+    if (options.engine != IoEngine::Pread) {
+        bool registered = options.registeredBuffers;
+        std::string why;
+        if (readWithUring(*source, plan, buffers.data(), bufferCount, depth, registered, local.fallback, advice, queue, bytes, why)) {
+            ran = true;
+            local.engine = IoEngine::Uring;
+            local.registeredBuffers = registered;
+        } else {
+            appendFallback(local.fallback, why);
+        }
+    }
+#else
+    if (options.engine == IoEngine::Uring)
+        appendFallback(local.fallback, "io_uring: not available on this platform");
+#endif
+    if (!ran) {
+        local.engine = IoEngine::Pread;
+        const int readers = std::min(depth, cores * kReadersPerCore);
+        if (readers < depth)
+            advice.readAhead(static_cast<uint64_t>(readers));
+        local.readers = readers;
+        readWithThreads(*source, plan, buffers.data(), readers, advice, queue, bytes);
+    }
+    queue.finish();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    local.queueDepth = depth;
+    local.reads = queue.batches();
+    local.bytes = bytes.load();
+    if (stats != nullptr)
+        *stats = local;
+    if (queue.failed()) {
+        error = queue.error();
+        return false;
+    }
+    return true;
+}
+
+std::string describePageRead(const PageReadStats& stats)
+{
+    return std::string("engine=") + ioEngineName(stats.engine) + " depth=" + std::to_string(stats.queueDepth)
+           + (stats.readers > 0 ? " readers=" + std::to_string(stats.readers) : std::string())
+           + " registered=" + (stats.registeredBuffers ? "true" : "false")
+           + " policy=" + ioPolicyName(stats.policy);
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,98 @@
+#include "PageSource.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace WCDBRepair {
+
+PageSource::PageSource(const PageFile& file, uint32_t pageSize, const CipherKeys* keys)
+: m_file(&file)
+, m_pageSize(pageSize)
+, m_pageCount(pageSize > 0 ? static_cast<uint32_t>(std::min<uint64_t>(file.size() / pageSize, 0xFFFFFFFEull)) : 0)
+, m_raw(pageSize)
+{
+    if (keys != nullptr) {
+        m_codec.reset(new PageCodec(*keys));
+        m_plain.resize(pageSize);
+    }
+}
+
+const unsigned char* PageSource::rawPage(uint32_t pgno, Status* status)
+{
+    if (pgno == 0 || pgno > m_pageCount) {
+        if (status != nullptr)
+            *status = Status::OutOfRange;
+        return nullptr;
+    }
+    const uint64_t offset = static_cast<uint64_t>(pgno - 1) * m_pageSize;
+    if (!m_file->readFully(offset, m_raw.data(), m_pageSize)) {
+        if (status != nullptr)
+            *status = Status::ReadFailed;
+        return nullptr;
+    }
+    if (status != nullptr)
+        *status = Status::OK;
+    return m_raw.data();
+}
+
+const unsigned char* PageSource::page(uint32_t pgno, Status* status)
+{
+    const unsigned char* raw = rawPage(pgno, status);
+    if (raw == nullptr)
+        return nullptr;
+    return decode(raw, pgno, status);
+}
+
+const unsigned char* PageSource::decode(const unsigned char* raw, uint32_t pgno, Status* status)
+{
+    if (status != nullptr)
+        *status = Status::OK;
+    if (m_codec == nullptr)
+        return raw;
+    if (!m_codec->verifyHmac(raw, pgno)) {
+        if (status != nullptr)
+            *status = Status::HmacFailed;
+        return nullptr;
+    }
+    if (isAllZero(raw, m_pageSize)) {
+        // Never written; SQLCipher hands these out as zero pages.
+        std::memset(m_plain.data(), 0, m_pageSize);
+        return m_plain.data();
+    }
+    if (!m_codec->decrypt(raw, pgno, m_plain.data())) {
+        if (status != nullptr)
+            *status = Status::DecryptFailed;
+        return nullptr;
+    }
+    return m_plain.data();
+}
+
+bool PageSource::readPayload(const unsigned char* page,
+                             const CellInfo& cell,
+                             uint32_t usableSize,
+                             std::vector<unsigned char>& out)
+{
+    out.assign(page + cell.payloadOffset, page + cell.payloadOffset + cell.localSize);
+    if (cell.overflowPage == 0)
+        return true;
+
+    // `page` may be our own buffer, which the reads below overwrite; it is not used again.
+    uint64_t remaining = cell.payloadSize - cell.localSize;
+    uint32_t next = cell.overflowPage;
+    uint32_t hops = 0;
+    const uint32_t perPage = usableSize - 4;
+    while (remaining > 0) {
+        if (next == 0 || ++hops > m_pageCount)
+            return false;
+        const unsigned char* overflow = this->page(next);
+        if (overflow == nullptr)
+            return false;
+        const uint32_t take = static_cast<uint32_t>(std::min<uint64_t>(remaining, perPage));
+        out.insert(out.end(), overflow + 4, overflow + 4 + take);
+        remaining -= take;
+        next = readBE32(overflow);
+    }
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "SqliteFormat.hpp"
+#include "Sqlcipher.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Hands out plaintext pages of a database file read through positional reads (or read
+// elsewhere and passed to decode()), decrypting SQLCipher pages (after the HMAC check)
+// when keys are given. Holds one page buffer and one PageCodec, so use one instance per
+// thread.
+class PageSource {
+public:
+    PageSource(const PageFile& file, uint32_t pageSize, const CipherKeys* keys);
+
+    enum class Status {
+        OK,
+        OutOfRange,
+        ReadFailed,
+        HmacFailed,
+        DecryptFailed,
+    };
+
+    // Returns the plaintext page (valid until the next call) or nullptr.
+    const unsigned char* page(uint32_t pgno, Status* status = nullptr);
+
+    // Raw on-disk bytes (ciphertext for encrypted files), valid until the next call.
+    const unsigned char* rawPage(uint32_t pgno, Status* status = nullptr);
+
+    // Plaintext of page `pgno` whose on-disk bytes were read elsewhere (`raw`, one page):
+    // `raw` itself for plaintext files, else the decrypted copy. nullptr on failure.
+    const unsigned char* decode(const unsigned char* raw, uint32_t pgno, Status* status = nullptr);
+
+    uint32_t pageSize() const { return m_pageSize; }
+    uint32_t pageCount() const { return m_pageCount; }
+    bool encrypted() const { return m_codec != nullptr; }
+    PageCodec* codec() { return m_codec.get(); }
+
+    // Concatenates a cell's local payload and its overflow chain into `out`.
+    // Stops (and returns false) on a broken chain; `out` then holds what was read.
+    bool readPayload(const unsigned char* page,
+                     const CellInfo& cell,
+                     uint32_t usableSize,
+                     std::vector<unsigned char>& out);
+
+private:
+    const PageFile* m_file;
+    uint32_t m_pageSize;
+    uint32_t m_pageCount;
+    std::unique_ptr<PageCodec> m_codec;
+    std::vector<unsigned char> m_raw;
+    std::vector<unsigned char> m_plain;
+};
+
+} // namespace WCDBRepair
@@ -0,0 +1,174 @@
+#include "PhaseTimeline.hpp"
+
+#include "JobProtocol.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace WCDBRepair {
+
+double processCpuMs()
+{
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return static_cast<double>(k.QuadPart + u.QuadPart) / 10000.0; // 100ns units
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+           + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#endif
+}
+
+uint64_t processPeakRssKb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS memory = {};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+        return 0;
+    return static_cast<uint64_t>(memory.PeakWorkingSetSize) / 1024;
+#else
+    struct rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024; // bytes on macOS
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+PhaseTimeline::PhaseTimeline() : m_start(std::chrono::steady_clock::now())
+{
+}
+
+PhaseSpan PhaseTimeline::close(int track, const Open& open, double nowMs, double cpuMs, uint64_t peakRssKb)
+{
+    PhaseSpan span;
+    span.name = open.name;
+    span.track = track;
+    span.startMs = open.startMs;
+    span.durationMs = nowMs - open.startMs;
+    span.cpuMs = cpuMs - open.cpuMs;
+    span.peakRssDeltaKb = static_cast<int64_t>(peakRssKb) - static_cast<int64_t>(open.peakRssKb);
+    m_spans.push_back(span);
+    return span;
+}
+
+bool PhaseTimeline::mark(int track, const std::string& name, PhaseSpan& closed)
+{
+    const double nowMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    const double cpuMs = processCpuMs();
+    const uint64_t peakRssKb = processPeakRssKb();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool hadOpen = false;
+    auto it = m_open.find(track);
+    if (it != m_open.end()) {
+        closed = close(track, it->second, nowMs, cpuMs, peakRssKb);
+        hadOpen = true;
+    }
+    m_open[track] = Open{ name, nowMs, cpuMs, peakRssKb };
+    return hadOpen;
+}
+
+void PhaseTimeline::closeAll()
+{
+    const double nowMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    const double cpuMs = processCpuMs();
+    const uint64_t peakRssKb = processPeakRssKb();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& open : m_open) {
+        close(open.first, open.second, nowMs, cpuMs, peakRssKb);
+    }
+    m_open.clear();
+}
+
+void PhaseTimeline::printSummary(std::FILE* out) const
+{
+    struct Total {
+        std::string name;
+        int count = 0;
+        double wallMs = 0;
+        double cpuMs = 0;
+        int64_t peakRssDeltaKb = 0;
+    };
+    std::vector<Total> totals;
+    double allMs = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const PhaseSpan& span : m_spans) {
+            auto it = std::find_if(totals.begin(), totals.end(), [&span](const Total& t) { return t.name == span.name; });
+            if (it == totals.end()) {
+                totals.push_back(Total());
+                it = totals.end() - 1;
+                it->name = span.name;
+            }
+            it->count++;
+            it->wallMs += span.durationMs;
+            it->cpuMs += span.cpuMs;
+            it->peakRssDeltaKb += span.peakRssDeltaKb;
+            allMs += span.durationMs;
+        }
+    }
+    std::stable_sort(totals.begin(), totals.end(), [](const Total& a, const Total& b) { return a.wallMs > b.wallMs; });
+    for (const Total& t : totals) {
+        std::fprintf(out,
+                     "TIMING phase=%-32s count=%-4d wallMs=%-10.1f cpuMs=%-10.1f peakRssDeltaKb=%-8lld share=%.1f%%\n",
+                     t.name.c_str(),
+                     t.count,
+                     t.wallMs,
+                     t.cpuMs,
+                     static_cast<long long>(t.peakRssDeltaKb),
+                     allMs > 0 ? 100.0 * t.wallMs / allMs : 0.0);
+    }
+    std::fflush(out);
+}
+
+bool PhaseTimeline::writeTraceEvents(const std::string& path) const
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+        return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    out << "{\"traceEvents\":[\n";
+    char buf[256];
+    for (size_t i = 0; i < m_spans.size(); i++) {
+        const PhaseSpan& span = m_spans[i];
+        std::string line = "{\"name\":";
+        appendJsonString(line, span.name);
+        // Chrome trace timestamps are microseconds.
+        std::snprintf(buf,
+                      sizeof(buf),
+                      ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.0f,\"dur\":%.0f,"
+                      "\"args\":{\"cpuMs\":%.1f,\"peakRssDeltaKb\":%lld}}",
+                      span.track,
+                      span.startMs * 1000.0,
+                      span.durationMs * 1000.0,
+                      span.cpuMs,
+                      static_cast<long long>(span.peakRssDeltaKb));
+        line += buf;
+        out << line << (i + 1 < m_spans.size() ? ",\n" : "\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out.flush());
+}
+
+} // namespace WCDBRepair
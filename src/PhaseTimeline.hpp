@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+struct PhaseSpan {
+    std::string name;
+    int track = 0;       // one per database (batch manifest line), 0 for a single run
+    double startMs = 0;  // monotonic, since the timeline was created
+    double durationMs = 0;
+    double cpuMs = 0;    // process CPU time (all threads) spent during the span
+    int64_t peakRssDeltaKb = 0;
+};
+
+// Turns the STATE= markers of a run into spans: a state opens a span that lasts until
+// the next state on the same track. CPU time and peak RSS are process-wide, so spans
+// of concurrent batch items overlap in those columns.
+class PhaseTimeline {
+public:
+    PhaseTimeline();
+
+    // Ends the open span of `track` (returned in `closed` when there was one) and
+    // opens `name`.
+    bool mark(int track, const std::string& name, PhaseSpan& closed);
+    // Ends every open span.
+    void closeAll();
+
+    // Per-name totals, largest first.
+    void printSummary(std::FILE* out) const;
+    // Chrome trace-event format ("X" events), loadable in chrome://tracing / Perfetto.
+    bool writeTraceEvents(const std::string& path) const;
+
+private:
+    struct Open {
+        std::string name;
+        double startMs;
+        double cpuMs;
+        uint64_t peakRssKb;
+    };
+
+    PhaseSpan close(int track, const Open& open, double nowMs, double cpuMs, uint64_t peakRssKb);
+
+    const std::chrono::steady_clock::time_point m_start;
+    mutable std::mutex m_mutex;
+    std::map<int, Open> m_open;
+    std::vector<PhaseSpan> m_spans;
+};
+
+// Process CPU time (user + system) and peak resident set size so far.
+double processCpuMs();
+uint64_t processPeakRssKb();
+
+} // namespace WCDBRepair
@@ -0,0 +1,194 @@
+#include "Probe.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kMaxPageSize = 65536;
+constexpr int kPageSizes[] = { 1024, 4096, 2048, 8192, 16384, 32768, 65536, 512 };
+
+struct KdfTask {
+    HashAlgorithm kdfAlgorithm;
+    int kdfIter;
+};
+
+struct HmacVariant {
+    bool useHmac;
+    HashAlgorithm algorithm;
+};
+
+const HmacVariant kHmacVariants[] = {
+    { true, HashAlgorithm::SHA512 },
+    { true, HashAlgorithm::SHA1 },
+    { true, HashAlgorithm::SHA256 },
+    { false, HashAlgorithm::SHA1 },
+};
+
+// Evenly spread page numbers in [2, pageCount].
+std::vector<uint32_t> samplePageNumbers(uint64_t pageCount, int count)
+{
+    std::vector<uint32_t> out;
+    if (pageCount < 2 || count <= 0)
+        return out;
+    const uint64_t span = pageCount - 1;
+    const uint64_t n = std::min<uint64_t>(span, static_cast<uint64_t>(count));
+    for (uint64_t i = 0; i < n; i++) {
+        out.push_back(static_cast<uint32_t>(2 + (span - 1) * i / (n > 1 ? n - 1 : 1)));
+    }
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+// Page types a decrypted b-tree page may start with; 0 covers overflow/freelist pages.
+bool plausiblePageType(unsigned char type)
+{
+    return type == 0x02 || type == 0x05 || type == 0x0a || type == 0x0d || type == 0x00;
+}
+
+} // namespace
+
+bool probeCipher(const PageFile& file,
+                 const std::vector<unsigned char>& passphrase,
+                 const ProbeOptions& options,
+                 ProbeResult& result)
+{
+    result = ProbeResult();
+
+    const size_t headLength = static_cast<size_t>(std::min<uint64_t>(file.size(), kMaxPageSize));
+    if (headLength < 512)
+        return false;
+    std::vector<unsigned char> head(headLength);
+    if (!file.readFully(0, head.data(), headLength))
+        return false;
+    if (std::memcmp(head.data(), "SQLite format 3", 16) == 0) {
+        result.encrypted = false;
+        return true;
+    }
+
+    std::vector<int> iters = { 4000, 64000, 256000 };
+    for (int v : options.extraKdfIters) {
+        if (v > 0 && std::find(iters.begin(), iters.end(), v) == iters.end())
+            iters.push_back(v);
+    }
+    // Cheap derivations first, so the common legacy settings answer fastest.
+    std::sort(iters.begin(), iters.end());
+    std::vector<KdfTask> tasks;
+    for (int iter : iters) {
+        for (HashAlgorithm a : { HashAlgorithm::SHA1, HashAlgorithm::SHA512, HashAlgorithm::SHA256 }) {
+            tasks.push_back({ a, iter });
+        }
+    }
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0)
+            threads = 1;
+    }
+    threads = std::min<int>(threads, static_cast<int>(tasks.size()));
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> found(false);
+    std::atomic<int> candidates(0);
+    std::atomic<int> derivations(0);
+    std::mutex resultMutex;
+    size_t bestTask = tasks.size();
+
+    auto tryTask = [&](size_t taskIndex) {
+        const KdfTask& task = tasks[taskIndex];
+        unsigned char key[KeySize];
+        if (!deriveKey(passphrase, head.data(), task.kdfAlgorithm, task.kdfIter, key))
+            return;
+        derivations++;
+
+        std::vector<unsigned char> page;
+        std::vector<unsigned char> plain;
+        for (int pageSize : kPageSizes) {
+            if (static_cast<size_t>(pageSize) > headLength)
+                continue;
+            for (const HmacVariant& variant : kHmacVariants) {
+                candidates++;
+                CipherParams params;
+                params.pageSize = pageSize;
+                params.kdfIter = task.kdfIter;
+                params.kdfAlgorithm = task.kdfAlgorithm;
+                params.useHmac = variant.useHmac;
+                params.hmacAlgorithm = variant.algorithm;
+
+                CipherKeys keys;
+                if (!keys.init(params, head.data(), key))
+                    continue;
+                PageCodec codec(keys);
+                if (!codec.isValid())
+                    continue;
+                if (params.useHmac && !codec.verifyHmac(head.data(), 1))
+                    continue;
+                if (!codec.looksLikeFirstPage(head.data()))
+                    continue;
+
+                // Page 1 matched; confirm on a few pages elsewhere in the file.
+                const uint64_t pageCount = file.size() / static_cast<uint64_t>(pageSize);
+                page.resize(static_cast<size_t>(pageSize));
+                plain.resize(static_cast<size_t>(pageSize));
+                int verified = 0;
+                bool allVerified = true;
+                for (uint32_t pgno : samplePageNumbers(pageCount, options.samplePages)) {
+                    if (!file.readFully(static_cast<uint64_t>(pgno - 1) * pageSize, page.data(), page.size())) {
+                        allVerified = false;
+                        break;
+                    }
+                    bool ok = params.useHmac ? codec.verifyHmac(page.data(), pgno)
+                                             : codec.decrypt(page.data(), pgno, plain.data())
+                                               && plausiblePageType(plain[0]);
+                    if (!ok) {
+                        allVerified = false;
+                        break;
+                    }
+                    verified++;
+                }
+                if (!allVerified)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(resultMutex);
+                if (taskIndex < bestTask) {
+                    bestTask = taskIndex;
+                    result.found = true;
+                    result.params = params;
+                    result.sampledPages = verified;
+                }
+                found = true;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (;;) {
+                if (found.load())
+                    return;
+                const size_t idx = next.fetch_add(1);
+                if (idx >= tasks.size())
+                    return;
+                tryTask(idx);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    result.candidates = candidates.load();
+    result.derivations = derivations.load();
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "Sqlcipher.hpp"
+
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+struct ProbeOptions {
+    // Extra kdf_iter candidates on top of the SQLCipher 1-4 defaults.
+    std::vector<int> extraKdfIters;
+    int threads = 0;     // 0 means hardware concurrency
+    int samplePages = 4; // pages besides page 1 whose HMAC must verify too
+};
+
+struct ProbeResult {
+    bool encrypted = true; // false when the file has a plain SQLite header
+    bool found = false;
+    CipherParams params;
+    int sampledPages = 0;  // sample pages that verified
+    int candidates = 0;    // parameter combinations tried
+    int derivations = 0;   // PBKDF2 runs (one per kdf algorithm x kdf_iter)
+};
+
+// Finds the SQLCipher parameters a passphrase was used with by working on page 1
+// (and a few sampled pages) directly; no WCDB handle is opened. PBKDF2 is the only
+// expensive step, so the grid is split by (kdf algorithm, kdf_iter) across threads
+// and every derived key is tried against all page sizes and HMAC algorithms.
+bool probeCipher(const PageFile& file,
+                 const std::vector<unsigned char>& passphrase,
+                 const ProbeOptions& options,
+                 ProbeResult& result);
+
+} // namespace WCDBRepair
@@ -0,0 +1,169 @@
+#include "Progress.hpp"
+
+#include "JobProtocol.hpp"
+
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr std::chrono::milliseconds kInterval(250);
+constexpr double kSmoothing = 0.3; // weight of the newest sample in the rate averages
+
+uint64_t fileSizeOf(const std::string& path)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    return _stat64(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+#else
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+#endif
+}
+
+} // namespace
+
+ProgressReporter::ProgressReporter(const std::string& command, const std::string& path, bool text, bool json)
+: m_command(command)
+, m_path(path)
+, m_text(text)
+, m_json(json)
+, m_phase("start")
+, m_pagesTotal(0)
+, m_pageSize(0)
+, m_rows(0)
+, m_start(std::chrono::steady_clock::now())
+, m_lastPrint(m_start)
+, m_lastSample(m_start)
+, m_lastProgress(0)
+, m_lastRows(0)
+, m_progressRate(-1)
+, m_rowRate(-1)
+{
+}
+
+void ProgressReporter::setTotals(uint64_t pages, uint32_t pageSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pagesTotal = pages;
+    m_pageSize = pageSize;
+}
+
+void ProgressReporter::setOutputPath(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_outputPath = path;
+}
+
+void ProgressReporter::setPhase(const char* phase)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phase = phase;
+}
+
+void ProgressReporter::setTable(const std::string& table)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_table != table)
+        m_table = table;
+}
+
+void ProgressReporter::update(double progress)
+{
+    if (!m_text && !json())
+        return;
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (now - m_lastPrint < kInterval)
+        return;
+    m_lastPrint = now;
+    emit(progress, now);
+}
+
+void ProgressReporter::finish(double progress, const char* phase)
+{
+    if (!json())
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phase = phase;
+    emit(progress, std::chrono::steady_clock::now());
+}
+
+void ProgressReporter::emit(double progress, std::chrono::steady_clock::time_point now)
+{
+    if (m_text) {
+        char text[64];
+        std::snprintf(text, sizeof(text), "PROGRESS=%.6f", progress);
+        write(text);
+    }
+    if (!json())
+        return;
+
+    const uint64_t rows = m_rows.load(std::memory_order_relaxed);
+    const double dt = std::chrono::duration<double>(now - m_lastSample).count();
+    if (dt > 0) {
+        const double progressRate = (progress - m_lastProgress) / dt;
+        const double rowRate = static_cast<double>(rows - m_lastRows) / dt;
+        m_progressRate = m_progressRate < 0 ? progressRate : kSmoothing * progressRate + (1 - kSmoothing) * m_progressRate;
+        m_rowRate = m_rowRate < 0 ? rowRate : kSmoothing * rowRate + (1 - kSmoothing) * m_rowRate;
+        m_lastSample = now;
+        m_lastProgress = progress;
+        m_lastRows = rows;
+    }
+    const double elapsedMs = std::chrono::duration<double, std::milli>(now - m_start).count();
+    const uint64_t pagesDone = static_cast<uint64_t>(progress * static_cast<double>(m_pagesTotal));
+    const double pagesPerSec = m_progressRate > 0 ? m_progressRate * static_cast<double>(m_pagesTotal) : 0;
+    const uint64_t bytesWritten =
+    m_outputPath.empty() ? 0 : fileSizeOf(m_outputPath) + fileSizeOf(m_outputPath + "-wal");
+
+    std::string line = "{\"event\":\"progress\",\"command\":";
+    appendJsonString(line, m_command);
+    line += ",\"path\":";
+    appendJsonString(line, m_path);
+    line += ",\"phase\":";
+    appendJsonString(line, m_phase);
+    char buf[512];
+    std::snprintf(buf,
+                  sizeof(buf),
+                  ",\"progress\":%.6f,\"elapsedMs\":%.0f,\"pagesDone\":%llu,\"pagesTotal\":%llu,\"pagesPerSec\":%.1f,"
+                  "\"rows\":%llu,\"rowsPerSec\":%.1f,\"bytesRead\":%llu,\"bytesWritten\":%llu,\"table\":",
+                  progress,
+                  elapsedMs,
+                  static_cast<unsigned long long>(pagesDone),
+                  static_cast<unsigned long long>(m_pagesTotal),
+                  pagesPerSec,
+                  static_cast<unsigned long long>(rows),
+                  m_rowRate > 0 ? m_rowRate : 0.0,
+                  static_cast<unsigned long long>(pagesDone * m_pageSize),
+                  static_cast<unsigned long long>(bytesWritten));
+    line += buf;
+    appendJsonString(line, m_table);
+    if (progress >= 1.0) {
+        line += ",\"etaSec\":0}";
+    } else if (m_progressRate > 0) {
+        std::snprintf(buf, sizeof(buf), ",\"etaSec\":%.1f}", (1.0 - progress) / m_progressRate);
+        line += buf;
+    } else {
+        line += ",\"etaSec\":null}"; // stalled or no sample yet
+    }
+    if (m_listener)
+        m_listener(progress, line);
+    if (m_json)
+        write("PROGRESS_JSON=" + line);
+}
+
+void ProgressReporter::write(const std::string& line)
+{
+    if (m_writer) {
+        m_writer(line);
+        return;
+    }
+    std::printf("%s\n", line.c_str());
+    std::fflush(stdout);
+}
+
+} // namespace WCDBRepair
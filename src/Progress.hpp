@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace WCDBRepair {
+
+// Progress of one long-running command (repair, salvage): the plain PROGRESS=<fraction>
+// line plus, when enabled, a one-line JSON event with throughput and a smoothed ETA:
+//
+//   PROGRESS_JSON={"event":"progress","command":"repair","path":"...","phase":"assemble",
+//                  "progress":0.42,"elapsedMs":..,"pagesDone":..,"pagesTotal":..,"pagesPerSec":..,
+//                  "rows":..,"rowsPerSec":..,"bytesRead":..,"bytesWritten":..,"table":"..","etaSec":..}
+//
+// Counters may be fed from any thread; update() throttles output to one line pair per
+// 250 ms. Page and read-byte counts follow the progress fraction of the page total.
+class ProgressReporter {
+public:
+    ProgressReporter(const std::string& command, const std::string& path, bool text, bool json);
+
+    // Size of the input; pagesDone/bytesRead are derived from it.
+    void setTotals(uint64_t pages, uint32_t pageSize);
+    // File whose size (plus its -wal) is reported as bytesWritten.
+    void setOutputPath(const std::string& path);
+    // Receives each output line (without the newline) instead of stdout (serve jobs).
+    void setWriter(std::function<void(const std::string&)> writer) { m_writer = std::move(writer); }
+    // Receives every event as the fraction and the JSON object, also without --progress-json
+    // (the C API's progress callback).
+    void setListener(std::function<void(double, const std::string&)> listener) { m_listener = std::move(listener); }
+
+    void setPhase(const char* phase);
+    void setTable(const std::string& table);
+    void addRows(uint64_t rows) { m_rows.fetch_add(rows, std::memory_order_relaxed); }
+    uint64_t rows() const { return m_rows.load(std::memory_order_relaxed); }
+
+    void update(double progress);
+    // Last event, unthrottled, with the final phase.
+    void finish(double progress, const char* phase);
+
+    // Whether JSON events are built: for PROGRESS_JSON lines or for the listener.
+    bool json() const { return m_json || m_listener != nullptr; }
+
+private:
+    void emit(double progress, std::chrono::steady_clock::time_point now);
+    void write(const std::string& line);
+
+    const std::string m_command;
+    const std::string m_path;
+    const bool m_text;
+    const bool m_json;
+    std::function<void(const std::string&)> m_writer;
+    std::function<void(double, const std::string&)> m_listener;
+
+    std::mutex m_mutex; // phase, table, output path and the rate state
+    std::string m_phase;
+    std::string m_table;
+    std::string m_outputPath;
+    uint64_t m_pagesTotal;
+    uint32_t m_pageSize;
+    std::atomic<uint64_t> m_rows;
+
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_lastPrint;
+    std::chrono::steady_clock::time_point m_lastSample;
+    double m_lastProgress;
+    uint64_t m_lastRows;
+    double m_progressRate; // smoothed fraction per second
+    double m_rowRate;      // smoothed rows per second
+};
+
+} // namespace WCDBRepair
@@ -0,0 +1,35 @@
+#include "ResultLine.hpp"
+
+#include <cstring>
+
+namespace WCDBRepair {
+
+void parseResultLine(const std::string& line, ResultLine& result)
+{
+    result.kind.clear();
+    result.fields.clear();
+    size_t pos = std::strlen("RESULT=");
+    bool first = true;
+    while (pos < line.size()) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos)
+            end = line.size();
+        const std::string token = line.substr(pos, end - pos);
+        pos = end + 1;
+        if (token.empty())
+            continue;
+        if (first) {
+            result.kind = token;
+            first = false;
+            continue;
+        }
+        const size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            result.fields.emplace_back(token, std::string());
+        } else {
+            result.fields.emplace_back(token.substr(0, eq), token.substr(eq + 1));
+        }
+    }
+}
+
+} // namespace WCDBRepair
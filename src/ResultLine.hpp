@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace WCDBRepair {
+
+// A RESULT=<kind> key=value key=value ... line taken apart, fields in line order. Values
+// end at the next space; a token without '=' is a field with an empty value.
+struct ResultLine {
+    std::string kind;
+    std::vector<std::pair<std::string, std::string>> fields;
+};
+
+// `line` starts with "RESULT=". Replaces what `result` held.
+void parseResultLine(const std::string& line, ResultLine& result);
+
+} // namespace WCDBRepair
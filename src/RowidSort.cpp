@@ -0,0 +1,240 @@
+#include "RowidSort.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kRunBufferSize = 1 << 20;
+
+// Row encoding, in memory and in run files (native byte order: runs never leave the process):
+// u32 body size, then body = u32 value count, per value u8 type + i64/f64 or u32 size + bytes.
+void put(std::vector<unsigned char>& out, const void* p, size_t n)
+{
+    const unsigned char* b = static_cast<const unsigned char*>(p);
+    out.insert(out.end(), b, b + n);
+}
+
+void encodeRow(const std::vector<RecordValue>& values, std::vector<unsigned char>& out)
+{
+    const size_t start = out.size();
+    uint32_t size = 0;
+    put(out, &size, sizeof(size));
+    const uint32_t count = static_cast<uint32_t>(values.size());
+    put(out, &count, sizeof(count));
+    for (const RecordValue& v : values) {
+        out.push_back(static_cast<unsigned char>(v.type));
+        switch (v.type) {
+        case RecordValue::Integer:
+            put(out, &v.integer, sizeof(v.integer));
+            break;
+        case RecordValue::Real:
+            put(out, &v.real, sizeof(v.real));
+            break;
+        case RecordValue::Text:
+        case RecordValue::Blob: {
+            const uint32_t n = static_cast<uint32_t>(v.size);
+            put(out, &n, sizeof(n));
+            put(out, v.data, v.size);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    size = static_cast<uint32_t>(out.size() - start - sizeof(size));
+    std::memcpy(&out[start], &size, sizeof(size));
+}
+
+bool decodeBody(const unsigned char* p, size_t size, std::vector<RecordValue>& values)
+{
+    const unsigned char* end = p + size;
+    uint32_t count = 0;
+    if (size < sizeof(count))
+        return false;
+    std::memcpy(&count, p, sizeof(count));
+    p += sizeof(count);
+    values.resize(count);
+    for (RecordValue& v : values) {
+        if (p >= end)
+            return false;
+        v = RecordValue();
+        v.type = static_cast<RecordValue::Type>(*p++);
+        switch (v.type) {
+        case RecordValue::Integer:
+        case RecordValue::Real:
+            if (end - p < 8)
+                return false;
+            std::memcpy(v.type == RecordValue::Integer ? static_cast<void*>(&v.integer) : static_cast<void*>(&v.real), p, 8);
+            p += 8;
+            break;
+        case RecordValue::Text:
+        case RecordValue::Blob: {
+            uint32_t n = 0;
+            if (end - p < 4)
+                return false;
+            std::memcpy(&n, p, sizeof(n));
+            p += sizeof(n);
+            if (static_cast<size_t>(end - p) < n)
+                return false;
+            v.data = p;
+            v.size = n;
+            p += n;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+// Sequential reader of one sorted run: u32 table, i64 rowid, then an encoded row.
+class RunReader {
+public:
+    explicit RunReader(const std::string& path) : table(0), rowid(0), m_buffer(kRunBufferSize)
+    {
+        m_in.rdbuf()->pubsetbuf(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_in.open(path, std::ios::binary);
+    }
+
+    bool next()
+    {
+        uint32_t t = 0;
+        uint32_t size = 0;
+        if (!m_in.read(reinterpret_cast<char*>(&t), sizeof(t)) || !m_in.read(reinterpret_cast<char*>(&rowid), sizeof(rowid))
+            || !m_in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+            return false;
+        table = t;
+        body.resize(size);
+        return size == 0 || static_cast<bool>(m_in.read(reinterpret_cast<char*>(body.data()), size));
+    }
+
+    size_t table;
+    int64_t rowid;
+    std::vector<unsigned char> body;
+
+private:
+    std::vector<char> m_buffer;
+    std::ifstream m_in;
+};
+
+} // namespace
+
+RowidSorter::RowidSorter(const std::vector<SalvageTable>& tables,
+                         SalvageSink& next,
+                         size_t memoryBudget,
+                         const std::string& spillPrefix)
+: m_tables(tables), m_next(next), m_memoryBudget(memoryBudget), m_spillPrefix(spillPrefix), m_spilledBytes(0)
+{
+}
+
+RowidSorter::~RowidSorter()
+{
+    for (const std::string& run : m_runs) {
+        std::remove(run.c_str());
+    }
+}
+
+bool RowidSorter::row(size_t table, int64_t rowid, const std::vector<RecordValue>& values)
+{
+    if (m_tables[table].withoutRowid)
+        return m_next.row(table, rowid, values);
+    m_entries.push_back(Entry{ table, rowid, m_arena.size() });
+    encodeRow(values, m_arena);
+    if (m_arena.size() + m_entries.size() * sizeof(Entry) >= m_memoryBudget)
+        return spill();
+    return true;
+}
+
+bool RowidSorter::spill()
+{
+    std::stable_sort(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+        return a.table != b.table ? a.table < b.table : a.rowid < b.rowid;
+    });
+    const std::string path = m_spillPrefix + "." + std::to_string(m_runs.size());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    m_runs.push_back(path); // removed by the destructor even if writing fails
+    if (!out)
+        return false;
+    for (const Entry& e : m_entries) {
+        const uint32_t table = static_cast<uint32_t>(e.table);
+        uint32_t size = 0;
+        std::memcpy(&size, &m_arena[e.offset], sizeof(size));
+        out.write(reinterpret_cast<const char*>(&table), sizeof(table));
+        out.write(reinterpret_cast<const char*>(&e.rowid), sizeof(e.rowid));
+        out.write(reinterpret_cast<const char*>(&m_arena[e.offset]), sizeof(size) + size);
+    }
+    if (!out.flush())
+        return false;
+    m_spilledBytes += static_cast<uint64_t>(out.tellp());
+    m_entries.clear();
+    m_arena.clear();
+    return true;
+}
+
+bool RowidSorter::finish()
+{
+    if (m_runs.empty()) {
+        std::stable_sort(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+            return a.table != b.table ? a.table < b.table : a.rowid < b.rowid;
+        });
+        bool ok = true;
+        for (const Entry& e : m_entries) {
+            uint32_t size = 0;
+            std::memcpy(&size, &m_arena[e.offset], sizeof(size));
+            ok = decodeBody(&m_arena[e.offset + sizeof(size)], size, m_values) && m_next.row(e.table, e.rowid, m_values);
+            if (!ok)
+                break;
+        }
+        m_entries.clear();
+        m_arena.clear();
+        return ok;
+    }
+    if (!m_entries.empty() && !spill())
+        return false;
+
+    // k-way merge; on equal keys the earlier run (earlier rows) goes first.
+    std::vector<std::unique_ptr<RunReader>> readers;
+    for (const std::string& run : m_runs) {
+        readers.emplace_back(new RunReader(run));
+    }
+    auto later = [&readers](size_t a, size_t b) {
+        const RunReader& x = *readers[a];
+        const RunReader& y = *readers[b];
+        if (x.table != y.table)
+            return x.table > y.table;
+        if (x.rowid != y.rowid)
+            return x.rowid > y.rowid;
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (readers[i]->next())
+            heap.push(i);
+    }
+    while (!heap.empty()) {
+        const size_t i = heap.top();
+        heap.pop();
+        RunReader& reader = *readers[i];
+        if (!decodeBody(reader.body.data(), reader.body.size(), m_values)
+            || !m_next.row(reader.table, reader.rowid, m_values))
+            return false;
+        if (reader.next())
+            heap.push(i);
+    }
+    readers.clear();
+    for (const std::string& run : m_runs) {
+        std::remove(run.c_str());
+    }
+    m_runs.clear();
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Salvage.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Sits between the Salvager and the output and hands rows of rowid tables on sorted by
+// (table, rowid), so every table b-tree of the new database is filled by appends instead
+// of page splits. Orphan pages are found in file order, long after the walk of their
+// tree, which is what puts rows out of order in the first place.
+//
+// Rows are kept in memory up to `memoryBudget` bytes; beyond that they are written to
+// sorted run files (<spillPrefix>.<n>) that finish() merges. Rows with the same rowid
+// keep their arrival order, so the first copy still wins in the output. WITHOUT ROWID
+// rows are passed straight through.
+class RowidSorter final : public SalvageSink {
+public:
+    RowidSorter(const std::vector<SalvageTable>& tables,
+                SalvageSink& next,
+                size_t memoryBudget,
+                const std::string& spillPrefix);
+    ~RowidSorter() override; // removes the run files
+
+    bool row(size_t table, int64_t rowid, const std::vector<RecordValue>& values) override;
+
+    // Hands every collected row to the next sink, in order. Rows added afterwards start
+    // a new sorted batch (checkpoints flush the sorter this way).
+    bool finish();
+
+    size_t runs() const { return m_runs.size(); }
+    uint64_t spilledBytes() const { return m_spilledBytes; }
+
+private:
+    struct Entry {
+        size_t table;
+        int64_t rowid;
+        size_t offset; // into m_arena
+    };
+
+    bool spill();
+
+    const std::vector<SalvageTable>& m_tables;
+    SalvageSink& m_next;
+    size_t m_memoryBudget;
+    std::string m_spillPrefix;
+    std::vector<unsigned char> m_arena; // encoded values of the collected rows
+    std::vector<Entry> m_entries;
+    std::vector<std::string> m_runs;
+    std::vector<RecordValue> m_values;
+    uint64_t m_spilledBytes;
+};
+
+} // namespace WCDBRepair
@@ -0,0 +1,690 @@
+#include "Salvage.hpp"
+
+#include "PageSource.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr uint32_t kProgressEveryPages = 256;
+constexpr uint32_t kCheckpointEveryPages = 4096;
+constexpr uint32_t kFreelistTrunkSlots = 2; // next trunk + leaf count
+
+bool containsNoCase(const std::string& haystack, const char* needle)
+{
+    const size_t n = std::strlen(needle);
+    if (haystack.size() < n)
+        return false;
+    for (size_t i = 0; i + n <= haystack.size(); i++) {
+        size_t j = 0;
+        while (j < n && std::toupper(static_cast<unsigned char>(haystack[i + j])) == needle[j]) {
+            j++;
+        }
+        if (j == n)
+            return true;
+    }
+    return false;
+}
+
+std::string textOf(const RecordValue& v)
+{
+    if (v.type != RecordValue::Text)
+        return std::string();
+    return std::string(reinterpret_cast<const char*>(v.data), v.size);
+}
+
+// A value that SQLite could not have stored in a column of this affinity.
+bool conflicts(Affinity affinity, const RecordValue& v)
+{
+    switch (affinity) {
+    case Affinity::Text:
+        // Numbers are converted to text on the way in.
+        return v.type == RecordValue::Integer || v.type == RecordValue::Real;
+    case Affinity::Integer:
+    case Affinity::Real:
+    case Affinity::Numeric:
+        // Only text that does not look like a number stays text; rare enough to count against.
+        return v.type == RecordValue::Text;
+    case Affinity::Blob:
+        return false;
+    }
+    return false;
+}
+
+class Bitset {
+public:
+    explicit Bitset(uint32_t bits) : m_words((static_cast<size_t>(bits) + 64) / 64, 0) {}
+    bool test(uint32_t i) const { return (m_words[i / 64] >> (i % 64)) & 1; }
+    void set(uint32_t i) { m_words[i / 64] |= uint64_t(1) << (i % 64); }
+
+private:
+    std::vector<uint64_t> m_words;
+};
+
+// State shared by the tree walks and the page scan of one run.
+class Walker {
+public:
+    Walker(PageSource& source, uint32_t usableSize, SalvageStats& stats)
+    : m_source(source), m_usableSize(usableSize), m_stats(stats), m_visited(source.pageCount() + 1)
+    {
+    }
+
+    bool visited(uint32_t pgno) const { return m_visited.test(pgno); }
+    void markVisited(uint32_t pgno) { m_visited.set(pgno); }
+
+    // Copies page `pgno` into m_page and parses it; false if unreadable or not a b-tree page.
+    // Cells that parsed before a structural error are kept when `strict` is off.
+    bool load(uint32_t pgno, bool strict, BTreePage& bt)
+    {
+        PageSource::Status status = PageSource::Status::OK;
+        const unsigned char* data = m_source.page(pgno, &status);
+        if (data == nullptr) {
+            if (status != PageSource::Status::OutOfRange)
+                m_stats.unreadablePages++;
+            return false;
+        }
+        m_page.assign(data, data + m_source.pageSize());
+        if (!bt.parse(m_page.data(), pgno, m_usableSize, strict)) {
+            if (strict || !isBTreePageType(bt.type) || bt.cells.empty())
+                return false;
+        }
+        return true;
+    }
+
+    // Walks a b-tree from `root` in key order, calling `visit` with each page that has the
+    // expected kind. Returns false if some page of the tree could not be used.
+    template<typename Visit>
+    bool walk(uint32_t root, bool indexTree, Visit visit)
+    {
+        bool intact = true;
+        std::vector<uint32_t> stack(1, root);
+        BTreePage bt;
+        while (!stack.empty()) {
+            const uint32_t pgno = stack.back();
+            stack.pop_back();
+            if (pgno == 0 || pgno > m_source.pageCount() || visited(pgno)) {
+                intact = false;
+                continue;
+            }
+            if (!load(pgno, false, bt) || isTablePageType(bt.type) == indexTree) {
+                intact = false;
+                continue;
+            }
+            markVisited(pgno);
+            m_stats.walkedPages++;
+            if (!isLeafPageType(bt.type)) {
+                // Pushed right to left so pages come out in key order.
+                stack.push_back(bt.rightChild);
+                for (size_t i = bt.cells.size(); i > 0; i--) {
+                    stack.push_back(bt.cells[i - 1].leftChild);
+                }
+            }
+            if (!visit(pgno, bt))
+                return intact;
+        }
+        return intact;
+    }
+
+    // Decodes the records of the loaded page into m_rows (one entry per cell with a payload).
+    // m_page is clobbered by overflow reads, so cells are parsed before any payload is read.
+    void decodeRows(const BTreePage& bt)
+    {
+        m_rowCount = 0;
+        if (bt.type == PageTypeTableInterior)
+            return;
+        const std::vector<unsigned char> page(m_page);
+        for (const CellInfo& cell : bt.cells) {
+            if (m_payloads.size() <= m_rowCount) {
+                m_payloads.emplace_back();
+                m_values.emplace_back();
+                m_rowids.push_back(0);
+            }
+            std::vector<unsigned char>& payload = m_payloads[m_rowCount];
+            if (!m_source.readPayload(page.data(), cell, m_usableSize, payload)) {
+                m_stats.brokenPayloads++;
+                continue;
+            }
+            if (payload.empty() || !decodeRecord(payload.data(), payload.size(), m_values[m_rowCount])) {
+                m_stats.badRecords++;
+                continue;
+            }
+            m_rowids[m_rowCount] = cell.rowid;
+            m_rowCount++;
+        }
+    }
+
+    size_t rowCount() const { return m_rowCount; }
+    const std::vector<RecordValue>& values(size_t row) const { return m_values[row]; }
+    int64_t rowid(size_t row) const { return m_rowids[row]; }
+
+    bool emitRows(size_t table, SalvageSink& sink, const std::vector<bool>* only = nullptr)
+    {
+        for (size_t r = 0; r < m_rowCount; r++) {
+            if (only != nullptr && !(*only)[r])
+                continue;
+            if (!sink.row(table, m_rowids[r], m_values[r]))
+                return false;
+            m_stats.rows++;
+        }
+        return true;
+    }
+
+private:
+    PageSource& m_source;
+    uint32_t m_usableSize;
+    SalvageStats& m_stats;
+    Bitset m_visited;
+    std::vector<unsigned char> m_page;
+    // Per-row buffers, reused from page to page.
+    std::vector<std::vector<unsigned char>> m_payloads;
+    std::vector<std::vector<RecordValue>> m_values;
+    std::vector<int64_t> m_rowids;
+    size_t m_rowCount = 0;
+};
+
+bool rowFits(const SalvageTable& table, const std::vector<RecordValue>& values)
+{
+    if (values.empty() || values.size() > table.columns.size())
+        return false;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (static_cast<int>(i) == table.rowidColumn) {
+            if (values[i].type != RecordValue::Null)
+                return false;
+            continue;
+        }
+        if (conflicts(table.affinities[i], values[i]))
+            return false;
+    }
+    return true;
+}
+
+// Next token of a DDL statement: a word, a quoted identifier (unquoted) or one punctuation char.
+std::string nextToken(const std::string& sql, size_t& pos)
+{
+    while (pos < sql.size() && std::isspace(static_cast<unsigned char>(sql[pos]))) {
+        pos++;
+    }
+    if (pos >= sql.size())
+        return std::string();
+    const char c = sql[pos];
+    if (c == '"' || c == '`' || c == '[' || c == '\'') {
+        const char close = c == '[' ? ']' : c;
+        std::string out;
+        for (pos++; pos < sql.size(); pos++) {
+            if (sql[pos] == close) {
+                if (close != ']' && pos + 1 < sql.size() && sql[pos + 1] == close) {
+                    out.push_back(close);
+                    pos++;
+                    continue;
+                }
+                pos++;
+                break;
+            }
+            out.push_back(sql[pos]);
+        }
+        return out;
+    }
+    if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80) {
+        const size_t start = pos;
+        while (pos < sql.size()
+               && (std::isalnum(static_cast<unsigned char>(sql[pos])) || sql[pos] == '_' || sql[pos] == '$'
+                   || static_cast<unsigned char>(sql[pos]) >= 0x80)) {
+            pos++;
+        }
+        return sql.substr(start, pos - start);
+    }
+    pos++;
+    return std::string(1, c);
+}
+
+std::string upper(std::string s)
+{
+    for (char& c : s) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+// Fills type/name/tableName from "CREATE [TEMP] [UNIQUE|VIRTUAL] <type> [IF NOT EXISTS] [schema.]name [ON table]".
+bool describeStatement(SchemaEntry& entry)
+{
+    size_t pos = 0;
+    if (upper(nextToken(entry.sql, pos)) != "CREATE")
+        return false;
+    std::string word = upper(nextToken(entry.sql, pos));
+    while (word == "TEMP" || word == "TEMPORARY" || word == "UNIQUE" || word == "VIRTUAL") {
+        word = upper(nextToken(entry.sql, pos));
+    }
+    if (word != "TABLE" && word != "INDEX" && word != "VIEW" && word != "TRIGGER")
+        return false;
+    entry.type = word == "TABLE" ? "table" : word == "INDEX" ? "index" : word == "VIEW" ? "view" : "trigger";
+    size_t save = pos;
+    if (upper(nextToken(entry.sql, pos)) == "IF") {
+        nextToken(entry.sql, pos); // NOT
+        nextToken(entry.sql, pos); // EXISTS
+    } else {
+        pos = save;
+    }
+    entry.name = nextToken(entry.sql, pos);
+    save = pos;
+    if (nextToken(entry.sql, pos) == ".") {
+        entry.name = nextToken(entry.sql, pos);
+    } else {
+        pos = save;
+    }
+    entry.tableName = entry.name;
+    if (entry.type == "index" && upper(nextToken(entry.sql, pos)) == "ON")
+        entry.tableName = nextToken(entry.sql, pos);
+    return !entry.name.empty();
+}
+
+} // namespace
+
+void parseSchemaScript(const std::string& script, std::vector<SchemaEntry>& entries)
+{
+    std::string statement;
+    std::string lastWord; // trigger bodies hold ';' and end with END
+    std::string word;
+    for (size_t i = 0; i < script.size(); i++) {
+        const char c = script[i];
+        if (c == '-' && i + 1 < script.size() && script[i + 1] == '-') {
+            while (i < script.size() && script[i] != '\n') {
+                i++;
+            }
+            statement.push_back('\n');
+            continue;
+        }
+        if (c == '/' && i + 1 < script.size() && script[i + 1] == '*') {
+            const size_t end = script.find("*/", i + 2);
+            i = end == std::string::npos ? script.size() : end + 1;
+            statement.push_back(' ');
+            continue;
+        }
+        if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            const char close = c == '[' ? ']' : c;
+            const size_t end = script.find(close, i + 1);
+            const size_t stop = end == std::string::npos ? script.size() : end + 1;
+            statement.append(script, i, stop - i);
+            i = stop - 1;
+            lastWord.clear();
+            continue;
+        }
+        if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
+            word.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+        } else if (!word.empty()) {
+            lastWord.swap(word);
+            word.clear();
+        }
+        if (c == ';') {
+            SchemaEntry entry;
+            entry.sql = statement;
+            size_t pos = 0;
+            const std::string first = upper(nextToken(statement, pos));
+            if (first.empty()) {
+                statement.clear();
+                continue;
+            }
+            if (describeStatement(entry) && entry.type == "trigger" && lastWord != "END") {
+                statement.push_back(c);
+                continue;
+            }
+            if (!entry.type.empty() && !entry.name.empty())
+                entries.push_back(std::move(entry));
+            statement.clear();
+            lastWord.clear();
+            continue;
+        }
+        statement.push_back(c);
+    }
+    SchemaEntry entry;
+    entry.sql = statement;
+    if (describeStatement(entry))
+        entries.push_back(std::move(entry));
+}
+
+bool isWithoutRowidTable(const std::string& createSql)
+{
+    // Table options follow the closing parenthesis of the column list.
+    std::string tail;
+    const size_t close = createSql.rfind(')');
+    if (close == std::string::npos)
+        return false;
+    for (size_t i = close; i < createSql.size(); i++) {
+        if (!std::isspace(static_cast<unsigned char>(createSql[i])))
+            tail.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(createSql[i]))));
+    }
+    return tail.find("WITHOUTROWID") != std::string::npos;
+}
+
+Affinity affinityOfDeclaredType(const std::string& declaredType)
+{
+    if (containsNoCase(declaredType, "INT"))
+        return Affinity::Integer;
+    if (containsNoCase(declaredType, "CHAR") || containsNoCase(declaredType, "CLOB")
+        || containsNoCase(declaredType, "TEXT"))
+        return Affinity::Text;
+    if (declaredType.empty() || containsNoCase(declaredType, "BLOB"))
+        return Affinity::Blob;
+    if (containsNoCase(declaredType, "REAL") || containsNoCase(declaredType, "FLOA")
+        || containsNoCase(declaredType, "DOUB"))
+        return Affinity::Real;
+    return Affinity::Numeric;
+}
+
+Salvager::Salvager(const PageFile& file, const SalvageOptions& options)
+: m_file(file), m_options(options), m_pageSize(0), m_usableSize(0), m_headerValid(false)
+{
+}
+
+bool Salvager::open(std::string& error)
+{
+    if (m_options.keys != nullptr) {
+        m_pageSize = static_cast<uint32_t>(m_options.keys->params.pageSize);
+        m_usableSize = m_pageSize - static_cast<uint32_t>(m_options.keys->params.reserveSize());
+        PageSource source(m_file, m_pageSize, m_options.keys);
+        const unsigned char* first = source.page(1);
+        m_headerValid = first != nullptr && m_header.parse(first, m_pageSize) && m_header.pageSize == m_pageSize;
+    } else {
+        unsigned char head[DatabaseHeaderSize];
+        m_headerValid = m_file.readFully(0, head, sizeof(head)) && m_header.parse(head, sizeof(head));
+        if (m_headerValid) {
+            m_pageSize = m_header.pageSize;
+            m_usableSize = m_header.usableSize();
+        } else {
+            m_pageSize = m_options.pageSize;
+            m_usableSize = m_pageSize;
+        }
+    }
+    if (m_pageSize < 512 || m_pageSize > 65536 || (m_pageSize & (m_pageSize - 1)) != 0 || m_usableSize < 480) {
+        error = "page size unknown";
+        return false;
+    }
+    if (m_headerValid && m_header.textEncoding != 1) {
+        error = "only UTF-8 databases are supported";
+        return false;
+    }
+    if (m_file.size() < m_pageSize) {
+        error = "file shorter than one page";
+        return false;
+    }
+    return true;
+}
+
+void Salvager::readSchema(std::vector<SchemaEntry>& entries)
+{
+    entries.clear();
+    PageSource source(m_file, m_pageSize, m_options.keys);
+    SalvageStats scratch;
+    Walker walker(source, m_usableSize, scratch);
+    walker.walk(1, false, [&](uint32_t, const BTreePage& bt) {
+        walker.decodeRows(bt);
+        for (size_t r = 0; r < walker.rowCount(); r++) {
+            const std::vector<RecordValue>& v = walker.values(r);
+            if (v.size() < 5 || v[0].type != RecordValue::Text || v[1].type != RecordValue::Text)
+                continue;
+            SchemaEntry entry;
+            entry.type = textOf(v[0]);
+            entry.name = textOf(v[1]);
+            entry.tableName = textOf(v[2]);
+            entry.rootPage = v[3].type == RecordValue::Integer ? static_cast<uint32_t>(v[3].integer) : 0;
+            entry.sql = textOf(v[4]);
+            entries.push_back(std::move(entry));
+        }
+        return true;
+    });
+}
+
+bool Salvager::collectTreePages(uint32_t root, bool indexTree, std::vector<uint32_t>& pages)
+{
+    pages.clear();
+    PageSource source(m_file, m_pageSize, m_options.keys);
+    SalvageStats scratch;
+    Walker walker(source, m_usableSize, scratch);
+    return walker.walk(root, indexTree, [&](uint32_t pgno, const BTreePage&) {
+        pages.push_back(pgno);
+        return true;
+    });
+}
+
+uint64_t Salvager::estimateTreePages(uint32_t root, bool indexTree)
+{
+    PageSource source(m_file, m_pageSize, m_options.keys);
+    SalvageStats scratch;
+    Walker walker(source, m_usableSize, scratch);
+    uint64_t pages = 1;
+    uint64_t level = 1; // pages on the current level
+    BTreePage bt;
+    for (uint32_t pgno = root; pgno != 0 && level < (uint64_t(1) << 40);) {
+        if (walker.visited(pgno) || !walker.load(pgno, false, bt) || isTablePageType(bt.type) == indexTree)
+            break;
+        walker.markVisited(pgno); // a cycle ends the descent
+        if (isLeafPageType(bt.type))
+            break;
+        level *= bt.cells.size() + 1;
+        pages += level;
+        pgno = bt.cells.empty() ? bt.rightChild : bt.cells[0].leftChild;
+    }
+    return pages;
+}
+
+bool Salvager::run(const std::vector<SalvageTable>& tables,
+                   SalvageSink& sink,
+                   SalvageStats& stats,
+                   const std::vector<size_t>& walkOrder)
+{
+    stats = SalvageStats();
+    PageSource source(m_file, m_pageSize, m_options.keys);
+    const uint32_t pageCount = source.pageCount();
+    stats.pageCount = pageCount;
+    Walker walker(source, m_usableSize, stats);
+    auto report = [&](double progress) {
+        if (m_options.progress)
+            m_options.progress(progress);
+    };
+    auto cancelled = [&]() {
+        if (m_options.cancelled && m_options.cancelled())
+            stats.cancelled = true;
+        return stats.cancelled;
+    };
+    auto checkpoint = [&](size_t walkedTables, uint32_t scanPage) {
+        if (!m_options.checkpoint)
+            return;
+        SalvagePosition position;
+        position.walkedTables = walkedTables;
+        position.scanPage = scanPage;
+        m_options.checkpoint(position);
+    };
+    const SalvagePosition& resume = m_options.resumeFrom;
+
+    // Pages that must not be taken for orphans: the schema tree, the freelist (stale
+    // content of deleted rows), pointer maps and the lock-byte page.
+    walker.walk(1, false, [](uint32_t, const BTreePage&) { return true; });
+    if (m_headerValid) {
+        uint32_t trunk = m_header.firstFreelistTrunk;
+        std::vector<unsigned char> trunkPage;
+        while (trunk != 0 && trunk <= pageCount && !walker.visited(trunk)) {
+            walker.markVisited(trunk);
+            const unsigned char* data = source.page(trunk);
+            if (data == nullptr)
+                break;
+            trunkPage.assign(data, data + m_pageSize);
+            const uint32_t leaves = std::min(readBE32(trunkPage.data() + 4), m_usableSize / 4 - kFreelistTrunkSlots);
+            for (uint32_t i = 0; i < leaves; i++) {
+                const uint32_t leaf = readBE32(trunkPage.data() + 4 * (kFreelistTrunkSlots + i));
+                if (leaf != 0 && leaf <= pageCount)
+                    walker.markVisited(leaf);
+            }
+            trunk = readBE32(trunkPage.data());
+        }
+        if (m_header.largestRootPage != 0) {
+            for (uint32_t pgno = 2; pgno <= pageCount; pgno++) {
+                if (isPointerMapPage(pgno, m_usableSize, m_pageSize))
+                    walker.markVisited(pgno);
+            }
+        }
+    }
+    if (lockBytePage(m_pageSize) <= pageCount)
+        walker.markVisited(lockBytePage(m_pageSize));
+
+    // Pass 1: everything reachable from a known root.
+    std::vector<bool> damaged(tables.size(), true);
+    bool stopped = false;
+    std::vector<size_t> order = walkOrder;
+    if (order.empty()) {
+        order.resize(tables.size());
+        for (size_t t = 0; t < order.size(); t++) {
+            order[t] = t;
+        }
+    }
+    for (size_t i = 0; i < order.size() && !stopped; i++) {
+        const size_t t = order[i];
+        if (tables[t].rootPage == 0)
+            continue;
+        const bool replay = i < resume.walkedTables;
+        damaged[t] = !walker.walk(tables[t].rootPage, tables[t].withoutRowid, [&](uint32_t, const BTreePage& bt) {
+            if (cancelled()) {
+                stopped = true;
+                return false;
+            }
+            if (!replay) {
+                walker.decodeRows(bt);
+                if (!walker.emitRows(t, sink)) {
+                    stopped = true;
+                    return false;
+                }
+            }
+            if (stats.walkedPages % kProgressEveryPages == 0)
+                report(0.5 * static_cast<double>(stats.walkedPages) / pageCount);
+            return true;
+        });
+        if (!stopped && !replay)
+            checkpoint(i + 1, 0);
+    }
+    if (stopped)
+        return false;
+    if (order.size() < tables.size()) {
+        // Leaves of the trees not walked would pass for orphans of other tables.
+        report(1.0);
+        return true;
+    }
+    report(0.5);
+
+    // Owners from backup material, for leaves the walks above did not reach.
+    std::vector<std::pair<uint32_t, size_t>> known;
+    for (size_t t = 0; t < tables.size(); t++) {
+        for (uint32_t pgno : tables[t].knownPages) {
+            if (pgno <= pageCount && !walker.visited(pgno))
+                known.emplace_back(pgno, t);
+        }
+    }
+    std::sort(known.begin(), known.end());
+
+    // Pass 2: table leaves no walk reached, matched to the rowid table their rows fit best.
+    BTreePage bt;
+    std::vector<bool> fits;
+    std::vector<bool> bestFits;
+    for (uint32_t pgno = std::max<uint32_t>(2, resume.scanPage); pgno <= pageCount; pgno++) {
+        if (pgno % kProgressEveryPages == 0) {
+            report(0.5 + 0.5 * static_cast<double>(pgno) / pageCount);
+            if (cancelled()) {
+                checkpoint(tables.size(), pgno); // pages before pgno are done
+                return false;
+            }
+        }
+        if (pgno % kCheckpointEveryPages == 0)
+            checkpoint(tables.size(), pgno);
+        if (walker.visited(pgno))
+            continue;
+        if (!walker.load(pgno, false, bt))
+            continue;
+        auto owner = std::lower_bound(known.begin(), known.end(), std::make_pair(pgno, size_t(0)));
+        const bool hasOwner = owner != known.end() && owner->first == pgno;
+        // Index pages only carry rows of a WITHOUT ROWID table the material names as owner.
+        const bool ownerTree = hasOwner && tables[owner->second].withoutRowid == !isTablePageType(bt.type);
+        if (bt.type != PageTypeTableLeaf && !ownerTree)
+            continue;
+        walker.decodeRows(bt);
+        const size_t rows = walker.rowCount();
+        if (rows == 0)
+            continue;
+
+        if (ownerTree) {
+            // The page may have been reused since the material was taken; the shape must still agree.
+            fits.assign(rows, false);
+            size_t fit = 0;
+            for (size_t r = 0; r < rows; r++) {
+                fits[r] = rowFits(tables[owner->second], walker.values(r));
+                fit += fits[r] ? 1 : 0;
+            }
+            if (fit * 10 >= rows * 9) {
+                stats.knownLeafPages++;
+                if (!walker.emitRows(owner->second, sink, &fits))
+                    return false;
+                continue;
+            }
+            if (bt.type != PageTypeTableLeaf)
+                continue;
+        }
+
+        // Best table by fitting rows, then by rows using every column, then damaged first.
+        size_t best = tables.size();
+        size_t bestFit = 0;
+        size_t bestExact = 0;
+        bool tie = false;
+        for (size_t t = 0; t < tables.size(); t++) {
+            if (tables[t].withoutRowid)
+                continue;
+            fits.assign(rows, false);
+            size_t fit = 0;
+            size_t exact = 0;
+            for (size_t r = 0; r < rows; r++) {
+                if (rowFits(tables[t], walker.values(r))) {
+                    fits[r] = true;
+                    fit++;
+                    if (walker.values(r).size() == tables[t].columns.size())
+                        exact++;
+                }
+            }
+            if (fit == 0)
+                continue;
+            int order = 0;
+            if (best == tables.size()) {
+                order = 1;
+            } else if (fit != bestFit) {
+                order = fit > bestFit ? 1 : -1;
+            } else if (exact != bestExact) {
+                order = exact > bestExact ? 1 : -1;
+            } else if (damaged[t] != damaged[best]) {
+                order = damaged[t] ? 1 : -1;
+            }
+            if (order > 0) {
+                best = t;
+                bestFit = fit;
+                bestExact = exact;
+                bestFits = fits;
+                tie = false;
+            } else if (order == 0) {
+                tie = true;
+            }
+        }
+        if (best == tables.size() || bestFit * 10 < rows * 9) {
+            stats.unmatchedPages++;
+            continue;
+        }
+        if (tie) {
+            stats.ambiguousPages++;
+            continue;
+        }
+        stats.orphanLeafPages++;
+        if (!walker.emitRows(best, sink, &bestFits))
+            return false;
+    }
+    report(1.0);
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "PageFile.hpp"
+#include "SqliteFormat.hpp"
+#include "Sqlcipher.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// One row of sqlite_master.
+struct SchemaEntry {
+    std::string type; // table, index, view, trigger
+    std::string name;
+    std::string tableName;
+    uint32_t rootPage = 0; // 0 when unknown (DDL from another source)
+    std::string sql;
+};
+
+// Splits a DDL script into CREATE statements (others are ignored) and names them.
+void parseSchemaScript(const std::string& script, std::vector<SchemaEntry>& entries);
+
+// Whether a CREATE TABLE statement declares a WITHOUT ROWID table (an index b-tree).
+bool isWithoutRowidTable(const std::string& createSql);
+
+enum class Affinity : uint8_t {
+    Integer,
+    Real,
+    Text,
+    Blob,
+    Numeric,
+};
+
+// Column affinity of a declared type, following SQLite's rules (section 3.1 of datatype3).
+Affinity affinityOfDeclaredType(const std::string& declaredType);
+
+// A table rows are salvaged into. Columns are in record order: declaration order for
+// rowid tables, primary key columns first for WITHOUT ROWID tables.
+struct SalvageTable {
+    std::string name;
+    uint32_t rootPage = 0; // root in the damaged file, 0 if unknown
+    bool withoutRowid = false;
+    int rowidColumn = -1; // INTEGER PRIMARY KEY column, stored as NULL in the record
+    std::vector<std::string> columns;
+    std::vector<Affinity> affinities;
+    // B-tree pages the table had when backup material was taken; orphans among them are
+    // assigned to the table without shape matching.
+    std::vector<uint32_t> knownPages;
+};
+
+class SalvageSink {
+public:
+    virtual ~SalvageSink() {}
+    // `values` point into a buffer that is reused after the call returns.
+    // Returning false stops the salvage.
+    virtual bool row(size_t table, int64_t rowid, const std::vector<RecordValue>& values) = 0;
+};
+
+// How far a run got: every row before this point has been handed to the sink.
+struct SalvagePosition {
+    size_t walkedTables = 0; // pass 1: the first walkedTables tables of the walk order are done
+    uint32_t scanPage = 0;   // pass 2: pages below this are scanned, 0 before pass 2
+};
+
+struct SalvageOptions {
+    const CipherKeys* keys = nullptr; // nullptr for plaintext files
+    uint32_t pageSize = 0;            // 0 means from the header (plaintext only)
+    std::function<void(double)> progress;
+    // Polled between pages; returning true stops the run (stats.cancelled).
+    std::function<bool()> cancelled;
+    // Called after each walked table and every few thousand scanned pages, at points a
+    // later run can resume from. Rows replayed after a resume are the same rows again.
+    std::function<void(const SalvagePosition&)> checkpoint;
+    // Rows before this position are not emitted again (the trees are still walked, to
+    // know which pages they own).
+    SalvagePosition resumeFrom;
+};
+
+struct SalvageStats {
+    uint32_t pageCount = 0;
+    uint64_t walkedPages = 0;      // reached from a known root
+    uint64_t orphanLeafPages = 0;  // table leaves found by the page scan and matched by shape
+    uint64_t knownLeafPages = 0;   // orphan leaves assigned from backup material
+    uint64_t ambiguousPages = 0;   // leaves that fit several tables equally well (skipped)
+    uint64_t unmatchedPages = 0;   // leaves that fit no table (skipped)
+    uint64_t unreadablePages = 0;  // read/HMAC/decrypt failures
+    uint64_t rows = 0;
+    uint64_t brokenPayloads = 0;   // overflow chain unreadable
+    uint64_t badRecords = 0;       // record could not be decoded
+    bool cancelled = false;
+};
+
+// Streams rows straight out of the b-tree pages of a damaged database, without
+// SQLite and without needing sqlite_master or interior pages to be intact.
+//
+// First every table with a known root page is walked as far as its pages allow.
+// Then all pages are scanned once in file order, and table leaves no walk reached
+// are matched to a table by the shape of their records: column count, NULL in the
+// INTEGER PRIMARY KEY slot and values fitting the column affinities. Rows are handed
+// to the sink page by page, so memory stays constant apart from one bit per page.
+// Orphaned WITHOUT ROWID leaves look like index pages and are not matched.
+class Salvager {
+public:
+    Salvager(const PageFile& file, const SalvageOptions& options);
+
+    // Checks the header (plaintext) or the page size (encrypted).
+    bool open(std::string& error);
+
+    // sqlite_master rows reachable from page 1; empty when page 1 is gone.
+    void readSchema(std::vector<SchemaEntry>& entries);
+
+    // `walkOrder` is the order pass 1 walks the tables in (indexes into `tables`); empty
+    // means list order. Orphan leaves are still found in file order. When it names only
+    // some of the tables, the others are not walked and there is no page scan.
+    bool run(const std::vector<SalvageTable>& tables,
+             SalvageSink& sink,
+             SalvageStats& stats,
+             const std::vector<size_t>& walkOrder = std::vector<size_t>());
+
+    // Pages of the b-tree rooted at `root`, in key order; false if some page was unusable.
+    bool collectTreePages(uint32_t root, bool indexTree, std::vector<uint32_t>& pages);
+
+    // Rough size of the b-tree rooted at `root`, from the fan-out along its leftmost path
+    // (one page read per level), for ordering tables before a run.
+    uint64_t estimateTreePages(uint32_t root, bool indexTree);
+
+    uint32_t pageSize() const { return m_pageSize; }
+    const CipherKeys* keys() const { return m_options.keys; }
+
+private:
+    const PageFile& m_file;
+    SalvageOptions m_options;
+    uint32_t m_pageSize;
+    uint32_t m_usableSize;
+    DatabaseHeader m_header;
+    bool m_headerValid;
+};
+
+} // namespace WCDBRepair
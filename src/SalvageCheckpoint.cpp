@@ -0,0 +1,81 @@
+#include "SalvageCheckpoint.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace WCDBRepair {
+
+namespace {
+
+const char kMagic[] = "wcdb-repair-salvage-checkpoint 1";
+
+} // namespace
+
+bool saveSalvageCheckpoint(const std::string& path, const SalvageCheckpoint& checkpoint)
+{
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out << kMagic << "\n";
+        out << "sourceSize=" << checkpoint.sourceSize << "\n";
+        out << "walkedTables=" << checkpoint.position.walkedTables << "\n";
+        out << "scanPage=" << checkpoint.position.scanPage << "\n";
+        if (!checkpoint.walkOrder.empty()) {
+            out << "walkOrder=";
+            for (size_t i = 0; i < checkpoint.walkOrder.size(); i++) {
+                out << (i > 0 ? "," : "") << checkpoint.walkOrder[i];
+            }
+            out << "\n";
+        }
+        for (const std::string& table : checkpoint.tables) {
+            out << "table=" << table << "\n";
+        }
+        if (!out.flush())
+            return false;
+    }
+    std::remove(path.c_str()); // rename does not replace on Windows
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool loadSalvageCheckpoint(const std::string& path, SalvageCheckpoint& checkpoint)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        in.open(path + ".tmp", std::ios::binary); // crashed between remove and rename
+    std::string line;
+    if (!std::getline(in, line) || line != kMagic)
+        return false;
+    checkpoint = SalvageCheckpoint();
+    while (std::getline(in, line)) {
+        const size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            continue;
+        const std::string key = line.substr(0, eq);
+        const std::string value = line.substr(eq + 1);
+        if (key == "sourceSize")
+            checkpoint.sourceSize = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "walkedTables")
+            checkpoint.position.walkedTables = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        else if (key == "scanPage")
+            checkpoint.position.scanPage = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (key == "table")
+            checkpoint.tables.push_back(value);
+        else if (key == "walkOrder") {
+            for (const char* p = value.c_str(); *p != '\0';) {
+                char* end = nullptr;
+                checkpoint.walkOrder.push_back(static_cast<size_t>(std::strtoull(p, &end, 10)));
+                p = *end == ',' ? end + 1 : end;
+            }
+        }
+    }
+    return true;
+}
+
+void removeSalvageCheckpoint(const std::string& path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".tmp").c_str());
+}
+
+} // namespace WCDBRepair
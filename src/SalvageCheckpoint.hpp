@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Salvage.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Where an interrupted salvage stopped; rows before `position` are committed to the output.
+// Kept next to the output as <output>-checkpoint, a small key=value text file.
+struct SalvageCheckpoint {
+    uint64_t sourceSize = 0;
+    std::vector<std::string> tables; // output tables, in the order the run used
+    std::vector<size_t> walkOrder;   // empty means table order
+    SalvagePosition position;
+};
+
+// Written to <path>.tmp first, so a crash mid-write keeps the previous checkpoint.
+bool saveSalvageCheckpoint(const std::string& path, const SalvageCheckpoint& checkpoint);
+// False when there is no checkpoint at `path` (or only a leftover <path>.tmp) or it is not one.
+bool loadSalvageCheckpoint(const std::string& path, SalvageCheckpoint& checkpoint);
+void removeSalvageCheckpoint(const std::string& path);
+
+} // namespace WCDBRepair
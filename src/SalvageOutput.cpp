@@ -0,0 +1,414 @@
+#include "SalvageOutput.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <thread>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kRowsPerTransaction = 20000;
+constexpr size_t kRowsPerStatement = 64;
+constexpr size_t kMaxVariables = 999; // SQLITE_MAX_VARIABLE_NUMBER before 3.32
+constexpr size_t kNotPrepared = static_cast<size_t>(-1);
+constexpr std::chrono::milliseconds kBusyRetryInterval(20);
+
+std::string quoteIdentifier(const std::string& name)
+{
+    std::string out = "\"";
+    for (char c : name) {
+        if (c == '"')
+            out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
+
+bool sameName(const std::string& a, const std::string& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+            return false;
+    }
+    return true;
+}
+
+std::string upperNoSpace(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s) {
+        if (!std::isspace(static_cast<unsigned char>(c)))
+            out.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+    }
+    return out;
+}
+
+std::string toString(const WCDB::UnsafeStringView& v)
+{
+    return std::string(v.data(), v.length());
+}
+
+} // namespace
+
+SalvageOutput::SalvageOutput(WCDB::Database& database)
+: m_handle(database.getHandle())
+, m_tables(nullptr)
+, m_inTransaction(false)
+, m_pendingRows(0)
+, m_preparedTable(kNotPrepared)
+, m_preparedCount(0)
+, m_preparedRows(0)
+, m_failedRows(0)
+, m_bufferTable(kNotPrepared)
+, m_bufferCount(0)
+, m_busyTimeout(0)
+{
+}
+
+SalvageOutput::~SalvageOutput()
+{
+    m_handle.finalize();
+    if (m_inTransaction)
+        m_handle.rollbackTransaction();
+}
+
+bool SalvageOutput::whileBusy(const std::function<bool()>& op)
+{
+    const auto end = std::chrono::steady_clock::now() + m_busyTimeout;
+    while (!op()) {
+        const WCDB::Error::Code code = m_handle.getError().code();
+        if (code != WCDB::Error::Code::Busy && code != WCDB::Error::Code::Locked)
+            return false;
+        if (std::chrono::steady_clock::now() >= end)
+            return false;
+        std::this_thread::sleep_for(kBusyRetryInterval);
+    }
+    return true;
+}
+
+bool SalvageOutput::describeTable(const SchemaEntry& entry, SalvageTable& table)
+{
+    struct Column {
+        std::string name;
+        std::string type;
+        int pk;
+    };
+    std::vector<Column> columns;
+    if (!m_handle.prepareSQL("PRAGMA table_info(" + quoteIdentifier(entry.name) + ")"))
+        return false;
+    while (m_handle.step() && !m_handle.isDone()) {
+        Column c;
+        c.name = toString(m_handle.getText(1));
+        c.type = toString(m_handle.getText(2));
+        c.pk = static_cast<int>(m_handle.getInteger(5));
+        columns.push_back(std::move(c));
+    }
+    m_handle.finalize();
+    if (columns.empty())
+        return false;
+
+    table = SalvageTable();
+    table.name = entry.name;
+    table.rootPage = entry.rootPage;
+    table.withoutRowid = isWithoutRowidTable(entry.sql);
+    if (table.withoutRowid) {
+        // Record order: primary key columns in key order, then the rest.
+        std::stable_sort(columns.begin(), columns.end(), [](const Column& a, const Column& b) {
+            const int ka = a.pk > 0 ? a.pk : 1 << 30;
+            const int kb = b.pk > 0 ? b.pk : 1 << 30;
+            return ka < kb;
+        });
+    } else {
+        int pkColumns = 0;
+        int pkIndex = -1;
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].pk > 0) {
+                pkColumns++;
+                pkIndex = static_cast<int>(i);
+            }
+        }
+        if (pkColumns == 1 && upperNoSpace(columns[pkIndex].type) == "INTEGER")
+            table.rowidColumn = pkIndex;
+    }
+    for (const Column& c : columns) {
+        table.columns.push_back(c.name);
+        table.affinities.push_back(affinityOfDeclaredType(c.type));
+    }
+    return true;
+}
+
+void SalvageOutput::createTables(const std::vector<SchemaEntry>& entries,
+                                 std::vector<SalvageTable>& tables,
+                                 std::vector<std::string>& failed,
+                                 bool existing)
+{
+    tables.clear();
+    for (const SchemaEntry& entry : entries) {
+        if (entry.type != "table" || entry.sql.empty())
+            continue;
+        // sqlite_sequence comes with the first AUTOINCREMENT table; other internal tables are skipped.
+        const bool internal = entry.name.compare(0, 7, "sqlite_") == 0;
+        if (internal && entry.name != "sqlite_sequence")
+            continue;
+        if (!internal && !existing && !m_handle.execute(WCDB::UnsafeStringView(entry.sql))) {
+            failed.push_back(entry.name);
+            continue;
+        }
+        SalvageTable table;
+        if (describeTable(entry, table)) {
+            tables.push_back(std::move(table));
+        } else if (!internal) {
+            failed.push_back(entry.name);
+        }
+    }
+    m_tables = &tables;
+}
+
+bool SalvageOutput::prepareInsert(size_t table, size_t valueCount, size_t rows)
+{
+    if (table == m_preparedTable && valueCount == m_preparedCount && rows == m_preparedRows)
+        return true;
+    const SalvageTable& t = (*m_tables)[table];
+    std::string sql = "INSERT OR IGNORE INTO " + quoteIdentifier(t.name) + "(";
+    std::string values;
+    if (!t.withoutRowid && t.rowidColumn < 0) {
+        sql += "rowid";
+        values += "?";
+    }
+    for (size_t i = 0; i < valueCount; i++) {
+        if (!values.empty()) {
+            sql += ",";
+            values += ",";
+        }
+        sql += quoteIdentifier(t.columns[i]);
+        values += "?";
+    }
+    sql += ") VALUES";
+    for (size_t r = 0; r < rows; r++) {
+        sql += r > 0 ? ",(" : "(";
+        sql += values + ")";
+    }
+    m_handle.finalize();
+    m_preparedTable = kNotPrepared;
+    if (!m_handle.prepareSQL(sql))
+        return false;
+    m_preparedTable = table;
+    m_preparedCount = valueCount;
+    m_preparedRows = rows;
+    return true;
+}
+
+void SalvageOutput::bindRow(int& index, size_t table, int64_t rowid, const RecordValue* values, size_t count)
+{
+    const SalvageTable& t = (*m_tables)[table];
+    if (!t.withoutRowid && t.rowidColumn < 0)
+        m_handle.bindInteger(rowid, index++);
+    for (size_t i = 0; i < count; i++, index++) {
+        const RecordValue& v = values[i];
+        if (static_cast<int>(i) == t.rowidColumn) {
+            m_handle.bindInteger(rowid, index);
+            continue;
+        }
+        switch (v.type) {
+        case RecordValue::Null:
+            m_handle.bindNull(index);
+            break;
+        case RecordValue::Integer:
+            m_handle.bindInteger(v.integer, index);
+            break;
+        case RecordValue::Real:
+            m_handle.bindDouble(v.real, index);
+            break;
+        case RecordValue::Text:
+            m_handle.bindText(WCDB::UnsafeStringView(reinterpret_cast<const char*>(v.data), v.size), index);
+            break;
+        case RecordValue::Blob:
+            m_handle.bindBLOB(WCDB::UnsafeData::immutable(v.data, v.size), index);
+            break;
+        }
+    }
+}
+
+bool SalvageOutput::row(size_t table, int64_t rowid, const std::vector<RecordValue>& values)
+{
+    const SalvageTable& t = (*m_tables)[table];
+    const size_t count = std::min(values.size(), t.columns.size());
+    if ((table != m_bufferTable || count != m_bufferCount) && !flush())
+        return false;
+    m_bufferTable = table;
+    m_bufferCount = count;
+    m_bufferRowids.push_back(rowid);
+    for (size_t i = 0; i < count; i++) {
+        RecordValue v = values[i];
+        size_t offset = 0;
+        if (v.type == RecordValue::Text || v.type == RecordValue::Blob) {
+            // The record lives in a page buffer that is gone after this call.
+            offset = m_bufferBytes.size();
+            m_bufferBytes.insert(m_bufferBytes.end(), v.data, v.data + v.size);
+            v.data = nullptr;
+        }
+        m_bufferValues.push_back(v);
+        m_bufferOffsets.push_back(offset);
+    }
+    const size_t perRow = count + ((!t.withoutRowid && t.rowidColumn < 0) ? 1 : 0);
+    const size_t batch = std::max<size_t>(1, std::min(kRowsPerStatement, kMaxVariables / std::max<size_t>(1, perRow)));
+    return m_bufferRowids.size() < batch || flush();
+}
+
+// Inserts the buffered rows with one statement. When it fails, they are inserted one
+// by one, so failedRows() counts only the rows that are refused.
+bool SalvageOutput::flush()
+{
+    const size_t rows = m_bufferRowids.size();
+    if (rows == 0)
+        return true;
+    if (!m_inTransaction) {
+        // The statement must not span the transaction boundary.
+        m_handle.finalize();
+        m_preparedTable = kNotPrepared;
+        if (!whileBusy([this]() { return m_handle.beginTransaction(); }))
+            return false;
+        m_inTransaction = true;
+    }
+    for (size_t i = 0; i < m_bufferValues.size(); i++) {
+        RecordValue& v = m_bufferValues[i];
+        if (v.type == RecordValue::Text || v.type == RecordValue::Blob)
+            v.data = m_bufferBytes.data() + m_bufferOffsets[i];
+    }
+    const size_t count = m_bufferCount;
+    bool inserted = false;
+    if (prepareInsert(m_bufferTable, count, rows)) {
+        int index = 1;
+        for (size_t r = 0; r < rows; r++) {
+            bindRow(index, m_bufferTable, m_bufferRowids[r], m_bufferValues.data() + r * count, count);
+        }
+        inserted = m_handle.step();
+        m_handle.reset();
+    }
+    if (!inserted) {
+        for (size_t r = 0; r < rows; r++) {
+            if (!prepareInsert(m_bufferTable, count, 1)) {
+                m_failedRows += rows - r;
+                break;
+            }
+            int index = 1;
+            bindRow(index, m_bufferTable, m_bufferRowids[r], m_bufferValues.data() + r * count, count);
+            if (!m_handle.step())
+                m_failedRows++;
+            m_handle.reset();
+        }
+    }
+    m_bufferRowids.clear();
+    m_bufferValues.clear();
+    m_bufferOffsets.clear();
+    m_bufferBytes.clear();
+
+    m_pendingRows += rows;
+    if (m_pendingRows >= kRowsPerTransaction) {
+        m_handle.finalize();
+        m_preparedTable = kNotPrepared;
+        m_inTransaction = false;
+        m_pendingRows = 0;
+        if (!m_handle.commitOrRollbackTransaction())
+            return false;
+    }
+    return true;
+}
+
+bool SalvageOutput::commit()
+{
+    if (!flush())
+        return false;
+    m_handle.finalize();
+    m_preparedTable = kNotPrepared;
+    if (!m_inTransaction)
+        return true;
+    m_inTransaction = false;
+    m_pendingRows = 0;
+    return m_handle.commitOrRollbackTransaction();
+}
+
+bool SalvageOutput::mergeShard(const std::string& path)
+{
+    if (!commit())
+        return false;
+    if (!m_handle.prepareSQL(WCDB::UnsafeStringView("ATTACH DATABASE ? AS shard")))
+        return false;
+    m_handle.bindText(WCDB::UnsafeStringView(path), 1);
+    const bool attached = m_handle.step();
+    m_handle.finalize();
+    if (!attached)
+        return false;
+
+    bool ok = m_handle.beginTransaction();
+    for (size_t i = 0; ok && i < m_tables->size(); i++) {
+        const SalvageTable& t = (*m_tables)[i];
+        std::string columns;
+        if (!t.withoutRowid && t.rowidColumn < 0)
+            columns = "rowid";
+        for (const std::string& column : t.columns) {
+            if (!columns.empty())
+                columns += ",";
+            columns += quoteIdentifier(column);
+        }
+        std::string sql = "INSERT OR IGNORE INTO main." + quoteIdentifier(t.name) + "(" + columns + ") SELECT "
+                          + columns + " FROM shard." + quoteIdentifier(t.name);
+        if (!t.withoutRowid)
+            sql += " ORDER BY rowid";
+        ok = m_handle.execute(WCDB::UnsafeStringView(sql));
+    }
+    if (ok) {
+        ok = m_handle.commitOrRollbackTransaction();
+    } else {
+        m_handle.rollbackTransaction();
+    }
+    m_handle.execute(WCDB::UnsafeStringView("DETACH DATABASE shard"));
+    return ok;
+}
+
+bool SalvageOutput::exists(const std::string& name)
+{
+    if (!m_handle.prepareSQL(WCDB::UnsafeStringView("SELECT 1 FROM sqlite_master WHERE name = ?")))
+        return false;
+    m_handle.bindText(WCDB::UnsafeStringView(name), 1);
+    const bool found = m_handle.step() && !m_handle.isDone();
+    m_handle.finalize();
+    return found;
+}
+
+bool SalvageOutput::finish(const std::vector<SchemaEntry>& entries,
+                           std::vector<std::string>& failed,
+                           bool triggers,
+                           const std::vector<std::string>* indexedTables)
+{
+    if (!commit())
+        return false;
+    // Indexes first: each one is one sorted bulk build over rows that are all in place.
+    // Triggers go last so nothing fires while the schema is being finished.
+    for (const char* type : { "index", "view", "trigger" }) {
+        if (!triggers && std::strcmp(type, "trigger") == 0)
+            continue;
+        for (const SchemaEntry& entry : entries) {
+            if (entry.type != type || entry.sql.empty() || entry.name.compare(0, 7, "sqlite_") == 0)
+                continue;
+            if (indexedTables != nullptr && entry.type == "index"
+                && std::none_of(indexedTables->begin(), indexedTables->end(), [&](const std::string& table) {
+                       return sameName(table, entry.tableName);
+                   }))
+                continue; // its table is still empty
+            if (exists(entry.name)) // finished by a run this one resumes
+                continue;
+            if (!whileBusy([&]() { return m_handle.execute(WCDB::UnsafeStringView(entry.sql)); }))
+                failed.push_back(entry.name);
+        }
+    }
+    return true;
+}
+
+} // namespace WCDBRepair
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Salvage.hpp"
+
+#include "WCDBCpp.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Writes salvaged rows into a fresh database through one WCDB handle: tables are
+// created up front, rows go in with INSERT OR IGNORE (rows walked from a root win
+// over orphan copies with the same rowid) in large transactions, and indexes, views
+// and triggers are created once the data is in. Consecutive rows of one table are
+// buffered and inserted by one multi-row statement, which is prepared once and reused
+// while the table and the batch size stay the same.
+class SalvageOutput final : public SalvageSink {
+public:
+    explicit SalvageOutput(WCDB::Database& database);
+    ~SalvageOutput() override;
+
+    // Creates the tables among `entries` and describes their record layout in `tables`.
+    // Tables whose DDL fails are named in `failed` and left out. With `existing` the
+    // tables are only described (resuming into an output an earlier run created).
+    void createTables(const std::vector<SchemaEntry>& entries,
+                      std::vector<SalvageTable>& tables,
+                      std::vector<std::string>& failed,
+                      bool existing = false);
+
+    bool row(size_t table, int64_t rowid, const std::vector<RecordValue>& values) override;
+
+    // Commits the rows written so far (checkpoints).
+    bool commit();
+
+    // Copies every table of a database built by another SalvageOutput from the same schema
+    // (a shard of a parallel run) into this one, in rowid order. The shard is attached, so
+    // an encrypted output reads it with its own key.
+    bool mergeShard(const std::string& path);
+
+    // Commits the last batch, then creates the indexes, views and triggers that do not exist yet.
+    // Without `triggers`, rows added by a later run into the same output do not fire them.
+    // With `indexedTables`, only the indexes on those tables are created; the others are left
+    // to the run that fills their tables, so it does not maintain them row by row.
+    bool finish(const std::vector<SchemaEntry>& entries,
+                std::vector<std::string>& failed,
+                bool triggers = true,
+                const std::vector<std::string>* indexedTables = nullptr);
+
+    uint64_t failedRows() const { return m_failedRows; }
+
+    // For an output another connection may write to (the DB the app has open after repair
+    // --priority-tables): how long to keep retrying when it holds the write lock. Only
+    // taking the lock waits; in WAL mode, which WCDB uses, a commit never waits on readers.
+    void setBusyTimeout(std::chrono::milliseconds timeout) { m_busyTimeout = timeout; }
+
+private:
+    bool whileBusy(const std::function<bool()>& op);
+    bool prepareInsert(size_t table, size_t valueCount, size_t rows);
+    void bindRow(int& index, size_t table, int64_t rowid, const RecordValue* values, size_t count);
+    bool flush();
+    bool describeTable(const SchemaEntry& entry, SalvageTable& table);
+    bool exists(const std::string& name);
+
+    WCDB::Handle m_handle;
+    const std::vector<SalvageTable>* m_tables;
+    bool m_inTransaction;
+    size_t m_pendingRows; // written in the open transaction
+    size_t m_preparedTable;
+    size_t m_preparedCount;
+    size_t m_preparedRows;
+    uint64_t m_failedRows;
+
+    // Rows of table m_bufferTable with m_bufferCount values each, not inserted yet. Text
+    // and blob values are copied into m_bufferBytes; m_bufferOffsets says where.
+    size_t m_bufferTable;
+    size_t m_bufferCount;
+    std::vector<int64_t> m_bufferRowids;
+    std::vector<RecordValue> m_bufferValues;
+    std::vector<size_t> m_bufferOffsets;
+    std::vector<unsigned char> m_bufferBytes;
+    std::chrono::milliseconds m_busyTimeout;
+};
+
+} // namespace WCDBRepair
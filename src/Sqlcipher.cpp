@@ -0,0 +1,397 @@
+// HMAC_CTX is deprecated in OpenSSL 3 but is the API that exists in both 1.1 and 3.x.
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "Sqlcipher.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr int kFastKdfIter = 2;
+constexpr unsigned char kHmacSaltMask = 0x3a;
+constexpr size_t kAesBlockSize = 16;
+
+const EVP_MD* evpDigest(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::SHA1:
+        return EVP_sha1();
+    case HashAlgorithm::SHA256:
+        return EVP_sha256();
+    case HashAlgorithm::SHA512:
+        return EVP_sha512();
+    }
+    return nullptr;
+}
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return 10 + (c - 'a');
+    if (c >= 'A' && c <= 'F')
+        return 10 + (c - 'A');
+    return -1;
+}
+
+// x'<64 hex key>' or x'<64 hex key><32 hex salt>'; the salt part is ignored here
+// because the file's own salt is authoritative when reading.
+bool parseRawKey(const std::vector<unsigned char>& passphrase, unsigned char* key)
+{
+    const size_t n = passphrase.size();
+    if (n != 67 && n != 99)
+        return false;
+    if ((passphrase[0] != 'x' && passphrase[0] != 'X') || passphrase[1] != '\'' || passphrase[n - 1] != '\'')
+        return false;
+    for (size_t i = 0; i < KeySize; i++) {
+        const int hi = hexValue(static_cast<char>(passphrase[2 + i * 2]));
+        const int lo = hexValue(static_cast<char>(passphrase[3 + i * 2]));
+        if (hi < 0 || lo < 0)
+            return false;
+        key[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return true;
+}
+
+} // namespace
+
+size_t hashSize(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::SHA1:
+        return 20;
+    case HashAlgorithm::SHA256:
+        return 32;
+    case HashAlgorithm::SHA512:
+        return 64;
+    }
+    return 0;
+}
+
+const char* hmacAlgorithmName(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::SHA1:
+        return "HMAC_SHA1";
+    case HashAlgorithm::SHA256:
+        return "HMAC_SHA256";
+    case HashAlgorithm::SHA512:
+        return "HMAC_SHA512";
+    }
+    return "UNKNOWN";
+}
+
+const char* kdfAlgorithmName(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::SHA1:
+        return "PBKDF2_HMAC_SHA1";
+    case HashAlgorithm::SHA256:
+        return "PBKDF2_HMAC_SHA256";
+    case HashAlgorithm::SHA512:
+        return "PBKDF2_HMAC_SHA512";
+    }
+    return "UNKNOWN";
+}
+
+bool parseHmacAlgorithm(const std::string& name, HashAlgorithm& out)
+{
+    for (HashAlgorithm a : { HashAlgorithm::SHA1, HashAlgorithm::SHA256, HashAlgorithm::SHA512 }) {
+        if (name == hmacAlgorithmName(a)) {
+            out = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseKdfAlgorithm(const std::string& name, HashAlgorithm& out)
+{
+    for (HashAlgorithm a : { HashAlgorithm::SHA1, HashAlgorithm::SHA256, HashAlgorithm::SHA512 }) {
+        if (name == kdfAlgorithmName(a)) {
+            out = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t CipherParams::reserveSize() const
+{
+    size_t reserve = IvSize + (useHmac ? hashSize(hmacAlgorithm) : 0);
+    if (reserve % kAesBlockSize != 0) {
+        reserve = (reserve / kAesBlockSize + 1) * kAesBlockSize;
+    }
+    return reserve;
+}
+
+bool CipherParams::forCompatibility(int version, CipherParams& out)
+{
+    CipherParams p;
+    switch (version) {
+    case 1:
+        p.pageSize = 1024;
+        p.kdfIter = 4000;
+        p.kdfAlgorithm = HashAlgorithm::SHA1;
+        p.useHmac = false;
+        p.hmacAlgorithm = HashAlgorithm::SHA1;
+        break;
+    case 2:
+        p.pageSize = 1024;
+        p.kdfIter = 4000;
+        p.kdfAlgorithm = HashAlgorithm::SHA1;
+        p.useHmac = true;
+        p.hmacAlgorithm = HashAlgorithm::SHA1;
+        break;
+    case 3:
+        p.pageSize = 1024;
+        p.kdfIter = 64000;
+        p.kdfAlgorithm = HashAlgorithm::SHA1;
+        p.useHmac = true;
+        p.hmacAlgorithm = HashAlgorithm::SHA1;
+        break;
+    case 4:
+        p.pageSize = 4096;
+        p.kdfIter = 256000;
+        p.kdfAlgorithm = HashAlgorithm::SHA512;
+        p.useHmac = true;
+        p.hmacAlgorithm = HashAlgorithm::SHA512;
+        break;
+    default:
+        return false;
+    }
+    out = p;
+    return true;
+}
+
+int CipherParams::matchingCompatibility() const
+{
+    for (int v = 1; v <= 4; v++) {
+        CipherParams p;
+        forCompatibility(v, p);
+        // The page size is set separately (cipher_page_size), so it does not count.
+        if (p.kdfIter == kdfIter && p.kdfAlgorithm == kdfAlgorithm && p.useHmac == useHmac
+            && (!useHmac || p.hmacAlgorithm == hmacAlgorithm)) {
+            return v;
+        }
+    }
+    return 0;
+}
+
+bool deriveKey(const std::vector<unsigned char>& passphrase,
+               const unsigned char* salt,
+               HashAlgorithm kdfAlgorithm,
+               int kdfIter,
+               unsigned char* key)
+{
+    if (parseRawKey(passphrase, key))
+        return true;
+    if (kdfIter <= 0)
+        return false;
+    return PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(passphrase.data()),
+                             static_cast<int>(passphrase.size()),
+                             salt,
+                             static_cast<int>(SaltSize),
+                             kdfIter,
+                             evpDigest(kdfAlgorithm),
+                             static_cast<int>(KeySize),
+                             key)
+           == 1;
+}
+
+bool CipherKeys::init(const CipherParams& p, const unsigned char* s, const unsigned char* k)
+{
+    params = p;
+    std::memcpy(salt, s, SaltSize);
+    std::memcpy(key, k, KeySize);
+    std::memset(hmacKey, 0, KeySize);
+    if (!params.useHmac)
+        return true;
+
+    unsigned char hmacSalt[SaltSize];
+    for (size_t i = 0; i < SaltSize; i++) {
+        hmacSalt[i] = salt[i] ^ kHmacSaltMask;
+    }
+    return PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(key),
+                             static_cast<int>(KeySize),
+                             hmacSalt,
+                             static_cast<int>(SaltSize),
+                             kFastKdfIter,
+                             evpDigest(params.kdfAlgorithm),
+                             static_cast<int>(KeySize),
+                             hmacKey)
+           == 1;
+}
+
+PageCodec::PageCodec(const CipherKeys& keys)
+: m_keys(keys), m_hmacBase(nullptr), m_hmacWork(nullptr), m_cipher(nullptr)
+{
+    HMAC_CTX* base = HMAC_CTX_new();
+    HMAC_CTX* work = HMAC_CTX_new();
+    if (base != nullptr && work != nullptr
+        && HMAC_Init_ex(base,
+                        m_keys.hmacKey,
+                        static_cast<int>(KeySize),
+                        evpDigest(m_keys.params.hmacAlgorithm),
+                        nullptr)
+           == 1) {
+        m_hmacBase = base;
+        m_hmacWork = work;
+    } else {
+        HMAC_CTX_free(base);
+        HMAC_CTX_free(work);
+    }
+    m_cipher = EVP_CIPHER_CTX_new();
+}
+
+PageCodec::~PageCodec()
+{
+    HMAC_CTX_free(static_cast<HMAC_CTX*>(m_hmacBase));
+    HMAC_CTX_free(static_cast<HMAC_CTX*>(m_hmacWork));
+    EVP_CIPHER_CTX_free(static_cast<EVP_CIPHER_CTX*>(m_cipher));
+}
+
+bool PageCodec::verifyHmac(const unsigned char* page, uint32_t pgno)
+{
+    const CipherParams& p = m_keys.params;
+    if (!p.useHmac)
+        return true;
+    const size_t pageSize = static_cast<size_t>(p.pageSize);
+    const size_t reserve = p.reserveSize();
+    const size_t offset = pgno == 1 ? SaltSize : 0;
+    if (pageSize <= reserve + offset)
+        return false;
+    const size_t dataSize = pageSize - reserve - offset;
+
+    unsigned char pgnoLE[4] = {
+        static_cast<unsigned char>(pgno & 0xFF),
+        static_cast<unsigned char>((pgno >> 8) & 0xFF),
+        static_cast<unsigned char>((pgno >> 16) & 0xFF),
+        static_cast<unsigned char>((pgno >> 24) & 0xFF),
+    };
+    unsigned char mac[MaxHashSize];
+    unsigned int macSize = 0;
+    HMAC_CTX* work = static_cast<HMAC_CTX*>(m_hmacWork);
+    // Copying the keyed context skips re-hashing the ipad/opad blocks for every page.
+    if (HMAC_CTX_copy(work, static_cast<HMAC_CTX*>(m_hmacBase)) != 1
+        || HMAC_Update(work, page + offset, dataSize + IvSize) != 1
+        || HMAC_Update(work, pgnoLE, sizeof(pgnoLE)) != 1 || HMAC_Final(work, mac, &macSize) != 1) {
+        return false;
+    }
+    const unsigned char* stored = page + pageSize - reserve + IvSize;
+    if (std::memcmp(mac, stored, hashSize(p.hmacAlgorithm)) == 0)
+        return true;
+    return isAllZero(page, pageSize);
+}
+
+bool PageCodec::decrypt(const unsigned char* page, uint32_t pgno, unsigned char* out)
+{
+    const CipherParams& p = m_keys.params;
+    const size_t pageSize = static_cast<size_t>(p.pageSize);
+    const size_t reserve = p.reserveSize();
+    const size_t offset = pgno == 1 ? SaltSize : 0;
+    if (pageSize <= reserve + offset)
+        return false;
+    const size_t dataSize = pageSize - reserve - offset;
+    const unsigned char* iv = page + pageSize - reserve;
+
+    EVP_CIPHER_CTX* ctx = static_cast<EVP_CIPHER_CTX*>(m_cipher);
+    int outLen = 0;
+    int finalLen = 0;
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, m_keys.key, iv) != 1
+        || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1
+        || EVP_DecryptUpdate(ctx, out + offset, &outLen, page + offset, static_cast<int>(dataSize)) != 1
+        || EVP_DecryptFinal_ex(ctx, out + offset + outLen, &finalLen) != 1) {
+        return false;
+    }
+    if (pgno == 1) {
+        std::memcpy(out, "SQLite format 3", SaltSize); // includes the trailing '\0'
+    }
+    std::memset(out + pageSize - reserve, 0, reserve);
+    return true;
+}
+
+bool PageCodec::looksLikeFirstPage(const unsigned char* page)
+{
+    const CipherParams& p = m_keys.params;
+    const size_t pageSize = static_cast<size_t>(p.pageSize);
+    const size_t reserve = p.reserveSize();
+    if (pageSize <= reserve + SaltSize)
+        return false;
+    const unsigned char* iv = page + pageSize - reserve;
+
+    unsigned char block[kAesBlockSize * 2];
+    EVP_CIPHER_CTX* ctx = static_cast<EVP_CIPHER_CTX*>(m_cipher);
+    int outLen = 0;
+    if (EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, m_keys.key, iv) != 1
+        || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1
+        || EVP_DecryptUpdate(ctx, block, &outLen, page + SaltSize, static_cast<int>(kAesBlockSize)) != 1) {
+        return false;
+    }
+    // block[] now holds header bytes 16..31.
+    const unsigned headerPageSize = (static_cast<unsigned>(block[0]) << 8) | block[1];
+    const unsigned expectedPageSize = pageSize == 65536 ? 1 : static_cast<unsigned>(pageSize);
+    return headerPageSize == expectedPageSize && (block[2] == 1 || block[2] == 2)
+           && (block[3] == 1 || block[3] == 2) && block[4] == reserve && block[5] == 64 && block[6] == 32
+           && block[7] == 32;
+}
+
+bool isAllZero(const unsigned char* data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+bool aesGcm(bool encrypt,
+            const unsigned char* key,
+            const unsigned char* nonce,
+            const std::string& aad,
+            const unsigned char* in,
+            size_t length,
+            unsigned char* out,
+            unsigned char* tag)
+{
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr)
+        return false;
+    int len = 0;
+    bool ok = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr, encrypt ? 1 : 0) == 1
+              && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(GcmNonceSize), nullptr) == 1
+              && EVP_CipherInit_ex(ctx, nullptr, nullptr, key, nonce, encrypt ? 1 : 0) == 1;
+    if (ok && !aad.empty()) {
+        ok = EVP_CipherUpdate(ctx,
+                              nullptr,
+                              &len,
+                              reinterpret_cast<const unsigned char*>(aad.data()),
+                              static_cast<int>(aad.size()))
+             == 1;
+    }
+    // EVP takes int lengths; feed large bodies in pieces.
+    size_t done = 0;
+    while (ok && done < length) {
+        const int piece = static_cast<int>(std::min<size_t>(length - done, 1 << 30));
+        ok = EVP_CipherUpdate(ctx, out + done, &len, in + done, piece) == 1;
+        done += static_cast<size_t>(len);
+    }
+    if (ok && !encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, static_cast<int>(GcmTagSize), tag) == 1;
+    }
+    ok = ok && EVP_CipherFinal_ex(ctx, out + done, &len) == 1;
+    if (ok && encrypt) {
+        ok = EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, static_cast<int>(GcmTagSize), tag) == 1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+} // namespace WCDBRepair
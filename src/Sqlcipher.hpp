@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Just enough of the SQLCipher page format to work on encrypted files without
+// opening a WCDB handle: key derivation, per-page HMAC check and decryption.
+//
+// On-disk page layout (AES-256-CBC):
+//   [ciphertext ... | IV (16) | HMAC (hmac size) | padding to 16]
+// Page 1 starts with the 16 byte KDF salt instead of "SQLite format 3\0".
+// The HMAC covers ciphertext + IV followed by the little-endian page number.
+
+enum class HashAlgorithm {
+    SHA1,
+    SHA256,
+    SHA512,
+};
+
+constexpr size_t SaltSize = 16;
+constexpr size_t KeySize = 32;
+constexpr size_t IvSize = 16;
+constexpr size_t MaxHashSize = 64;
+
+size_t hashSize(HashAlgorithm algorithm);
+const char* hmacAlgorithmName(HashAlgorithm algorithm);      // HMAC_SHA512
+const char* kdfAlgorithmName(HashAlgorithm algorithm);       // PBKDF2_HMAC_SHA512
+bool parseHmacAlgorithm(const std::string& name, HashAlgorithm& out);
+bool parseKdfAlgorithm(const std::string& name, HashAlgorithm& out);
+
+struct CipherParams {
+    int pageSize = 4096;
+    int kdfIter = 256000;
+    HashAlgorithm kdfAlgorithm = HashAlgorithm::SHA512;
+    bool useHmac = true;
+    HashAlgorithm hmacAlgorithm = HashAlgorithm::SHA512;
+
+    // Bytes reserved at the end of each page (IV + HMAC, rounded up to the AES block).
+    size_t reserveSize() const;
+
+    // Defaults of `PRAGMA cipher_compatibility = version` (1..4).
+    static bool forCompatibility(int version, CipherParams& out);
+    // Returns the compatibility version whose defaults equal these params, or 0.
+    int matchingCompatibility() const;
+};
+
+// PBKDF2 over the passphrase, or the raw key when the passphrase is in SQLCipher's
+// x'<64 hex>' / x'<96 hex>' form.
+bool deriveKey(const std::vector<unsigned char>& passphrase,
+               const unsigned char* salt,
+               HashAlgorithm kdfAlgorithm,
+               int kdfIter,
+               unsigned char* key /* KeySize */);
+
+// Derived key material for one database. Cheap to copy.
+struct CipherKeys {
+    CipherParams params;
+    unsigned char salt[SaltSize];
+    unsigned char key[KeySize];
+    unsigned char hmacKey[KeySize];
+
+    // Derives the HMAC key from an already derived cipher key (2 PBKDF2 rounds).
+    bool init(const CipherParams& params, const unsigned char* salt, const unsigned char* key);
+};
+
+// Per-thread page verifier/decryptor. Keeps the keyed HMAC state around, so each
+// page costs the hash of its own bytes only; not thread-safe, create one per thread.
+class PageCodec {
+public:
+    explicit PageCodec(const CipherKeys& keys);
+    ~PageCodec();
+
+    PageCodec(const PageCodec&) = delete;
+    PageCodec& operator=(const PageCodec&) = delete;
+
+    bool isValid() const { return m_hmacBase != nullptr && m_cipher != nullptr; }
+    const CipherKeys& keys() const { return m_keys; }
+
+    // `page` is the raw on-disk page of params.pageSize bytes, `pgno` is 1-based.
+    // Pages that are entirely zero pass (SQLCipher treats them as never written).
+    bool verifyHmac(const unsigned char* page, uint32_t pgno);
+
+    // Decrypts `page` into `out` (params.pageSize bytes, reserved tail zeroed).
+    // Page 1 gets the plain SQLite header string back in its first 16 bytes.
+    bool decrypt(const unsigned char* page, uint32_t pgno, unsigned char* out);
+
+    // Decrypts only the first AES block after the salt of page 1 and checks that it
+    // holds a plausible SQLite header (page size, versions, reserve, payload fractions).
+    bool looksLikeFirstPage(const unsigned char* page);
+
+private:
+    CipherKeys m_keys;
+    void* m_hmacBase; // HMAC_CTX keyed once
+    void* m_hmacWork;
+    void* m_cipher;   // EVP_CIPHER_CTX
+};
+
+bool isAllZero(const unsigned char* data, size_t length);
+
+// AES-256-GCM for what this tool keeps on disk under a key of its own (derived-key cache,
+// encrypted material backups); not part of the SQLCipher format.
+constexpr size_t GcmNonceSize = 12;
+constexpr size_t GcmTagSize = 16;
+
+// Seals `length` bytes of `in` into `out` and writes the tag, or opens them and checks
+// `tag`. `aad` is authenticated but not encrypted and may be empty.
+bool aesGcm(bool encrypt,
+            const unsigned char* key /* KeySize */,
+            const unsigned char* nonce /* GcmNonceSize */,
+            const std::string& aad,
+            const unsigned char* in,
+            size_t length,
+            unsigned char* out,
+            unsigned char* tag /* GcmTagSize */);
+
+} // namespace WCDBRepair
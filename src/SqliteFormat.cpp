@@ -0,0 +1,341 @@
+#include "SqliteFormat.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace WCDBRepair {
+
+bool isBTreePageType(uint8_t type)
+{
+    return type == PageTypeIndexInterior || type == PageTypeTableInterior || type == PageTypeIndexLeaf
+           || type == PageTypeTableLeaf;
+}
+
+bool isLeafPageType(uint8_t type)
+{
+    return type == PageTypeIndexLeaf || type == PageTypeTableLeaf;
+}
+
+bool isTablePageType(uint8_t type)
+{
+    return type == PageTypeTableInterior || type == PageTypeTableLeaf;
+}
+
+size_t readVarint(const unsigned char* p, const unsigned char* end, uint64_t& value)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < 9; i++) {
+        if (p + i >= end)
+            return 0;
+        if (i == 8) {
+            v = (v << 8) | p[i];
+            value = v;
+            return 9;
+        }
+        v = (v << 7) | (p[i] & 0x7F);
+        if ((p[i] & 0x80) == 0) {
+            value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+bool DatabaseHeader::parse(const unsigned char* page, size_t length)
+{
+    if (length < DatabaseHeaderSize || std::memcmp(page, "SQLite format 3", 16) != 0)
+        return false;
+    const uint32_t rawPageSize = readBE16(page + 16);
+    pageSize = rawPageSize == 1 ? 65536 : rawPageSize;
+    if (pageSize < 512 || pageSize > 65536 || (pageSize & (pageSize - 1)) != 0)
+        return false;
+    reserve = page[20];
+    if (usableSize() < 480)
+        return false;
+    // The in-header page count is only valid when "version-valid-for" matches the change counter.
+    pageCount = readBE32(page + 92) == readBE32(page + 24) ? readBE32(page + 28) : 0;
+    firstFreelistTrunk = readBE32(page + 32);
+    freelistCount = readBE32(page + 36);
+    largestRootPage = readBE32(page + 52);
+    textEncoding = readBE32(page + 56);
+    if (textEncoding == 0)
+        textEncoding = 1;
+    return true;
+}
+
+uint32_t lockBytePage(uint32_t pageSize)
+{
+    return static_cast<uint32_t>(LockByteOffset / pageSize) + 1;
+}
+
+bool isPointerMapPage(uint32_t pgno, uint32_t usableSize, uint32_t pageSize)
+{
+    if (pgno < 2)
+        return false;
+    const uint32_t pagesPerMap = usableSize / 5 + 1;
+    uint32_t map = ((pgno - 2) / pagesPerMap) * pagesPerMap + 2;
+    if (map == lockBytePage(pageSize))
+        map++;
+    return map == pgno;
+}
+
+uint32_t localPayloadSize(uint8_t pageType, uint64_t payloadSize, uint32_t usableSize)
+{
+    const uint64_t maxLocal = pageType == PageTypeTableLeaf ? usableSize - 35 : (usableSize - 12) * 64 / 255 - 23;
+    if (payloadSize <= maxLocal)
+        return static_cast<uint32_t>(payloadSize);
+    const uint64_t minLocal = (usableSize - 12) * 32 / 255 - 23;
+    const uint64_t k = minLocal + (payloadSize - minLocal) % (usableSize - 4);
+    return static_cast<uint32_t>(k <= maxLocal ? k : minLocal);
+}
+
+bool parseCell(const unsigned char* page, uint32_t usableSize, uint8_t pageType, uint32_t offset, CellInfo& cell)
+{
+    const unsigned char* end = page + usableSize;
+    const unsigned char* p = page + offset;
+    cell = CellInfo();
+    cell.offset = offset;
+    if (offset >= usableSize)
+        return false;
+
+    if (pageType == PageTypeTableInterior || pageType == PageTypeIndexInterior) {
+        if (p + 4 > end)
+            return false;
+        cell.leftChild = readBE32(p);
+        p += 4;
+    }
+    if (pageType != PageTypeTableInterior) {
+        size_t n = readVarint(p, end, cell.payloadSize);
+        if (n == 0)
+            return false;
+        p += n;
+    }
+    if (pageType == PageTypeTableLeaf || pageType == PageTypeTableInterior) {
+        uint64_t rowid = 0;
+        size_t n = readVarint(p, end, rowid);
+        if (n == 0)
+            return false;
+        cell.rowid = static_cast<int64_t>(rowid);
+        p += n;
+    }
+
+    cell.payloadOffset = static_cast<uint32_t>(p - page);
+    if (pageType != PageTypeTableInterior) {
+        cell.localSize = localPayloadSize(pageType, cell.payloadSize, usableSize);
+        if (static_cast<uint64_t>(cell.localSize) > static_cast<uint64_t>(end - p))
+            return false;
+        p += cell.localSize;
+        if (cell.localSize < cell.payloadSize) {
+            if (p + 4 > end)
+                return false;
+            cell.overflowPage = readBE32(p);
+            p += 4;
+        }
+    }
+    cell.size = std::max<uint32_t>(4, static_cast<uint32_t>(p - (page + offset)));
+    return offset + cell.size <= usableSize;
+}
+
+bool BTreePage::parse(const unsigned char* page, uint32_t pgno, uint32_t usableSize, bool validate)
+{
+    cells.clear();
+    error = nullptr;
+    headerOffset = pgno == 1 ? static_cast<uint32_t>(DatabaseHeaderSize) : 0;
+    const unsigned char* h = page + headerOffset;
+    type = h[0];
+    if (!isBTreePageType(type)) {
+        error = "page-type";
+        return false;
+    }
+    const bool interior = !isLeafPageType(type);
+    const uint32_t headerSize = interior ? 12 : 8;
+    const uint32_t firstFreeblock = readBE16(h + 1);
+    cellCount = readBE16(h + 3);
+    contentStart = readBE16(h + 5);
+    if (contentStart == 0)
+        contentStart = 65536;
+    const uint32_t fragmented = h[7];
+    rightChild = interior ? readBE32(h + 8) : 0;
+
+    const uint32_t pointerEnd = headerOffset + headerSize + 2 * cellCount;
+    if (pointerEnd > usableSize || (validate && pointerEnd > contentStart)) {
+        error = "cell-count";
+        return false;
+    }
+    if (validate && contentStart > usableSize) {
+        error = "content-start";
+        return false;
+    }
+
+    cells.reserve(cellCount);
+    for (uint32_t i = 0; i < cellCount; i++) {
+        const uint32_t offset = readBE16(h + headerSize + 2 * i);
+        CellInfo cell;
+        if ((validate && offset < contentStart) || !parseCell(page, usableSize, type, offset, cell)) {
+            error = "cell-pointer";
+            return false;
+        }
+        cells.push_back(cell);
+    }
+    if (!validate)
+        return true;
+
+    // Key order: strictly increasing rowids on table pages.
+    if (isTablePageType(type)) {
+        for (size_t i = 1; i < cells.size(); i++) {
+            if (cells[i].rowid <= cells[i - 1].rowid) {
+                error = "rowid-order";
+                return false;
+            }
+        }
+    }
+
+    // Cells must not overlap each other.
+    std::vector<std::pair<uint32_t, uint32_t>> extents;
+    extents.reserve(cells.size() + 8);
+    uint64_t cellBytes = 0;
+    for (const CellInfo& c : cells) {
+        extents.emplace_back(c.offset, c.offset + c.size);
+        cellBytes += c.size;
+    }
+
+    // Freeblocks: ascending, inside the content area, at least 4 bytes.
+    uint64_t freeBytes = 0;
+    uint32_t freeblock = firstFreeblock;
+    uint32_t previousEnd = 0;
+    uint32_t guard = 0;
+    while (freeblock != 0) {
+        if (freeblock < contentStart || freeblock < previousEnd || freeblock + 4 > usableSize || ++guard > usableSize / 4) {
+            error = "freeblock";
+            return false;
+        }
+        const uint32_t size = readBE16(page + freeblock + 2);
+        if (size < 4 || freeblock + size > usableSize) {
+            error = "freeblock";
+            return false;
+        }
+        extents.emplace_back(freeblock, freeblock + size);
+        freeBytes += size;
+        previousEnd = freeblock + size;
+        freeblock = readBE16(page + freeblock);
+    }
+
+    std::sort(extents.begin(), extents.end());
+    for (size_t i = 1; i < extents.size(); i++) {
+        if (extents[i].first < extents[i - 1].second) {
+            error = "cell-overlap";
+            return false;
+        }
+    }
+
+    // Everything in the content area is a cell, a freeblock or a fragment.
+    if (fragmented > 60 || cellBytes + freeBytes + fragmented != usableSize - std::min(contentStart, usableSize)) {
+        error = "free-space";
+        return false;
+    }
+    return true;
+}
+
+static uint64_t serialTypeSize(uint64_t serialType)
+{
+    static const uint64_t sizes[] = { 0, 1, 2, 3, 4, 6, 8, 8, 0, 0 };
+    if (serialType < 10)
+        return sizes[serialType];
+    return (serialType - 12) / 2;
+}
+
+bool decodeRecordHeader(const unsigned char* payload, size_t size, std::vector<uint64_t>& serialTypes)
+{
+    serialTypes.clear();
+    const unsigned char* end = payload + size;
+    uint64_t headerSize = 0;
+    size_t n = readVarint(payload, end, headerSize);
+    if (n == 0 || headerSize < n || headerSize > size)
+        return false;
+    const unsigned char* p = payload + n;
+    const unsigned char* headerEnd = payload + headerSize;
+    while (p < headerEnd) {
+        uint64_t serialType = 0;
+        n = readVarint(p, headerEnd, serialType);
+        if (n == 0 || serialType == 10 || serialType == 11)
+            return false;
+        serialTypes.push_back(serialType);
+        p += n;
+    }
+    return true;
+}
+
+bool recordHeaderConsistent(const unsigned char* local, size_t localSize, uint64_t payloadSize)
+{
+    const unsigned char* end = local + localSize;
+    uint64_t headerSize = 0;
+    size_t n = readVarint(local, end, headerSize);
+    if (n == 0)
+        return localSize < 9 && localSize < payloadSize;
+    if (headerSize < n || headerSize > payloadSize)
+        return false;
+    if (headerSize > localSize)
+        return true; // rest of the header is in the overflow chain
+    uint64_t bodySize = 0;
+    const unsigned char* p = local + n;
+    const unsigned char* headerEnd = local + headerSize;
+    while (p < headerEnd) {
+        uint64_t serialType = 0;
+        n = readVarint(p, headerEnd, serialType);
+        if (n == 0 || serialType == 10 || serialType == 11)
+            return false;
+        bodySize += serialTypeSize(serialType);
+        p += n;
+    }
+    return headerSize + bodySize == payloadSize;
+}
+
+bool decodeRecord(const unsigned char* payload, size_t size, std::vector<RecordValue>& values)
+{
+    std::vector<uint64_t> serialTypes;
+    if (!decodeRecordHeader(payload, size, serialTypes))
+        return false;
+    uint64_t headerSize = 0;
+    readVarint(payload, payload + size, headerSize);
+
+    values.clear();
+    values.reserve(serialTypes.size());
+    size_t offset = static_cast<size_t>(headerSize);
+    for (uint64_t serialType : serialTypes) {
+        const uint64_t length = serialTypeSize(serialType);
+        if (length > size - offset)
+            return false;
+        const unsigned char* p = payload + offset;
+        RecordValue v;
+        if (serialType == 0) {
+            v.type = RecordValue::Null;
+        } else if (serialType <= 6) {
+            // Big-endian two's complement, sign-extended from the top byte.
+            int64_t x = static_cast<int8_t>(p[0]);
+            for (size_t i = 1; i < length; i++) {
+                x = static_cast<int64_t>((static_cast<uint64_t>(x) << 8) | p[i]);
+            }
+            v.type = RecordValue::Integer;
+            v.integer = x;
+        } else if (serialType == 7) {
+            uint64_t bits = 0;
+            for (size_t i = 0; i < 8; i++) {
+                bits = (bits << 8) | p[i];
+            }
+            v.type = RecordValue::Real;
+            std::memcpy(&v.real, &bits, sizeof(bits));
+        } else if (serialType == 8 || serialType == 9) {
+            v.type = RecordValue::Integer;
+            v.integer = serialType == 9 ? 1 : 0;
+        } else {
+            v.type = (serialType & 1) ? RecordValue::Text : RecordValue::Blob;
+            v.data = p;
+            v.size = static_cast<size_t>(length);
+        }
+        values.push_back(v);
+        offset += static_cast<size_t>(length);
+    }
+    return true;
+}
+
+} // namespace WCDBRepair
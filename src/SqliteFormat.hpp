@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace WCDBRepair {
+
+// Decoding of the SQLite on-disk format (https://www.sqlite.org/fileformat2.html)
+// for tools that read pages without going through SQLite.
+
+enum PageType : uint8_t {
+    PageTypeIndexInterior = 0x02,
+    PageTypeTableInterior = 0x05,
+    PageTypeIndexLeaf = 0x0a,
+    PageTypeTableLeaf = 0x0d,
+};
+
+constexpr size_t DatabaseHeaderSize = 100;
+constexpr uint64_t LockByteOffset = 0x40000000ull; // page holding this offset is never used
+
+bool isBTreePageType(uint8_t type);
+bool isLeafPageType(uint8_t type);
+bool isTablePageType(uint8_t type);
+
+inline uint16_t readBE16(const unsigned char* p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline uint32_t readBE32(const unsigned char* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+           | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// Returns the number of bytes consumed (1..9), or 0 if the varint runs past `end`.
+size_t readVarint(const unsigned char* p, const unsigned char* end, uint64_t& value);
+
+struct DatabaseHeader {
+    uint32_t pageSize = 0;
+    uint8_t reserve = 0;
+    uint32_t pageCount = 0; // 0 when the in-header size is not valid
+    uint32_t firstFreelistTrunk = 0;
+    uint32_t freelistCount = 0;
+    uint32_t largestRootPage = 0; // non-zero means auto/incremental vacuum (pointer-map pages)
+    uint32_t textEncoding = 1;    // 1 utf8, 2 utf16le, 3 utf16be
+
+    // `page` holds at least the first 100 bytes of a plaintext page 1.
+    bool parse(const unsigned char* page, size_t length);
+    uint32_t usableSize() const { return pageSize - reserve; }
+};
+
+// Whether `pgno` is a pointer-map page (only meaningful for auto-vacuum databases).
+bool isPointerMapPage(uint32_t pgno, uint32_t usableSize, uint32_t pageSize);
+uint32_t lockBytePage(uint32_t pageSize);
+
+// Bytes of payload stored on the b-tree page itself; the rest is in the overflow chain.
+uint32_t localPayloadSize(uint8_t pageType, uint64_t payloadSize, uint32_t usableSize);
+
+struct CellInfo {
+    uint32_t offset = 0;       // within the page
+    uint32_t size = 0;         // bytes the cell occupies (at least 4)
+    uint32_t leftChild = 0;    // interior pages
+    int64_t rowid = 0;         // table pages
+    uint64_t payloadSize = 0;  // total payload (leaf / index pages)
+    uint32_t localSize = 0;    // payload bytes on this page
+    uint32_t payloadOffset = 0;
+    uint32_t overflowPage = 0; // first overflow page, 0 if none
+};
+
+// Parses the cell at `offset` of a b-tree page; false if it does not fit in `usableSize`.
+bool parseCell(const unsigned char* page, uint32_t usableSize, uint8_t pageType, uint32_t offset, CellInfo& cell);
+
+// One b-tree page with the structural checks `PRAGMA integrity_check` does per page:
+// header fields, cell pointer bounds, cell extents and overlaps, freeblock chain,
+// free-space accounting and key order.
+struct BTreePage {
+    uint8_t type = 0;
+    uint32_t headerOffset = 0; // 100 on page 1
+    uint32_t cellCount = 0;
+    uint32_t contentStart = 0;
+    uint32_t rightChild = 0;
+    std::vector<CellInfo> cells;
+    const char* error = nullptr; // first failed check, nullptr if the page is sane
+
+    // Returns false when the page is not a b-tree page at all or fails a check;
+    // `error` names the check. Cells are parsed in pointer order.
+    bool parse(const unsigned char* page, uint32_t pgno, uint32_t usableSize, bool validate = true);
+};
+
+struct RecordValue {
+    enum Type : uint8_t {
+        Null,
+        Integer,
+        Real,
+        Text,
+        Blob,
+    };
+    Type type = Null;
+    int64_t integer = 0;
+    double real = 0;
+    const unsigned char* data = nullptr; // Text/Blob, points into the record
+    size_t size = 0;
+};
+
+// Decodes a complete record (local payload plus overflow, already concatenated).
+bool decodeRecord(const unsigned char* payload, size_t size, std::vector<RecordValue>& values);
+
+// False only when the record header seen in the local payload is definitely
+// inconsistent with the cell's payload size (header cut off by overflow passes).
+bool recordHeaderConsistent(const unsigned char* local, size_t localSize, uint64_t payloadSize);
+
+// Reads the serial types of a record header only; enough to guess a row's shape.
+bool decodeRecordHeader(const unsigned char* payload, size_t size, std::vector<uint64_t>& serialTypes);
+
+} // namespace WCDBRepair
@@ -0,0 +1,217 @@
+#include "TraceSink.hpp"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstring>
+
+namespace WCDBRepair {
+
+namespace {
+
+constexpr size_t kWriteBufferSize = 1 << 20;
+
+size_t roundUpToPowerOfTwo(size_t v)
+{
+    size_t p = 1;
+    while (p < v) {
+        p <<= 1;
+    }
+    return p;
+}
+
+} // namespace
+
+TraceSink::TraceSink(size_t capacity, Policy policy)
+: m_capacity(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity))
+, m_mask(m_capacity - 1)
+, m_policy(policy)
+, m_slots(new Slot[m_capacity])
+, m_tail(0)
+, m_head(0)
+, m_stopping(true)
+, m_producers(0)
+, m_written(0)
+, m_dropped(0)
+, m_truncated(0)
+, m_file(nullptr)
+, m_ownsFile(false)
+, m_bufferUsed(0)
+{
+    for (size_t i = 0; i < m_capacity; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_slots[i].length = 0;
+    }
+}
+
+TraceSink::~TraceSink()
+{
+    stop();
+}
+
+bool TraceSink::start(const std::string& path)
+{
+    if (m_writer.joinable())
+        return true;
+    if (path.empty()) {
+        m_file = stdout;
+        m_ownsFile = false;
+    } else {
+        m_file = std::fopen(path.c_str(), "wb");
+        if (m_file == nullptr)
+            return false;
+        m_ownsFile = true;
+    }
+    m_buffer.reset(new char[kWriteBufferSize]);
+    m_bufferUsed = 0;
+    m_stopping.store(false, std::memory_order_release);
+    m_writer = std::thread([this] { writerLoop(); });
+    return true;
+}
+
+void TraceSink::stop()
+{
+    if (!m_writer.joinable())
+        return;
+    m_stopping.store(true, std::memory_order_seq_cst);
+    m_writer.join();
+    if (m_ownsFile) {
+        std::fclose(m_file);
+    } else {
+        std::fflush(m_file);
+    }
+    m_file = nullptr;
+    m_ownsFile = false;
+}
+
+void TraceSink::printf(const char* format, ...)
+{
+    // Sequentially consistent with stop(): either this sees m_stopping, or the writer
+    // sees this producer and drains its slot before exiting.
+    m_producers.fetch_add(1, std::memory_order_seq_cst);
+    if (m_stopping.load(std::memory_order_seq_cst)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_producers.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    Slot* slot = claim();
+    while (slot == nullptr) {
+        if (m_policy == Policy::Drop || m_stopping.load(std::memory_order_acquire)) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            m_producers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        std::this_thread::yield();
+        slot = claim();
+    }
+
+    va_list ap;
+    va_start(ap, format);
+    int n = std::vsnprintf(slot->data, RecordSize, format, ap);
+    va_end(ap);
+    if (n < 0) {
+        n = 0;
+    } else if (static_cast<size_t>(n) >= RecordSize) {
+        // Keep the record a complete line.
+        n = static_cast<int>(RecordSize - 1);
+        slot->data[n - 1] = '\n';
+        m_truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    slot->length = static_cast<uint32_t>(n);
+    publish(slot);
+    m_producers.fetch_sub(1, std::memory_order_release);
+}
+
+// Bounded MPMC queue after Dmitry Vyukov: every slot carries a sequence number that
+// tells producers whether it is free for position `pos` (sequence == pos) and tells
+// the consumer whether it has been published (sequence == pos + 1).
+TraceSink::Slot* TraceSink::claim()
+{
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot* slot = &m_slots[pos & m_mask];
+        const size_t seq = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return slot;
+            }
+        } else if (diff < 0) {
+            return nullptr; // full
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void TraceSink::publish(Slot* slot)
+{
+    // The slot was claimed at position `sequence`; mark it readable.
+    const size_t pos = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+TraceSink::Slot* TraceSink::peek()
+{
+    Slot* slot = &m_slots[m_head & m_mask];
+    if (slot->sequence.load(std::memory_order_acquire) != m_head + 1)
+        return nullptr;
+    return slot;
+}
+
+void TraceSink::release(Slot* slot)
+{
+    slot->sequence.store(m_head + m_capacity, std::memory_order_release);
+    m_head++;
+}
+
+void TraceSink::flushBuffer()
+{
+    if (m_bufferUsed == 0)
+        return;
+    std::fwrite(m_buffer.get(), 1, m_bufferUsed, m_file);
+    m_bufferUsed = 0;
+}
+
+void TraceSink::writerLoop()
+{
+    unsigned idleRounds = 0;
+    for (;;) {
+        Slot* slot = peek();
+        if (slot != nullptr) {
+            if (m_bufferUsed + slot->length > kWriteBufferSize) {
+                flushBuffer();
+            }
+            std::memcpy(m_buffer.get() + m_bufferUsed, slot->data, slot->length);
+            m_bufferUsed += slot->length;
+            release(slot);
+            m_written.fetch_add(1, std::memory_order_relaxed);
+            idleRounds = 0;
+            continue;
+        }
+
+        if (m_stopping.load(std::memory_order_seq_cst)) {
+            // Producers that got past the m_stopping check before stop() still claim and
+            // publish a slot; only when none is left can an empty ring stay empty.
+            if (m_producers.load(std::memory_order_seq_cst) == 0 && m_head == m_tail.load(std::memory_order_acquire))
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Idle: push out what we have so the trace stays reasonably live, then back off.
+        if (m_bufferUsed > 0) {
+            flushBuffer();
+            std::fflush(m_file);
+        }
+        if (++idleRounds < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    flushBuffer();
+    std::fflush(m_file);
+}
+
+} // namespace WCDBRepair
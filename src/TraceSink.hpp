@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace WCDBRepair {
+
+// Asynchronous log sink for high-volume trace lines (SQL trace).
+//
+// Producers (WCDB trace callbacks, any thread) format straight into a slot of a
+// bounded lock-free multi-producer ring buffer; a single background thread drains
+// it into a large buffer and writes it out in big chunks. Producers never touch
+// stdio, so tracing costs one snprintf per statement on the hot path.
+class TraceSink {
+public:
+    enum class Policy {
+        Drop,  // ring full: drop the record and count it
+        Block, // ring full: spin/yield until the writer catches up
+    };
+
+    // Fixed record size; longer lines are truncated (and counted).
+    static constexpr size_t RecordSize = 1024;
+
+    TraceSink(size_t capacity, Policy policy);
+    ~TraceSink();
+
+    TraceSink(const TraceSink&) = delete;
+    TraceSink& operator=(const TraceSink&) = delete;
+
+    // Starts the writer thread. An empty path writes to stdout.
+    bool start(const std::string& path);
+    // Drains everything queued so far, then joins the writer thread.
+    void stop();
+
+    // printf-style; the formatted line should end with '\n'.
+    void printf(const char* format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+    uint64_t written() const { return m_written.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    uint64_t truncated() const { return m_truncated.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        uint32_t length;
+        char data[RecordSize];
+    };
+
+    Slot* claim();
+    void publish(Slot* slot);
+    Slot* peek();
+    void release(Slot* slot);
+    void writerLoop();
+    void flushBuffer();
+
+    const size_t m_capacity; // power of two
+    const size_t m_mask;
+    const Policy m_policy;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // Keep m_tail (producers contend on it) and m_head (writer only) on separate
+    // cache lines. Padding instead of alignas: C++14 has no over-aligned new.
+    std::atomic<size_t> m_tail;
+    char m_padding[64 - sizeof(std::atomic<size_t>)];
+    size_t m_head;
+
+    std::atomic<bool> m_stopping;
+    // Producers inside printf(); the writer only exits once none is left to publish.
+    std::atomic<uint32_t> m_producers;
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_truncated;
+
+    std::thread m_writer;
+    std::FILE* m_file;
+    bool m_ownsFile;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_bufferUsed;
+};
+
+} // namespace WCDBRepair
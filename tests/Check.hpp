@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Just enough of a test harness for the unit tests: one executable per unit, CHECK
+// reports and counts a failure and carries on, main() returns checkFailures() != 0
+// for ctest. No framework to fetch, so the tests build wherever the tool does.
+
+namespace WCDBRepairTest {
+
+inline int& checkFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+inline bool check(bool ok, const char* expression, const char* file, int line)
+{
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+        checkFailures()++;
+    }
+    return ok;
+}
+
+// A scratch path in the working directory (ctest runs each test in the build tree).
+inline std::string scratchPath(const std::string& name)
+{
+    return "wcdbrepair-test-" + name;
+}
+
+} // namespace WCDBRepairTest
+
+#define CHECK(expression) WCDBRepairTest::check(static_cast<bool>(expression), #expression, __FILE__, __LINE__)
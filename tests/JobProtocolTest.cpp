@@ -0,0 +1,168 @@
+#include "Check.hpp"
+#include "JobProtocol.hpp"
+#include "LocalSocket.hpp"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace WCDBRepair;
+
+namespace {
+
+// A connected pair over a listening socket, as serve and its clients use it.
+struct Connection {
+    LocalSocket listener;
+    LocalSocket server;
+    LocalSocket client;
+
+    Connection()
+    {
+        std::string why;
+        CHECK(listener.listen(WCDBRepairTest::scratchPath("jobs.sock"), why));
+        CHECK(client.connect(WCDBRepairTest::scratchPath("jobs.sock")));
+        CHECK(listener.accept(5000, server));
+    }
+};
+
+void testFramesRoundTrip()
+{
+    Connection c;
+    const std::vector<std::string> payloads = {
+        "{\"id\":\"1\",\"command\":\"check\"}",
+        "",
+        std::string(kMaxJobFrame, 'x'), // the largest frame; more than a socket buffer holds
+        std::string("\0\xff\n", 3),
+    };
+    std::thread writer([&c, &payloads]() {
+        for (const std::string& payload : payloads) {
+            CHECK(writeFrame(c.client, payload));
+        }
+    });
+    for (const std::string& payload : payloads) {
+        std::string read = "stale";
+        CHECK(readFrame(c.server, read));
+        CHECK(read == payload);
+    }
+    writer.join();
+
+    // End of stream between frames.
+    c.client.close();
+    std::string read;
+    CHECK(!readFrame(c.server, read));
+}
+
+void testLengthIsBigEndian()
+{
+    Connection c;
+    const unsigned char header[4] = { 0, 0, 1, 2 }; // 258
+    const std::string body(258, 'b');
+    CHECK(c.client.writeFully(header, sizeof(header)));
+    CHECK(c.client.writeFully(body.data(), body.size()));
+    std::string read;
+    CHECK(readFrame(c.server, read));
+    CHECK(read == body);
+}
+
+void testRejectsOversizedAndCutFrames()
+{
+    {
+        Connection c;
+        CHECK(writeFrame(c.client, std::string(100, 'x')));
+        std::string read;
+        CHECK(!readFrame(c.server, read, 99));
+    }
+    {
+        Connection c;
+        const unsigned char header[4] = { 0, 0, 0, 10 };
+        CHECK(c.client.writeFully(header, sizeof(header)));
+        CHECK(c.client.writeFully("short", 5));
+        c.client.close(); // the peer is gone halfway through the payload
+        std::string read;
+        CHECK(!readFrame(c.server, read));
+    }
+}
+
+void testParsesRequests()
+{
+    JobRequest request;
+    std::string why;
+    CHECK(parseJobRequest("{\"id\":\"7\",\"command\":\"repair\",\"path\":\"C:\\\\db\\\\msg.db\",\"priority\":10,"
+                          "\"progress\":true,\"args\":[\"--key\",\"k\\\"ey\"]}",
+                          request,
+                          why));
+    CHECK(request.id == "7");
+    CHECK(request.command == "repair");
+    CHECK(request.path == "C:\\db\\msg.db");
+    CHECK(request.priority == 10);
+    CHECK(request.progress);
+    CHECK(request.args == std::vector<std::string>({ "--key", "k\"ey" }));
+
+    // A numeric id is kept as its text; unknown keys of any shape are skipped.
+    CHECK(parseJobRequest(" { \"id\" : 42 , \"extra\" : {\"a\":[1,2.5,null,{\"b\":false}]}, \"command\":\"cancel\","
+                          "\"target\":7 } ",
+                          request,
+                          why));
+    CHECK(request.id == "42");
+    CHECK(request.target == "7");
+    CHECK(!request.progress);
+    CHECK(request.priority == 0);
+
+    // \u escapes, surrogate pairs included, come out as UTF-8.
+    CHECK(parseJobRequest("{\"id\":\"u\",\"command\":\"check\",\"path\":\"\\u00e9\\ud83d\\ude00/\\n\"}", request, why));
+    CHECK(request.path == "\xc3\xa9\xf0\x9f\x98\x80/\n");
+}
+
+void testRejectsBadRequests()
+{
+    const struct {
+        const char* json;
+        const char* why;
+    } cases[] = {
+        { "[]", "not-an-object" },
+        { "{\"command\":\"check\"}", "missing-id" },
+        { "{\"id\":\"1\"}", "missing-command" },
+        { "{\"id\":\"1\",\"command\":\"check\",\"priority\":1.5}", "bad-field:priority" },
+        { "{\"id\":\"1\",\"command\":\"check\",\"progress\":\"yes\"}", "bad-field:progress" },
+        { "{\"id\":\"1\",\"command\":\"check\",\"args\":[\"a\",2]}", "bad-field:args" },
+        { "{\"id\":\"1\",\"command\":\"check\"} {}", "trailing-data" },
+        { "{\"id\":\"1\",\"command\":\"check\"", "bad-json" },
+        { "{\"id\":\"1\",\"command\":\"check\",\"path\":\"\\ud83d\"}", "bad-field:path" },
+    };
+    for (const auto& c : cases) {
+        JobRequest request;
+        std::string why;
+        CHECK(!parseJobRequest(c.json, request, why));
+        if (!CHECK(why == c.why))
+            std::fprintf(stderr, "  %s -> %s\n", c.json, why.c_str());
+    }
+}
+
+void testQuotesEvents()
+{
+    CHECK(jsonQuote("plain") == "\"plain\"");
+    CHECK(jsonQuote("a\"b\\c") == "\"a\\\"b\\\\c\"");
+    CHECK(jsonQuote(std::string("\n\x01\x1f", 3)) == "\"\\u000a\\u0001\\u001f\"");
+    CHECK(jsonQuote("\xc3\xa9") == "\"\xc3\xa9\"");
+
+    // What an event carries parses back to the same text.
+    const std::string line = "STATE=REPAIR_START detail=\"C:\\db\"\t\x02";
+    JobRequest request;
+    std::string why;
+    CHECK(parseJobRequest("{\"id\":" + jsonQuote(line) + ",\"command\":\"x\"}", request, why));
+    CHECK(request.id == line);
+}
+
+} // namespace
+
+int main()
+{
+    testFramesRoundTrip();
+    testLengthIsBigEndian();
+    testRejectsOversizedAndCutFrames();
+    testParsesRequests();
+    testRejectsBadRequests();
+    testQuotesEvents();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#include "Check.hpp"
+#include "ResultLine.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace WCDBRepair;
+
+namespace {
+
+typedef std::vector<std::pair<std::string, std::string>> Fields;
+
+void testFields()
+{
+    ResultLine result;
+    parseResultLine("RESULT=repair score=0.982100 ok=true mode=priority rows=1200000 original=C:\\db\\msg.db-original",
+                    result);
+    CHECK(result.kind == "repair");
+    CHECK(result.fields
+          == Fields({ { "score", "0.982100" },
+                      { "ok", "true" },
+                      { "mode", "priority" },
+                      { "rows", "1200000" },
+                      { "original", "C:\\db\\msg.db-original" } }));
+
+    // Batch items append path=; the summary line has only numbers.
+    parseResultLine("RESULT=batch command=check total=2 succeeded=2 failed=0 skipped=0", result);
+    CHECK(result.kind == "batch");
+    CHECK(result.fields.size() == 5);
+    CHECK(result.fields[0] == std::make_pair(std::string("command"), std::string("check")));
+}
+
+void testUnusualTokens()
+{
+    ResultLine result;
+    // Only the first '=' splits; a bare word is a field without a value; runs of spaces
+    // and a trailing space add nothing; an empty value stays empty.
+    parseResultLine("RESULT=salvage  reason=a=b cancelled  checkpoint= ", result);
+    CHECK(result.kind == "salvage");
+    CHECK(result.fields == Fields({ { "reason", "a=b" }, { "cancelled", "" }, { "checkpoint", "" } }));
+
+    // Parsing again replaces what was there.
+    parseResultLine("RESULT=", result);
+    CHECK(result.kind.empty());
+    CHECK(result.fields.empty());
+
+    parseResultLine("RESULT=probe", result);
+    CHECK(result.kind == "probe");
+    CHECK(result.fields.empty());
+}
+
+} // namespace
+
+int main()
+{
+    testFields();
+    testUnusualTokens();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#include "Check.hpp"
+#include "RowidSort.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace WCDBRepair;
+
+namespace {
+
+// A row as it arrived and as it left: table, rowid and its values, flattened to text.
+struct Row {
+    size_t table;
+    int64_t rowid;
+    std::string values;
+
+    bool operator==(const Row& other) const
+    {
+        return table == other.table && rowid == other.rowid && values == other.values;
+    }
+};
+
+std::string flatten(const std::vector<RecordValue>& values)
+{
+    std::string out;
+    for (const RecordValue& v : values) {
+        out += std::to_string(static_cast<int>(v.type)) + ":";
+        switch (v.type) {
+        case RecordValue::Integer:
+            out += std::to_string(v.integer);
+            break;
+        case RecordValue::Real:
+            out += std::to_string(v.real);
+            break;
+        case RecordValue::Text:
+        case RecordValue::Blob:
+            out.append(reinterpret_cast<const char*>(v.data), v.size);
+            break;
+        default:
+            break;
+        }
+        out += "|";
+    }
+    return out;
+}
+
+class Collector final : public SalvageSink {
+public:
+    bool row(size_t table, int64_t rowid, const std::vector<RecordValue>& values) override
+    {
+        rows.push_back(Row{ table, rowid, flatten(values) });
+        return true;
+    }
+
+    std::vector<Row> rows;
+};
+
+std::vector<SalvageTable> makeTables()
+{
+    std::vector<SalvageTable> tables(3);
+    tables[0].name = "message";
+    tables[1].name = "contact";
+    tables[2].name = "settings";
+    tables[2].withoutRowid = true;
+    return tables;
+}
+
+// Rows in salvage order: rowids out of order, some rowids found twice (an orphan copy of
+// a row that was also walked), every value type, blobs large enough to fill runs quickly.
+void feed(RowidSorter& sorter, const std::vector<SalvageTable>& tables, std::vector<Row>& arrived, unsigned seed, int count)
+{
+    std::mt19937 random(seed);
+    std::vector<RecordValue> values(4);
+    for (int i = 0; i < count; i++) {
+        const size_t table = random() % tables.size();
+        const int64_t rowid = (i % 10 == 9 && !arrived.empty()) ? arrived[random() % arrived.size()].rowid
+                                                                 : static_cast<int64_t>(random() % 100000) - 50000;
+        const std::string text = "row " + std::to_string(i);
+        const std::string blob(64 + random() % 512, static_cast<char>('a' + i % 26));
+        values[0] = RecordValue();
+        values[1].type = RecordValue::Integer;
+        values[1].integer = static_cast<int64_t>(random()) << 20;
+        values[2].type = i % 3 == 0 ? RecordValue::Real : RecordValue::Text;
+        values[2].real = i / 7.0;
+        values[2].data = reinterpret_cast<const unsigned char*>(text.data());
+        values[2].size = text.size();
+        values[3].type = RecordValue::Blob;
+        values[3].data = reinterpret_cast<const unsigned char*>(blob.data());
+        values[3].size = blob.size();
+        arrived.push_back(Row{ table, rowid, flatten(values) });
+        CHECK(sorter.row(table, rowid, values));
+    }
+}
+
+// What the sorter must hand on: WITHOUT ROWID rows as they come, then the rest ordered by
+// (table, rowid), copies of a rowid in arrival order.
+std::vector<Row> expected(const std::vector<SalvageTable>& tables, const std::vector<Row>& arrived)
+{
+    std::vector<Row> passed;
+    std::vector<Row> sorted;
+    for (const Row& row : arrived) {
+        (tables[row.table].withoutRowid ? passed : sorted).push_back(row);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Row& a, const Row& b) {
+        return a.table != b.table ? a.table < b.table : a.rowid < b.rowid;
+    });
+    passed.insert(passed.end(), sorted.begin(), sorted.end());
+    return passed;
+}
+
+bool exists(const std::string& path)
+{
+    std::ifstream in(path);
+    return static_cast<bool>(in);
+}
+
+void testSortsWithSpills()
+{
+    const std::vector<SalvageTable> tables = makeTables();
+    const std::string prefix = WCDBRepairTest::scratchPath("sort-spill");
+    Collector out;
+    std::vector<Row> arrived;
+    {
+        RowidSorter sorter(tables, out, 64 << 10, prefix);
+        feed(sorter, tables, arrived, 1, 5000);
+        CHECK(sorter.runs() > 4);
+        CHECK(sorter.spilledBytes() > 0);
+        CHECK(exists(prefix + ".0"));
+        CHECK(sorter.finish());
+        CHECK(sorter.runs() == 0);
+        CHECK(!exists(prefix + ".0"));
+    }
+    CHECK(out.rows.size() == arrived.size());
+    CHECK(out.rows == expected(tables, arrived));
+}
+
+void testSameOrderWithoutSpills()
+{
+    const std::vector<SalvageTable> tables = makeTables();
+    Collector out;
+    std::vector<Row> arrived;
+    RowidSorter sorter(tables, out, 256 << 20, WCDBRepairTest::scratchPath("sort-memory"));
+    feed(sorter, tables, arrived, 1, 5000);
+    CHECK(sorter.runs() == 0);
+    CHECK(sorter.finish());
+    CHECK(out.rows == expected(tables, arrived));
+}
+
+void testEachFinishIsOneBatch()
+{
+    // Checkpoints finish() the sorter mid-salvage: rows after it are a new sorted batch.
+    const std::vector<SalvageTable> tables = makeTables();
+    Collector out;
+    std::vector<Row> first;
+    std::vector<Row> second;
+    RowidSorter sorter(tables, out, 16 << 10, WCDBRepairTest::scratchPath("sort-batches"));
+    feed(sorter, tables, first, 2, 800);
+    CHECK(sorter.finish());
+    const size_t firstBatch = out.rows.size();
+    CHECK(out.rows == expected(tables, first));
+    feed(sorter, tables, second, 3, 800);
+    CHECK(sorter.finish());
+    const std::vector<Row> rest(out.rows.begin() + static_cast<std::ptrdiff_t>(firstBatch), out.rows.end());
+    CHECK(rest == expected(tables, second));
+}
+
+void testRunFilesGoWithTheSorter()
+{
+    const std::vector<SalvageTable> tables = makeTables();
+    const std::string prefix = WCDBRepairTest::scratchPath("sort-abandoned");
+    Collector out;
+    std::vector<Row> arrived;
+    {
+        RowidSorter sorter(tables, out, 16 << 10, prefix);
+        feed(sorter, tables, arrived, 4, 500);
+        CHECK(exists(prefix + ".0"));
+    } // a stopped salvage never calls finish()
+    CHECK(!exists(prefix + ".0"));
+}
+
+} // namespace
+
+int main()
+{
+    testSortsWithSpills();
+    testSameOrderWithoutSpills();
+    testEachFinishIsOneBatch();
+    testRunFilesGoWithTheSorter();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}
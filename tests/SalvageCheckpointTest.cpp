@@ -0,0 +1,87 @@
+#include "Check.hpp"
+#include "SalvageCheckpoint.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+using namespace WCDBRepair;
+
+namespace {
+
+bool sameCheckpoint(const SalvageCheckpoint& a, const SalvageCheckpoint& b)
+{
+    return a.sourceSize == b.sourceSize && a.tables == b.tables && a.walkOrder == b.walkOrder
+           && a.position.walkedTables == b.position.walkedTables && a.position.scanPage == b.position.scanPage;
+}
+
+SalvageCheckpoint sample()
+{
+    SalvageCheckpoint checkpoint;
+    checkpoint.sourceSize = 5000000000ull; // over 4 GiB
+    checkpoint.tables = { "message", "contact", "40001", "with space", "eq=sign" };
+    checkpoint.walkOrder = { 2, 0, 4, 1, 3 };
+    checkpoint.position.walkedTables = 3;
+    checkpoint.position.scanPage = 4000000000u;
+    return checkpoint;
+}
+
+void testRoundTrip()
+{
+    const std::string path = WCDBRepairTest::scratchPath("checkpoint");
+    const SalvageCheckpoint saved = sample();
+    CHECK(saveSalvageCheckpoint(path, saved));
+    SalvageCheckpoint loaded;
+    CHECK(loadSalvageCheckpoint(path, loaded));
+    CHECK(sameCheckpoint(saved, loaded));
+
+    // Saving again replaces it; table order (no walkOrder line) loads back empty.
+    SalvageCheckpoint tableOrder;
+    tableOrder.tables = { "t0" };
+    CHECK(saveSalvageCheckpoint(path, tableOrder));
+    CHECK(loadSalvageCheckpoint(path, loaded));
+    CHECK(sameCheckpoint(tableOrder, loaded));
+    CHECK(loaded.walkOrder.empty());
+
+    removeSalvageCheckpoint(path);
+    CHECK(!loadSalvageCheckpoint(path, loaded));
+}
+
+void testCrashBetweenRemoveAndRename()
+{
+    // save() writes <path>.tmp, removes <path>, then renames: a crash in between leaves
+    // only the .tmp, which is complete.
+    const std::string path = WCDBRepairTest::scratchPath("checkpoint-tmp");
+    const SalvageCheckpoint saved = sample();
+    CHECK(saveSalvageCheckpoint(path, saved));
+    CHECK(std::rename(path.c_str(), (path + ".tmp").c_str()) == 0);
+    SalvageCheckpoint loaded;
+    CHECK(loadSalvageCheckpoint(path, loaded));
+    CHECK(sameCheckpoint(saved, loaded));
+
+    removeSalvageCheckpoint(path);
+    std::ifstream left(path + ".tmp");
+    CHECK(!left);
+}
+
+void testRejectsOtherFiles()
+{
+    const std::string path = WCDBRepairTest::scratchPath("checkpoint-other");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << "sourceSize=1\nwalkedTables=2\n";
+    }
+    SalvageCheckpoint loaded = sample();
+    CHECK(!loadSalvageCheckpoint(path, loaded));
+    removeSalvageCheckpoint(path);
+}
+
+} // namespace
+
+int main()
+{
+    testRoundTrip();
+    testCrashBetweenRemoveAndRename();
+    testRejectsOtherFiles();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}
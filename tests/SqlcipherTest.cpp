@@ -0,0 +1,229 @@
+// HMAC() and PKCS5_PBKDF2_HMAC exist in both OpenSSL 1.1 and 3.x; see Sqlcipher.cpp.
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "Check.hpp"
+#include "Sqlcipher.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace WCDBRepair;
+
+namespace {
+
+const EVP_MD* digest(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::SHA1:
+        return EVP_sha1();
+    case HashAlgorithm::SHA256:
+        return EVP_sha256();
+    case HashAlgorithm::SHA512:
+        return EVP_sha512();
+    }
+    return nullptr;
+}
+
+// Keys and pages are built here straight from the SQLCipher format with OpenSSL, not
+// with the code under test: cipher key from PBKDF2, HMAC key from PBKDF2 over the cipher
+// key with the salt xor 0x3a and 2 iterations, and each page laid out as
+//   [AES-256-CBC(plaintext) | IV | HMAC(ciphertext | IV | pgno LE) | padding]
+// with page 1 keeping the salt in its first 16 bytes.
+struct Database {
+    CipherParams params;
+    unsigned char salt[SaltSize];
+    unsigned char key[KeySize];
+    unsigned char hmacKey[KeySize];
+
+    Database(const CipherParams& p, const std::string& passphrase) : params(p)
+    {
+        for (size_t i = 0; i < SaltSize; i++) {
+            salt[i] = static_cast<unsigned char>(0xA0 + i);
+        }
+        PKCS5_PBKDF2_HMAC(passphrase.data(),
+                          static_cast<int>(passphrase.size()),
+                          salt,
+                          SaltSize,
+                          params.kdfIter,
+                          digest(params.kdfAlgorithm),
+                          KeySize,
+                          key);
+        unsigned char hmacSalt[SaltSize];
+        for (size_t i = 0; i < SaltSize; i++) {
+            hmacSalt[i] = salt[i] ^ 0x3a;
+        }
+        PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(key),
+                          KeySize,
+                          hmacSalt,
+                          SaltSize,
+                          2,
+                          digest(params.kdfAlgorithm),
+                          KeySize,
+                          hmacKey);
+    }
+
+    // A plaintext page: page 1 gets a valid SQLite header, other pages a byte pattern.
+    std::vector<unsigned char> plainPage(uint32_t pgno) const
+    {
+        const size_t pageSize = static_cast<size_t>(params.pageSize);
+        std::vector<unsigned char> plain(pageSize, 0);
+        for (size_t i = 0; i < pageSize - params.reserveSize(); i++) {
+            plain[i] = static_cast<unsigned char>((i * 31 + pgno * 7) & 0xFF);
+        }
+        if (pgno == 1) {
+            std::memcpy(plain.data(), "SQLite format 3", 16);
+            plain[16] = static_cast<unsigned char>(pageSize >> 8);
+            plain[17] = static_cast<unsigned char>(pageSize & 0xFF);
+            plain[18] = 1;
+            plain[19] = 1;
+            plain[20] = static_cast<unsigned char>(params.reserveSize());
+            plain[21] = 64;
+            plain[22] = 32;
+            plain[23] = 32;
+        }
+        return plain;
+    }
+
+    std::vector<unsigned char> encryptPage(const std::vector<unsigned char>& plain, uint32_t pgno) const
+    {
+        const size_t pageSize = static_cast<size_t>(params.pageSize);
+        const size_t reserve = params.reserveSize();
+        const size_t offset = pgno == 1 ? SaltSize : 0;
+        std::vector<unsigned char> page(pageSize, 0);
+        unsigned char* iv = page.data() + pageSize - reserve;
+        for (size_t i = 0; i < IvSize; i++) {
+            iv[i] = static_cast<unsigned char>(pgno * 13 + i);
+        }
+
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int length = 0;
+        int finalLength = 0;
+        EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), nullptr, key, iv);
+        EVP_CIPHER_CTX_set_padding(ctx, 0);
+        EVP_EncryptUpdate(ctx,
+                          page.data() + offset,
+                          &length,
+                          plain.data() + offset,
+                          static_cast<int>(pageSize - reserve - offset));
+        EVP_EncryptFinal_ex(ctx, page.data() + offset + length, &finalLength);
+        EVP_CIPHER_CTX_free(ctx);
+        if (pgno == 1)
+            std::memcpy(page.data(), salt, SaltSize);
+
+        if (params.useHmac) {
+            std::vector<unsigned char> signedBytes(page.begin() + offset, page.begin() + (pageSize - reserve + IvSize));
+            for (int shift = 0; shift < 32; shift += 8) {
+                signedBytes.push_back(static_cast<unsigned char>((pgno >> shift) & 0xFF));
+            }
+            unsigned int macSize = 0;
+            HMAC(digest(params.hmacAlgorithm),
+                 hmacKey,
+                 KeySize,
+                 signedBytes.data(),
+                 signedBytes.size(),
+                 page.data() + pageSize - reserve + IvSize,
+                 &macSize);
+        }
+        return page;
+    }
+
+    CipherKeys cipherKeys() const
+    {
+        CipherKeys keys;
+        CHECK(keys.init(params, salt, key));
+        return keys;
+    }
+};
+
+void testPages(int compatibility)
+{
+    CipherParams params;
+    CHECK(CipherParams::forCompatibility(compatibility, params));
+    params.kdfIter = 1000; // the iteration count does not change the page format
+    const Database db(params, "secret");
+    const CipherKeys keys = db.cipherKeys();
+    CHECK(std::memcmp(keys.hmacKey, db.hmacKey, KeySize) == 0);
+
+    PageCodec codec(keys);
+    CHECK(codec.isValid());
+    const size_t pageSize = static_cast<size_t>(params.pageSize);
+    const size_t reserve = params.reserveSize();
+    for (uint32_t pgno : { 1u, 2u, 77u }) {
+        std::vector<unsigned char> plain = db.plainPage(pgno);
+        const std::vector<unsigned char> page = db.encryptPage(plain, pgno);
+        CHECK(codec.verifyHmac(page.data(), pgno));
+        CHECK(!codec.verifyHmac(page.data(), pgno + 1)); // the page number is signed too
+
+        std::vector<unsigned char> out(pageSize, 0xFF);
+        CHECK(codec.decrypt(page.data(), pgno, out.data()));
+        std::memset(plain.data() + pageSize - reserve, 0, reserve);
+        CHECK(out == plain);
+
+        std::vector<unsigned char> flipped = page;
+        flipped[pgno == 1 ? SaltSize + 5 : 5] ^= 0x01;
+        CHECK(!codec.verifyHmac(flipped.data(), pgno));
+        flipped = page;
+        flipped[pageSize - reserve + IvSize] ^= 0x80; // the stored HMAC itself
+        CHECK(!codec.verifyHmac(flipped.data(), pgno));
+    }
+    CHECK(codec.looksLikeFirstPage(db.encryptPage(db.plainPage(1), 1).data()));
+
+    // Never-written pages are all zero and pass, as SQLCipher reads them.
+    const std::vector<unsigned char> zero(pageSize, 0);
+    CHECK(codec.verifyHmac(zero.data(), 3));
+
+    // Another passphrase: no page verifies, and page 1 does not look like a header.
+    const Database other(params, "not the secret");
+    CipherKeys otherKeys;
+    CHECK(otherKeys.init(params, db.salt, other.key));
+    PageCodec wrong(otherKeys);
+    const std::vector<unsigned char> first = db.encryptPage(db.plainPage(1), 1);
+    CHECK(!wrong.verifyHmac(first.data(), 1));
+    CHECK(!wrong.looksLikeFirstPage(first.data()));
+}
+
+void testDeriveKey()
+{
+    const Database db([]() {
+        CipherParams p;
+        p.kdfIter = 4000;
+        return p;
+    }(), "secret");
+    const std::string passphrase = "secret";
+    unsigned char key[KeySize];
+    CHECK(deriveKey(std::vector<unsigned char>(passphrase.begin(), passphrase.end()),
+                    db.salt,
+                    HashAlgorithm::SHA512,
+                    4000,
+                    key));
+    CHECK(std::memcmp(key, db.key, KeySize) == 0);
+
+    // x'<64 hex>' is the raw key, used as is.
+    std::string raw = "x'";
+    for (size_t i = 0; i < KeySize; i++) {
+        static const char hex[] = "0123456789abcdef";
+        raw.push_back(hex[i >> 4]);
+        raw.push_back(hex[i & 0xF]);
+    }
+    raw.push_back('\'');
+    CHECK(deriveKey(std::vector<unsigned char>(raw.begin(), raw.end()), db.salt, HashAlgorithm::SHA512, 0, key));
+    bool identity = true;
+    for (size_t i = 0; i < KeySize; i++) {
+        identity = identity && key[i] == i;
+    }
+    CHECK(identity);
+}
+
+} // namespace
+
+int main()
+{
+    testPages(3); // 1 KiB pages, HMAC-SHA1, 48 reserved bytes
+    testPages(4); // 4 KiB pages, HMAC-SHA512, 80 reserved bytes
+    testDeriveKey();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}
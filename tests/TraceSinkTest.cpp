@@ -0,0 +1,117 @@
+#include "Check.hpp"
+#include "TraceSink.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using WCDBRepair::TraceSink;
+
+namespace {
+
+constexpr int kProducers = 4;
+constexpr int kLinesPerProducer = 20000;
+
+// Runs kProducers threads printing "<producer> <n>\n" through a sink with a tiny ring,
+// then reads the file back: per producer, the line numbers that arrived, in file order.
+std::vector<std::vector<int>> runProducers(TraceSink& sink, const std::string& path)
+{
+    CHECK(sink.start(path));
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&sink, p]() {
+            for (int n = 0; n < kLinesPerProducer; n++) {
+                sink.printf("%d %d\n", p, n);
+            }
+        });
+    }
+    for (std::thread& t : producers) {
+        t.join();
+    }
+    sink.stop();
+
+    std::vector<std::vector<int>> seen(kProducers);
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        int p = -1;
+        int n = -1;
+        char extra = 0;
+        if (!CHECK(std::sscanf(line.c_str(), "%d %d%c", &p, &n, &extra) == 2 && p >= 0 && p < kProducers))
+            continue; // a torn or merged record
+        seen[p].push_back(n);
+    }
+    return seen;
+}
+
+void testBlockKeepsEveryLine()
+{
+    const std::string path = WCDBRepairTest::scratchPath("trace-block.txt");
+    TraceSink sink(4, TraceSink::Policy::Block);
+    const std::vector<std::vector<int>> seen = runProducers(sink, path);
+    CHECK(sink.written() == static_cast<uint64_t>(kProducers) * kLinesPerProducer);
+    CHECK(sink.dropped() == 0);
+    for (const std::vector<int>& lines : seen) {
+        bool inOrder = lines.size() == static_cast<size_t>(kLinesPerProducer);
+        for (size_t i = 0; inOrder && i < lines.size(); i++) {
+            inOrder = lines[i] == static_cast<int>(i);
+        }
+        CHECK(inOrder);
+    }
+    std::remove(path.c_str());
+}
+
+void testDropCountsWhatItLoses()
+{
+    const std::string path = WCDBRepairTest::scratchPath("trace-drop.txt");
+    TraceSink sink(2, TraceSink::Policy::Drop);
+    const std::vector<std::vector<int>> seen = runProducers(sink, path);
+    uint64_t lines = 0;
+    for (const std::vector<int>& producer : seen) {
+        lines += producer.size();
+        bool increasing = true;
+        for (size_t i = 1; increasing && i < producer.size(); i++) {
+            increasing = producer[i] > producer[i - 1];
+        }
+        CHECK(increasing); // what is kept stays in order
+    }
+    CHECK(lines == sink.written());
+    CHECK(sink.written() + sink.dropped() == static_cast<uint64_t>(kProducers) * kLinesPerProducer);
+
+    // A stopped sink drops, whatever the policy.
+    const uint64_t dropped = sink.dropped();
+    sink.printf("late\n");
+    CHECK(sink.dropped() == dropped + 1);
+    std::remove(path.c_str());
+}
+
+void testLongLinesAreTruncatedToOneRecord()
+{
+    const std::string path = WCDBRepairTest::scratchPath("trace-long.txt");
+    TraceSink sink(4, TraceSink::Policy::Block);
+    CHECK(sink.start(path));
+    const std::string longText(TraceSink::RecordSize * 2, 'x');
+    sink.printf("%s\n", longText.c_str());
+    sink.printf("short\n");
+    sink.stop();
+    CHECK(sink.truncated() == 1);
+
+    std::ifstream in(path);
+    std::string first;
+    std::string second;
+    CHECK(std::getline(in, first) && first.size() == TraceSink::RecordSize - 2);
+    CHECK(std::getline(in, second) && second == "short");
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main()
+{
+    testBlockKeepsEveryLine();
+    testDropCountsWhatItLoses();
+    testLongLinesAreTruncatedToOneRecord();
+    return WCDBRepairTest::checkFailures() == 0 ? 0 : 1;
+}